@@ -24,6 +24,8 @@
 #include <string>
 #include <vector>
 #include <string_view>
+#include <algorithm>
+#include <chrono>
 
 #include <math.h>
 #include <string.h>
@@ -37,6 +39,18 @@
 #include <linux/fb.h>
 #include <linux/videodev2.h>
 
+#ifdef TRACE_BUILD
+	#include <atomic>
+	#include <mutex>
+	#include <sys/syscall.h>
+#endif
+
+#if defined(__SSE2__)
+	#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+	#include <arm_neon.h>
+#endif
+
 #ifdef PLATFORM_X11_GL
 	#define GL_GLEXT_PROTOTYPES
 	#include <X11/Xlib.h>
@@ -45,6 +59,10 @@
 	#include <GL/glext.h>
 	#include <GL/glx.h>
 	#include <GL/glu.h>
+
+	#ifndef GLX_BACK_BUFFER_AGE_EXT
+		#define GLX_BACK_BUFFER_AGE_EXT	0x20F4
+	#endif
 #endif
 
 // This is for linux systems that have no window manager. Like RPi4 running their light version of raspbian or a distro built with Yocto.
@@ -60,6 +78,38 @@
 	#define EGL_NO_X11
 	#define MESA_EGL_NO_X11_HEADERS
 
+	// From eglext.h, which not all the systems we build on have.
+	#ifndef EGL_BUFFER_AGE_EXT
+		#define EGL_BUFFER_AGE_EXT	0x313D
+	#endif
+	typedef EGLBoolean (*PFNEGLSWAPBUFFERSWITHDAMAGEPROC)(EGLDisplay pDisplay,EGLSurface pSurface,const EGLint* pRects,EGLint pNumRects);
+#endif
+
+// Renders to a pbuffer with no display, for build servers and CI. Mesa gives us this with llvmpipe when there is no GPU.
+#ifdef PLATFORM_HEADLESS_EGL
+	#include "EGL/egl.h" // sudo apt install libegl-dev
+	#include "EGL/eglext.h"
+	#include "GLES2/gl2.h" // sudo apt install libgles2-mesa-dev
+
+	#ifndef EGL_PLATFORM_SURFACELESS_MESA
+		#define EGL_PLATFORM_SURFACELESS_MESA	0x31DD
+	#endif
+#endif
+
+// Compressed texture formats, not in all the headers we build with.
+#ifndef GL_ETC1_RGB8_OES
+	#define GL_ETC1_RGB8_OES				0x8D64
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+	#define GL_COMPRESSED_RGB8_ETC2			0x9274
+#endif
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+	#define GL_COMPRESSED_RGBA8_ETC2_EAC	0x9278
+#endif
+
+// GL_OES_packed_depth_stencil, the same value as GL_DEPTH24_STENCIL8 in GL 3.0.
+#ifndef GL_DEPTH24_STENCIL8_OES
+	#define GL_DEPTH24_STENCIL8_OES			0x88F0
 #endif
 
 
@@ -96,6 +146,102 @@ namespace tinygles{	// Using a namespace to try to prevent name clashes as my cl
 
 #define THROW_MEANINGFUL_EXCEPTION(THE_MESSAGE__)	{throw std::runtime_error("At: " + std::to_string(__LINE__) + " In " + std::string(__FILE__) + " : " + std::string(THE_MESSAGE__));}
 
+/**
+ * @brief What the draw calls do when passed a stale or unknown handle. In debug it throws so the bug is found, in release the draw is skipped without the cost of an exception.
+ * The optional second argument is what to return.
+ */
+#ifdef DEBUG_BUILD
+	#define STALE_HANDLE_IN_DRAW(THE_MESSAGE__,...)	THROW_MEANINGFUL_EXCEPTION(THE_MESSAGE__)
+#else
+	#define STALE_HANDLE_IN_DRAW(THE_MESSAGE__,...)	{return __VA_ARGS__;}
+#endif
+
+/**
+ * @brief Looks up the object for a handle, throws if it is stale, zero or was never made. For the calls that are not made per draw.
+ */
+template<typename OBJECT_TYPE> static OBJECT_TYPE* GetValid(const SlotMap<OBJECT_TYPE>& pMap,uint32_t pHandle,const char* pWhat)
+{
+	OBJECT_TYPE* object = pMap.Get(pHandle);
+	if( object == nullptr )
+	{
+		THROW_MEANINGFUL_EXCEPTION(std::string(pWhat) + " handle " + std::to_string(pHandle) + " is stale or was never created");
+	}
+	return object;
+}
+
+#ifdef TRACE_BUILD
+/**
+ * @brief One timed scope, the times are nanoseconds from the steady clock.
+ */
+struct TraceEvent
+{
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+/**
+ * @brief The scopes recorded by one thread. Only that thread adds to it so no lock is needed, TraceSave reads up to the count published with the release store.
+ * When full the oldest are written over.
+ */
+struct TraceRing
+{
+	static constexpr uint64_t Size = 16384;// A power of two so the index is a mask.
+
+	TraceEvent mEvents[Size];
+	std::atomic<uint64_t> mWritten{0};
+	std::atomic<uint64_t> mCleared{0};	//!< Scopes before this are not saved, set by TraceClear.
+	long mThreadID = 0;
+
+	void Add(const char* pName,uint64_t pBegin,uint64_t pEnd)
+	{
+		const uint64_t n = mWritten.load(std::memory_order_relaxed);
+		mEvents[n&(Size-1)] = {pName,pBegin,pEnd};
+		mWritten.store(n + 1,std::memory_order_release);
+	}
+};
+
+/**
+ * @brief Every ring made, a thread gets its ring the first time it records a scope. They are kept after the thread exits so what it did can still be saved.
+ */
+static std::mutex gTraceRingsLock;
+static std::vector<std::unique_ptr<TraceRing>> gTraceRings;
+
+static TraceRing* GetThreadTraceRing()
+{
+	thread_local TraceRing* ring = nullptr;
+	if( ring == nullptr )
+	{// Only locks the once per thread.
+		std::lock_guard<std::mutex> lock(gTraceRingsLock);
+		gTraceRings.emplace_back(std::make_unique<TraceRing>());
+		ring = gTraceRings.back().get();
+		ring->mThreadID = syscall(SYS_gettid);
+	}
+	return ring;
+}
+
+static uint64_t GetTraceTime()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Times from where it is made to the end of the scope. The name must be a string literal, only the pointer is kept.
+ */
+struct TraceScope
+{
+	TraceScope(const char* pName) : mName(pName),mBegin(GetTraceTime()){}
+	~TraceScope(){GetThreadTraceRing()->Add(mName,mBegin,GetTraceTime());}
+
+	const char* const mName;
+	const uint64_t mBegin;
+};
+
+	#define TRACE_SCOPE(THE_NAME__)	TraceScope traceScope__(THE_NAME__)
+#else
+	#define TRACE_SCOPE(THE_NAME__)
+#endif
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Internal structures.
 
@@ -131,11 +277,185 @@ struct Quad2Df
 struct GLTexture
 {
 	GLTexture() = delete; // Forces use to use references.
-	GLTexture(TextureFormat pFormat,int pWidth,int pHeight):mFormat(pFormat),mWidth(pWidth),mHeight(pHeight){}
+	GLTexture(GLuint pGLName,TextureFormat pFormat,int pWidth,int pHeight,int pSourceBytesPerPixel):mGLName(pGLName),mFormat(pFormat),mWidth(pWidth),mHeight(pHeight),mSourceBytesPerPixel(pSourceBytesPerPixel){}
+
+	const GLuint mGLName;
+	const TextureFormat mFormat;
+	const int mWidth;
+	const int mHeight;
+	const int mSourceBytesPerPixel;	//!< Of the pixels it was made from, for the 16 bit formats not the same as the texture.
+
+	size_t mBytes = 0;				//!< GPU memory used when resident, including the mip levels.
+	bool mMipmaps = false;
+	bool mEvicted = false;			//!< It's memory has been given back, the reloader will get the image back when it's drawn with.
+	uint32_t mLastUsedFrame = 0;
+	GLES::TextureReloader mReloader;	//!< Only textures with one can be evicted.
+	GLuint mFrameBuffer = 0;		//!< Not zero if it's a render target.
+	GLuint mDepthBuffer = 0;		//!< The render target's depth buffer, if it has one.
+};
+
+static const uint32_t SUB_TEXTURE_HANDLE_BIT = 0x80000000;	//!< Set in the handles of the images in an atlas, GL will never get near this many textures.
+
+/**
+ * @brief An image that has been packed into one of the pages of an atlas.
+ * Is used in place of a texture, the functions that take a texture map their UV's to this rectangle of the page.
+ */
+struct SubTexture
+{
+	const uint32_t mAtlas;		//!< The atlas the image is in.
+	const uint32_t mTexture;	//!< The page of the atlas, a normal texture.
+	const int mX,mY;			//!< Where the image is in the page, not including the padding.
+	const int mWidth,mHeight;
+};
 
+static const uint32_t STREAMING_TEXTURE_HANDLE_BIT = 0x40000000;	//!< Set in the handles of streaming textures.
+static const uint32_t FRAMES_IN_FLIGHT = 2;	//!< How many frames the GPU can be behind us, a texture drawn with in one of these frames may still be in use.
+
+/**
+ * @brief A texture whose whole image is replaced often, once a frame or more.
+ * Has a ring of textures, an update writes to one the GPU is not drawing with so we don't stall or make the driver take a copy.
+ * Draws use the one that was last updated.
+ */
+struct StreamingTexture
+{
 	const TextureFormat mFormat;
 	const int mWidth;
 	const int mHeight;
+	std::vector<uint32_t> mTextures;	//!< The ring of textures.
+	std::vector<uint32_t> mDrawnFrame;	//!< The frame each texture was last drawn with, zero if never.
+	size_t mCurrent = 0;				//!< The texture draws use.
+	uint32_t mStallCount = 0;			//!< Updates that had to write to a texture that could be in use. If this goes up the ring is too small.
+
+	StreamingTexture(TextureFormat pFormat,int pWidth,int pHeight):mFormat(pFormat),mWidth(pWidth),mHeight(pHeight){}
+};
+
+/**
+ * @brief Packs rectangles into a page using the skyline bottom left method.
+ * Tracks the top edge of what has been placed so far as a list of horizontal segments. A new rectangle goes where it's top is lowest.
+ * Not as tight as max rects but a lot faster and tight enough for sprites and glyphs that tend to be similar in size.
+ */
+struct SkylinePacker
+{
+	struct Segment
+	{
+		int x,y,width;
+	};
+
+	const int mWidth,mHeight;
+	std::vector<Segment> mSkyline;
+
+	SkylinePacker(int pWidth,int pHeight):mWidth(pWidth),mHeight(pHeight)
+	{
+		mSkyline.push_back({0,0,pWidth});
+	}
+
+	/**
+	 * @brief Finds a place for the rectangle, returns false if the page is too full.
+	 */
+	bool Insert(int pWidth,int pHeight,int& rX,int& rY)
+	{
+		size_t best = mSkyline.size();
+		int bestTop = mHeight + 1;
+		int bestWidth = mWidth + 1;
+		for( size_t n = 0 ; n < mSkyline.size() ; n++ )
+		{
+			int y;
+			if( Fits(n,pWidth,pHeight,y) && (y + pHeight < bestTop || (y + pHeight == bestTop && mSkyline[n].width < bestWidth)) )
+			{
+				best = n;
+				bestTop = y + pHeight;
+				bestWidth = mSkyline[n].width;
+				rX = mSkyline[n].x;
+				rY = y;
+			}
+		}
+
+		if( best == mSkyline.size() )
+		{
+			return false;
+		}
+
+		// Add the new top edge then cut away the segments it covers.
+		mSkyline.insert(mSkyline.begin() + best,{rX,rY + pHeight,pWidth});
+		for( size_t n = best + 1 ; n < mSkyline.size() ; )
+		{
+			Segment& seg = mSkyline[n];
+			const int covered = (rX + pWidth) - seg.x;
+			if( covered <= 0 )
+			{
+				break;
+			}
+
+			if( covered < seg.width )
+			{
+				seg.x += covered;
+				seg.width -= covered;
+				break;
+			}
+			mSkyline.erase(mSkyline.begin() + n);
+		}
+
+		// Join neighbours at the same height so the list stays short.
+		for( size_t n = 0 ; n + 1 < mSkyline.size() ; )
+		{
+			if( mSkyline[n].y == mSkyline[n+1].y )
+			{
+				mSkyline[n].width += mSkyline[n+1].width;
+				mSkyline.erase(mSkyline.begin() + n + 1);
+			}
+			else
+			{
+				n++;
+			}
+		}
+		return true;
+	}
+
+private:
+	/**
+	 * @brief Checks if the rectangle will fit with it's left edge at the start of the segment, rY is the lowest it can sit.
+	 */
+	bool Fits(size_t pSegment,int pWidth,int pHeight,int& rY)const
+	{
+		if( mSkyline[pSegment].x + pWidth > mWidth )
+		{
+			return false;
+		}
+
+		rY = 0;
+		int widthLeft = pWidth;
+		for( size_t n = pSegment ; widthLeft > 0 ; n++ )
+		{
+			rY = std::max(rY,mSkyline[n].y);
+			if( rY + pHeight > mHeight )
+			{
+				return false;
+			}
+			widthLeft -= mSkyline[n].width;
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief A set of textures, pages, that images are packed into so they can be drawn with one texture and so in one draw call.
+ */
+struct TextureAtlas
+{
+	struct Page
+	{
+		uint32_t texture;
+		SkylinePacker packer;
+	};
+
+	const TextureFormat mFormat;
+	const int mPageSize;
+	const bool mFiltered;
+	const int mPadding;			//!< Pixels around each image that are a copy of it's edge, stops filtering picking up the neighbours.
+	std::vector<Page> mPages;
+	std::vector<uint32_t> mSubTextures;	//!< So they can be removed when the atlas is deleted.
+
+	TextureAtlas(TextureFormat pFormat,int pPageSize,bool pFiltered,int pPadding):mFormat(pFormat),mPageSize(pPageSize),mFiltered(pFiltered),mPadding(pPadding){}
 };
 
 /**
@@ -145,7 +465,7 @@ struct NinePatch
 {
 	NinePatch() = delete;
 
-	NinePatch(int pWidth,int pHeight,const VertShortXY& pScaleFrom,const VertShortXY& pScaleTo,const VertShortXY& pFillFrom,const VertShortXY& pFillTo)
+	NinePatch(uint32_t pTexture,int pWidth,int pHeight,const VertShortXY& pScaleFrom,const VertShortXY& pScaleTo,const VertShortXY& pFillFrom,const VertShortXY& pFillTo):mTexture(pTexture)
 	{
 		mScalable.from = pScaleFrom;
 		mScalable.to = pScaleTo;
@@ -174,6 +494,8 @@ struct NinePatch
 		}
 	}
 
+	const uint32_t mTexture;	//!< Has the image without the one pixel border that marks out the areas.
+
 	struct
 	{
 		VertShortXY from,to;
@@ -192,1635 +514,4955 @@ enum struct StreamIndex
 };
 
 /**
- * @brief Defines a sprite that has a lot of the work needed to render pre-computed with position, rotation and scale done in the shader for speed.
+ * @brief Shadows the GL state we change so that calls that would not change anything are never made, GL calls are expensive on some drivers, RPi in particular.
+ * Starts with the values GL defines for a new context. Anything that changes this state must go through here or the shadow will be wrong.
  */
-struct Sprite
+struct GLStateCache
 {
-	uint32_t mTexture;
-	float mWidth,mHeight,mCX,mCY;
-	Quad2Df mVert;
-	Quad2D mUV;
+	static constexpr size_t MaxTextureUnits = 8;
+	static constexpr size_t MaxAttribArrays = 4;
 
-	void BuildVerts()
-	{
-		mVert.v[0].x = -mCX;
-		mVert.v[0].y = -mCY;
+	uint32_t mIssued = 0;	//!< State changes sent to GL.
+	uint32_t mSkipped = 0;	//!< State changes not sent as GL already had the value.
 
-		mVert.v[1].x = mWidth - mCX;
-		mVert.v[1].y = -mCY;
+	// Running totals for the frame stats, they take the difference between the start and end of the frame.
+	uint32_t mProgramChanges = 0;
+	uint32_t mTextureBinds = 0;
+	uint32_t mBytesUploaded = 0;	//!< Vertex, index and texture data given to GL. Added to where the data is sent.
 
-		mVert.v[2].x = mWidth - mCX;
-		mVert.v[2].y = mHeight - mCY;
+	// Instanced drawing is not part of GLES 2.0, these are found at runtime and are null if the driver does not have it.
+	typedef void (*DrawElementsInstancedFunc)(GLenum pMode,GLsizei pCount,GLenum pType,const void* pIndices,GLsizei pInstanceCount);
+	typedef void (*VertexAttribDivisorFunc)(GLuint pIndex,GLuint pDivisor);
+	DrawElementsInstancedFunc mDrawElementsInstanced = nullptr;
+	VertexAttribDivisorFunc mVertexAttribDivisor = nullptr;
 
-		mVert.v[3].x = -mCX;
-		mVert.v[3].y = mHeight - mCY;
-	}
+	bool GetHasInstancing()const{return mDrawElementsInstanced != nullptr && mVertexAttribDivisor != nullptr;}
 
-	void BuildUVs(int pTextureWidth,int pTextureHeight,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+	/**
+	 * @brief Updates the shadow value, returns true if it changed and so the GL call needs to be made.
+	 */
+	template<typename VALUE> bool Update(VALUE& rShadow,const VALUE& pValue)
 	{
-		auto scaleUV = [](int pSize,int pCoord)
+		if( rShadow == pValue )
 		{
-			return (0x7fff * pCoord) / pSize;
-		};
-
-		mUV.v[0].x = scaleUV(pTextureWidth,pTexFromX);
-		mUV.v[0].y = scaleUV(pTextureHeight,pTexFromY);
-
-		mUV.v[1].x = scaleUV(pTextureWidth,pTexToX);
-		mUV.v[1].y = scaleUV(pTextureHeight,pTexFromY);
-
-		mUV.v[2].x = scaleUV(pTextureWidth,pTexToX);
-		mUV.v[2].y = scaleUV(pTextureHeight,pTexToY);
-
-		mUV.v[3].x = scaleUV(pTextureWidth,pTexFromX);
-		mUV.v[3].y = scaleUV(pTextureHeight,pTexToY);
+			mSkipped++;
+			return false;
+		}
+		rShadow = pValue;
+		mIssued++;
+		return true;
 	}
-};
-
-/**
- * @brief Represents a large number of quads, handy when you want to render many at once. Like particles.
- */
-struct QuadBatch
-{
-	const uint32_t mNumQuads;
-	uint32_t mTexture;
-
-	std::vector<Quad2D> mUVs;
-	std::vector<QuadBatchTransform> mTransforms;
-
-	inline size_t GetNumQuads()const{return mNumQuads;}
 
-	QuadBatch(int pCount,uint32_t pTexture,int pTextureWidth,int pTextureHeight,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY) :
-		mNumQuads(pCount),
-		mTexture(pTexture)
+	/**
+	 * @brief For uniforms, arrays of floats, returns true if it changed and so the GL call needs to be made.
+	 */
+	bool UpdateUniform(float* rShadow,const float* pValue,size_t pCount)
 	{
-		mTransforms.resize(pCount);
-
-		auto scaleUV = [](int pSize,int pCoord)
+		if( memcmp(rShadow,pValue,sizeof(float) * pCount) == 0 )
 		{
-			return (0x7fff * pCoord) / pSize;
-		};
-
-		Quad2D uv;
-		uv.v[0].x = scaleUV(pTextureWidth,pTexFromX);
-		uv.v[0].y = scaleUV(pTextureHeight,pTexFromY);
-		uv.v[1].x = scaleUV(pTextureWidth,pTexToX);
-		uv.v[1].y = scaleUV(pTextureHeight,pTexFromY);
-		uv.v[2].x = scaleUV(pTextureWidth,pTexToX);
-		uv.v[2].y = scaleUV(pTextureHeight,pTexToY);
-		uv.v[3].x = scaleUV(pTextureWidth,pTexFromX);
-		uv.v[3].y = scaleUV(pTextureHeight,pTexToY);
+			mSkipped++;
+			return false;
+		}
+		memcpy(rShadow,pValue,sizeof(float) * pCount);
+		mIssued++;
+		return true;
+	}
 
-		mUVs.resize(pCount,uv);
+	void UseProgram(GLuint pProgram)
+	{
+		if( Update(mProgram,pProgram) )
+		{
+			glUseProgram(pProgram);
+			mProgramChanges++;
+		}
 	}
-};
 
+	void BindTexture(GLuint pUnit,GLuint pTexture)
+	{
+		assert( pUnit < MaxTextureUnits );
+		if( Update(mActiveTexture,pUnit) )
+		{
+			glActiveTexture(GL_TEXTURE0 + pUnit);
+		}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// scratch memory buffer utility
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-template<typename SCRATCH_MEMORY_TYPE,int START_TYPE_COUNT,int GROWN_TYPE_COUNT,int MAXIMUN_GROWN_COUNT> struct ScratchBuffer
-{
-	ScratchBuffer():mMemory(new SCRATCH_MEMORY_TYPE[START_TYPE_COUNT]),mCount(START_TYPE_COUNT),mNextIndex(0){}
-	~ScratchBuffer(){delete []mMemory;}
-	
-	/**
-	 * @brief Start filling your data from the start of the buffer, overwriting what maybe there. This is the core speed up we get.
-	 */
-	void Restart(){mNextIndex = 0;}
+		if( Update(mBoundTextures[pUnit],pTexture) )
+		{
+			glBindTexture(GL_TEXTURE_2D,pTexture);
+			mTextureBinds++;
+		}
+	}
 
-	/**
-	 * @brief For when you know in advance how much space you need.
-	 */
-	SCRATCH_MEMORY_TYPE* Restart(size_t pCount)
+	void SetAttribArray(StreamIndex pStream,bool pEnabled)
 	{
-		mNextIndex = 0;
-		return Next(pCount);
+		if( Update(mAttribArrays[(size_t)pStream],pEnabled) )
+		{
+			if( pEnabled )
+			{
+				glEnableVertexAttribArray((GLuint)pStream);
+			}
+			else
+			{
+				glDisableVertexAttribArray((GLuint)pStream);
+			}
+		}
 	}
 
-	/**
-	 * @brief Return enough memory to put the next N items into, you can only safety write the number of items requested.
-	 */
-	SCRATCH_MEMORY_TYPE* Next(size_t pCount = 1)
+	void SetAttribDivisor(StreamIndex pStream,GLuint pDivisor)
 	{
-		EnsureSpace(pCount);
-		SCRATCH_MEMORY_TYPE* next = mMemory + mNextIndex;
-		mNextIndex += pCount;
-		return next;
+		assert(GetHasInstancing());
+		if( Update(mAttribDivisors[(size_t)pStream],pDivisor) )
+		{
+			mVertexAttribDivisor((GLuint)pStream,pDivisor);
+		}
 	}
 
 	/**
-	 * @brief How many items have been written since Restart was called.
+	 * @brief For GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE.
 	 */
-	const size_t Used()const{return mNextIndex;}
+	void SetCapability(GLenum pCapability,bool pEnabled)
+	{
+		bool* shadow = nullptr;
+		switch( pCapability )
+		{
+		case GL_BLEND:
+			shadow = &mBlend;
+			break;
 
-	/**
-	 * @brief Diagnostics tool, how many bytes we're using.
-	 */
-	const size_t MemoryUsed()const{return mCount * sizeof(SCRATCH_MEMORY_TYPE);}
+		case GL_DEPTH_TEST:
+			shadow = &mDepthTest;
+			break;
 
-	/**
-	 * @brief The root of our memory, handy for when you've finished filling the buffer and need to now do work with it.
-	 * You should fetch this memory pointer AFTER you have done your work as it may change as you fill the data.
-	 */
-	const SCRATCH_MEMORY_TYPE* Data()const{return mMemory;}
+		case GL_CULL_FACE:
+			shadow = &mCullFace;
+			break;
 
-private:
-	SCRATCH_MEMORY_TYPE* mMemory; //<! Our memory, only reallocated when it's too small. That is the speed win!
-	size_t mCount; //<! How many there are available to write too.
-	size_t mNextIndex; //<! Where we can write to next.
+		default:
+			assert(!"SetCapability passed a capability we don't track");
+			return;
+		}
+
+		if( Update(*shadow,pEnabled) )
+		{
+			if( pEnabled )
+			{
+				glEnable(pCapability);
+			}
+			else
+			{
+				glDisable(pCapability);
+			}
+		}
+	}
+
+	void DepthFunc(GLenum pFunc)
+	{
+		if( Update(mDepthFunc,pFunc) )
+		{
+			glDepthFunc(pFunc);
+		}
+	}
+
+	void DepthMask(bool pWrite)
+	{
+		if( Update(mDepthMask,pWrite) )
+		{
+			glDepthMask(pWrite?GL_TRUE:GL_FALSE);
+		}
+	}
+
+	void BindBuffer(GLenum pTarget,GLuint pBuffer)
+	{
+		GLuint& shadow = pTarget == GL_ELEMENT_ARRAY_BUFFER ? mElementArrayBuffer : mArrayBuffer;
+		if( Update(shadow,pBuffer) )
+		{
+			glBindBuffer(pTarget,pBuffer);
+		}
+	}
 
 	/**
-	 * @brief Makes sure we always have space.
+	 * @brief GL unbinds deleted textures from the texture units, so we have to as well.
 	 */
-	void EnsureSpace(size_t pExtraSpaceNeeded)
+	void OnTextureDeleted(GLuint pTexture)
 	{
-		if( pExtraSpaceNeeded > MAXIMUN_GROWN_COUNT )
+		for( auto& t : mBoundTextures )
 		{
-			throw std::runtime_error("Scratch memory type tried to grow too large in one go, you may have a memory bug. Tried to add " + std::to_string(pExtraSpaceNeeded) + " items");
+			if( t == pTexture )
+			{
+				t = 0;
+			}
 		}
+	}
 
-		if( (mNextIndex + pExtraSpaceNeeded) >= mCount )
+	void OnBufferDeleted(GLuint pBuffer)
+	{
+		if( mArrayBuffer == pBuffer )
 		{
-			const size_t newCount = mCount + pExtraSpaceNeeded + GROWN_TYPE_COUNT;
-			SCRATCH_MEMORY_TYPE* newMemory = new SCRATCH_MEMORY_TYPE[newCount];
-			std::memmove(newMemory,mMemory,mCount);
-			delete []mMemory;
-			mMemory = newMemory;
-			mCount = newCount;
+			mArrayBuffer = 0;
+		}
+
+		if( mElementArrayBuffer == pBuffer )
+		{
+			mElementArrayBuffer = 0;
 		}
 	}
+
+private:
+	GLuint mProgram = 0;
+	GLuint mActiveTexture = 0;
+	std::array<GLuint,MaxTextureUnits> mBoundTextures = {};
+	std::array<bool,MaxAttribArrays> mAttribArrays = {};
+	std::array<GLuint,MaxAttribArrays> mAttribDivisors = {};
+	bool mBlend = false;
+	bool mDepthTest = false;
+	bool mCullFace = false;
+	GLenum mDepthFunc = GL_LESS;
+	bool mDepthMask = true;
+	GLuint mArrayBuffer = 0;
+	GLuint mElementArrayBuffer = 0;
 };
 
 /**
- * @brief Simple utility for building quads on the fly.
+ * @brief A ring of GL buffer objects that transient geometry is written into so that nothing is drawn from client memory.
+ * Drawing from client memory makes the driver copy the data, and wait, for every draw call.
+ * One buffer per frame in flight, the data for a frame is appended with sub-range writes. When we come back round to a buffer
+ * we wait on the fence set when it was last used, when fences are not available the buffer is orphaned so the driver gives us memory the GPU is not reading.
  */
-struct Vert2DShortScratchBuffer : public ScratchBuffer<VertShortXY,256,64,1024>
+struct StreamingBuffer
 {
+	static constexpr size_t NumBuffers = 3;
+
+	StreamingBuffer(GLStateCache& rStateCache,GLenum pTarget,size_t pSize):mStateCache(rStateCache),mTarget(pTarget),mHasFences(GetHasFences()),mSize(pSize)
+	{
+		glGenBuffers(NumBuffers,mBuffers.data());
+		for( size_t n = 0 ; n < NumBuffers ; n++ )
+		{
+			Allocate(n);
+		}
+		CHECK_OGL_ERRORS();
+	}
+
+	~StreamingBuffer()
+	{
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		for( auto& f : mFences )
+		{
+			if( f )
+			{
+				glDeleteSync(f);
+			}
+		}
+#endif
+		for( auto b : mBuffers )
+		{
+			mStateCache.OnBufferDeleted(b);
+		}
+		glDeleteBuffers(NumBuffers,mBuffers.data());
+	}
+
+	GLuint GetBuffer()const{return mBuffers[mCurrent];}
+
 	/**
-	 * @brief Writes six vertices to the buffer.
+	 * @brief Makes sure the next pBytes of writes will fit without the buffer being orphaned part way through a draw.
 	 */
-	inline void BuildQuad(int pX,int pY,int pWidth,int pHeight)
+	void Reserve(size_t pBytes)
 	{
-		VertShortXY* verts = Next(6);
-		verts[0].x = pX;			verts[0].y = pY;
-		verts[1].x = pX + pWidth;	verts[1].y = pY;
-		verts[2].x = pX + pWidth;	verts[2].y = pY + pHeight;
+		if( GetAligned(mOffset) + pBytes > mSize )
+		{
+			// Out of room, ask GL for new memory for this buffer. The draws already made from it keep the old memory.
+			mSize = std::max(mSize,pBytes);
+			Allocate(mCurrent);
+			mOffset = 0;
+		}
+	}
 
-		verts[3].x = pX;			verts[3].y = pY;
-		verts[4].x = pX + pWidth;	verts[4].y = pY + pHeight;
-		verts[5].x = pX;			verts[5].y = pY + pHeight;
+	/**
+	 * @brief Copies the data into the current buffer, returns the offset in the buffer it was written to.
+	 */
+	uintptr_t Write(const void* pData,size_t pBytes)
+	{
+		Reserve(pBytes);
+
+		const size_t offset = GetAligned(mOffset);
+		mStateCache.BindBuffer(mTarget,mBuffers[mCurrent]);
+		glBufferSubData(mTarget,offset,pBytes,pData);
+		mStateCache.mBytesUploaded += pBytes;
+		CHECK_OGL_ERRORS();
+
+		mOffset = offset + pBytes;
+		return offset;
 	}
 
 	/**
-	 * @brief Writes the UV's to six vertices in the correct order to match the quad built above.
+	 * @brief Called at the end of the frame, moves onto the next buffer in the ring.
 	 */
-	inline void AddUVRect(int U0,int V0,int U1,int V1)
+	void NextFrame()
 	{
-		VertShortXY* verts = Next(6);
-		verts[0].x = U0;	verts[0].y = V0;
-		verts[1].x = U1;	verts[1].y = V0;
-		verts[2].x = U1;	verts[2].y = V1;
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		if( mHasFences )
+		{
+			mFences[mCurrent] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+		}
+#endif
+		mCurrent = (mCurrent + 1) % NumBuffers;
+		mOffset = 0;
 
-		verts[3].x = U0;	verts[3].y = V0;
-		verts[4].x = U1;	verts[4].y = V1;
-		verts[5].x = U0;	verts[5].y = V1;
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		if( mFences[mCurrent] )
+		{
+			glClientWaitSync(mFences[mCurrent],GL_SYNC_FLUSH_COMMANDS_BIT,GL_TIMEOUT_IGNORED);
+			glDeleteSync(mFences[mCurrent]);
+			mFences[mCurrent] = nullptr;
+		}
+#endif
+
+		if( mHasFences == false || mAllocated[mCurrent] != mSize )
+		{
+			Allocate(mCurrent);
+		}
 	}
 
+private:
+	GLStateCache& mStateCache;
+	const GLenum mTarget;
+	const bool mHasFences;	//!< False when the driver has no sync objects, the buffers are then orphaned each time round.
+	size_t mSize;			//!< How big the buffers are, grows if a draw needs more.
+	size_t mCurrent = 0;	//!< The buffer being written to this frame.
+	size_t mOffset = 0;		//!< Where the next write goes.
+	std::array<GLuint,NumBuffers> mBuffers;
+	std::array<size_t,NumBuffers> mAllocated = {};
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+	std::array<GLsync,NumBuffers> mFences = {};
+#endif
+
+	static size_t GetAligned(size_t pOffset){return (pOffset + 3) & ~3;}// Some GL drivers are slow with vertex data that is not four byte aligned.
+
 	/**
-	 * @brief Adds a number of quads to the buffer, moving STEP for each one.
+	 * @brief Sync objects are core in GLES 3.0 and GL 3.2, before that they need ARB_sync.
+	 * The headers having GL_SYNC_GPU_COMMANDS_COMPLETE, as glext.h always does, does not mean the driver has the functions.
 	 */
-	inline void BuildQuads(int pX,int pY,int pWidth,int pHeight,int pCount,int pXStep,int pYStep)
+	static bool GetHasFences()
 	{
-		for(int n = 0 ; n < pCount ; n++, pX += pXStep, pY += pYStep )
+#ifdef GL_SYNC_GPU_COMMANDS_COMPLETE
+		const char* version = (const char*)glGetString(GL_VERSION);
+		if( version == nullptr )
 		{
-			BuildQuad(pX,pY,pWidth,pHeight);
+			return false;
+		}
+
+		const bool isGLES = strncmp(version,"OpenGL ES",9) == 0;
+		int major = 0,minor = 0;
+		sscanf(isGLES ? version + 9 : version,"%d.%d",&major,&minor);
+		if( isGLES )
+		{
+			return major >= 3;
+		}
+		if( major > 3 || (major == 3 && minor >= 2) )
+		{
+			return true;
 		}
+
+		const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+		return extensions != nullptr && strstr(extensions,"GL_ARB_sync") != nullptr;
+#else
+		return false;
+#endif
 	}
-};
 
-struct WorkBuffers
-{
-	ScratchBuffer<uint8_t,128,16,512*512*4> scratchRam;// gets used for some temporary texture operations.
-	ScratchBuffer<Vert2Df,128,16,128> vertices2Df;
-	Vert2DShortScratchBuffer vertices2DShort;
-	Vert2DShortScratchBuffer uvShort;
+	void Allocate(size_t pIndex)
+	{
+		mStateCache.BindBuffer(mTarget,mBuffers[pIndex]);
+		glBufferData(mTarget,mSize,nullptr,GL_STREAM_DRAW);
+		mAllocated[pIndex] = mSize;
+	}
 };
 
-// End of scratch memory buffer utility
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-
 /**
- * @brief Mainly for debugging, returns a string representation of the enum.
+ * @brief The streaming buffers for vertices and indices.
  */
-constexpr std::string_view TextureFormatToString(TextureFormat pFormat)
+struct StreamingBuffers
 {
-	switch( pFormat )
-	{
-	case TextureFormat::FORMAT_RGBA:
-		return "FORMAT_RGBA";
-		
-	case TextureFormat::FORMAT_RGB:
-		return "FORMAT_RGB";
+	StreamingBuffers(GLStateCache& rStateCache):
+		vertices(rStateCache,GL_ARRAY_BUFFER,256 * 1024),
+		indices(rStateCache,GL_ELEMENT_ARRAY_BUFFER,32 * 1024)
+	{}
 
-	case TextureFormat::FORMAT_ALPHA:
-		return "FORMAT_ALPHA";
-	}
-	return "Invalid TextureFormat";
-}
- 
-constexpr GLint TextureFormatToGLFormat(TextureFormat pFormat)
+	StreamingBuffer vertices;
+	StreamingBuffer indices;
+};
+
+/**
+ * @brief Returns the size, in bytes, of the GL data types we use for vertex and index streams.
+ */
+constexpr size_t GetGLTypeSize(GLenum pType)
 {
-	switch( pFormat )
+	switch( pType )
 	{
-	case TextureFormat::FORMAT_RGB:
-		return GL_RGB;
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE:
+		return 1;
 
-	case TextureFormat::FORMAT_RGBA:
-		return GL_RGBA;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT:
+		return 2;
 
-	case TextureFormat::FORMAT_ALPHA:
-		return GL_ALPHA; // This is mainly used for the fonts.
+	case GL_FLOAT:
+		return 4;
 	}
-	return GL_INVALID_ENUM;
+	return 0;
 }
 
-#ifdef USE_FREETYPEFONTS
 /**
- * @brief Optional freetype font library support. Is optional as the code is dependant on a library tha may not be avalibel for the host platform.
- * One note, I don't do localisation. ASCII here. If you need all the characters then maybe add yourself or use a commercial grade GL engine. :) localisation is a BIG job!
- * Rendering is done in the GL code, this class is more of just a container.
+ * @brief One vertex stream used by a draw command.
  */
-struct FreeTypeFont
+struct DrawStream
 {
+	const void* data = nullptr;		//!< Client memory, or the offset into the buffer object if buffer is not zero.
+	uint32_t buffer = 0;			//!< The GL buffer object the stream is in, zero if the data is in client memory.
+	GLenum type = GL_FLOAT;
+	GLint size = 0;					//!< Number of components per vertex, zero means the stream is not used.
+	GLboolean normalised = GL_FALSE;
+	GLsizei stride = 0;
+	GLuint divisor = 0;				//!< Zero for a value per vertex, one for a value per instance.
+
+	size_t GetElementSize()const{return GetGLTypeSize(type) * size;}
+
 	/**
-	 * @brief An entry into the glyph cache
+	 * @brief How many bytes of memory the stream reads for the number of vertices passed.
 	 */
-	struct Glyph
+	size_t GetBytes(size_t pVertexCount)const
 	{
-		int width;
-		int height;
-		int pitch;
-		int advance;
-		int x_off,y_off;	//!< offset from current x and y that the quad is rendered.
-		struct
-		{// Where, in 16bit UV's, the glyph is.
-			int x,y;
-		}uv[2];
-	};
+		const size_t elementSize = GetGLTypeSize(type) * size;
+		if( pVertexCount == 0 )
+		{
+			return 0;
+		}
+		return ((pVertexCount - 1) * (stride > 0 ? stride : elementSize)) + elementSize;
+	}
+};
 
-	FreeTypeFont(FT_Face pFontFace,int pPixelHeight);
-	~FreeTypeFont();
+/**
+ * @brief Everything needed to issue one draw call. All the draw functions fill one of these in and then pass it to SubmitDraw.
+ * Having them all go through one place allows them to be recorded and sorted when deferred rendering is on.
+ */
+struct DrawCommand
+{
+	DrawCommand(TinyShader pShader,GLenum pMode,GLsizei pCount):shader(pShader),mode(pMode),count(pCount),vertexCount(pCount){}
+
+	TinyShader shader;
+	uint32_t texture = 0;
+	float colour[4] = {1.0f,1.0f,1.0f,1.0f};
+	GLenum mode;
+	GLsizei count;								//!< Number of vertices drawn, or indices if an indexed draw.
+	GLsizei vertexCount;						//!< Number of vertices in the streams, for indexed draws this is not the same as count.
+	GLsizei instanceCount = 0;					//!< When not zero the draw is instanced, streams with a divisor have one value per instance.
+	std::array<DrawStream,4> streams;			//!< Indexed with StreamIndex.
+
+	const void* indices = nullptr;				//!< Client memory, or the offset into the buffer object if indexBuffer is not zero.
+	uint32_t indexBuffer = 0;
+	GLenum indexType = GL_UNSIGNED_SHORT;
+	bool interleaved = false;					//!< Set by the caller when the streams in client memory are in one block, an array of structs. The block is then copied once and not once per stream.
+
+	bool GetIsIndexed()const{return indices != nullptr || indexBuffer != 0;}
 
 	/**
-	 * @brief Get the Glyph object of an ASCII character. All that is needed to render as well as build the texture.
+	 * @brief The start and end of the memory the streams in client memory read. Only one block if interleaved is set.
 	 */
-	bool GetGlyph(FT_UInt pChar,FreeTypeFont::Glyph& rGlyph,std::vector<uint8_t>& rPixels);
+	void GetClientBlock(uintptr_t& rStart,uintptr_t& rEnd)const
+	{
+		rStart = UINTPTR_MAX;
+		rEnd = 0;
+		for( const auto& s : streams )
+		{
+			if( s.size > 0 && s.buffer == 0 )
+			{
+				rStart = std::min(rStart,(uintptr_t)s.data);
+				rEnd = std::max(rEnd,(uintptr_t)s.data + GetStreamBytes(s));
+			}
+		}
+	}
 
 	/**
-	 * @brief Builds our texture object.
+	 * @brief How many bytes of memory the stream reads for this draw.
 	 */
-	void BuildTexture(
-			int pMaximumAllowedGlyph,
-			std::function<uint32_t(int pWidth,int pHeight)> pCreateTexture,
-			std::function<void(uint32_t pTexture,int pX,int pY,int pWidth,int pHeight,const uint8_t* pPixels)> pFillTexture);
+	size_t GetStreamBytes(const DrawStream& pStream)const
+	{
+		return pStream.GetBytes(pStream.divisor > 0 ? instanceCount : vertexCount);
+	}
 
-	const std::string mFontName; //<! Helps with debugging.
-	FT_Face mFace;								//<! The font we are rending from.
-	uint32_t mTexture;							//<! This is the texture that the glyphs are in so we can render using GL and quads.
-	std::array<FreeTypeFont::Glyph,96>mGlyphs;	//<! Meta data needed to render the characters.
-	int mBaselineHeight;						//<! This is the number of pixels above baseline the higest character is. Used for centering a font in the y.
-	int mSpaceAdvance;							//<! How much to advance by for a non rerendered character.
+	void SetColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+	{
+		colour[0] = ColourToFloat(pRed);
+		colour[1] = ColourToFloat(pGreen);
+		colour[2] = ColourToFloat(pBlue);
+		colour[3] = ColourToFloat(pAlpha);
+	}
 
-	struct
+	void SetStream(StreamIndex pStream,GLint pSize,GLenum pType,GLboolean pNormalised,GLsizei pStride,const void* pData,uint32_t pBuffer = 0)
 	{
-		uint8_t R = 255;
-		uint8_t G = 255;
-		uint8_t B = 255;
-		uint8_t A = 255;
-	}mColour;	
+		DrawStream& s = streams[(size_t)pStream];
+		s.data = pData;
+		s.buffer = pBuffer;
+		s.type = pType;
+		s.size = pSize;
+		s.normalised = pNormalised;
+		s.stride = pStride;
+	}
+
+	/**
+	 * @brief Makes the draw instanced, the streams passed have one value per instance.
+	 */
+	void SetInstanced(GLsizei pInstanceCount,std::initializer_list<StreamIndex> pInstanceStreams)
+	{
+		instanceCount = pInstanceCount;
+		for( StreamIndex i : pInstanceStreams )
+		{
+			streams[(size_t)i].divisor = 1;
+		}
+	}
 
+	void SetIndices(GLsizei pVertexCount,GLenum pType,const void* pIndices,uint32_t pBuffer = 0)
+	{
+		vertexCount = pVertexCount;
+		indexType = pType;
+		indices = pIndices;
+		indexBuffer = pBuffer;
+	}
 };
 
 /**
- * @brief Because this is a very simple font system I have a limited number of characters I can render. This allows me to use the ones I expect to be most useful.
+ * @brief The draw commands recorded over a frame when deferred rendering is on.
+ * The vertex and index data is copied as the callers memory, and our work buffers, will be reused before the frame ends.
+ * The projection and transform are only stored when they change, most draws share them.
  */
-static std::array<int,256>GlyphIndex;
-static bool BuildGlyphIndex = true;
-
-inline int GetGlyphIndex(FT_UInt pCharacter)
+struct DeferredDraws
 {
-	return GlyphIndex[pCharacter];
-}
+	struct Recorded
+	{
+		uint64_t key;			//!< Layer, projection, shader, texture and depth state. What we sort on.
+		uint32_t projection;	//!< Index into mProjections.
+		uint32_t transform;		//!< Index into mTransforms.
+		bool depthTest;
+		DrawCommand command;	//!< Stream and index pointers that are not in a buffer object are offsets into mData.
+	};
+
+	bool mEnabled = false;
+	int16_t mLayer = 0;
+	std::vector<Recorded> mDraws;
+	std::vector<uint32_t> mOrder;	//!< Sorted index into mDraws, kept so we don't reallocate every frame.
+	std::vector<Matrix> mProjections;
+	std::vector<Matrix> mTransforms;
+	std::vector<uint8_t> mData;
+
+	static constexpr size_t MaxProjections = 256;//!< The projection index has eight bits in the sort key.
+
+	/**
+	 * @brief True when recording with this projection would need more than MaxProjections, the draws so far have to be flushed first.
+	 */
+	bool GetIsProjectionsFull(const float pProjection[4][4])const
+	{
+		return mProjections.size() >= MaxProjections && memcmp(mProjections.back().m,pProjection,sizeof(Matrix::m)) != 0;
+	}
+
+	/**
+	 * @brief Copies the data into our memory, returning the offset it was written to.
+	 * Never returns zero, the first four bytes are skipped, as the offset replaces the index pointer and a null index pointer means the draw is not indexed.
+	 */
+	uintptr_t Store(const void* pData,size_t pBytes)
+	{
+		const size_t offset = std::max((mData.size() + 3) & ~3,(size_t)4);// Keep everything four byte aligned, some GL drivers are slow with unaligned vertex data.
+		mData.resize(offset + pBytes);
+		memcpy(mData.data() + offset,pData,pBytes);
+		return offset;
+	}
+
+	/**
+	 * @brief Adds the matrix to the list if it's not the same as the last one added. Returns it's index.
+	 */
+	static uint32_t AddMatrix(std::vector<Matrix>& rMatrices,const float pMatrix[4][4])
+	{
+		if( rMatrices.size() == 0 || memcmp(rMatrices.back().m,pMatrix,sizeof(Matrix::m)) != 0 )
+		{
+			rMatrices.emplace_back();
+			memcpy(rMatrices.back().m,pMatrix,sizeof(Matrix::m));
+		}
+		return (uint32_t)(rMatrices.size() - 1);
+	}
+
+	void Record(const DrawCommand& pCommand,uint32_t pShaderSortID,const float pProjection[4][4],const float pTransform[4][4],bool pDepthTest)
+	{
+		Recorded r = {0,0,0,pDepthTest,pCommand};
+		r.projection = AddMatrix(mProjections,pProjection);
+		r.transform = AddMatrix(mTransforms,pTransform);
+		assert( r.projection < MaxProjections );
+
+		uintptr_t blockStart = 0,blockEnd = 0,blockOffset = 0;
+		if( pCommand.interleaved )
+		{
+			pCommand.GetClientBlock(blockStart,blockEnd);
+			blockOffset = blockEnd > 0 ? Store((const void*)blockStart,blockEnd - blockStart) : 0;
+		}
+
+		for( auto& s : r.command.streams )
+		{
+			if( s.size > 0 && s.buffer == 0 )
+			{
+				if( pCommand.interleaved )
+				{
+					s.data = (const void*)(blockOffset + ((uintptr_t)s.data - blockStart));
+				}
+				else
+				{
+					s.data = (const void*)Store(s.data,pCommand.GetStreamBytes(s));
+				}
+			}
+		}
+
+		if( r.command.indices != nullptr && r.command.indexBuffer == 0 )
+		{
+			r.command.indices = (const void*)Store(r.command.indices,GetGLTypeSize(r.command.indexType) * pCommand.count);
+		}
+
+		// Sort on layer first, then projection so a frame that mixes 2D and 3D keeps it's passes in order.
+		// Then the expensive state changes, shader and texture. Last the depth state. TinyGLES has blending on all the time so that is not part of the key.
+		r.key = ((uint64_t)(uint16_t)(mLayer + 32768) << 48) |
+				((uint64_t)r.projection << 40) |
+				((uint64_t)(pShaderSortID&0xff) << 32) |
+				((uint64_t)(pCommand.texture&0xffffff) << 8) |
+				(pDepthTest?1:0);
+
+		mDraws.emplace_back(r);
+	}
+
+	void Clear()
+	{
+		mDraws.clear();
+		mProjections.clear();
+		mTransforms.clear();
+		mData.clear();
+	}
+};
+
+/**
+ * @brief Draw commands recorded once and replayed many times. The vertex and index data they had in client memory is in the list's own buffer objects.
+ */
+struct DisplayList
+{
+	struct Recorded
+	{
+		uint32_t projection;	//!< Index into mProjections.
+		uint32_t transform;		//!< Index into mTransforms.
+		bool depthTest;
+		DrawCommand command;	//!< Streams and indices that were in client memory now point into mVertexBuffer and mIndexBuffer.
+	};
+
+	/**
+	 * @brief The area a 2D draw covers before transform and projection, used to tell if two draws can be swapped.
+	 */
+	struct Bounds
+	{
+		bool valid = false;		//!< False when not known, the draw is then taken to cover everything.
+		float minX = 0.0f,minY = 0.0f,maxX = 0.0f,maxY = 0.0f;
+
+		/**
+		 * @brief Draws that only touch count as overlapping, they can share pixels on the edge.
+		 */
+		bool GetOverlaps(const Bounds& pOther)const
+		{
+			return !valid || !pOther.valid || (minX <= pOther.maxX && pOther.minX <= maxX && minY <= pOther.maxY && pOther.minY <= maxY);
+		}
+	};
+
+	static constexpr size_t MergeCheckLimit = 1024;//!< How many draws one draw is checked against when looking for a group to join, stops DisplayListEnd going quadratic.
+
+	GLStateCache& mStateCache;
+	std::vector<Recorded> mDraws;
+	std::vector<Matrix> mProjections;
+	std::vector<Matrix> mTransforms;
+	std::vector<uint8_t> mVertexData;	//!< Only used while recording, freed once uploaded.
+	std::vector<uint8_t> mIndexData;	//!< Only used while recording, freed once uploaded.
+	GLuint mVertexBuffer = 0;
+	GLuint mIndexBuffer = 0;
+	size_t mBytes = 0;					//!< Size of the two buffers after upload.
+
+	DisplayList(GLStateCache& rStateCache):mStateCache(rStateCache)
+	{
+		// Made now so the commands can reference them as they are recorded, filled in Upload.
+		glGenBuffers(1,&mVertexBuffer);
+		glGenBuffers(1,&mIndexBuffer);
+	}
+
+	~DisplayList()
+	{
+		mStateCache.OnBufferDeleted(mVertexBuffer);
+		mStateCache.OnBufferDeleted(mIndexBuffer);
+		glDeleteBuffers(1,&mVertexBuffer);
+		glDeleteBuffers(1,&mIndexBuffer);
+	}
+
+	/**
+	 * @brief Copies the data to the end of rBuffer, returning the offset it was written to.
+	 */
+	static uintptr_t Store(std::vector<uint8_t>& rBuffer,const void* pData,size_t pBytes)
+	{
+		const size_t offset = (rBuffer.size() + 3) & ~3;// Four byte aligned, same as the streaming buffers.
+		rBuffer.resize(offset + pBytes);
+		memcpy(rBuffer.data() + offset,pData,pBytes);
+		return offset;
+	}
+
+	/**
+	 * @brief Copies pCount elements of the stream, stepping by it's stride, to the end of rBuffer with no gaps. Returns the offset it was written to.
+	 * Only the bytes the stream reads are copied, interleaved streams are pulled apart.
+	 */
+	static uintptr_t StorePacked(std::vector<uint8_t>& rBuffer,const DrawStream& pStream,size_t pCount)
+	{
+		const size_t elementSize = pStream.GetElementSize();
+		if( pStream.stride == 0 || (size_t)pStream.stride == elementSize )
+		{
+			return Store(rBuffer,pStream.data,elementSize * pCount);
+		}
+
+		const size_t offset = (rBuffer.size() + 3) & ~3;
+		rBuffer.resize(offset + (elementSize * pCount));
+		const uint8_t* src = (const uint8_t*)pStream.data;
+		uint8_t* dst = rBuffer.data() + offset;
+		for( size_t n = 0 ; n < pCount ; n++, src += pStream.stride, dst += elementSize )
+		{
+			memcpy(dst,src,elementSize);
+		}
+		return offset;
+	}
+
+	void Record(const DrawCommand& pCommand,const float pProjection[4][4],const float pTransform[4][4],bool pDepthTest)
+	{
+		Recorded r = {0,0,pDepthTest,pCommand};
+		r.projection = DeferredDraws::AddMatrix(mProjections,pProjection);
+		r.transform = DeferredDraws::AddMatrix(mTransforms,pTransform);
+
+		// Each stream in client memory is copied on it's own and packed, so the list never holds bytes the draw does not read.
+		for( auto& s : r.command.streams )
+		{
+			if( s.size > 0 && s.buffer == 0 )
+			{
+				s.data = (const void*)StorePacked(mVertexData,s,s.divisor > 0 ? pCommand.instanceCount : pCommand.vertexCount);
+				s.stride = 0;
+				s.buffer = mVertexBuffer;
+			}
+		}
+
+		if( r.command.indices != nullptr && r.command.indexBuffer == 0 )
+		{
+			r.command.indices = (const void*)Store(mIndexData,r.command.indices,GetGLTypeSize(r.command.indexType) * pCommand.count);
+			r.command.indexBuffer = mIndexBuffer;
+		}
+
+		mDraws.emplace_back(r);
+	}
+
+	/**
+	 * @brief True if the draw can be joined with others, a plain triangle list with all it's streams packed in mVertexData.
+	 */
+	bool GetCanMerge(const Recorded& pDraw)const
+	{
+		const DrawCommand& c = pDraw.command;
+		if( c.mode != GL_TRIANGLES || c.GetIsIndexed() || c.instanceCount > 0 )
+		{
+			return false;
+		}
+
+		for( const auto& s : c.streams )
+		{
+			if( s.size > 0 && (s.buffer != mVertexBuffer || s.divisor > 0) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief True if the two draws would set the same GL state and read their streams the same way.
+	 */
+	static bool GetSameState(const Recorded& pA,const Recorded& pB)
+	{
+		const DrawCommand& a = pA.command;
+		const DrawCommand& b = pB.command;
+		if( a.shader != b.shader || a.texture != b.texture || memcmp(a.colour,b.colour,sizeof(a.colour)) != 0 ||
+			pA.projection != pB.projection || pA.transform != pB.transform || pA.depthTest != pB.depthTest )
+		{
+			return false;
+		}
+
+		for( size_t n = 0 ; n < a.streams.size() ; n++ )
+		{
+			const DrawStream& sa = a.streams[n];
+			const DrawStream& sb = b.streams[n];
+			if( sa.size != sb.size || (sa.size > 0 && (sa.type != sb.type || sa.normalised != sb.normalised)) )
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Only worked out for flat 2D float vertices. On one plane, draws that do not overlap before the transform can't after it.
+	 */
+	Bounds GetBounds(const Recorded& pDraw)const
+	{
+		Bounds b;
+		const DrawStream& v = pDraw.command.streams[(size_t)StreamIndex::VERTEX];
+		if( v.size != 2 || v.type != GL_FLOAT || pDraw.command.vertexCount == 0 )
+		{
+			return b;
+		}
+
+		const float* xy = (const float*)(mVertexData.data() + (uintptr_t)v.data);
+		b.valid = true;
+		b.minX = b.maxX = xy[0];
+		b.minY = b.maxY = xy[1];
+		for( GLsizei n = 1 ; n < pDraw.command.vertexCount ; n++ )
+		{
+			b.minX = std::min(b.minX,xy[n*2]);
+			b.maxX = std::max(b.maxX,xy[n*2]);
+			b.minY = std::min(b.minY,xy[n*2+1]);
+			b.maxY = std::max(b.maxY,xy[n*2+1]);
+		}
+		return b;
+	}
+
+	/**
+	 * @brief Joins draws with the same state into one draw. Replayed one at a time the list can be slower than drawing it every frame,
+	 * a UI panel alternates between fills and text so the 2D batch can't join them as they are made.
+	 * A draw joins the earliest group with the same state that no group after it overlaps, moving it past one that overlaps would change what is on top.
+	 * Taking the earliest and not the nearest leaves the later groups free for what is drawn on top of it.
+	 * Returns the number of draws there were before merging.
+	 */
+	size_t Merge()
+	{
+		struct Group
+		{
+			std::vector<size_t> draws;		//!< Indices into mDraws, in the order recorded.
+			std::vector<Bounds> bounds;		//!< One per draw, a single box around them all would soon cover everything.
+			bool canMerge;
+		};
+
+		std::vector<Group> groups;
+		for( size_t d = 0 ; d < mDraws.size() ; d++ )
+		{
+			const Recorded& draw = mDraws[d];
+			const bool canMerge = GetCanMerge(draw);
+			const Bounds bounds = canMerge ? GetBounds(draw) : Bounds();
+
+			Group* target = nullptr;
+			size_t checks = 0;
+			for( size_t g = groups.size() ; canMerge && g > 0 ; )
+			{
+				Group& group = groups[--g];
+				const Recorded& first = mDraws[group.draws.front()];
+				if( group.canMerge && GetSameState(first,draw) )
+				{// Joins at the end of the group, so the group's own draws are still under it.
+					target = &group;
+				}
+
+				// Bounds are in the space of the transform so are only comparable when it's the same.
+				bool overlaps = !group.canMerge || first.projection != draw.projection || first.transform != draw.transform;
+				for( size_t b = 0 ; b < group.bounds.size() && !overlaps ; b++ )
+				{
+					overlaps = checks++ >= MergeCheckLimit || group.bounds[b].GetOverlaps(bounds);
+				}
+
+				if( overlaps )
+				{
+					break;
+				}
+			}
+
+			if( target )
+			{
+				target->draws.push_back(d);
+				target->bounds.push_back(bounds);
+			}
+			else
+			{
+				groups.push_back({{d},{bounds},canMerge});
+			}
+		}
+
+		const size_t recorded = mDraws.size();
+		if( groups.size() == recorded )
+		{
+			return recorded;
+		}
+
+		// Lay the vertices out again, each stream of a group is the streams of it's draws one after the other.
+		std::vector<Recorded> merged;
+		std::vector<uint8_t> vertexData;
+		merged.reserve(groups.size());
+		for( const auto& group : groups )
+		{
+			Recorded r = mDraws[group.draws.front()];
+			for( size_t n = 0 ; n < r.command.streams.size() ; n++ )
+			{
+				DrawStream& s = r.command.streams[n];
+				if( s.size > 0 && s.buffer == mVertexBuffer && s.divisor == 0 )
+				{
+					const size_t offset = (vertexData.size() + 3) & ~3;
+					vertexData.resize(offset);
+					for( size_t d : group.draws )
+					{
+						const DrawCommand& c = mDraws[d].command;
+						const uint8_t* src = mVertexData.data() + (uintptr_t)c.streams[n].data;
+						vertexData.insert(vertexData.end(),src,src + c.GetStreamBytes(c.streams[n]));
+					}
+					s.data = (const void*)offset;
+				}
+				else if( s.size > 0 && s.buffer == mVertexBuffer )
+				{// Per instance streams of a draw on it's own.
+					s.data = (const void*)Store(vertexData,mVertexData.data() + (uintptr_t)s.data,r.command.GetStreamBytes(s));
+				}
+			}
+
+			if( group.draws.size() > 1 )
+			{
+				GLsizei vertices = 0;
+				for( size_t d : group.draws )
+				{
+					vertices += mDraws[d].command.vertexCount;
+				}
+				r.command.count = r.command.vertexCount = vertices;
+			}
+			merged.emplace_back(r);
+		}
+
+		mDraws = std::move(merged);
+		mVertexData = std::move(vertexData);
+		return recorded;
+	}
+
+	/**
+	 * @brief Sends the recorded geometry to GL, after this the draws no longer need anything in client memory.
+	 */
+	void Upload()
+	{
+		if( mVertexData.size() > 0 )
+		{
+			mStateCache.BindBuffer(GL_ARRAY_BUFFER,mVertexBuffer);
+			glBufferData(GL_ARRAY_BUFFER,mVertexData.size(),mVertexData.data(),GL_STATIC_DRAW);
+			CHECK_OGL_ERRORS();
+		}
+
+		if( mIndexData.size() > 0 )
+		{
+			mStateCache.BindBuffer(GL_ELEMENT_ARRAY_BUFFER,mIndexBuffer);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER,mIndexData.size(),mIndexData.data(),GL_STATIC_DRAW);
+			CHECK_OGL_ERRORS();
+		}
+
+		mBytes = mVertexData.size() + mIndexData.size();
+		mStateCache.mBytesUploaded += mBytes;
+		std::vector<uint8_t>().swap(mVertexData);
+		std::vector<uint8_t>().swap(mIndexData);
+	}
+};
+
+/**
+ * @brief The stats of the last MaxFrames frames and the counts for the one being drawn.
+ * Draw calls are counted as they are made, the GL state cache keeps running totals of the rest that are sampled at the start and end of the frame.
+ */
+struct FrameStatsHistory
+{
+	typedef std::chrono::steady_clock Clock;
+	static constexpr size_t MaxFrames = 120;	//!< Two seconds at 60Hz.
+
+	std::array<FrameStats,MaxFrames> mFrames;	//!< Ring of the frames, mNext is the oldest once it's full.
+	size_t mNext = 0;
+	size_t mCount = 0;
+	FrameStats mCurrent;						//!< Being counted, between BeginFrame and EndFrame.
+	FrameStats mLast;							//!< The last complete frame.
+	bool mOverlay = false;
+
+	Clock::time_point mFrameStart;
+	Clock::time_point mLastFrameEnd;
+	bool mHasFrameEnd = false;
+	uint32_t mProgramChangesAtStart = 0;
+	uint32_t mTextureBindsAtStart = 0;
+	uint32_t mBytesUploadedAtStart = 0;
+
+	void BeginFrame(const GLStateCache& pStateCache)
+	{
+		mCurrent = {};
+		mFrameStart = Clock::now();
+		mProgramChangesAtStart = pStateCache.mProgramChanges;
+		mTextureBindsAtStart = pStateCache.mTextureBinds;
+		mBytesUploadedAtStart = pStateCache.mBytesUploaded;
+	}
+
+	void EndFrame(const GLStateCache& pStateCache)
+	{
+		const Clock::time_point now = Clock::now();
+		mCurrent.cpuMilliseconds = std::chrono::duration<float,std::milli>(now - mFrameStart).count();
+		mCurrent.frameMilliseconds = mHasFrameEnd ? std::chrono::duration<float,std::milli>(now - mLastFrameEnd).count() : mCurrent.cpuMilliseconds;
+		mCurrent.shaderChanges = pStateCache.mProgramChanges - mProgramChangesAtStart;
+		mCurrent.textureChanges = pStateCache.mTextureBinds - mTextureBindsAtStart;
+		mCurrent.bytesUploaded = pStateCache.mBytesUploaded - mBytesUploadedAtStart;
+		mLastFrameEnd = now;
+		mHasFrameEnd = true;
+
+		mLast = mCurrent;
+		mFrames[mNext] = mCurrent;
+		mNext = (mNext + 1) % MaxFrames;
+		mCount = std::min(mCount + 1,MaxFrames);
+	}
+
+	/**
+	 * @brief The frame pAgo frames before the last one, zero for the last.
+	 */
+	const FrameStats& GetFrame(size_t pAgo)const
+	{
+		assert( pAgo < mCount );
+		return mFrames[(mNext + MaxFrames - 1 - pAgo) % MaxFrames];
+	}
+
+	template<typename GET_VALUE> FrameStatsSummary::Range GetRange(GET_VALUE pGetValue)const
+	{
+		FrameStatsSummary::Range range;
+		if( mCount == 0 )
+		{
+			return range;
+		}
+
+		std::array<float,MaxFrames> values;
+		float total = 0.0f;
+		for( size_t n = 0 ; n < mCount ; n++ )
+		{
+			values[n] = (float)pGetValue(mFrames[n]);
+			total += values[n];
+		}
+		std::sort(values.begin(),values.begin() + mCount);
+
+		range.min = values[0];
+		range.max = values[mCount - 1];
+		range.average = total / (float)mCount;
+		range.p99 = values[((mCount * 99) + 99) / 100 - 1];// The smallest value that 99% of the frames are at or below.
+		return range;
+	}
+};
+
+/**
+ * @brief The vertex used by the 2D batcher, position, normalised uv and colour in 16 bytes.
+ */
+struct BatchVert2D
+{
+	float x,y;
+	int16_t u,v;
+	uint32_t rgba;	//!< In memory the order is red, green, blue, alpha.
+};
+
+/**
+ * @brief Packs the colour so that in memory it's in the order red, green, blue, alpha. What the GL colour stream wants.
+ */
+inline uint32_t PackColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+{
+	const uint8_t rgba[4] = {pRed,pGreen,pBlue,pAlpha};
+	uint32_t packed;
+	memcpy(&packed,rgba,sizeof(packed));
+	return packed;
+}
+
+/**
+ * @brief Collects the 2D primitives into one triangle list with per vertex colour and uv.
+ * Consecutive draws that use the same shader and texture become one draw call. Lines are added as thin quads so fills and outlines can share a draw.
+ */
+struct Batch2D
+{
+	static constexpr size_t MaxVertices = 6 * 2048;// A multiple of six so that a full buffer is always whole triangles and quads.
+
+	TinyShader mShader;
+	uint32_t mTexture = 0;
+	size_t mUsed = 0;
+	BatchVert2D mVertices[MaxVertices];
+};
+
+inline void SetBatchVert(BatchVert2D& rVert,float pX,float pY,const VertShortXY* pUV,uint32_t pColour)
+{
+	rVert.x = pX;
+	rVert.y = pY;
+	rVert.u = pUV ? pUV->x : 0;
+	rVert.v = pUV ? pUV->y : 0;
+	rVert.rgba = pColour;
+}
+
+/**
+ * @brief How many vertices a triangle fan of pCount points is as a triangle list. Fewer than three points is no triangles.
+ */
+constexpr size_t GetFanAsTrianglesCount(size_t pCount)
+{
+	return pCount < 3 ? 0 : (pCount - 2) * 3;
+}
+
+/**
+ * @brief Writes a triangle fan out as a triangle list so it can be added to a 2D batch. Writes GetFanAsTrianglesCount(pCount) vertices.
+ */
+static void WriteFanAsTriangles(BatchVert2D* rOut,const Vert2Df* pPoints,const VertShortXY* pUVs,size_t pCount,uint32_t pColour)
+{
+	for( size_t n = 1 ; n + 1 < pCount ; n++ )
+	{
+		for( size_t i : {(size_t)0,n,n+1} )
+		{
+			SetBatchVert(*rOut++,pPoints[i].x,pPoints[i].y,pUVs ? pUVs + i : nullptr,pColour);
+		}
+	}
+}
+
+/**
+ * @brief Writes a one pixel wide line out as two triangles so it can be added to a 2D batch with fills. Writes 6 vertices.
+ * Like GL_LINES the pixel at pFrom is drawn and the one at pTo is not, so the segments of a loop meet without drawing a corner twice.
+ */
+static void WriteLineAsTriangles(BatchVert2D* rOut,const Vert2Df& pFrom,const Vert2Df& pTo,const VertShortXY* pFromUV,const VertShortXY* pToUV,uint32_t pColour)
+{
+	// Half a pixel along and across the line. Zero length lines come out as nothing.
+	const float dx = pTo.x - pFrom.x;
+	const float dy = pTo.y - pFrom.y;
+	const float length = std::sqrt((dx * dx) + (dy * dy));
+	const float ax = length > 0.0f ? (dx * 0.5f) / length : 0.0f;
+	const float ay = length > 0.0f ? (dy * 0.5f) / length : 0.0f;
+
+	// Moved to the pixel centres, then back half a pixel so the quad starts at the edge of the first pixel.
+	const float fromX = pFrom.x + 0.5f - ax;
+	const float fromY = pFrom.y + 0.5f - ay;
+	const float toX = pTo.x + 0.5f - ax;
+	const float toY = pTo.y + 0.5f - ay;
+
+	// Same winding as the fills, so it is not culled.
+	SetBatchVert(rOut[0],fromX + ay,fromY - ax,pFromUV,pColour);
+	SetBatchVert(rOut[1],toX + ay,toY - ax,pToUV,pColour);
+	SetBatchVert(rOut[2],toX - ay,toY + ax,pToUV,pColour);
+	rOut[3] = rOut[0];
+	rOut[4] = rOut[2];
+	SetBatchVert(rOut[5],fromX - ay,fromY + ax,pFromUV,pColour);
+}
+
+/**
+ * @brief Writes a line loop out as one pixel wide quads so it can be added to a 2D batch. Writes pCount * 6 vertices.
+ */
+static void WriteLoopAsTriangles(BatchVert2D* rOut,const Vert2Df* pPoints,const VertShortXY* pUVs,size_t pCount,uint32_t pColour)
+{
+	for( size_t n = 0 ; n < pCount ; n++, rOut += 6 )
+	{
+		const size_t next = (n+1)%pCount;
+		WriteLineAsTriangles(rOut,pPoints[n],pPoints[next],pUVs ? pUVs + n : nullptr,pUVs ? pUVs + next : nullptr,pColour);
+	}
+}
+
+/**
+ * @brief Defines a sprite that has a lot of the work needed to render pre-computed with position, rotation and scale done in the shader for speed.
+ */
+struct Sprite
+{
+	uint32_t mTexture;
+	float mWidth,mHeight,mCX,mCY;
+	Quad2Df mVert;
+	Quad2D mUV;
+
+	void BuildVerts()
+	{
+		mVert.v[0].x = -mCX;
+		mVert.v[0].y = -mCY;
+
+		mVert.v[1].x = mWidth - mCX;
+		mVert.v[1].y = -mCY;
+
+		mVert.v[2].x = mWidth - mCX;
+		mVert.v[2].y = mHeight - mCY;
+
+		mVert.v[3].x = -mCX;
+		mVert.v[3].y = mHeight - mCY;
+	}
+
+	void BuildUVs(int pTextureWidth,int pTextureHeight,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+	{
+		auto scaleUV = [](int pSize,int pCoord)
+		{
+			return (0x7fff * pCoord) / pSize;
+		};
+
+		mUV.v[0].x = scaleUV(pTextureWidth,pTexFromX);
+		mUV.v[0].y = scaleUV(pTextureHeight,pTexFromY);
+
+		mUV.v[1].x = scaleUV(pTextureWidth,pTexToX);
+		mUV.v[1].y = scaleUV(pTextureHeight,pTexFromY);
+
+		mUV.v[2].x = scaleUV(pTextureWidth,pTexToX);
+		mUV.v[2].y = scaleUV(pTextureHeight,pTexToY);
+
+		mUV.v[3].x = scaleUV(pTextureWidth,pTexFromX);
+		mUV.v[3].y = scaleUV(pTextureHeight,pTexToY);
+	}
+};
+
+/**
+ * @brief True if the transform only moves, rotates and scales in x and y. Sprites drawn with it can be transformed on the CPU and batched.
+ */
+inline bool GetIsTransform2D(const float pTransform[4][4])
+{
+	return pTransform[0][2] == 0.0f && pTransform[0][3] == 0.0f &&
+			pTransform[1][2] == 0.0f && pTransform[1][3] == 0.0f &&
+			pTransform[3][2] == 0.0f && pTransform[3][3] == 1.0f;
+}
+
+/**
+ * @brief Transforms the four corners of the quad by the 2D part of the transform, only the x and y of the output are written.
+ * Same maths as the shader, x' = x * m[0][0] + y * m[1][0] + m[3][0] and y' = x * m[0][1] + y * m[1][1] + m[3][1].
+ * Two corners are done at a time, one in each half of the register.
+ */
+inline void TransformQuad2D(BatchVert2D rOut[4],const Quad2Df& pQuad,const float pTransform[4][4])
+{
+#if defined(__SSE2__)
+	const __m128 mx = _mm_setr_ps(pTransform[0][0],pTransform[0][1],pTransform[0][0],pTransform[0][1]);
+	const __m128 my = _mm_setr_ps(pTransform[1][0],pTransform[1][1],pTransform[1][0],pTransform[1][1]);
+	const __m128 mt = _mm_setr_ps(pTransform[3][0],pTransform[3][1],pTransform[3][0],pTransform[3][1]);
+	for( int n = 0 ; n < 4 ; n += 2 )
+	{
+		const __m128 xy = _mm_loadu_ps(&pQuad.v[n].x);
+		const __m128 xx = _mm_shuffle_ps(xy,xy,_MM_SHUFFLE(2,2,0,0));
+		const __m128 yy = _mm_shuffle_ps(xy,xy,_MM_SHUFFLE(3,3,1,1));
+		const __m128 res = _mm_add_ps(_mm_add_ps(_mm_mul_ps(xx,mx),_mm_mul_ps(yy,my)),mt);
+		_mm_storel_pi((__m64*)&rOut[n].x,res);
+		_mm_storeh_pi((__m64*)&rOut[n+1].x,res);
+	}
+#elif defined(__ARM_NEON)
+	const float32x2_t mx2 = {pTransform[0][0],pTransform[0][1]};
+	const float32x2_t my2 = {pTransform[1][0],pTransform[1][1]};
+	const float32x2_t mt2 = {pTransform[3][0],pTransform[3][1]};
+	const float32x4_t mx = vcombine_f32(mx2,mx2);
+	const float32x4_t my = vcombine_f32(my2,my2);
+	const float32x4_t mt = vcombine_f32(mt2,mt2);
+	for( int n = 0 ; n < 4 ; n += 2 )
+	{
+		const float32x4_t xy = vld1q_f32(&pQuad.v[n].x);
+		const float32x2_t lo = vget_low_f32(xy);
+		const float32x2_t hi = vget_high_f32(xy);
+		const float32x4_t xx = vcombine_f32(vdup_lane_f32(lo,0),vdup_lane_f32(hi,0));
+		const float32x4_t yy = vcombine_f32(vdup_lane_f32(lo,1),vdup_lane_f32(hi,1));
+		const float32x4_t res = vmlaq_f32(vmlaq_f32(mt,xx,mx),yy,my);
+		vst1_f32(&rOut[n].x,vget_low_f32(res));
+		vst1_f32(&rOut[n+1].x,vget_high_f32(res));
+	}
+#else
+	for( int n = 0 ; n < 4 ; n++ )
+	{
+		const float x = pQuad.v[n].x;
+		const float y = pQuad.v[n].y;
+		rOut[n].x = (x * pTransform[0][0]) + (y * pTransform[1][0]) + pTransform[3][0];
+		rOut[n].y = (x * pTransform[0][1]) + (y * pTransform[1][1]) + pTransform[3][1];
+	}
+#endif
+}
+
+/**
+ * @brief The sprites drawn between SpriteBatchBegin and SpriteBatchEnd. Four vertices per sprite, drawn with the quad batch index buffer.
+ */
+struct SpriteBatch
+{
+	struct Bucket
+	{
+		uint32_t texture;
+		std::vector<BatchVert2D> vertices;
+	};
+
+	bool mActive = false;
+	std::vector<Bucket> mBuckets;	//!< Kept from frame to frame so their memory is reused.
+	size_t mLastBucket = 0;			//!< Sprites tend to come in runs of the same texture, so look here first.
+
+	BatchVert2D* Append(uint32_t pTexture)
+	{
+		if( mLastBucket >= mBuckets.size() || mBuckets[mLastBucket].texture != pTexture )
+		{
+			auto found = std::find_if(mBuckets.begin(),mBuckets.end(),[pTexture](const Bucket& b){return b.texture == pTexture;});
+			if( found == mBuckets.end() )
+			{
+				mBuckets.push_back({pTexture,{}});
+				found = mBuckets.end() - 1;
+			}
+			mLastBucket = found - mBuckets.begin();
+		}
+
+		auto& verts = mBuckets[mLastBucket].vertices;
+		verts.resize(verts.size() + 4);
+		return verts.data() + verts.size() - 4;
+	}
+};
+
+/**
+ * @brief Converts the arrays of per quad values into the four copies per quad the transform stream wants.
+ * Four quads at a time with SSE2 or NEON, the rest with the scalar loop.
+ * Positions and size are clamped to 16 bit. Rotation is wrapped to within one turn in float before it is converted,
+ * so any angle works and all three paths give the same result. A turn is 32768, same scale as QuadBatchTransform::SetTransform.
+ * Taking the fraction of the turns is exact in float, angles too big to have a fraction and NaN become zero.
+ */
+static void FillQuadBatchTransforms(QuadBatchTransform* rOut,const float* pX,const float* pY,const float* pRotation,const float* pSize,size_t pCount)
+{
+	const float radianToTurns = 0.159154943f;// 1 / 2PI
+	const float turnToShort = 32768.0f;
+	const float noFraction = 8388608.0f;// 2^23, from here up every float is a whole number.
+	size_t n = 0;
+
+#if defined(__SSE2__)
+	const __m128 rotScale = _mm_set1_ps(radianToTurns);
+	const __m128 turnScale = _mm_set1_ps(turnToShort);
+	const __m128 fractionLimit = _mm_set1_ps(noFraction);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 shortMin = _mm_set1_ps(-32768.0f);
+	const __m128 shortMax = _mm_set1_ps(32767.0f);
+	auto clamp4x16 = [shortMin,shortMax](const float* pValues)
+	{// Clamp before converting, out of int32 range the convert gives INT_MIN and that would pack to -32768.
+		return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(pValues),shortMin),shortMax));
+	};
+
+	for( ; n + 4 <= pCount ; n += 4 )
+	{
+		const __m128i x = clamp4x16(pX + n);
+		const __m128i y = clamp4x16(pY + n);
+		const __m128i s = clamp4x16(pSize + n);
+		const __m128 turns = _mm_mul_ps(_mm_loadu_ps(pRotation + n),rotScale);
+		const __m128 hasFraction = _mm_cmplt_ps(_mm_and_ps(turns,absMask),fractionLimit);
+		const __m128 fraction = _mm_and_ps(_mm_sub_ps(turns,_mm_cvtepi32_ps(_mm_cvttps_epi32(turns))),hasFraction);
+		const __m128i r = _mm_cvttps_epi32(_mm_mul_ps(fraction,turnScale));
+
+		// Pack to 16 bit then interleave so each 64 bits is the x,y,r,s of one quad.
+		const __m128i xy = _mm_unpacklo_epi16(_mm_packs_epi32(x,x),_mm_packs_epi32(y,y));
+		const __m128i rs = _mm_unpacklo_epi16(_mm_packs_epi32(r,r),_mm_packs_epi32(s,s));
+		const __m128i q01 = _mm_unpacklo_epi32(xy,rs);
+		const __m128i q23 = _mm_unpackhi_epi32(xy,rs);
+		const __m128i quads[4] = {_mm_unpacklo_epi64(q01,q01),_mm_unpackhi_epi64(q01,q01),_mm_unpacklo_epi64(q23,q23),_mm_unpackhi_epi64(q23,q23)};
+
+		for( int q = 0 ; q < 4 ; q++ )
+		{
+			__m128i* dst = (__m128i*)rOut[n + q].trans;
+			_mm_storeu_si128(dst,quads[q]);
+			_mm_storeu_si128(dst + 1,quads[q]);
+		}
+	}
+#elif defined(__ARM_NEON)
+	const float32x4_t rotScale = vdupq_n_f32(radianToTurns);
+	const float32x4_t turnScale = vdupq_n_f32(turnToShort);
+	const float32x4_t fractionLimit = vdupq_n_f32(noFraction);
+	for( ; n + 4 <= pCount ; n += 4 )
+	{
+		const int16x4_t x = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(pX + n)));
+		const int16x4_t y = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(pY + n)));
+		const int16x4_t s = vqmovn_s32(vcvtq_s32_f32(vld1q_f32(pSize + n)));
+		const float32x4_t turns = vmulq_f32(vld1q_f32(pRotation + n),rotScale);
+		const uint32x4_t hasFraction = vcltq_f32(vabsq_f32(turns),fractionLimit);
+		const float32x4_t fraction = vsubq_f32(turns,vcvtq_f32_s32(vcvtq_s32_f32(turns)));
+		const float32x4_t wrapped = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(fraction),hasFraction));
+		const int16x4_t r = vmovn_s32(vcvtq_s32_f32(vmulq_f32(wrapped,turnScale)));
+
+		// Interleave so each 64 bits is the x,y,r,s of one quad.
+		const int16x4x2_t xy = vzip_s16(x,y);
+		const int16x4x2_t rs = vzip_s16(r,s);
+		const int32x2x2_t q01 = vzip_s32(vreinterpret_s32_s16(xy.val[0]),vreinterpret_s32_s16(rs.val[0]));
+		const int32x2x2_t q23 = vzip_s32(vreinterpret_s32_s16(xy.val[1]),vreinterpret_s32_s16(rs.val[1]));
+		const int32x2_t quads[4] = {q01.val[0],q01.val[1],q23.val[0],q23.val[1]};
+
+		for( int q = 0 ; q < 4 ; q++ )
+		{
+			const int16x8_t two = vreinterpretq_s16_s32(vcombine_s32(quads[q],quads[q]));
+			int16_t* dst = &rOut[n + q].trans[0].x;
+			vst1q_s16(dst,two);
+			vst1q_s16(dst + 8,two);
+		}
+	}
+#endif
+
+	auto clamp16 = [](float pValue)
+	{
+		return (int16_t)std::clamp(pValue,-32768.0f,32767.0f);
+	};
+
+	for( ; n < pCount ; n++ )
+	{
+		const int16_t x = clamp16(pX[n]);
+		const int16_t y = clamp16(pY[n]);
+		const float turns = pRotation[n] * radianToTurns;
+		const float fraction = std::fabs(turns) < noFraction ? turns - std::trunc(turns) : 0.0f;
+		const int16_t r = (int16_t)(fraction * turnToShort);
+		const int16_t s = clamp16(pSize[n]);
+		for( auto& t : rOut[n].trans )
+		{
+			t.x = x;
+			t.y = y;
+			t.r = r;
+			t.s = s;
+		}
+	}
+}
+
+/**
+ * @brief A range of quads whose data has changed since it was last sent to the GPU.
+ */
+struct DirtyRange
+{
+	size_t from = 0;
+	size_t to = 0;
+
+	inline bool Get()const{return to > from;}
+	inline void Clear(){from = to = 0;}
+
+	void Set(size_t pFromIndex,size_t pToIndex)
+	{
+		if( pFromIndex >= pToIndex )
+		{
+			return;
+		}
+
+		if( Get() )
+		{
+			from = std::min(from,pFromIndex);
+			to = std::max(to,pToIndex);
+		}
+		else
+		{
+			from = pFromIndex;
+			to = pToIndex;
+		}
+	}
+};
+
+/**
+ * @brief Represents a large number of quads, handy when you want to render many at once. Like particles.
+ * The application sees the data per vertex, four copies per quad. When the driver has instancing the GPU copy is one per quad.
+ */
+struct QuadBatch
+{
+	// What is sent per quad when instancing.
+	typedef std::array<int16_t,4> InstanceUV;			//!< Top left and bottom right of the uvs, the shader picks the corner.
+	typedef std::array<int16_t,4> InstanceTransform;
+	typedef std::array<uint8_t,4> InstanceColour;
+
+	const uint32_t mNumQuads;
+	uint32_t mTexture;
+	const int mTextureWidth;
+	const int mTextureHeight;
+	GLStateCache& mStateCache;
+	const bool mInstanced;
+
+	std::vector<Quad2D> mUVs;
+	std::vector<QuadBatchTransform> mTransforms;
+	std::vector<QuadBatchColour> mColours;	//!< Empty until the application asks for per quad colour, until then all quads are white.
+	std::vector<Quad2D> mFrames;			//!< The uvs of the frames a quad can show. Frame zero is the one the batch was created with.
+
+	GLuint mBuffer = 0;				//!< GPU copy of the uvs, transforms and, if used, colours. One after the other.
+	DirtyRange mDirtyUVs;
+	DirtyRange mDirtyTransforms;
+	DirtyRange mDirtyColours;
+	uint32_t mDrawnFrame = 0;		//!< The frame the batch was last drawn in, used when deferred rendering is on.
+	int mFrameOffsetX = 0;			//!< Added to the rectangles passed to AddFrame, when made from an image in an atlas it's where the image is in the page.
+	int mFrameOffsetY = 0;
+	std::vector<uint8_t> mStaging;	//!< When instancing, where the one per quad data is gathered before it's sent.
+
+	inline size_t GetNumQuads()const{return mNumQuads;}
+	inline bool GetIsDirty()const{return mDirtyUVs.Get() || mDirtyTransforms.Get() || mDirtyColours.Get();}
+	inline bool GetHasColours()const{return mColours.size() > 0;}
+	inline size_t GetUVStride()const{return mInstanced ? sizeof(InstanceUV) : sizeof(Quad2D);}
+	inline size_t GetTransformStride()const{return mInstanced ? sizeof(InstanceTransform) : sizeof(QuadBatchTransform);}
+	inline size_t GetColourStride()const{return mInstanced ? sizeof(InstanceColour) : sizeof(QuadBatchColour);}
+	inline size_t GetTransformsOffset()const{return mNumQuads * GetUVStride();}
+	inline size_t GetColoursOffset()const{return GetTransformsOffset() + (mNumQuads * GetTransformStride());}
+
+	QuadBatch(GLStateCache& rStateCache,int pCount,uint32_t pTexture,int pTextureWidth,int pTextureHeight,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY) :
+		mNumQuads(pCount),
+		mTexture(pTexture),
+		mTextureWidth(pTextureWidth),
+		mTextureHeight(pTextureHeight),
+		mStateCache(rStateCache),
+		mInstanced(rStateCache.GetHasInstancing())
+	{
+		mTransforms.resize(pCount);
+		AddFrame(pTexFromX,pTexFromY,pTexToX,pTexToY);
+		mUVs.resize(pCount,mFrames[0]);
+
+		glGenBuffers(1,&mBuffer);
+		AllocateBuffer();
+	}
+
+	~QuadBatch()
+	{
+		mStateCache.OnBufferDeleted(mBuffer);
+		glDeleteBuffers(1,&mBuffer);
+	}
+
+	inline void SetFrameOffset(int pX,int pY){mFrameOffsetX = pX;mFrameOffsetY = pY;}
+
+	/**
+	 * @brief Adds a rectangle of the texture as a frame quads can be set to show, returns it's index.
+	 */
+	size_t AddFrame(int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+	{
+		auto scaleUV = [](int pSize,int pCoord)
+		{
+			return (0x7fff * pCoord) / pSize;
+		};
+
+		Quad2D uv;
+		uv.v[0].x = scaleUV(mTextureWidth,pTexFromX);
+		uv.v[0].y = scaleUV(mTextureHeight,pTexFromY);
+		uv.v[1].x = scaleUV(mTextureWidth,pTexToX);
+		uv.v[1].y = scaleUV(mTextureHeight,pTexFromY);
+		uv.v[2].x = scaleUV(mTextureWidth,pTexToX);
+		uv.v[2].y = scaleUV(mTextureHeight,pTexToY);
+		uv.v[3].x = scaleUV(mTextureWidth,pTexFromX);
+		uv.v[3].y = scaleUV(mTextureHeight,pTexToY);
+
+		mFrames.emplace_back(uv);
+		return mFrames.size() - 1;
+	}
+
+	/**
+	 * @brief The first time colours are asked for we make room for them in the GPU buffer.
+	 */
+	void EnableColours()
+	{
+		if( GetHasColours() == false )
+		{
+			mColours.resize(mNumQuads);
+			AllocateBuffer();
+		}
+	}
+
+	/**
+	 * @brief Creates the GPU memory, everything will be sent on the next draw.
+	 */
+	void AllocateBuffer()
+	{
+		mStateCache.BindBuffer(GL_ARRAY_BUFFER,mBuffer);
+		glBufferData(GL_ARRAY_BUFFER,GetColoursOffset() + (mColours.size() * GetColourStride()),nullptr,GL_DYNAMIC_DRAW);
+		CHECK_OGL_ERRORS();
+
+		mDirtyUVs.Set(0,mNumQuads);
+		mDirtyTransforms.Set(0,mNumQuads);
+		mDirtyColours.Set(0,mColours.size());
+	}
+
+	/**
+	 * @brief Sends the data that has changed to the GPU.
+	 */
+	void Upload()
+	{
+		Upload(mDirtyUVs,0,mUVs.data(),[](const Quad2D& pUV)
+		{
+			return InstanceUV{pUV.v[0].x,pUV.v[0].y,pUV.v[2].x,pUV.v[2].y};
+		});
+
+		Upload(mDirtyTransforms,GetTransformsOffset(),mTransforms.data(),[](const QuadBatchTransform& pTransform)
+		{
+			const auto& t = pTransform.trans[0];
+			return InstanceTransform{t.x,t.y,t.r,t.s};
+		});
+
+		Upload(mDirtyColours,GetColoursOffset(),mColours.data(),[](const QuadBatchColour& pColour)
+		{
+			const auto& c = pColour.col[0];
+			return InstanceColour{c.r,c.g,c.b,c.a};
+		});
+	}
+
+private:
+	/**
+	 * @brief Sends the dirty range of the stream. When instancing each quad is reduced to the one value the GPU needs with pGetInstance.
+	 */
+	template<typename STREAM_TYPE,typename GET_INSTANCE> void Upload(DirtyRange& rDirty,size_t pOffset,const STREAM_TYPE* pData,GET_INSTANCE pGetInstance)
+	{
+		if( rDirty.Get() == false )
+		{
+			return;
+		}
+
+		const size_t count = rDirty.to - rDirty.from;
+		mStateCache.BindBuffer(GL_ARRAY_BUFFER,mBuffer);
+		if( mInstanced )
+		{
+			typedef decltype(pGetInstance(*pData)) INSTANCE_TYPE;
+			mStaging.resize(count * sizeof(INSTANCE_TYPE));
+			INSTANCE_TYPE* instances = (INSTANCE_TYPE*)mStaging.data();
+			for( size_t n = 0 ; n < count ; n++ )
+			{
+				instances[n] = pGetInstance(pData[rDirty.from + n]);
+			}
+			glBufferSubData(GL_ARRAY_BUFFER,pOffset + (rDirty.from * sizeof(INSTANCE_TYPE)),count * sizeof(INSTANCE_TYPE),instances);
+			mStateCache.mBytesUploaded += count * sizeof(INSTANCE_TYPE);
+		}
+		else
+		{
+			glBufferSubData(GL_ARRAY_BUFFER,pOffset + (rDirty.from * sizeof(STREAM_TYPE)),count * sizeof(STREAM_TYPE),pData + rDirty.from);
+			mStateCache.mBytesUploaded += count * sizeof(STREAM_TYPE);
+		}
+		CHECK_OGL_ERRORS();
+		rDirty.Clear();
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// scratch memory buffer utility
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+template<typename SCRATCH_MEMORY_TYPE,int START_TYPE_COUNT,int GROWN_TYPE_COUNT,int MAXIMUN_GROWN_COUNT> struct ScratchBuffer
+{
+	ScratchBuffer():mMemory(new SCRATCH_MEMORY_TYPE[START_TYPE_COUNT]),mCount(START_TYPE_COUNT),mNextIndex(0){}
+	~ScratchBuffer(){delete []mMemory;}
+	
+	/**
+	 * @brief Start filling your data from the start of the buffer, overwriting what maybe there. This is the core speed up we get.
+	 */
+	void Restart(){mNextIndex = 0;}
+
+	/**
+	 * @brief For when you know in advance how much space you need.
+	 */
+	SCRATCH_MEMORY_TYPE* Restart(size_t pCount)
+	{
+		mNextIndex = 0;
+		return Next(pCount);
+	}
+
+	/**
+	 * @brief Return enough memory to put the next N items into, you can only safety write the number of items requested.
+	 */
+	SCRATCH_MEMORY_TYPE* Next(size_t pCount = 1)
+	{
+		EnsureSpace(pCount);
+		SCRATCH_MEMORY_TYPE* next = mMemory + mNextIndex;
+		mNextIndex += pCount;
+		return next;
+	}
+
+	/**
+	 * @brief How many items have been written since Restart was called.
+	 */
+	const size_t Used()const{return mNextIndex;}
+
+	/**
+	 * @brief Diagnostics tool, how many bytes we're using.
+	 */
+	const size_t MemoryUsed()const{return mCount * sizeof(SCRATCH_MEMORY_TYPE);}
+
+	/**
+	 * @brief The root of our memory, handy for when you've finished filling the buffer and need to now do work with it.
+	 * You should fetch this memory pointer AFTER you have done your work as it may change as you fill the data.
+	 */
+	const SCRATCH_MEMORY_TYPE* Data()const{return mMemory;}
+
+private:
+	SCRATCH_MEMORY_TYPE* mMemory; //<! Our memory, only reallocated when it's too small. That is the speed win!
+	size_t mCount; //<! How many there are available to write too.
+	size_t mNextIndex; //<! Where we can write to next.
+
+	/**
+	 * @brief Makes sure we always have space.
+	 */
+	void EnsureSpace(size_t pExtraSpaceNeeded)
+	{
+		if( pExtraSpaceNeeded > MAXIMUN_GROWN_COUNT )
+		{
+			throw std::runtime_error("Scratch memory type tried to grow too large in one go, you may have a memory bug. Tried to add " + std::to_string(pExtraSpaceNeeded) + " items");
+		}
+
+		if( (mNextIndex + pExtraSpaceNeeded) >= mCount )
+		{
+			const size_t newCount = mCount + pExtraSpaceNeeded + GROWN_TYPE_COUNT;
+			SCRATCH_MEMORY_TYPE* newMemory = new SCRATCH_MEMORY_TYPE[newCount];
+			std::memmove(newMemory,mMemory,mCount * sizeof(SCRATCH_MEMORY_TYPE));
+			delete []mMemory;
+			mMemory = newMemory;
+			mCount = newCount;
+		}
+	}
+};
+
+/**
+ * @brief Simple utility for building quads on the fly.
+ */
+struct Vert2DShortScratchBuffer : public ScratchBuffer<VertShortXY,256,64,1024>
+{
+	/**
+	 * @brief Writes six vertices to the buffer.
+	 */
+	inline void BuildQuad(int pX,int pY,int pWidth,int pHeight)
+	{
+		VertShortXY* verts = Next(6);
+		verts[0].x = pX;			verts[0].y = pY;
+		verts[1].x = pX + pWidth;	verts[1].y = pY;
+		verts[2].x = pX + pWidth;	verts[2].y = pY + pHeight;
+
+		verts[3].x = pX;			verts[3].y = pY;
+		verts[4].x = pX + pWidth;	verts[4].y = pY + pHeight;
+		verts[5].x = pX;			verts[5].y = pY + pHeight;
+	}
+
+	/**
+	 * @brief Writes the UV's to six vertices in the correct order to match the quad built above.
+	 */
+	inline void AddUVRect(int U0,int V0,int U1,int V1)
+	{
+		VertShortXY* verts = Next(6);
+		verts[0].x = U0;	verts[0].y = V0;
+		verts[1].x = U1;	verts[1].y = V0;
+		verts[2].x = U1;	verts[2].y = V1;
+
+		verts[3].x = U0;	verts[3].y = V0;
+		verts[4].x = U1;	verts[4].y = V1;
+		verts[5].x = U0;	verts[5].y = V1;
+	}
+
+	/**
+	 * @brief Adds a number of quads to the buffer, moving STEP for each one.
+	 */
+	inline void BuildQuads(int pX,int pY,int pWidth,int pHeight,int pCount,int pXStep,int pYStep)
+	{
+		for(int n = 0 ; n < pCount ; n++, pX += pXStep, pY += pYStep )
+		{
+			BuildQuad(pX,pY,pWidth,pHeight);
+		}
+	}
+};
+
+struct WorkBuffers
+{
+	ScratchBuffer<uint8_t,128,16,512*512*4> scratchRam;// gets used for some temporary texture operations.
+	ScratchBuffer<Vert2Df,128,16,128> vertices2Df;
+	Vert2DShortScratchBuffer vertices2DShort;
+	Vert2DShortScratchBuffer uvShort;
+	ScratchBuffer<uint16_t,16,0,4096*4096> pixels16;// Pixels converted to a 16 bit texture format before they are uploaded.
+};
+
+// End of scratch memory buffer utility
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief Mainly for debugging, returns a string representation of the enum.
+ */
+constexpr std::string_view TextureFormatToString(TextureFormat pFormat)
+{
+	switch( pFormat )
+	{
+	case TextureFormat::FORMAT_RGBA:
+		return "FORMAT_RGBA";
+		
+	case TextureFormat::FORMAT_RGB:
+		return "FORMAT_RGB";
+
+	case TextureFormat::FORMAT_ALPHA:
+		return "FORMAT_ALPHA";
+
+	case TextureFormat::FORMAT_ETC1:
+		return "FORMAT_ETC1";
+
+	case TextureFormat::FORMAT_ETC2_RGB:
+		return "FORMAT_ETC2_RGB";
+
+	case TextureFormat::FORMAT_ETC2_RGBA:
+		return "FORMAT_ETC2_RGBA";
+
+	case TextureFormat::FORMAT_RGB565:
+		return "FORMAT_RGB565";
+
+	case TextureFormat::FORMAT_RGBA4444:
+		return "FORMAT_RGBA4444";
+
+	case TextureFormat::FORMAT_RGBA5551:
+		return "FORMAT_RGBA5551";
+
+	case TextureFormat::FORMAT_16BIT_AUTO:
+		return "FORMAT_16BIT_AUTO";
+	}
+	return "Invalid TextureFormat";
+}
+ 
+constexpr GLint TextureFormatToGLFormat(TextureFormat pFormat)
+{
+	switch( pFormat )
+	{
+	case TextureFormat::FORMAT_RGB:
+		return GL_RGB;
+
+	case TextureFormat::FORMAT_RGBA:
+		return GL_RGBA;
+
+	case TextureFormat::FORMAT_ALPHA:
+		return GL_ALPHA; // This is mainly used for the fonts.
+
+	case TextureFormat::FORMAT_ETC1:
+		return GL_ETC1_RGB8_OES;
+
+	case TextureFormat::FORMAT_ETC2_RGB:
+		return GL_COMPRESSED_RGB8_ETC2;
+
+	case TextureFormat::FORMAT_ETC2_RGBA:
+		return GL_COMPRESSED_RGBA8_ETC2_EAC;
+
+	case TextureFormat::FORMAT_RGB565:
+		return GL_RGB;
+
+	case TextureFormat::FORMAT_RGBA4444:
+	case TextureFormat::FORMAT_RGBA5551:
+		return GL_RGBA;
+
+	case TextureFormat::FORMAT_16BIT_AUTO:
+		break;// Has to be turned into one of the above first.
+	}
+	return GL_INVALID_ENUM;
+}
+
+constexpr bool GetIsCompressedFormat(TextureFormat pFormat)
+{
+	return pFormat == TextureFormat::FORMAT_ETC1 || pFormat == TextureFormat::FORMAT_ETC2_RGB || pFormat == TextureFormat::FORMAT_ETC2_RGBA;
+}
+
+/**
+ * @brief The number of bytes of a compressed image. All the ETC formats use 4x4 blocks, 8 bytes for RGB and 16 for RGBA.
+ */
+constexpr size_t GetCompressedImageSize(TextureFormat pFormat,int pWidth,int pHeight)
+{
+	const size_t blocks = (size_t)((pWidth + 3) / 4) * (size_t)((pHeight + 3) / 4);
+	return blocks * (pFormat == TextureFormat::FORMAT_ETC2_RGBA ? 16 : 8);
+}
+
+constexpr GLenum TextureFormatToGLType(TextureFormat pFormat)
+{
+	switch( pFormat )
+	{
+	case TextureFormat::FORMAT_RGB565:
+		return GL_UNSIGNED_SHORT_5_6_5;
+
+	case TextureFormat::FORMAT_RGBA4444:
+		return GL_UNSIGNED_SHORT_4_4_4_4;
+
+	case TextureFormat::FORMAT_RGBA5551:
+		return GL_UNSIGNED_SHORT_5_5_5_1;
+
+	default:
+		break;
+	}
+	return GL_UNSIGNED_BYTE;
+}
+
+constexpr bool GetIs16BitFormat(TextureFormat pFormat)
+{
+	return pFormat == TextureFormat::FORMAT_RGB565 || pFormat == TextureFormat::FORMAT_RGBA4444 || pFormat == TextureFormat::FORMAT_RGBA5551;
+}
+
+/**
+ * @brief Picks the 16 bit format for FORMAT_16BIT_AUTO. 565 when all the pixels are solid, 5551 when alpha is only on or off, else 4444.
+ */
+static TextureFormat Choose16BitFormat(const uint8_t* pRGBA,size_t pNumPixels)
+{
+	bool solid = true;
+	for( size_t n = 0 ; n < pNumPixels ; n++ )
+	{
+		const uint8_t a = pRGBA[(n * 4) + 3];
+		if( a != 255 )
+		{
+			if( a != 0 )
+			{
+				return TextureFormat::FORMAT_RGBA4444;
+			}
+			solid = false;
+		}
+	}
+	return solid ? TextureFormat::FORMAT_RGB565 : TextureFormat::FORMAT_RGBA5551;
+}
+
+/**
+ * @brief Packs one pixel, R in the bottom byte A in the top, in to the 16 bit format.
+ */
+template<TextureFormat FORMAT> inline uint16_t PackPixel16(uint32_t pRGBA)
+{
+	if constexpr( FORMAT == TextureFormat::FORMAT_RGB565 )
+	{
+		return ((pRGBA & 0xf8) << 8) | ((pRGBA >> 5) & 0x7e0) | ((pRGBA >> 19) & 0x1f);
+	}
+	else if constexpr( FORMAT == TextureFormat::FORMAT_RGBA4444 )
+	{
+		return ((pRGBA & 0xf0) << 8) | ((pRGBA >> 4) & 0xf00) | ((pRGBA >> 16) & 0xf0) | (pRGBA >> 28);
+	}
+	else
+	{
+		return ((pRGBA & 0xf8) << 8) | ((pRGBA >> 5) & 0x7c0) | ((pRGBA >> 18) & 0x3e) | (pRGBA >> 31);
+	}
+}
+
+#if defined(__SSE2__)
+/**
+ * @brief Same as PackPixel16 for four pixels, result is in the bottom 16 bits of each 32 bit lane.
+ */
+template<TextureFormat FORMAT> inline __m128i PackPixels16(__m128i pRGBA)
+{
+	auto field = [pRGBA](int pShift,uint32_t pMask)
+	{
+		const __m128i v = pShift > 0 ? _mm_slli_epi32(pRGBA,pShift) : _mm_srli_epi32(pRGBA,-pShift);
+		return _mm_and_si128(v,_mm_set1_epi32(pMask));
+	};
+
+	if constexpr( FORMAT == TextureFormat::FORMAT_RGB565 )
+	{
+		return _mm_or_si128(_mm_or_si128(field(8,0xf800),field(-5,0x7e0)),field(-19,0x1f));
+	}
+	else if constexpr( FORMAT == TextureFormat::FORMAT_RGBA4444 )
+	{
+		return _mm_or_si128(_mm_or_si128(field(8,0xf000),field(-4,0xf00)),_mm_or_si128(field(-16,0xf0),field(-28,0xf)));
+	}
+	else
+	{
+		return _mm_or_si128(_mm_or_si128(field(8,0xf800),field(-5,0x7c0)),_mm_or_si128(field(-18,0x3e),field(-31,0x1)));
+	}
+}
+#elif defined(__ARM_NEON)
+template<TextureFormat FORMAT> inline uint16x4_t PackPixels16(uint32x4_t pRGBA)
+{
+	if constexpr( FORMAT == TextureFormat::FORMAT_RGB565 )
+	{
+		const uint32x4_t r = vandq_u32(vshlq_n_u32(pRGBA,8),vdupq_n_u32(0xf800));
+		const uint32x4_t g = vandq_u32(vshrq_n_u32(pRGBA,5),vdupq_n_u32(0x7e0));
+		const uint32x4_t b = vandq_u32(vshrq_n_u32(pRGBA,19),vdupq_n_u32(0x1f));
+		return vmovn_u32(vorrq_u32(vorrq_u32(r,g),b));
+	}
+	else if constexpr( FORMAT == TextureFormat::FORMAT_RGBA4444 )
+	{
+		const uint32x4_t r = vandq_u32(vshlq_n_u32(pRGBA,8),vdupq_n_u32(0xf000));
+		const uint32x4_t g = vandq_u32(vshrq_n_u32(pRGBA,4),vdupq_n_u32(0xf00));
+		const uint32x4_t b = vandq_u32(vshrq_n_u32(pRGBA,16),vdupq_n_u32(0xf0));
+		const uint32x4_t a = vshrq_n_u32(pRGBA,28);
+		return vmovn_u32(vorrq_u32(vorrq_u32(r,g),vorrq_u32(b,a)));
+	}
+	else
+	{
+		const uint32x4_t r = vandq_u32(vshlq_n_u32(pRGBA,8),vdupq_n_u32(0xf800));
+		const uint32x4_t g = vandq_u32(vshrq_n_u32(pRGBA,5),vdupq_n_u32(0x7c0));
+		const uint32x4_t b = vandq_u32(vshrq_n_u32(pRGBA,18),vdupq_n_u32(0x3e));
+		const uint32x4_t a = vshrq_n_u32(pRGBA,31);
+		return vmovn_u32(vorrq_u32(vorrq_u32(r,g),vorrq_u32(b,a)));
+	}
+}
+#endif
+
+/**
+ * @brief Converts a row of RGB or RGBA pixels to the 16 bit format.
+ * pDither is added to the four pixels at x%4 == 0,1,2,3, with saturation, before the low bits are dropped. All zero for no dither.
+ * RGBA rows are done four or eight pixels at a time with SSE2 or NEON, RGB rows with NEON for 565 as it can load three channels apart.
+ */
+template<TextureFormat FORMAT> static void ConvertRowTo16Bit(const uint8_t* pSrc,int pSrcBytesPerPixel,uint16_t* rDst,int pWidth,const uint8_t pDither[16])
+{
+	int x = 0;
+	if( pSrcBytesPerPixel == 4 )
+	{
+#if defined(__SSE2__)
+		const __m128i dither = _mm_loadu_si128((const __m128i*)pDither);
+		for( ; x + 8 <= pWidth ; x += 8 )
+		{
+			const __m128i a = PackPixels16<FORMAT>(_mm_adds_epu8(_mm_loadu_si128((const __m128i*)(pSrc + (x * 4))),dither));
+			const __m128i b = PackPixels16<FORMAT>(_mm_adds_epu8(_mm_loadu_si128((const __m128i*)(pSrc + (x * 4) + 16)),dither));
+			// Sign extend so the signed pack does not clamp the values with the top bit set.
+			const __m128i packed = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a,16),16),_mm_srai_epi32(_mm_slli_epi32(b,16),16));
+			_mm_storeu_si128((__m128i*)(rDst + x),packed);
+		}
+#elif defined(__ARM_NEON)
+		const uint8x16_t dither = vld1q_u8(pDither);
+		for( ; x + 8 <= pWidth ; x += 8 )
+		{
+			const uint16x4_t a = PackPixels16<FORMAT>(vreinterpretq_u32_u8(vqaddq_u8(vld1q_u8(pSrc + (x * 4)),dither)));
+			const uint16x4_t b = PackPixels16<FORMAT>(vreinterpretq_u32_u8(vqaddq_u8(vld1q_u8(pSrc + (x * 4) + 16),dither)));
+			vst1q_u16(rDst + x,vcombine_u16(a,b));
+		}
+#endif
+	}
+#if defined(__ARM_NEON)
+	else if constexpr( FORMAT == TextureFormat::FORMAT_RGB565 )
+	{
+		const uint8_t r[8] = {pDither[0],pDither[4],pDither[8],pDither[12],pDither[0],pDither[4],pDither[8],pDither[12]};
+		const uint8_t g[8] = {pDither[1],pDither[5],pDither[9],pDither[13],pDither[1],pDither[5],pDither[9],pDither[13]};
+		const uint8_t b[8] = {pDither[2],pDither[6],pDither[10],pDither[14],pDither[2],pDither[6],pDither[10],pDither[14]};
+		const uint8x8_t ditherR = vld1_u8(r),ditherG = vld1_u8(g),ditherB = vld1_u8(b);
+		for( ; x + 8 <= pWidth ; x += 8 )
+		{
+			const uint8x8x3_t rgb = vld3_u8(pSrc + (x * 3));
+			const uint16x8_t red = vandq_u16(vshll_n_u8(vqadd_u8(rgb.val[0],ditherR),8),vdupq_n_u16(0xf800));
+			const uint16x8_t green = vandq_u16(vshll_n_u8(vqadd_u8(rgb.val[1],ditherG),3),vdupq_n_u16(0x7e0));
+			const uint16x8_t blue = vshrq_n_u16(vmovl_u8(vqadd_u8(rgb.val[2],ditherB)),3);
+			vst1q_u16(rDst + x,vorrq_u16(vorrq_u16(red,green),blue));
+		}
+	}
+#endif
+
+	for( ; x < pWidth ; x++ )
+	{
+		const uint8_t* s = pSrc + (x * pSrcBytesPerPixel);
+		const uint8_t* d = pDither + ((x & 3) * 4);
+		uint32_t rgba = pSrcBytesPerPixel == 4 ? 0 : 0xff000000;
+		for( int c = 0 ; c < pSrcBytesPerPixel ; c++ )
+		{
+			rgba |= (uint32_t)std::min(s[c] + d[c],255) << (c * 8);
+		}
+		rDst[x] = PackPixel16<FORMAT>(rgba);
+	}
+}
+
+/**
+ * @brief Converts RGB (for 565) or RGBA pixels to the 16 bit format, optionally with a 4x4 ordered dither to hide the banding.
+ */
+static void ConvertTo16Bit(TextureFormat pFormat,const uint8_t* pSrc,int pSrcBytesPerPixel,int pWidth,int pHeight,uint16_t* rDst,bool pDither)
+{
+	static const uint8_t bayer[4][4] = {{0,8,2,10},{12,4,14,6},{3,11,1,9},{15,7,13,5}};
+
+	// The bits each colour channel keeps, the dither is scaled to be less than one step of it. Alpha is not dithered, it would make edges noisy.
+	int bits[3] = {5,6,5};
+	if( pFormat == TextureFormat::FORMAT_RGBA4444 )
+	{
+		bits[0] = bits[1] = bits[2] = 4;
+	}
+	else if( pFormat == TextureFormat::FORMAT_RGBA5551 )
+	{
+		bits[1] = 5;
+	}
+
+	for( int y = 0 ; y < pHeight ; y++ )
+	{
+		uint8_t dither[16] = {0};
+		if( pDither )
+		{
+			for( int x = 0 ; x < 4 ; x++ )
+			{
+				for( int c = 0 ; c < 3 ; c++ )
+				{
+					dither[(x * 4) + c] = (bayer[y & 3][x] << (8 - bits[c])) >> 4;
+				}
+			}
+		}
+
+		const uint8_t* src = pSrc + ((size_t)y * pWidth * pSrcBytesPerPixel);
+		uint16_t* dst = rDst + ((size_t)y * pWidth);
+		switch( pFormat )
+		{
+		case TextureFormat::FORMAT_RGB565:
+			ConvertRowTo16Bit<TextureFormat::FORMAT_RGB565>(src,pSrcBytesPerPixel,dst,pWidth,dither);
+			break;
+
+		case TextureFormat::FORMAT_RGBA4444:
+			ConvertRowTo16Bit<TextureFormat::FORMAT_RGBA4444>(src,pSrcBytesPerPixel,dst,pWidth,dither);
+			break;
+
+		default:
+			ConvertRowTo16Bit<TextureFormat::FORMAT_RGBA5551>(src,pSrcBytesPerPixel,dst,pWidth,dither);
+			break;
+		}
+	}
+}
+
+constexpr int TextureFormatToBytesPerPixel(TextureFormat pFormat)
+{
+	switch( pFormat )
+	{
+	case TextureFormat::FORMAT_RGB:
+		return 3;
+
+	case TextureFormat::FORMAT_RGBA:
+		return 4;
+
+	case TextureFormat::FORMAT_ALPHA:
+		return 1;
+
+	// The size of the pixels they are made from.
+	case TextureFormat::FORMAT_RGB565:
+		return 3;
+
+	case TextureFormat::FORMAT_RGBA4444:
+	case TextureFormat::FORMAT_RGBA5551:
+		return 4;
+
+	default:// Compressed and auto formats don't have a size per pixel.
+		break;
+	}
+	return 0;
+}
+
+/**
+ * @brief The GPU memory a texture uses, what the driver really uses may be a bit more as it can pad rows and RGB to RGBA.
+ */
+static size_t GetTextureBytes(TextureFormat pFormat,int pWidth,int pHeight,bool pMipmaps)
+{
+	size_t bytes = 0;
+	do
+	{
+		if( GetIsCompressedFormat(pFormat) )
+		{
+			bytes += GetCompressedImageSize(pFormat,pWidth,pHeight);
+		}
+		else
+		{
+			bytes += (size_t)pWidth * pHeight * (GetIs16BitFormat(pFormat) ? 2 : TextureFormatToBytesPerPixel(pFormat));
+		}
+
+		if( pWidth == 1 && pHeight == 1 )
+		{
+			break;
+		}
+		pWidth = std::max(pWidth / 2,1);
+		pHeight = std::max(pHeight / 2,1);
+	}while( pMipmaps );
+	return bytes;
+}
+
+#ifdef USE_FREETYPEFONTS
+/**
+ * @brief Optional freetype font library support. Is optional as the code is dependant on a library tha may not be avalibel for the host platform.
+ * One note, I don't do localisation. ASCII here. If you need all the characters then maybe add yourself or use a commercial grade GL engine. :) localisation is a BIG job!
+ * Rendering is done in the GL code, this class is more of just a container.
+ */
+struct FreeTypeFont
+{
+	/**
+	 * @brief An entry into the glyph cache
+	 */
+	struct Glyph
+	{
+		int width;
+		int height;
+		int pitch;
+		int advance;
+		int x_off,y_off;	//!< offset from current x and y that the quad is rendered.
+		struct
+		{// Where, in 16bit UV's, the glyph is.
+			int x,y;
+		}uv[2];
+	};
+
+	FreeTypeFont(FT_Face pFontFace,int pPixelHeight);
+	~FreeTypeFont();
+
+	/**
+	 * @brief Get the Glyph object of an ASCII character. All that is needed to render as well as build the texture.
+	 */
+	bool GetGlyph(FT_UInt pChar,FreeTypeFont::Glyph& rGlyph,std::vector<uint8_t>& rPixels);
+
+	/**
+	 * @brief Builds our texture object.
+	 */
+	void BuildTexture(
+			int pMaximumAllowedGlyph,
+			std::function<uint32_t(int pWidth,int pHeight)> pCreateTexture,
+			std::function<void(uint32_t pTexture,int pX,int pY,int pWidth,int pHeight,const uint8_t* pPixels)> pFillTexture);
+
+	const std::string mFontName; //<! Helps with debugging.
+	FT_Face mFace;								//<! The font we are rending from.
+	uint32_t mTexture;							//<! This is the texture that the glyphs are in so we can render using GL and quads.
+	std::array<FreeTypeFont::Glyph,96>mGlyphs;	//<! Meta data needed to render the characters.
+	int mBaselineHeight;						//<! This is the number of pixels above baseline the higest character is. Used for centering a font in the y.
+	int mSpaceAdvance;							//<! How much to advance by for a non rerendered character.
+
+	struct
+	{
+		uint8_t R = 255;
+		uint8_t G = 255;
+		uint8_t B = 255;
+		uint8_t A = 255;
+	}mColour;	
+
+};
+
+/**
+ * @brief Because this is a very simple font system I have a limited number of characters I can render. This allows me to use the ones I expect to be most useful.
+ */
+static std::array<int,256>GlyphIndex;
+static bool BuildGlyphIndex = true;
+
+inline int GetGlyphIndex(FT_UInt pCharacter)
+{
+	return GlyphIndex[pCharacter];
+}
 
 inline FT_UInt GetNextGlyph(const char *& pText)
 {
-	if( pText == 0 )
-		return 0;
+	if( pText == 0 )
+		return 0;
+
+	const FT_UInt c1 = *pText;
+	pText++;
+
+	if( (c1&0x80) == 0 )
+	{
+		return c1;
+	}
+
+	const FT_UInt c2 = *pText;
+	pText++;
+
+	return ((c1&0x3f) << 6) | (c2&0x3f);
+}
+
+#endif // #ifdef USE_FREETYPEFONTS
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Some basic matrix operations
+static const double PI = 3.141592654;
+static const double DEGTORAD = (PI / 180.0);
+
+void Matrix::SetIdentity()
+{
+	m[0][0] = 1.0f;
+	m[0][1] = 0.0f;
+	m[0][2] = 0.0f;
+	m[0][3] = 0.0f;
+
+	m[1][0] = 0.0f;
+	m[1][1] = 1.0f;
+	m[1][2] = 0.0f;
+	m[1][3] = 0.0f;
+
+	m[2][0] = 0.0f;
+	m[2][1] = 0.0f;
+	m[2][2] = 1.0f;
+	m[2][3] = 0.0f;
+
+	m[3][0] = 0.0f;
+	m[3][1] = 0.0f;
+	m[3][2] = 0.0f;
+	m[3][3] = 1.0f;
+}
+
+void Matrix::SetTranslation(float pX,float pY,float pZ)
+{
+	m[0][0] = 1.0f;
+	m[0][1] = 0.0f;
+	m[0][2] = 0.0f;
+	m[0][3] = 0.0f;
+
+	m[1][0] = 0.0f;
+	m[1][1] = 1.0f;
+	m[1][2] = 0.0f;
+	m[1][3] = 0.0f;
+
+	m[2][0] = 0.0f;
+	m[2][1] = 0.0f;
+	m[2][2] = 1.0f;
+	m[2][3] = 0.0f;
+
+	m[3][0] = pX;
+	m[3][1] = pY;
+	m[3][2] = pZ;
+	m[3][3] = 1.0f;
+}
+
+void Matrix::SetRotationX(float pPitch)
+{
+	float sinX = std::sin(pPitch * DEGTORAD);
+	float cosX = std::cos(pPitch * DEGTORAD);
+
+	m[0][0] = 1.0f;
+	m[0][1] = 0.0f;
+	m[0][2] = 0.0f;
+	m[0][3] = 0.0f;
+
+	m[1][0] = 0.0f;
+	m[1][1] = cosX;
+	m[1][2] = sinX;
+	m[1][3] = 0.0f;
+
+	m[2][0] = 0.0f;
+	m[2][1] = -sinX;
+	m[2][2] = cosX;
+	m[2][3] = 0.0f;
+
+	m[3][0] = 0.0f;
+	m[3][1] = 0.0f;
+	m[3][2] = 0.0f;
+	m[3][3] = 1.0f;
+}
+
+void Matrix::SetRotationY(float pYaw)
+{
+	float sinY = std::sin(pYaw * DEGTORAD);
+	float cosY = std::cos(pYaw * DEGTORAD);
+
+	m[0][0] = cosY;
+	m[0][1] = 0.0f;
+	m[0][2] = -sinY;
+	m[0][3] = 0.0f;
+
+	m[1][0] = 0.0f;
+	m[1][1] = 1.0f;
+	m[1][2] = 0.0f;
+	m[1][3] = 0.0f;
+
+	m[2][0] = sinY;
+	m[2][1] = 0.0f;
+	m[2][2] = cosY;
+	m[2][3] = 0.0f;
+
+	m[3][0] = 0.0f;
+	m[3][1] = 0.0f;
+	m[3][2] = 0.0f;
+	m[3][3] = 1.0f;
+}
+
+void Matrix::SetRotationZ(float pRoll)
+{
+	float sinZ = std::sin(pRoll * DEGTORAD);
+	float cosZ = std::cos(pRoll * DEGTORAD);
+
+	m[0][0] = cosZ;
+	m[0][1] = sinZ;
+	m[0][2] = 0.0f;
+	m[0][3] = 0.0f;
+
+	m[1][0] = -sinZ;
+	m[1][1] = cosZ;
+	m[1][2] = 0.0f;
+	m[1][3] = 0.0f;
+
+	m[2][0] = 0.0f;
+	m[2][1] = 0.0f;
+	m[2][2] = 1.0f;
+	m[2][3] = 0.0f;
+
+	m[3][0] = 0.0f;
+	m[3][1] = 0.0f;
+	m[3][2] = 0.0f;
+	m[3][3] = 1.0f;
+}
+
+void Matrix::Mul(const Matrix &pA,const Matrix &pB)
+{
+	m[0][0] = (pA.m[0][0]*pB.m[0][0]) + (pA.m[0][1]*pB.m[1][0]) + (pA.m[0][2]*pB.m[2][0]) + (pA.m[0][3]*pB.m[3][0]);
+	m[0][1] = (pA.m[0][0]*pB.m[0][1]) + (pA.m[0][1]*pB.m[1][1]) + (pA.m[0][2]*pB.m[2][1]) + (pA.m[0][3]*pB.m[3][1]);
+	m[0][2] = (pA.m[0][0]*pB.m[0][2]) + (pA.m[0][1]*pB.m[1][2]) + (pA.m[0][2]*pB.m[2][2]) + (pA.m[0][3]*pB.m[3][2]);
+	m[0][3] = (pA.m[0][0]*pB.m[0][3]) + (pA.m[0][1]*pB.m[1][3]) + (pA.m[0][2]*pB.m[2][3]) + (pA.m[0][3]*pB.m[3][3]);
+
+	m[1][0] = (pA.m[1][0]*pB.m[0][0]) + (pA.m[1][1]*pB.m[1][0]) + (pA.m[1][2]*pB.m[2][0]) + (pA.m[1][3]*pB.m[3][0]);
+	m[1][1] = (pA.m[1][0]*pB.m[0][1]) + (pA.m[1][1]*pB.m[1][1]) + (pA.m[1][2]*pB.m[2][1]) + (pA.m[1][3]*pB.m[3][1]);
+	m[1][2] = (pA.m[1][0]*pB.m[0][2]) + (pA.m[1][1]*pB.m[1][2]) + (pA.m[1][2]*pB.m[2][2]) + (pA.m[1][3]*pB.m[3][2]);
+	m[1][3] = (pA.m[1][0]*pB.m[0][3]) + (pA.m[1][1]*pB.m[1][3]) + (pA.m[1][2]*pB.m[2][3]) + (pA.m[1][3]*pB.m[3][3]);
+
+	m[2][0] = (pA.m[2][0]*pB.m[0][0]) + (pA.m[2][1]*pB.m[1][0]) + (pA.m[2][2]*pB.m[2][0]) + (pA.m[2][3]*pB.m[3][0]);
+	m[2][1] = (pA.m[2][0]*pB.m[0][1]) + (pA.m[2][1]*pB.m[1][1]) + (pA.m[2][2]*pB.m[2][1]) + (pA.m[2][3]*pB.m[3][1]);
+	m[2][2] = (pA.m[2][0]*pB.m[0][2]) + (pA.m[2][1]*pB.m[1][2]) + (pA.m[2][2]*pB.m[2][2]) + (pA.m[2][3]*pB.m[3][2]);
+	m[2][3] = (pA.m[2][0]*pB.m[0][3]) + (pA.m[2][1]*pB.m[1][3]) + (pA.m[2][2]*pB.m[2][3]) + (pA.m[2][3]*pB.m[3][3]);
+
+	m[3][0] = (pA.m[3][0]*pB.m[0][0]) + (pA.m[3][1]*pB.m[1][0]) + (pA.m[3][2]*pB.m[2][0]) + (pA.m[3][3]*pB.m[3][0]);
+	m[3][1] = (pA.m[3][0]*pB.m[0][1]) + (pA.m[3][1]*pB.m[1][1]) + (pA.m[3][2]*pB.m[2][1]) + (pA.m[3][3]*pB.m[3][1]);
+	m[3][2] = (pA.m[3][0]*pB.m[0][2]) + (pA.m[3][1]*pB.m[1][2]) + (pA.m[3][2]*pB.m[2][2]) + (pA.m[3][3]*pB.m[3][2]);
+	m[3][3] = (pA.m[3][0]*pB.m[0][3]) + (pA.m[3][1]*pB.m[1][3]) + (pA.m[3][2]*pB.m[2][3]) + (pA.m[3][3]*pB.m[3][3]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// GLES Shader definition
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+struct GLShader
+{
+	GLShader(GLStateCache& rStateCache,const std::string& pName,const char* pVertex, const char* pFragment);
+	~GLShader();
+
+	int GetUniformLocation(const char* pName);
+	void BindAttribLocation(int location,const char* pName);
+	void Enable(const float projInvcam[4][4]);
+	void SetTransform(float transform[4][4]);
+	void SetGlobalColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha);
+	void SetGlobalColour(float red,float green,float blue,float alpha);
+	void SetTexture(GLint texture);
+
+	bool GetUsesTexture()const{return mUniforms.tex0 > -1;}
+	bool GetUsesTransform()const{return mUniforms.trans > -1;}
+
+	const std::string mName;	//!< Mainly to help debugging.
+	const uint32_t mSortID;		//!< Unique for each shader, used to sort deferred draws so ones that use the same shader are drawn together.
+	const bool mEnableStreamUV;
+	const bool mEnableStreamTrans;
+	const bool mEnableStreamColour;
+	GLStateCache& mStateCache;
+
+	GLint mShader = 0;
+	GLint mVertexShader = 0;
+	GLint mFragmentShader = 0;
+	struct
+	{
+		GLint trans;
+		GLint proj_cam;
+		GLint global_colour;
+		GLint tex0;
+	}mUniforms;
+
+	/**
+	 * @brief The values last sent to the uniforms, GL sets them all to zero when the program is linked.
+	 */
+	struct
+	{
+		float trans[16] = {0};
+		float proj_cam[16] = {0};
+		float global_colour[4] = {0};
+		GLint tex0 = 0;
+	}mUniformValues;
+
+	int LoadShader(int type, const char* shaderCode);
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// DRM Direct Render Manager and EGL definition.
+// Used for more model systems like RPi4 and proper GL / GLES implementations.
+#ifdef PLATFORM_DRM_EGL
+struct PlatformInterface
+{
+	bool mIsFirstFrame = true;
+	int mDRMFile = -1;
+
+	// This is used for the EGL bring up and getting GLES going along with DRM.
+	struct gbm_device *mBufferManager = nullptr;
+	struct gbm_bo *mCurrentFrontBufferObject = nullptr;	//!< The buffer just drawn, locked in SwapBuffers.
+	struct gbm_bo *mFlipBufferObject = nullptr;			//!< Queued to be shown, on screen once the page flip event comes.
+	struct gbm_bo *mScanoutBufferObject = nullptr;		//!< On screen now, can't be drawn to until the next flip is done.
+	bool mFlipPending = false;
+	bool mAsyncPageFlip = false;						//!< SwapBuffers does not wait for the flip, the next frame is drawn in a third buffer.
+
+	struct
+	{
+		uint64_t microseconds = 0;	//!< When the last flip happened, from the page flip event.
+		uint32_t frame = 0;			//!< The vertical blank count of the last flip, zero if there has not been one.
+	}mLastVSync;
+
+	drmModeEncoder *mModeEncoder = nullptr;
+	drmModeConnector* mConnector = nullptr;
+	drmModeModeInfo* mModeInfo = nullptr;
+	uint32_t mFOURCC_Format = DRM_FORMAT_INVALID;
+	uint32_t mCurrentFrontBufferID = 0;
+
+	EGLDisplay mDisplay = nullptr;				//!<GL display
+	EGLSurface mSurface = nullptr;				//!<GL rendering surface
+	EGLContext mContext = nullptr;				//!<GL rendering context
+	EGLConfig mConfig = nullptr;				//!<Configuration of the display.
+
+	struct gbm_surface *mNativeWindow = nullptr;
+
+	bool mHasBufferAge = false;						//!< EGL_EXT_buffer_age is there so we can ask how old the back buffer is.
+	PFNEGLSWAPBUFFERSWITHDAMAGEPROC mSwapBuffersWithDamage = nullptr;	//!< From EGL_KHR_swap_buffers_with_damage or the EXT version, null if there is neither.
+
+	/**
+	 * @brief Information about the mouse driver
+	 */
+	struct
+	{
+		int mDevice = 0; //!< File handle to /dev/input/mice
+
+		/**
+		 * @brief Maintains the current known values. Because we get many messages.
+		 */
+		struct
+		{
+			bool touched = false;
+			int x = 0;
+			int y = 0;
+		}mCurrent;
+	}mPointer;
+
+	PlatformInterface();
+	~PlatformInterface();
+
+	int GetWidth()const{assert(mModeInfo);if(mModeInfo){return mModeInfo->hdisplay;}return 0;}
+	int GetHeight()const{assert(mModeInfo);if(mModeInfo){return mModeInfo->vdisplay;}return 0;}
+
+	/**
+	 * @brief Returns the address of a GL function that is not part of GLES 2.0, null if the driver does not have it.
+	 */
+	void* GetProcAddress(const char* pName){return (void*)eglGetProcAddress(pName);}
+
+	/**
+	 * @brief Looks for a mouse device we can used for touch screen input.
+	 * 
+	 * @return int 
+	 */
+	int FindMouseDevice();
+
+	/**
+	 * @brief Processes the X11 events then exits when all are done. Returns true if the app is asked to quit.
+	 */
+	bool ProcessEvents(tinygles::GLES::SystemEventHandler pEventHandler);
+
+
+	void InitialiseDisplay();
+	void FindEGLConfiguration();
+
+	void UpdateCurrentBuffer();
+
+	/**
+	 * @brief How many frames ago the back buffer was drawn, zero if that's not known and so it's contents are not either.
+	 */
+	int GetBufferAge();
+
+	/**
+	 * @brief Shows the frame. pDamageRect is x,y,width,height of what changed in GL window coordinates, null if it could be anything.
+	 * Waits for the page flip unless mAsyncPageFlip is set, then it only waits if the last frame's flip is still queued.
+	 */
+	void SwapBuffers(const int* pDamageRect = nullptr);
+
+	void SetAsyncPageFlip(bool pEnable){mAsyncPageFlip = pEnable;}
+
+	/**
+	 * @brief Handles the page flip event if there is one queued. Returns straight away if pBlock is false and it has not happened yet.
+	 * Once it has the buffer that was on screen is given back to be drawn to.
+	 */
+	void WaitForPageFlip(bool pBlock);
+
+	/**
+	 * @brief Gets the time and vertical blank count of the last flip, false if there has not been one.
+	 */
+	bool GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount);
+};
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// X11 GL emulation hidden definition.
+// Implementation is at the bottom of the source file.
+// This code is intended to allow development on a full desktop system for applications that
+// will eventually be deployed on a minimal linux system without all the X11 + fancy UI rendering bloat.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef PLATFORM_X11_GL
+/**
+ * @brief Emulation layer for X11
+ * 
+ */
+struct PlatformInterface
+{
+	Display *mXDisplay = nullptr;
+	Window mWindow = 0;
+	Atom mDeleteMessage;
+	GLXContext mGLXContext = 0;
+	XSetWindowAttributes mWindowAttributes;
+	XVisualInfo* mVisualInfo;
+
+	bool mWindowReady;
+
+	PlatformInterface();
+	~PlatformInterface();
+
+	/**
+	 * @brief Creates the X11 window and all the bits needed to get rendering with.
+	 */
+	void InitialiseDisplay();
+
+	/**
+	 * @brief Processes the X11 events then exits when all are done. Returns true if the app is asked to quit.
+	 */
+	bool ProcessEvents(tinygles::GLES::SystemEventHandler pEventHandler);
+
+	/**
+	 * @brief Draws the frame buffer to the X11 window. The damage is not used, X11 is only for development.
+	 */
+	void SwapBuffers(const int* pDamageRect = nullptr);
+
+	/**
+	 * @brief How many frames ago the back buffer was drawn, from GLX_EXT_buffer_age. Zero if that's not known.
+	 */
+	int GetBufferAge();
+
+	/**
+	 * @brief Page flips are a DRM thing, for X11 they do nothing.
+	 */
+	void SetAsyncPageFlip(bool pEnable){(void)pEnable;}
+	bool GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount){(void)rMicroseconds;(void)rVBlankCount;return false;}
+
+	int GetWidth()const{return X11_EMULATION_WIDTH;}
+	int GetHeight()const{return X11_EMULATION_HEIGHT;}
+
+	/**
+	 * @brief Returns the address of a GL function that is not part of GLES 2.0, null if the driver does not have it.
+	 */
+	void* GetProcAddress(const char* pName){return (void*)glXGetProcAddressARB((const GLubyte*)pName);}
+
+};
+#endif //#ifdef USE_X11_EMULATION
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Headless EGL definition.
+// Renders to a pbuffer, there is no display or input. For running the rendering code on machines with no GPU.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef PLATFORM_HEADLESS_EGL
+struct PlatformInterface
+{
+	EGLDisplay mDisplay = nullptr;				//!<GL display
+	EGLSurface mSurface = nullptr;				//!<GL rendering surface, a pbuffer.
+	EGLContext mContext = nullptr;				//!<GL rendering context
+	EGLConfig mConfig = nullptr;				//!<Configuration of the pbuffer.
+
+	PlatformInterface() = default;
+	~PlatformInterface();
+
+	/**
+	 * @brief Gets the surfaceless display if Mesa has it, which needs no X server or DRM device, else the default one. Then makes the pbuffer.
+	 */
+	void InitialiseDisplay();
+
+	/**
+	 * @brief There is no input, never asks to quit.
+	 */
+	bool ProcessEvents(tinygles::GLES::SystemEventHandler pEventHandler){(void)pEventHandler;return false;}
+
+	/**
+	 * @brief Nothing to show it on. Use GLES::SetFrameReadbackHandler to get the pixels.
+	 */
+	void SwapBuffers(const int* pDamageRect = nullptr);
+
+	/**
+	 * @brief A pbuffer has one buffer that keeps what was drawn, so it's always the last frame.
+	 */
+	int GetBufferAge(){return 1;}
+
+	void SetAsyncPageFlip(bool pEnable){(void)pEnable;}
+	bool GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount){(void)rMicroseconds;(void)rVBlankCount;return false;}
+
+	int GetWidth()const{return HEADLESS_WIDTH;}
+	int GetHeight()const{return HEADLESS_HEIGHT;}
+
+	/**
+	 * @brief Returns the address of a GL function that is not part of GLES 2.0, null if the driver does not have it.
+	 */
+	void* GetProcAddress(const char* pName){return (void*)eglGetProcAddress(pName);}
+};
+#endif //#ifdef PLATFORM_HEADLESS_EGL
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// GLES Implementation
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+/**
+ * @brief Used by the code that draws with state of it's own part way through the application's frame, the deferred flush, display lists and the stats overlay.
+ * Anything added here is put back for all of them.
+ */
+struct GLES::SavedDrawState
+{
+	SavedDrawState(GLES& rGL):mGL(rGL),mDepthTest(rGL.mDepthTest),mShader(rGL.mShaders.CurrentShader)
+	{
+		memcpy(mProjection.m,mGL.mMatrices.projection,sizeof(mGL.mMatrices.projection));
+		memcpy(mTransform.m,mGL.mMatrices.transform,sizeof(mGL.mMatrices.transform));
+	}
+
+	~SavedDrawState()
+	{
+		memcpy(mGL.mMatrices.projection,mProjection.m,sizeof(mGL.mMatrices.projection));
+		memcpy(mGL.mMatrices.transform,mTransform.m,sizeof(mGL.mMatrices.transform));
+		if( mGL.mDepthTest != mDepthTest )
+		{
+			mGL.mDepthTest = mDepthTest;
+			mGL.ApplyDepthState(mDepthTest);
+		}
+
+		// Put back the shader the application had with it's projection and transform.
+		mGL.mShaders.CurrentShader.reset();
+		if( mShader )
+		{
+			mGL.EnableShader(mShader);
+		}
+	}
+
+private:
+	GLES& mGL;
+	Matrix mProjection,mTransform;
+	const bool mDepthTest;
+	const TinyShader mShader;
+};
+
+GLES::GLES(uint32_t pFlags) :
+	mCreateFlags(pFlags),
+	mPlatform(std::make_unique<PlatformInterface>()),
+	mWorkBuffers(std::make_unique<WorkBuffers>()),
+	mStateCache(std::make_unique<GLStateCache>()),
+	mDeferred(std::make_unique<DeferredDraws>()),
+	mStats(std::make_unique<FrameStatsHistory>()),
+	mBatch2D(std::make_unique<Batch2D>()),
+	mSpriteBatch(std::make_unique<SpriteBatch>()),
+	mSubTextures(SUB_TEXTURE_HANDLE_BIT),
+	mStreamingTextures(STREAMING_TEXTURE_HANDLE_BIT)
+{
+	// Lets hook ctrl + c.
+	mUsersSignalAction = signal(SIGINT,CtrlHandler);
+
+	mPhysical.Width = mPlatform->GetWidth();
+	mPhysical.Height = mPlatform->GetHeight();
+
+	if( mCreateFlags&ROTATE_FRAME_PORTRATE )
+	{
+		mCreateFlags &= ~ROTATE_FRAME_PORTRATE;
+		if( mPhysical.Width > mPhysical.Height )
+		{
+			mCreateFlags |= ROTATE_FRAME_BUFFER_90;
+		}
+	}
+
+	if( mCreateFlags&ROTATE_FRAME_LANDSCAPE )
+	{
+		mCreateFlags &= ~ROTATE_FRAME_LANDSCAPE;
+		if( mPhysical.Width < mPhysical.Height )
+		{
+			mCreateFlags |= ROTATE_FRAME_BUFFER_90;
+		}
+	}
+
+	if( mCreateFlags&(ROTATE_FRAME_BUFFER_90|ROTATE_FRAME_BUFFER_270) )
+	{
+		mReported.Width = mPhysical.Height;
+		mReported.Height = mPhysical.Width;
+	}
+	else
+	{
+		mReported.Width = mPhysical.Width;
+		mReported.Height = mPhysical.Height;
+	}
+
+	VERBOSE_MESSAGE("Physical display resolution is " << mPhysical.Width << "x" << mPhysical.Height );
+
+	mPlatform->InitialiseDisplay();
+
+	SetRenderingDefaults();
+	InitInstancing();
+	InitTextureFormats();
+	BuildShaders();
+	BuildDebugTexture();
+	BuildPixelFontTexture();
+	InitFreeTypeFont();
+	AllocateQuadBuffers();
+	mStreaming = std::make_unique<StreamingBuffers>(*mStateCache);
+
+	VERBOSE_MESSAGE("GLES Ready");
+}
+
+GLES::~GLES()
+{
+	VERBOSE_MESSAGE("GLES destructor called");
+
+	VERBOSE_MESSAGE("On exit the following scratch memory buffers reached the sizes of...");
+	VERBOSE_MESSAGE("    mWorkBuffers.vertices2Df " << mWorkBuffers->vertices2Df.MemoryUsed() << " bytes");
+	VERBOSE_MESSAGE("    mWorkBuffers.vertices2DShort " << mWorkBuffers->vertices2DShort.MemoryUsed() << " bytes");
+	VERBOSE_MESSAGE("    mWorkBuffers.uvShort " << mWorkBuffers->uvShort.MemoryUsed() << " bytes");
+
+	mStateCache->BindTexture(0,0);
+	CHECK_OGL_ERRORS();
+
+	// Kill shaders.
+	VERBOSE_MESSAGE("Deleting shaders");
+
+	mStateCache->UseProgram(0);
+	CHECK_OGL_ERRORS();
+
+	VERBOSE_MESSAGE("GL state changes, issued " << mStateCache->mIssued << " skipped " << mStateCache->mSkipped);
+
+	mStateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	glDeleteBuffers(1,&mQuadBatch.IndicesBuffer);
+
+	mBatch2D->mShader.reset();
+	mDeferred->Clear();
+	mDisplayListRecording.reset();
+	mDisplayLists.Clear();
+	mStreaming.reset();
+	mQuadBatch.Batchs.Clear();
+	mShaders.CurrentShader.reset();
+	mShaders.ColourOnly2D.reset();
+	mShaders.TextureColour2D.reset();
+	mShaders.TextureAlphaOnly2D.reset();
+	mShaders.SpriteShader2D.reset();
+	mShaders.QuadBatchShader2D.reset();
+	mShaders.QuadBatchInstancedShader2D.reset();
+
+	mShaders.ColourOnly3D.reset();
+	mShaders.TextureOnly3D.reset();
+
+
+	// delete all free type fonts.
+#ifdef USE_FREETYPEFONTS
+	mFreeTypeFonts.Clear();
+	if( mFreetype != nullptr )
+	{
+		if( FT_Done_FreeType(mFreetype) == FT_Err_Ok )
+		{
+			mFreetype = nullptr;
+			VERBOSE_MESSAGE("Freetype font library deleted");
+		}
+	}
+#endif
+
+	// delete all textures.
+	if( mRenderTarget.Texture )
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER,0);
+	}
+	for( size_t n = 0 ; n < mTextures.Size() ; n++ )
+	{
+		const GLTexture* tex = mTextures.GetObject(n);
+		glDeleteFramebuffers(1,&tex->mFrameBuffer);
+		glDeleteRenderbuffers(1,&tex->mDepthBuffer);
+		glDeleteTextures(1,&tex->mGLName);
+		CHECK_OGL_ERRORS();
+	}
+
+	VERBOSE_MESSAGE("All done");
+}
+
+bool GLES::BeginFrame()
+{
+	TRACE_SCOPE("BeginFrame");
+	mDiagnostics.frameNumber++;
+
+	// Reset some items so that we have a working render setup to begin the frame with.
+	// This is done so that I don't have to have a load of if statements to deal with first frame. Also makes life simpler for the more minimal applications.
+	EnableShader(mShaders.ColourOnly2D);
+	SetTransformIdentity();
+	mDeferred->mLayer = 0;
+	mStats->BeginFrame(*mStateCache);
+
+	if( mDamage.Enabled )
+	{
+		// The back buffer has the frame from age frames ago, so it missed the damage of the age - 1 frames since.
+		const int age = mPlatform->GetBufferAge();
+		mDamage.Redraw = mDamage.Frame;
+		if( age < 1 || age > (int)mDamage.History.size() + 1 )
+		{// Don't know what's in it.
+			mDamage.Redraw = {0,0,mReported.Width,mReported.Height};
+		}
+		else
+		{
+			for( int n = 0 ; n < age - 1 ; n++ )
+			{
+				mDamage.Redraw.Add(mDamage.History[n]);
+			}
+		}
+		mDamage.InFrame = true;
+		ApplyDamageScissor();
+	}
+
+	return GLES::mKeepGoing;
+}
+
+void GLES::EndFrame()
+{
+	TRACE_SCOPE("EndFrame");
+	SpriteBatchEnd();
+	FlushDeferredDraws();
+	EnforceTextureBudget(0);
+	mStats->EndFrame(*mStateCache);
+	if( mStats->mOverlay )
+	{
+		DrawStatsOverlay();
+	}
+	if( mFrameReadbackHandler )
+	{
+		ReadbackFrame();
+	}
+	mStreaming->vertices.NextFrame();
+	mStreaming->indices.NextFrame();
+	glFlush();// This makes sure the display is fully up to date before we allow them to interact with any kind of UI. This is the specified use of this function.
+
+	if( mDamage.Enabled )
+	{
+		glDisable(GL_SCISSOR_TEST);
+
+		int damage[4];
+		DamageToPhysical(mDamage.Frame,damage);
+		mPlatform->SwapBuffers(mDamage.Frame.GetIsEmpty() ? nullptr : damage);
+
+		std::rotate(mDamage.History.rbegin(),mDamage.History.rbegin() + 1,mDamage.History.rend());
+		mDamage.History[0] = mDamage.Frame;
+		mDamage.Frame = {};
+		mDamage.InFrame = false;
+	}
+	else
+	{
+		mPlatform->SwapBuffers();
+	}
+	ProcessSystemEvents();
+}
+
+void GLES::SetDamageTracking(bool pEnable)
+{
+	FlushDeferredDraws();// What has been drawn so far was made with the old scissor.
+
+	// Nothing is known about what is in the buffers, they are all drawn in full until each has been drawn once.
+	const DamageRect full = {0,0,mReported.Width,mReported.Height};
+	mDamage.Enabled = pEnable;
+	mDamage.History.fill(full);
+	mDamage.Frame = full;
+	mDamage.Redraw = full;
+	mDamage.InFrame = false;// Takes effect from the next BeginFrame.
+	if( pEnable == false )
+	{
+		glDisable(GL_SCISSOR_TEST);
+	}
+}
+
+void GLES::SetAsyncPageFlip(bool pEnable)
+{
+	mPlatform->SetAsyncPageFlip(pEnable);
+}
+
+bool GLES::GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount)
+{
+	return mPlatform->GetLastVSync(rMicroseconds,rVBlankCount);
+}
+
+void GLES::AddDamage(int pX,int pY,int pWidth,int pHeight)
+{
+	DamageRect rect = {std::max(pX,0),std::max(pY,0),std::min(pX + pWidth,mReported.Width),std::min(pY + pHeight,mReported.Height)};
+	mDamage.Frame.Add(rect);
+	if( mDamage.Enabled && mDamage.InFrame )
+	{
+		mDamage.Redraw.Add(rect);
+		ApplyDamageScissor();
+	}
+}
+
+void GLES::DamageToPhysical(const DamageRect& pRect,int rPhysical[4])const
+{
+	if( pRect.GetIsEmpty() )
+	{
+		rPhysical[0] = rPhysical[1] = rPhysical[2] = rPhysical[3] = 0;
+		return;
+	}
 
-	const FT_UInt c1 = *pText;
-	pText++;
+	// The inverse of the 2D projections set in Begin2D.
+	const int w = pRect.x1 - pRect.x0;
+	const int h = pRect.y1 - pRect.y0;
+	if( mCreateFlags&ROTATE_FRAME_BUFFER_90 )
+	{
+		rPhysical[0] = mPhysical.Width - pRect.y1;
+		rPhysical[1] = mPhysical.Height - pRect.x1;
+		rPhysical[2] = h;
+		rPhysical[3] = w;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_180 )
+	{
+		rPhysical[0] = mPhysical.Width - pRect.x1;
+		rPhysical[1] = pRect.y0;
+		rPhysical[2] = w;
+		rPhysical[3] = h;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_270 )
+	{
+		rPhysical[0] = pRect.y0;
+		rPhysical[1] = pRect.x0;
+		rPhysical[2] = h;
+		rPhysical[3] = w;
+	}
+	else
+	{
+		rPhysical[0] = pRect.x0;
+		rPhysical[1] = mPhysical.Height - pRect.y1;
+		rPhysical[2] = w;
+		rPhysical[3] = h;
+	}
+}
 
-	if( (c1&0x80) == 0 )
+void GLES::ApplyDamageScissor()
+{
+	int scissor[4];
+	DamageToPhysical(mDamage.Redraw,scissor);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(scissor[0],scissor[1],scissor[2],scissor[3]);
+	CHECK_OGL_ERRORS();
+}
+
+void GLES::Clear(uint8_t pRed,uint8_t pGreen,uint8_t pBlue)
+{
+	TRACE_SCOPE("Clear");
+	FlushDeferredDraws();// Anything recorded before the clear has to be drawn before it.
+	glClearColor((float)pRed / 255.0f,(float)pGreen / 255.0f,(float)pBlue / 255.0f,1.0f);
+	mStateCache->DepthMask(true);// glClear does not write the depth buffer when the mask is off, as it is after Begin2D.
+	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
+	mStateCache->DepthMask(mDepthTest);
+	CHECK_OGL_ERRORS();
+}
+
+void GLES::Clear(uint32_t pTexture)
+{
+	TRACE_SCOPE("Clear");
+	FlushDeferredDraws();
+	mStateCache->DepthMask(true);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	mStateCache->DepthMask(mDepthTest);
+	CHECK_OGL_ERRORS();
+	if( mRenderTarget.Texture )
 	{
-		return c1;
+		FillRectangle(0,0,mRenderTarget.Width,mRenderTarget.Height,pTexture);
+	}
+	else
+	{
+		FillRectangle(0,0,GetWidth(),GetHeight(),pTexture);
 	}
+}
 
-	const FT_UInt c2 = *pText;
-	pText++;
+void GLES::Begin2D()
+{
+	FlushBatch2D();// What is in the batch was made with the old projection.
+
+	// Setup 2D frustum
+	memset(mMatrices.projection,0,sizeof(mMatrices.projection));
+	mMatrices.projection[3][3] = 1;
+
+	if( mRenderTarget.Texture )
+	{// Not rotated and y is not flipped, so the first row of the texture is the top of what was drawn.
+		mMatrices.projection[0][0] = 2.0f / (float)mRenderTarget.Width;
+		mMatrices.projection[1][1] = 2.0f / (float)mRenderTarget.Height;
+		mMatrices.projection[3][0] = -1;
+		mMatrices.projection[3][1] = -1;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_90 )
+	{
+		mMatrices.projection[0][1] = -2.0f / (float)mPhysical.Height;
+		mMatrices.projection[1][0] = -2.0f / (float)mPhysical.Width;
+				
+		mMatrices.projection[3][0] = 1;
+		mMatrices.projection[3][1] = 1;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_180 )
+	{
+		mMatrices.projection[0][0] = -2.0f / (float)mPhysical.Width;
+		mMatrices.projection[1][1] = 2.0f / (float)mPhysical.Height;
+				
+		mMatrices.projection[3][0] = 1;
+		mMatrices.projection[3][1] = -1;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_270 )
+	{
+		mMatrices.projection[0][1] = 2.0f / (float)mPhysical.Height;
+		mMatrices.projection[1][0] = 2.0f / (float)mPhysical.Width;
+				
+		mMatrices.projection[3][0] = -1;
+		mMatrices.projection[3][1] = -1;
+	}
+	else
+	{
+		mMatrices.projection[0][0] = 2.0f / (float)mPhysical.Width;
+		mMatrices.projection[1][1] = -2.0f / (float)mPhysical.Height;
+		mMatrices.projection[3][0] = -1;
+		mMatrices.projection[3][1] = 1;
+	}
+
+	// No Depth buffer in 2D
+	mDepthTest = false;
+	ApplyDepthState(mDepthTest);
 
-	return ((c1&0x3f) << 6) | (c2&0x3f);
 }
 
-#endif // #ifdef USE_FREETYPEFONTS
+void GLES::Begin3D(float pFov, float pNear, float pFar)
+{
+	FlushBatch2D();
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// Some basic matrix operations
-static const double PI = 3.141592654;
-static const double DEGTORAD = (PI / 180.0);
+	const float cotangent = 1.0f / tanf(DegreeToRadian(pFov));
+	const float q = pFar / (pFar - pNear);
+	const float aspect = mRenderTarget.Texture ? (float)mRenderTarget.Width / (float)mRenderTarget.Height : GetDisplayAspectRatio();
 
-void Matrix::SetIdentity()
+	memset(mMatrices.projection,0,sizeof(mMatrices.projection));
+
+	mMatrices.projection[0][0] = cotangent;
+
+	mMatrices.projection[1][1] = aspect * cotangent;
+
+	mMatrices.projection[2][2] = q;
+	mMatrices.projection[2][3] = 1.0f;
+
+	mMatrices.projection[3][2] = -q * pNear;
+
+	if( mRenderTarget.Texture )
+	{// Flipped in y, same as Begin2D, so the target is the right way up when drawn.
+		mMatrices.projection[1][1] = -mMatrices.projection[1][1];
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_90 )
+	{
+		mMatrices.projection[0][1] = -mMatrices.projection[0][0];
+		mMatrices.projection[0][0] = 0.0f;
+
+		mMatrices.projection[1][0] = mMatrices.projection[1][1];
+		mMatrices.projection[1][1] = 0.0f;
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_180 )
+	{
+		mMatrices.projection[0][0] = -mMatrices.projection[0][0];
+		mMatrices.projection[1][1] = -mMatrices.projection[1][1];
+	}
+	else if( mCreateFlags&ROTATE_FRAME_BUFFER_270 )
+	{
+		mMatrices.projection[0][1] = mMatrices.projection[0][0];
+		mMatrices.projection[0][0] = 0.0f;
+
+		mMatrices.projection[1][0] = -mMatrices.projection[1][1];
+		mMatrices.projection[1][1] = 0.0f;
+	}
+
+	// Depth buffer please
+	mDepthTest = true;
+	ApplyDepthState(mDepthTest);
+
+}
+
+void GLES::SetTransform(float pTransform[4][4])
 {
-	m[0][0] = 1.0f;
-	m[0][1] = 0.0f;
-	m[0][2] = 0.0f;
-	m[0][3] = 0.0f;
+	assert(mShaders.CurrentShader);
+	memcpy(mMatrices.transform,pTransform,sizeof(float) * 4 * 4);
+	mShaders.CurrentShader->SetTransform(pTransform);
+}
 
-	m[1][0] = 0.0f;
-	m[1][1] = 1.0f;
-	m[1][2] = 0.0f;
-	m[1][3] = 0.0f;
+void GLES::SetTransform(float x,float y,float z)
+{
+	float transOnly[4][4] =
+	{
+		{1,0,0,0},
+		{0,1,0,0},
+		{0,0,1,0},
+		{x,y,z,1}
+	};
+	SetTransform(transOnly);
+}
 
-	m[2][0] = 0.0f;
-	m[2][1] = 0.0f;
-	m[2][2] = 1.0f;
-	m[2][3] = 0.0f;
+void GLES::SetTransformIdentity()
+{
+	static float identity[4][4] = {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1}};
+	SetTransform(identity);
+}
 
-	m[3][0] = 0.0f;
-	m[3][1] = 0.0f;
-	m[3][2] = 0.0f;
-	m[3][3] = 1.0f;
+void GLES::SetTransform2D(float pX,float pY,float pRotation,float pScale)
+{
+	float trans[4][4] =
+	{
+		{cos(pRotation)*pScale,sin(pRotation)*pScale,0,0},
+		{-sin(pRotation)*pScale,cos(pRotation)*pScale,0,0},
+		{0,0,pScale,0},
+		{pX,pY,0,1}
+	};
+	SetTransform(trans);
 }
 
-void Matrix::SetTranslation(float pX,float pY,float pZ)
+void GLES::SetDeferredRendering(bool pEnable)
 {
-	m[0][0] = 1.0f;
-	m[0][1] = 0.0f;
-	m[0][2] = 0.0f;
-	m[0][3] = 0.0f;
+	FlushDeferredDraws();
+	mDeferred->mEnabled = pEnable;
+}
+
+bool GLES::GetDeferredRendering()const
+{
+	return mDeferred->mEnabled;
+}
+
+void GLES::DisplayListBegin()
+{
+	if( mDisplayListRecording )
+	{
+		THROW_MEANINGFUL_EXCEPTION("DisplayListBegin called while already recording a display list, call DisplayListEnd first");
+	}
+
+	// What's in the 2D batch was drawn before recording started, it's not part of the list.
+	FlushBatch2D();
+	mDisplayListRecording = std::make_unique<DisplayList>(*mStateCache);
+}
+
+uint32_t GLES::DisplayListEnd()
+{
+	if( !mDisplayListRecording )
+	{
+		THROW_MEANINGFUL_EXCEPTION("DisplayListEnd called without a DisplayListBegin");
+	}
+
+	// The last of the 2D primitives are still in the batch, they are part of the list.
+	FlushBatch2D();
+
+	std::unique_ptr<DisplayList> list = std::move(mDisplayListRecording);
+	const size_t recorded = list->Merge();
+	list->Upload();
+	VERBOSE_MESSAGE("Display list recorded, " << recorded << " draws merged into " << list->mDraws.size() << " using " << list->mBytes << " bytes of buffer memory");
+	return mDisplayLists.Add(std::move(list));
+}
+
+void GLES::DisplayListDraw(uint32_t pDisplayList)
+{
+	TRACE_SCOPE("DisplayListDraw");
+	const DisplayList* list = mDisplayLists.Get(pDisplayList);
+	if( list == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("DisplayListDraw passed a stale or unknown display list handle");
+	}
+	ReplayDisplayList(*list,nullptr);
+}
+
+void GLES::DisplayListDraw(uint32_t pDisplayList,const float pTransform[4][4])
+{
+	TRACE_SCOPE("DisplayListDraw");
+	const DisplayList* list = mDisplayLists.Get(pDisplayList);
+	if( list == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("DisplayListDraw passed a stale or unknown display list handle");
+	}
+	ReplayDisplayList(*list,pTransform);
+}
+
+void GLES::DisplayListDelete(uint32_t pDisplayList)
+{
+	if( mDisplayLists.Get(pDisplayList) )
+	{
+		FlushDeferredDraws();// Recorded draws may use it's buffers.
+		mDisplayLists.Erase(pDisplayList);
+	}
+}
+
+void GLES::GetStateChangeCounts(uint32_t& rIssued,uint32_t& rSkipped)const
+{
+	rIssued = mStateCache->mIssued;
+	rSkipped = mStateCache->mSkipped;
+}
+
+void GLES::ResetStateChangeCounts()
+{
+	mStateCache->mIssued = 0;
+	mStateCache->mSkipped = 0;
+}
+
+const FrameStats& GLES::GetFrameStats()const
+{
+	return mStats->mLast;
+}
+
+FrameStatsSummary GLES::GetFrameStatsSummary()const
+{
+	FrameStatsSummary summary;
+	summary.frames = (uint32_t)mStats->mCount;
+	summary.frameMilliseconds = mStats->GetRange([](const FrameStats& f){return f.frameMilliseconds;});
+	summary.cpuMilliseconds = mStats->GetRange([](const FrameStats& f){return f.cpuMilliseconds;});
+	summary.drawCalls = mStats->GetRange([](const FrameStats& f){return f.drawCalls;});
+	summary.vertices = mStats->GetRange([](const FrameStats& f){return f.vertices;});
+	summary.shaderChanges = mStats->GetRange([](const FrameStats& f){return f.shaderChanges;});
+	summary.textureChanges = mStats->GetRange([](const FrameStats& f){return f.textureChanges;});
+	summary.bytesUploaded = mStats->GetRange([](const FrameStats& f){return f.bytesUploaded;});
+	return summary;
+}
+
+void GLES::SetStatsOverlay(bool pEnable)
+{
+	mStats->mOverlay = pEnable;
+}
+
+bool GLES::TraceSave(const std::string& pFileName)const
+{
+#ifdef TRACE_BUILD
+	std::ofstream file(pFileName);
+	if( file.is_open() == false )
+	{
+		VERBOSE_MESSAGE("TraceSave failed to open " << pFileName);
+		return false;
+	}
+
+	// Complete events, ts and dur are in microseconds.
+	file << "{\"traceEvents\":[\n";
+	const char* separator = "";
+	const int pid = getpid();
+	std::lock_guard<std::mutex> lock(gTraceRingsLock);
+	for( const auto& ring : gTraceRings )
+	{
+		const uint64_t written = ring->mWritten.load(std::memory_order_acquire);
+		const uint64_t first = std::max(ring->mCleared.load(),written > TraceRing::Size ? written - TraceRing::Size : 0);
+		for( uint64_t n = first ; n < written ; n++ )
+		{
+			const TraceEvent& e = ring->mEvents[n&(TraceRing::Size-1)];
+			char buf[256];
+			snprintf(buf,sizeof(buf),"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%ld,\"ts\":%.3f,\"dur\":%.3f}",
+				separator,e.name,pid,ring->mThreadID,(double)e.begin / 1000.0,(double)(e.end - e.begin) / 1000.0);
+			file << buf;
+			separator = ",\n";
+		}
+	}
+	file << "\n]}\n";
+	return file.good();
+#else
+	(void)pFileName;
+	VERBOSE_MESSAGE("TraceSave called but TinyGLES was built without TRACE_BUILD, nothing to save to " << pFileName);
+	return false;
+#endif
+}
+
+void GLES::TraceClear()
+{
+#ifdef TRACE_BUILD
+	std::lock_guard<std::mutex> lock(gTraceRingsLock);
+	for( const auto& ring : gTraceRings )
+	{
+		ring->mCleared.store(ring->mWritten.load(std::memory_order_acquire));
+	}
+#endif
+}
+
+void GLES::DrawStatsOverlay()
+{
+	TRACE_SCOPE("DrawStatsOverlay");
+	const int graphBarWidth = 3;
+	const int graphHeight = 40;
+	const int lineHeight = 18;
+	const int width = 420;// Fits the longest line of text, the graph is on the right.
+	const int height = (lineHeight * 4) + graphHeight + 6;
 
-	m[1][0] = 0.0f;
-	m[1][1] = 1.0f;
-	m[1][2] = 0.0f;
-	m[1][3] = 0.0f;
+	// The overlay changes every frame so is always damage.
+	if( mDamage.Enabled && mDamage.InFrame )
+	{
+		AddDamage(0,0,width,height);
+	}
 
-	m[2][0] = 0.0f;
-	m[2][1] = 0.0f;
-	m[2][2] = 1.0f;
-	m[2][3] = 0.0f;
+	// Keep the state we change so the next frame starts as the application left it. Deferred is turned off so it's drawn now, on top.
+	SavedDrawState saved(*this);
+	const bool liveDeferred = mDeferred->mEnabled;
+	const auto liveFont = mPixelFont;
 
-	m[3][0] = pX;
-	m[3][1] = pY;
-	m[3][2] = pZ;
-	m[3][3] = 1.0f;
+	mDeferred->mEnabled = false;
+	Begin2D();
+	Matrix identity;
+	identity.SetIdentity();
+	memcpy(mMatrices.transform,identity.m,sizeof(mMatrices.transform));
+	mShaders.CurrentShader.reset();// Forces the next shader enabled to upload the 2D projection and transform.
+
+	const FrameStats& last = mStats->mLast;
+	const FrameStatsSummary::Range frameTime = mStats->GetRange([](const FrameStats& f){return f.frameMilliseconds;});
+	const FrameStatsSummary::Range cpuTime = mStats->GetRange([](const FrameStats& f){return f.cpuMilliseconds;});
+
+	FillRectangle(0,0,width,height,0,0,0,160);
+
+	mPixelFont.scale = 1;
+	mPixelFont.R = mPixelFont.G = mPixelFont.B = mPixelFont.A = 255;
+	FontPrintf(2,2,"FPS %.1f frame %.1fms p99 %.1f",frameTime.average > 0.0f ? 1000.0f / frameTime.average : 0.0f,last.frameMilliseconds,frameTime.p99);
+	FontPrintf(2,2 + lineHeight,"CPU %.2fms avg %.2f max %.2f",last.cpuMilliseconds,cpuTime.average,cpuTime.max);
+	FontPrintf(2,2 + (lineHeight * 2),"Draws %u verts %u",last.drawCalls,last.vertices);
+	FontPrintf(2,2 + (lineHeight * 3),"Shd %u tex %u up %uKB",last.shaderChanges,last.textureChanges,(last.bytesUploaded + 1023) / 1024);
+
+	// One bar per frame, newest on the right, two pixels per millisecond. Green makes 60Hz, yellow 30Hz, red is slower.
+	const int graphBottom = height - 2;
+	for( size_t n = 0 ; n < mStats->mCount ; n++ )
+	{
+		const float ms = mStats->GetFrame(n).frameMilliseconds;
+		const int barHeight = std::min((int)(ms * 2.0f) + 1,graphHeight);
+		const int x = width - ((int)(n + 1) * graphBarWidth);
+		const uint8_t red = ms > 17.0f ? 255 : 0;
+		const uint8_t green = ms > 34.0f ? 0 : 255;
+		FillRectangle(x,graphBottom - barHeight,x + graphBarWidth - 1,graphBottom,red,green,0);
+	}
+	FillRectangle(0,graphBottom - 34,width,graphBottom - 33,255,255,255,128);// 16.7ms, one frame at 60Hz.
+	FlushBatch2D();
+
+	mDeferred->mEnabled = liveDeferred;
+	mPixelFont = liveFont;
 }
 
-void Matrix::SetRotationX(float pPitch)
+void GLES::ReadbackFrame()
 {
-	float sinX = std::sin(pPitch * DEGTORAD);
-	float cosX = std::cos(pPitch * DEGTORAD);
+	TRACE_SCOPE("ReadbackFrame");
+	const int width = mPhysical.Width;
+	const int height = mPhysical.Height;
+	const size_t rowSize = width * 4;
+	mFrameReadbackPixels.resize(rowSize * height * 2);
+
+	// GL gives the bottom row first, read into the second half then copy the rows over in the order the handler wants.
+	uint8_t* bottomUp = mFrameReadbackPixels.data() + (rowSize * height);
+	glReadPixels(0,0,width,height,GL_RGBA,GL_UNSIGNED_BYTE,bottomUp);
+	CHECK_OGL_ERRORS();
+	for( int y = 0 ; y < height ; y++ )
+	{
+		memcpy(mFrameReadbackPixels.data() + (rowSize * y),bottomUp + (rowSize * (height - 1 - y)),rowSize);
+	}
 
-	m[0][0] = 1.0f;
-	m[0][1] = 0.0f;
-	m[0][2] = 0.0f;
-	m[0][3] = 0.0f;
+	mFrameReadbackHandler(width,height,mFrameReadbackPixels.data());
+}
 
-	m[1][0] = 0.0f;
-	m[1][1] = cosX;
-	m[1][2] = sinX;
-	m[1][3] = 0.0f;
+void GLES::SetDrawLayer(int16_t pLayer)
+{
+	FlushBatch2D();
+	mDeferred->mLayer = pLayer;
+}
 
-	m[2][0] = 0.0f;
-	m[2][1] = -sinX;
-	m[2][2] = cosX;
-	m[2][3] = 0.0f;
+void GLES::OnApplicationExitRequest()
+{
+	VERBOSE_MESSAGE("Exit request from user, quitting application");
+	mKeepGoing = false;
+	if( mSystemEventHandler != nullptr )
+	{
+		SystemEventData data(SystemEventType::EXIT_REQUEST);
+		mSystemEventHandler(data);
+	}
+}
 
-	m[3][0] = 0.0f;
-	m[3][1] = 0.0f;
-	m[3][2] = 0.0f;
-	m[3][3] = 1.0f;
+//*******************************************
+// Primitive draw commands.
+void GLES::DrawLine(int pFromX,int pFromY,int pToX,int pToY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+{
+	TRACE_SCOPE("DrawLine");
+	const Vert2Df from = {(float)pFromX,(float)pFromY};
+	const Vert2Df to = {(float)pToX,(float)pToY};
+	WriteLineAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,6),from,to,nullptr,nullptr,PackColour(pRed,pGreen,pBlue,pAlpha));
 }
 
-void Matrix::SetRotationY(float pYaw)
+void GLES::DrawLine(int pFromX,int pFromY,int pToX,int pToY,int pWidth,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
 {
-	float sinY = std::sin(pYaw * DEGTORAD);
-	float cosY = std::cos(pYaw * DEGTORAD);
+	TRACE_SCOPE("DrawLine");
+	if( pWidth < 2 )
+	{
+		DrawLine(pFromX,pFromY,pToX,pToY,pRed,pGreen,pBlue);
+	}
+	else
+	{
+		pWidth /= 2;
+		Vert2Df p[6];
 
-	m[0][0] = cosY;
-	m[0][1] = 0.0f;
-	m[0][2] = -sinY;
-	m[0][3] = 0.0f;
+		if( pFromY < pToY )
+		{
+			std::swap(pFromY,pToY);
+			std::swap(pFromX,pToX);
+		}
 
-	m[1][0] = 0.0f;
-	m[1][1] = 1.0f;
-	m[1][2] = 0.0f;
-	m[1][3] = 0.0f;
+		if( pFromX < pToX )
+		{
+			p[0].x = pToX - pWidth;
+			p[0].y = pToY - pWidth;
 
-	m[2][0] = sinY;
-	m[2][1] = 0.0f;
-	m[2][2] = cosY;
-	m[2][3] = 0.0f;
+			p[1].x = pToX + pWidth;
+			p[1].y = pToY - pWidth;
 
-	m[3][0] = 0.0f;
-	m[3][1] = 0.0f;
-	m[3][2] = 0.0f;
-	m[3][3] = 1.0f;
-}
+			p[2].x = pToX + pWidth;
+			p[2].y = pToY + pWidth;
 
-void Matrix::SetRotationZ(float pRoll)
-{
-	float sinZ = std::sin(pRoll * DEGTORAD);
-	float cosZ = std::cos(pRoll * DEGTORAD);
+			p[3].x = pFromX + pWidth;
+			p[3].y = pFromY + pWidth;
 
-	m[0][0] = cosZ;
-	m[0][1] = sinZ;
-	m[0][2] = 0.0f;
-	m[0][3] = 0.0f;
+			p[4].x = pFromX - pWidth;
+			p[4].y = pFromY + pWidth;
 
-	m[1][0] = -sinZ;
-	m[1][1] = cosZ;
-	m[1][2] = 0.0f;
-	m[1][3] = 0.0f;
+			p[5].x = pFromX - pWidth;
+			p[5].y = pFromY - pWidth;
+		}
+		else
+		{
+			p[0].x = pFromX + pWidth;
+			p[0].y = pFromY - pWidth;
 
-	m[2][0] = 0.0f;
-	m[2][1] = 0.0f;
-	m[2][2] = 1.0f;
-	m[2][3] = 0.0f;
+			p[1].x = pFromX + pWidth;
+			p[1].y = pFromY + pWidth;
 
-	m[3][0] = 0.0f;
-	m[3][1] = 0.0f;
-	m[3][2] = 0.0f;
-	m[3][3] = 1.0f;
-}
+			p[2].x = pFromX - pWidth;
+			p[2].y = pFromY + pWidth;
 
-void Matrix::Mul(const Matrix &pA,const Matrix &pB)
-{
-	m[0][0] = (pA.m[0][0]*pB.m[0][0]) + (pA.m[0][1]*pB.m[1][0]) + (pA.m[0][2]*pB.m[2][0]) + (pA.m[0][3]*pB.m[3][0]);
-	m[0][1] = (pA.m[0][0]*pB.m[0][1]) + (pA.m[0][1]*pB.m[1][1]) + (pA.m[0][2]*pB.m[2][1]) + (pA.m[0][3]*pB.m[3][1]);
-	m[0][2] = (pA.m[0][0]*pB.m[0][2]) + (pA.m[0][1]*pB.m[1][2]) + (pA.m[0][2]*pB.m[2][2]) + (pA.m[0][3]*pB.m[3][2]);
-	m[0][3] = (pA.m[0][0]*pB.m[0][3]) + (pA.m[0][1]*pB.m[1][3]) + (pA.m[0][2]*pB.m[2][3]) + (pA.m[0][3]*pB.m[3][3]);
+			p[3].x = pToX - pWidth;
+			p[3].y = pToY + pWidth;
 
-	m[1][0] = (pA.m[1][0]*pB.m[0][0]) + (pA.m[1][1]*pB.m[1][0]) + (pA.m[1][2]*pB.m[2][0]) + (pA.m[1][3]*pB.m[3][0]);
-	m[1][1] = (pA.m[1][0]*pB.m[0][1]) + (pA.m[1][1]*pB.m[1][1]) + (pA.m[1][2]*pB.m[2][1]) + (pA.m[1][3]*pB.m[3][1]);
-	m[1][2] = (pA.m[1][0]*pB.m[0][2]) + (pA.m[1][1]*pB.m[1][2]) + (pA.m[1][2]*pB.m[2][2]) + (pA.m[1][3]*pB.m[3][2]);
-	m[1][3] = (pA.m[1][0]*pB.m[0][3]) + (pA.m[1][1]*pB.m[1][3]) + (pA.m[1][2]*pB.m[2][3]) + (pA.m[1][3]*pB.m[3][3]);
+			p[4].x = pToX - pWidth;
+			p[4].y = pToY - pWidth;
 
-	m[2][0] = (pA.m[2][0]*pB.m[0][0]) + (pA.m[2][1]*pB.m[1][0]) + (pA.m[2][2]*pB.m[2][0]) + (pA.m[2][3]*pB.m[3][0]);
-	m[2][1] = (pA.m[2][0]*pB.m[0][1]) + (pA.m[2][1]*pB.m[1][1]) + (pA.m[2][2]*pB.m[2][1]) + (pA.m[2][3]*pB.m[3][1]);
-	m[2][2] = (pA.m[2][0]*pB.m[0][2]) + (pA.m[2][1]*pB.m[1][2]) + (pA.m[2][2]*pB.m[2][2]) + (pA.m[2][3]*pB.m[3][2]);
-	m[2][3] = (pA.m[2][0]*pB.m[0][3]) + (pA.m[2][1]*pB.m[1][3]) + (pA.m[2][2]*pB.m[2][3]) + (pA.m[2][3]*pB.m[3][3]);
+			p[5].x = pToX + pWidth;
+			p[5].y = pToY - pWidth;			
+		}
 
-	m[3][0] = (pA.m[3][0]*pB.m[0][0]) + (pA.m[3][1]*pB.m[1][0]) + (pA.m[3][2]*pB.m[2][0]) + (pA.m[3][3]*pB.m[3][0]);
-	m[3][1] = (pA.m[3][0]*pB.m[0][1]) + (pA.m[3][1]*pB.m[1][1]) + (pA.m[3][2]*pB.m[2][1]) + (pA.m[3][3]*pB.m[3][1]);
-	m[3][2] = (pA.m[3][0]*pB.m[0][2]) + (pA.m[3][1]*pB.m[1][2]) + (pA.m[3][2]*pB.m[2][2]) + (pA.m[3][3]*pB.m[3][2]);
-	m[3][3] = (pA.m[3][0]*pB.m[0][3]) + (pA.m[3][1]*pB.m[1][3]) + (pA.m[3][2]*pB.m[2][3]) + (pA.m[3][3]*pB.m[3][3]);
+		WriteFanAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,GetFanAsTrianglesCount(6)),p,nullptr,6,PackColour(pRed,pGreen,pBlue,pAlpha));
+	}
 }
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// GLES Shader definition
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-struct GLShader
+void GLES::DrawLineList(const VerticesShortXY& pPoints,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
 {
-	GLShader(const std::string& pName,const char* pVertex, const char* pFragment);
-	~GLShader();
+	TRACE_SCOPE("DrawLineList");
+	const uint32_t colour = PackColour(pRed,pGreen,pBlue,pAlpha);
 
-	int GetUniformLocation(const char* pName);
-	void BindAttribLocation(int location,const char* pName);
-	void Enable(const float projInvcam[4][4]);
-	void SetTransform(float transform[4][4]);
-	void SetGlobalColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha);
-	void SetGlobalColour(float red,float green,float blue,float alpha);
-	void SetTexture(GLint texture);
+	// Sent as quads, broken up if there are more than the batch can take.
+	const size_t numLines = pPoints.size() > 0 ? pPoints.size() - 1 : 0;
+	for( size_t n = 0 ; n < numLines ; )
+	{
+		const size_t count = std::min(numLines - n,Batch2D::MaxVertices / 6);
+		BatchVert2D* verts = Batch2DAppend(mShaders.ColourOnly2D,0,count * 6);
+		for( size_t end = n + count ; n < end ; n++, verts += 6 )
+		{
+			const Vert2Df from = {(float)pPoints[n].x,(float)pPoints[n].y};
+			const Vert2Df to = {(float)pPoints[n+1].x,(float)pPoints[n+1].y};
+			WriteLineAsTriangles(verts,from,to,nullptr,nullptr,colour);
+		}
+	}
+}
 
-	bool GetUsesTexture()const{return mUniforms.tex0 > -1;}
-	bool GetUsesTransform()const{return mUniforms.trans > -1;}
+void GLES::DrawLineList(const VerticesShortXY& pPoints,int pWidth,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+{
+	TRACE_SCOPE("DrawLineList");
+	if( pWidth < 2 )
+	{
+		DrawLineList(pPoints,pRed,pGreen,pBlue,pAlpha);
+	}
+	else
+	{
+		for( size_t n = 0 ; n < pPoints.size() - 1 ; n++ )
+		{
+			DrawLine(pPoints[n].x,pPoints[n].y,pPoints[n+1].x,pPoints[n+1].y,pWidth,pRed,pGreen,pBlue,pAlpha);
+		}
+	}
+}	
 
-	const std::string mName;	//!< Mainly to help debugging.
-	const bool mEnableStreamUV;
-	const bool mEnableStreamTrans;
-	const bool mEnableStreamColour;
+void GLES::Circle(int pCenterX,int pCenterY,int pRadius,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,size_t pNumPoints,bool pFilled)
+{
+	TRACE_SCOPE("Circle");
+	if( pNumPoints < 1 )
+	{
+        pNumPoints = (int)(3 + (std::sqrt(pRadius)*3));
+	}
+	if( pNumPoints > 128 ){pNumPoints = 128;}	// Make sure we don't go silly with number of verts and loose all the FPS.
+	if( pNumPoints < 3 )
+	{// Not enough points to make a shape, and the step below would divide by zero.
+		return;
+	}
 
-	GLint mShader = 0;
-	GLint mVertexShader = 0;
-	GLint mFragmentShader = 0;
-	struct
+	Vert2Df* verts = mWorkBuffers->vertices2Df.Restart(pNumPoints);
+
+	float rad = 0.0;
+	const float step = GetRadian() / (float)(pNumPoints-2);// +2 is because of first triangle.
+	const float r = (float)pRadius;
+	const float x = (float)pCenterX;
+	const float y = (float)pCenterY;
+	for( size_t n = 0 ; n < pNumPoints ; n++, rad += step )
 	{
-		GLint trans;
-		GLint proj_cam;
-		GLint global_colour;
-		GLint tex0;
-	}mUniforms;
+		verts[n].x = x - (r*std::sin(rad));
+		verts[n].y = y + (r*std::cos(rad));
+	}
 
-	int LoadShader(int type, const char* shaderCode);
-};
+	const uint32_t colour = PackColour(pRed,pGreen,pBlue,pAlpha);
+	if( pFilled )
+	{
+		WriteFanAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,GetFanAsTrianglesCount(pNumPoints)),verts,nullptr,pNumPoints,colour);
+	}
+	else
+	{
+		WriteLoopAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,pNumPoints * 6),verts,nullptr,pNumPoints,colour);
+	}
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// DRM Direct Render Manager and EGL definition.
-// Used for more model systems like RPi4 and proper GL / GLES implementations.
-#ifdef PLATFORM_DRM_EGL
-struct PlatformInterface
+void GLES::Rectangle(int pFromX,int pFromY,int pToX,int pToY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,bool pFilled,uint32_t pTexture)
 {
-	bool mIsFirstFrame = true;
-	int mDRMFile = -1;
+	TRACE_SCOPE("Rectangle");
+	const Vert2Df quad[4] = {{(float)pFromX,(float)pFromY},{(float)pToX,(float)pFromY},{(float)pToX,(float)pToY},{(float)pFromX,(float)pToY}};
+	VertShortXY uv[4] = {{0,0},{0x7fff,0},{0x7fff,0x7fff},{0,0x7fff}};// Normalised.
+
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
+	{// Map the uvs to the image in the atlas page.
+		const GLTexture* page = GetValid(mTextures,sub->mTexture,"Atlas page texture");
+		const int16_t u0 = (int16_t)((0x7fff * sub->mX) / page->mWidth);
+		const int16_t v0 = (int16_t)((0x7fff * sub->mY) / page->mHeight);
+		const int16_t u1 = (int16_t)((0x7fff * (sub->mX + sub->mWidth)) / page->mWidth);
+		const int16_t v1 = (int16_t)((0x7fff * (sub->mY + sub->mHeight)) / page->mHeight);
+		uv[0] = {u0,v0};
+		uv[1] = {u1,v0};
+		uv[2] = {u1,v1};
+		uv[3] = {u0,v1};
+		pTexture = sub->mTexture;
+	}
+
+	const TinyShader shader = Select2DShader(pTexture);
+	const uint32_t colour = PackColour(pRed,pGreen,pBlue,pAlpha);
+	if( pFilled )
+	{
+		WriteFanAsTriangles(Batch2DAppend(shader,pTexture,GetFanAsTrianglesCount(4)),quad,uv,4,colour);
+	}
+	else
+	{
+		WriteLoopAsTriangles(Batch2DAppend(shader,pTexture,4 * 6),quad,uv,4,colour);
+	}
+}
 
-	// This is used for the EGL bring up and getting GLES going along with DRM.
-	struct gbm_device *mBufferManager = nullptr;
-	struct gbm_bo *mCurrentFrontBufferObject = nullptr;
+void GLES::RoundedRectangle(int pFromX,int pFromY,int pToX,int pToY,int pRadius,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,bool pFilled)
+{
+	TRACE_SCOPE("RoundedRectangle");
+    size_t numPoints = (int)(7 + (std::sqrt(pRadius)*3));
 
-	drmModeEncoder *mModeEncoder = nullptr;
-	drmModeConnector* mConnector = nullptr;
-	drmModeModeInfo* mModeInfo = nullptr;
-	uint32_t mFOURCC_Format = DRM_FORMAT_INVALID;
-	uint32_t mCurrentFrontBufferID = 0;
+	// Need a multiple of 4 points.
+	numPoints = (numPoints+3)&~3;
+	if( numPoints > 128 ){numPoints = 128;}	// Make sure we don't go silly with number of verts and loose all the FPS.
+	Vert2Df* verts = mWorkBuffers->vertices2Df.Restart(numPoints);
 
-	EGLDisplay mDisplay = nullptr;				//!<GL display
-	EGLSurface mSurface = nullptr;				//!<GL rendering surface
-	EGLContext mContext = nullptr;				//!<GL rendering context
-	EGLConfig mConfig = nullptr;				//!<Configuration of the display.
+	float rad = GetRadian();
+	const float step = GetRadian() / (float)(numPoints-1);
+	const float r = (float)pRadius;
+	Vert2Df* p = verts;
 
-	struct gbm_surface *mNativeWindow = nullptr;
+	pToX -= pRadius;
+	pToY -= pRadius;
+	pFromX += pRadius;
+	pFromY += pRadius;
 
-	/**
-	 * @brief Information about the mouse driver
-	 */
-	struct
+	for( size_t n = 0 ; n < numPoints/4 ; n++ )
 	{
-		int mDevice = 0; //!< File handle to /dev/input/mice
+		p->x = pFromX + (r*std::sin(rad));
+		p->y = pToY + (r*std::cos(rad));
+		p++;
+		rad -= step;
+	}
 
-		/**
-		 * @brief Maintains the current known values. Because we get many messages.
-		 */
-		struct
-		{
-			bool touched = false;
-			int x = 0;
-			int y = 0;
-		}mCurrent;
-	}mPointer;
+	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+	{
+		p->x = pFromX + (r*std::sin(rad));
+		p->y = pFromY + (r*std::cos(rad));
+		p++;
+		rad -= step;
+	}
 
-	PlatformInterface();
-	~PlatformInterface();
+	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+	{
+		p->x = pToX + (r*std::sin(rad));
+		p->y = pFromY + (r*std::cos(rad));
+		p++;
+		rad -= step;
+	}
 
-	int GetWidth()const{assert(mModeInfo);if(mModeInfo){return mModeInfo->hdisplay;}return 0;}
-	int GetHeight()const{assert(mModeInfo);if(mModeInfo){return mModeInfo->vdisplay;}return 0;}
+	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+	{
+		p->x = pToX + (r*std::sin(rad));
+		p->y = pToY + (r*std::cos(rad));
+		p++;
+		rad -= step;
+	}
 
-	/**
-	 * @brief Looks for a mouse device we can used for touch screen input.
-	 * 
-	 * @return int 
-	 */
-	int FindMouseDevice();
+	const uint32_t colour = PackColour(pRed,pGreen,pBlue,pAlpha);
+	if( pFilled )
+	{
+		WriteFanAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,GetFanAsTrianglesCount(numPoints)),verts,nullptr,numPoints,colour);
+	}
+	else
+	{
+		WriteLoopAsTriangles(Batch2DAppend(mShaders.ColourOnly2D,0,numPoints * 6),verts,nullptr,numPoints,colour);
+	}
+}
 
-	/**
-	 * @brief Processes the X11 events then exits when all are done. Returns true if the app is asked to quit.
-	 */
-	bool ProcessEvents(tinygles::GLES::SystemEventHandler pEventHandler);
+void GLES::Blit(uint32_t pTexture,int pX,int pY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+{
+	TRACE_SCOPE("Blit");
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
+	{
+		FillRectangle(pX,pY,pX+sub->mWidth-1,pY+sub->mHeight-1,pRed,pGreen,pBlue,pAlpha,pTexture);
+		return;
+	}
 
+	if( pTexture&STREAMING_TEXTURE_HANDLE_BIT )
+	{
+		FillRectangle(pX,pY,pX+GetTextureWidth(pTexture)-1,pY+GetTextureHeight(pTexture)-1,pRed,pGreen,pBlue,pAlpha,pTexture);
+		return;
+	}
 
-	void InitialiseDisplay();
-	void FindEGLConfiguration();
+	const GLTexture* tex = mTextures.Get(pTexture);
+	if( tex == nullptr )
+	{
+		FillRectangle(pX,pY,pX+128,pY+128,pRed,pGreen,pBlue,pAlpha,mDiagnostics.texture);
+	}
+	else
+	{
 
-	void UpdateCurrentBuffer();
-	void SwapBuffers();
-};
-#endif
+		FillRectangle(pX,pY,pX+tex->mWidth-1,pY+tex->mHeight-1,pRed,pGreen,pBlue,pAlpha,pTexture);
+	}
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// X11 GL emulation hidden definition.
-// Implementation is at the bottom of the source file.
-// This code is intended to allow development on a full desktop system for applications that
-// will eventually be deployed on a minimal linux system without all the X11 + fancy UI rendering bloat.
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-#ifdef PLATFORM_X11_GL
-/**
- * @brief Emulation layer for X11
- * 
- */
-struct PlatformInterface
+// End of primitive draw commands.
+//*******************************************
+// Sprite functions
+uint32_t GLES::SpriteCreate(uint32_t pTexture,float pWidth,float pHeight,float pCX,float pCY,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
 {
-	Display *mXDisplay = nullptr;
-	Window mWindow = 0;
-	Atom mDeleteMessage;
-	GLXContext mGLXContext = 0;
-	XSetWindowAttributes mWindowAttributes;
-	XVisualInfo* mVisualInfo;
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
+	{// The sprite uses the page, with the texture rectangle moved to where the image is.
+		return SpriteCreate(sub->mTexture,pWidth,pHeight,pCX,pCY,pTexFromX + sub->mX,pTexFromY + sub->mY,pTexToX + sub->mX,pTexToY + sub->mY);
+	}
 
-	bool mWindowReady;
+	// Will throw an exception if texture not found, done early on so we don't waste sprint indices.
+	const int texWidth = GetTextureWidth(pTexture);
+	const int texHeight = GetTextureHeight(pTexture);
 
-	PlatformInterface();
-	~PlatformInterface();
+	const uint32_t newSprite = mSprites.Add(std::make_unique<Sprite>());
+	Sprite* s = mSprites.Get(newSprite);
 
-	/**
-	 * @brief Creates the X11 window and all the bits needed to get rendering with.
-	 */
-	void InitialiseDisplay();
+	s->mTexture = pTexture;
+	s->mWidth = pWidth;
+	s->mHeight = pHeight;
+	s->mCX = pCX;
+	s->mCY = pCY;
 
-	/**
-	 * @brief Processes the X11 events then exits when all are done. Returns true if the app is asked to quit.
-	 */
-	bool ProcessEvents(tinygles::GLES::SystemEventHandler pEventHandler);
+	s->BuildVerts();
+	s->BuildUVs(texWidth,texHeight,pTexFromX,pTexFromY,pTexToX,pTexToY);
 
-	/**
-	 * @brief Draws the frame buffer to the X11 window.
-	 */
-	void SwapBuffers();
+	return newSprite;
+}
 
-	int GetWidth()const{return X11_EMULATION_WIDTH;}
-	int GetHeight()const{return X11_EMULATION_HEIGHT;}
+uint32_t GLES::SpriteCreate(uint32_t pTexture,float pWidth,float pHeight,float pCX,float pCY)
+{
+	const float texWidth = GetTextureWidth(pTexture);
+	const float texHeight = GetTextureHeight(pTexture);
+	return SpriteCreate(pTexture,pWidth,pHeight,pCX,pCY,0,0,texWidth,texHeight);
+}
 
-};
-#endif //#ifdef USE_X11_EMULATION
+uint32_t GLES::SpriteCreate(uint32_t pTexture)
+{
+	const float texWidth = GetTextureWidth(pTexture);
+	const float texHeight = GetTextureHeight(pTexture);
+	return SpriteCreate(pTexture,texWidth,texHeight,texWidth / 2.0f,texHeight / 2.0f,0,0,texWidth,texHeight);	
+}
 
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-// GLES Implementation
-///////////////////////////////////////////////////////////////////////////////////////////////////////////
-GLES::GLES(uint32_t pFlags) :
-	mCreateFlags(pFlags),
-	mPlatform(std::make_unique<PlatformInterface>()),
-	mWorkBuffers(std::make_unique<WorkBuffers>())
+void GLES::SpriteDelete(uint32_t pSprite)
 {
-	// Lets hook ctrl + c.
-	mUsersSignalAction = signal(SIGINT,CtrlHandler);
+	mSprites.Erase(pSprite);
+}
 
-	mPhysical.Width = mPlatform->GetWidth();
-	mPhysical.Height = mPlatform->GetHeight();
+void GLES::SpriteDraw(uint32_t pSprite)
+{
+	TRACE_SCOPE("SpriteDraw");
+	assert(mShaders.SpriteShader2D);
+	assert(mShaders.TextureColour2D);
 
-	if( mCreateFlags&ROTATE_FRAME_PORTRATE )
+	const Sprite* sprite = mSprites.Get(pSprite);
+	if( sprite == nullptr )
 	{
-		mCreateFlags &= ~ROTATE_FRAME_PORTRATE;
-		if( mPhysical.Width > mPhysical.Height )
-		{
-			mCreateFlags |= ROTATE_FRAME_BUFFER_90;
-		}
+		STALE_HANDLE_IN_DRAW("SpriteDraw passed a stale or unknown sprite handle");
 	}
 
-	if( mCreateFlags&ROTATE_FRAME_LANDSCAPE )
+	// Sprites drawn with a 2D transform are transformed here and batched, saving a draw call and a uniform upload per sprite.
+	if( GetIsTransform2D(mMatrices.transform) )
 	{
-		mCreateFlags &= ~ROTATE_FRAME_LANDSCAPE;
-		if( mPhysical.Width < mPhysical.Height )
+		BatchVert2D corners[4];
+		TransformQuad2D(corners,sprite->mVert,mMatrices.transform);
+		for( int n = 0 ; n < 4 ; n++ )
 		{
-			mCreateFlags |= ROTATE_FRAME_BUFFER_90;
+			corners[n].u = sprite->mUV.v[n].x;
+			corners[n].v = sprite->mUV.v[n].y;
+			corners[n].rgba = PackColour(255,255,255,255);
+		}
+
+		if( mSpriteBatch->mActive )
+		{
+			memcpy(mSpriteBatch->Append(sprite->mTexture),corners,sizeof(corners));
 		}
+		else
+		{
+			// The 2D batch is a triangle list so the quad goes in as two triangles.
+			BatchVert2D* verts = Batch2DAppend(mShaders.TextureColour2D,sprite->mTexture,6);
+			for( int i : {0,1,2,0,2,3} )
+			{
+				*verts++ = corners[i];
+			}
+		}
+		return;
 	}
 
-	if( mCreateFlags&(ROTATE_FRAME_BUFFER_90|ROTATE_FRAME_BUFFER_270) )
+	DrawCommand draw(mShaders.SpriteShader2D,GL_TRIANGLE_FAN,4);
+	draw.texture = sprite->mTexture;
+	VertexPtr(draw,2,GL_FLOAT,sprite->mVert.data());
+
+	// Because UV's are normalized.
+	draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,4,sprite->mUV.data());
+
+	SubmitDraw(draw);
+}
+
+void GLES::SpriteBatchBegin()
+{
+	mSpriteBatch->mActive = true;
+}
+
+void GLES::SpriteBatchEnd()
+{
+	TRACE_SCOPE("SpriteBatchEnd");
+	auto& spriteBatch = *mSpriteBatch;
+	spriteBatch.mActive = false;
+
+	for( auto& bucket : spriteBatch.mBuckets )
 	{
-		mReported.Width = mPhysical.Height;
-		mReported.Height = mPhysical.Width;
+		const size_t totalQuads = bucket.vertices.size() / mQuadBatch.VerticesPerQuad;
+
+		// Like the quad batches, more quads than the index buffer can address are drawn in chunks.
+		for( size_t first = 0 ; first < totalQuads ; first += mQuadBatch.MaxQuads )
+		{
+			const size_t numQuads = std::min(totalQuads - first,mQuadBatch.MaxQuads);
+			const BatchVert2D* verts = bucket.vertices.data() + (first * mQuadBatch.VerticesPerQuad);
+
+			DrawCommand draw(mShaders.TextureColour2D,GL_TRIANGLES,numQuads * mQuadBatch.IndicesPerQuad);
+			draw.texture = bucket.texture;
+			draw.SetIndices(numQuads * mQuadBatch.VerticesPerQuad,GL_UNSIGNED_SHORT,0,mQuadBatch.IndicesBuffer);
+			draw.SetStream(StreamIndex::VERTEX,2,GL_FLOAT,GL_FALSE,sizeof(BatchVert2D),&verts->x);
+			draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,sizeof(BatchVert2D),&verts->u);
+			draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(BatchVert2D),&verts->rgba);
+			draw.interleaved = true;
+			SubmitDraw(draw);
+		}
+		bucket.vertices.clear();
 	}
-	else
-	{
-		mReported.Width = mPhysical.Width;
-		mReported.Height = mPhysical.Height;
+}
+
+void GLES::SpriteSetCenter(uint32_t pSprite,float pCX,float pCY)
+{
+	Sprite* sprite = GetValid(mSprites,pSprite,"Sprite");
+	sprite->mCX = pCX;
+	sprite->mCY = pCY;
+	sprite->BuildVerts();
+}
+
+uint32_t GLES::QuadBatchCreate(uint32_t pTexture,int pCount,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+{
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
+	{// The batch uses the page, frames added later are also moved to where the image is.
+		const uint32_t newBatch = QuadBatchCreate(sub->mTexture,pCount,pTexFromX + sub->mX,pTexFromY + sub->mY,pTexToX + sub->mX,pTexToY + sub->mY);
+		mQuadBatch.Batchs.Get(newBatch)->SetFrameOffset(sub->mX,sub->mY);
+		return newBatch;
 	}
 
-	VERBOSE_MESSAGE("Physical display resolution is " << mPhysical.Width << "x" << mPhysical.Height );
+	// Will throw an exception if texture not found, done early on so we don't waste sprint indices.
+	const int texWidth = GetTextureWidth(pTexture);
+	const int texHeight = GetTextureHeight(pTexture);
 
-	mPlatform->InitialiseDisplay();
+	return mQuadBatch.Batchs.Add(std::make_unique<QuadBatch>(*mStateCache,pCount,pTexture,texWidth,texHeight,pTexFromX,pTexFromY,pTexToX,pTexToY));
+}
 
-	SetRenderingDefaults();
-	BuildShaders();
-	BuildDebugTexture();
-	BuildPixelFontTexture();
-	InitFreeTypeFont();
-	AllocateQuadBuffers();
+uint32_t GLES::QuadBatchCreate(uint32_t pTexture,int pCount)
+{
+	const float texWidth = GetTextureWidth(pTexture);
+	const float texHeight = GetTextureHeight(pTexture);
+	return QuadBatchCreate(pTexture,pCount,0,0,texWidth,texHeight);
+}
 
-	VERBOSE_MESSAGE("GLES Ready");
+void GLES::QuadBatchDelete(uint32_t pQuadBatch)
+{
+	if( mQuadBatch.Batchs.Get(pQuadBatch) )
+	{
+		FlushDeferredDraws();// Recorded draws may use it's buffer.
+		mQuadBatch.Batchs.Erase(pQuadBatch);
+	}
+}
+
+void GLES::QuadBatchDraw(uint32_t pQuadBatch)
+{
+	const QuadBatch* batch = mQuadBatch.Batchs.Get(pQuadBatch);
+	if( batch == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("QuadBatchDraw passed a stale or unknown quad batch handle");
+	}
+	QuadBatchDraw(pQuadBatch,0,batch->GetNumQuads());
 }
 
-GLES::~GLES()
+void GLES::QuadBatchDraw(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex)
 {
-	VERBOSE_MESSAGE("GLES destructor called");
+	TRACE_SCOPE("QuadBatchDraw");
+	if( pToIndex <= pFromIndex )
+	{
+		return;// Allow this as their code may use this case at the start or end of an effect.
+	}
 
-	VERBOSE_MESSAGE("On exit the following scratch memory buffers reached the sizes of...");
-	VERBOSE_MESSAGE("    mWorkBuffers.vertices2Df " << mWorkBuffers->vertices2Df.MemoryUsed() << " bytes");
-	VERBOSE_MESSAGE("    mWorkBuffers.vertices2DShort " << mWorkBuffers->vertices2DShort.MemoryUsed() << " bytes");
-	VERBOSE_MESSAGE("    mWorkBuffers.uvShort " << mWorkBuffers->uvShort.MemoryUsed() << " bytes");
+	assert(mShaders.QuadBatchShader2D);
 
-	glBindTexture(GL_TEXTURE_2D,0);
-	CHECK_OGL_ERRORS();
+	auto QuadBatch = mQuadBatch.Batchs.Get(pQuadBatch);
+	if( QuadBatch == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("QuadBatchDraw passed a stale or unknown quad batch handle");
+	}
 
-	// Kill shaders.
-	VERBOSE_MESSAGE("Deleting shaders");
+	assert( pFromIndex < QuadBatch->GetNumQuads() );
+	assert( pToIndex <= QuadBatch->GetNumQuads() );
 
-	glUseProgram(0);
-	CHECK_OGL_ERRORS();
+	// When deferred, a draw made earlier this frame reads the buffer when the frame ends. So if the quads have
+	// changed since then this draw takes a copy of them and the buffer is updated on the next frame.
+	const bool copyQuads = mDeferred->mEnabled && QuadBatch->mDrawnFrame == mDiagnostics.frameNumber && QuadBatch->GetIsDirty();
+	if( copyQuads == false )
+	{
+		QuadBatch->Upload();
+	}
+	QuadBatch->mDrawnFrame = mDiagnostics.frameNumber;
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
-	glDeleteBuffers(1,&mQuadBatch.IndicesBuffer);
+	// With instancing the whole range is one draw, the quad's corners come from the first four vertices and the rest is per instance.
+	// Data copied because of deferred rendering is per vertex so is drawn the old way.
+	if( QuadBatch->mInstanced && copyQuads == false )
+	{
+		assert(mShaders.QuadBatchInstancedShader2D);
+		const size_t first = pFromIndex;
+		const size_t numQuads = pToIndex - pFromIndex;
 
-	mShaders.CurrentShader.reset();
-	mShaders.ColourOnly2D.reset();
-	mShaders.TextureColour2D.reset();
-	mShaders.TextureAlphaOnly2D.reset();
-	mShaders.SpriteShader2D.reset();
-	mShaders.QuadBatchShader2D.reset();
+		DrawCommand draw(mShaders.QuadBatchInstancedShader2D,GL_TRIANGLES,mQuadBatch.IndicesPerQuad);
+		draw.texture = QuadBatch->mTexture;
+		draw.SetIndices(mQuadBatch.VerticesPerQuad,GL_UNSIGNED_SHORT,0,mQuadBatch.IndicesBuffer);
 
-	mShaders.ColourOnly3D.reset();
-	mShaders.TextureOnly3D.reset();
+		draw.SetStream(StreamIndex::VERTEX,2,GL_BYTE,GL_TRUE,0,0,mQuadBatch.VerticesBuffer);
+		draw.SetStream(StreamIndex::TEXCOORD,4,GL_SHORT,GL_TRUE,0,(const void*)(first * QuadBatch->GetUVStride()),QuadBatch->mBuffer);
+		draw.SetStream(StreamIndex::TRANSFORM,4,GL_SHORT,GL_FALSE,0,(const void*)(QuadBatch->GetTransformsOffset() + (first * QuadBatch->GetTransformStride())),QuadBatch->mBuffer);
+		if( QuadBatch->GetHasColours() )
+		{
+			draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,0,(const void*)(QuadBatch->GetColoursOffset() + (first * QuadBatch->GetColourStride())),QuadBatch->mBuffer);
+		}
+		draw.SetInstanced(numQuads,{StreamIndex::TEXCOORD,StreamIndex::TRANSFORM,StreamIndex::COLOUR});
 
+		SubmitDraw(draw);
+		return;
+	}
 
-	// delete all free type fonts.
-#ifdef USE_FREETYPEFONTS
-	mFreeTypeFonts.clear();
-	if( mFreetype != nullptr )
+	// The index buffer is 16 bit so can only address MaxQuads quads. Larger ranges are drawn in chunks, the same indices
+	// are used for each chunk with the other streams offset to the first quad of the chunk.
+	for( size_t first = pFromIndex ; first < pToIndex ; first += mQuadBatch.MaxQuads )
 	{
-		if( FT_Done_FreeType(mFreetype) == FT_Err_Ok )
+		const size_t numQuads = std::min(pToIndex - first,mQuadBatch.MaxQuads);
+
+		DrawCommand draw(mShaders.QuadBatchShader2D,GL_TRIANGLES,numQuads * mQuadBatch.IndicesPerQuad);
+		draw.texture = QuadBatch->mTexture;
+		draw.SetIndices(numQuads * mQuadBatch.VerticesPerQuad,GL_UNSIGNED_SHORT,0,mQuadBatch.IndicesBuffer);
+
+		draw.SetStream(StreamIndex::VERTEX,2,GL_BYTE,GL_TRUE,0,0,mQuadBatch.VerticesBuffer);
+
+		if( copyQuads )
 		{
-			mFreetype = nullptr;
-			VERBOSE_MESSAGE("Freetype font library deleted");
+			// Because UV's are normalized.
+			draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,0,QuadBatch->mUVs.data() + first);
+			draw.SetStream(StreamIndex::TRANSFORM,4,GL_SHORT,GL_FALSE,0,QuadBatch->mTransforms.data() + first);
+			if( QuadBatch->GetHasColours() )
+			{
+				draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,0,QuadBatch->mColours.data() + first);
+			}
+		}
+		else
+		{
+			draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,0,(const void*)(first * sizeof(Quad2D)),QuadBatch->mBuffer);
+			draw.SetStream(StreamIndex::TRANSFORM,4,GL_SHORT,GL_FALSE,0,(const void*)(QuadBatch->GetTransformsOffset() + (first * sizeof(QuadBatchTransform))),QuadBatch->mBuffer);
+			if( QuadBatch->GetHasColours() )
+			{
+				draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,0,(const void*)(QuadBatch->GetColoursOffset() + (first * sizeof(QuadBatchColour))),QuadBatch->mBuffer);
+			}
 		}
-	}
-#endif
 
-	// delete all textures.
-	for( auto& t : mTextures )
-	{
-		glDeleteTextures(1,&t.first);
-		CHECK_OGL_ERRORS();
+		SubmitDraw(draw);
 	}
-
-	VERBOSE_MESSAGE("All done");
 }
 
-bool GLES::BeginFrame()
+std::vector<QuadBatchTransform>& GLES::QuadBatchGetTransform(uint32_t pQuadBatch)
 {
-	mDiagnostics.frameNumber++;
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	QuadBatch->mDirtyTransforms.Set(0,QuadBatch->GetNumQuads());
+	return QuadBatch->mTransforms;
+}
 
-	// Reset some items so that we have a working render setup to begin the frame with.
-	// This is done so that I don't have to have a load of if statements to deal with first frame. Also makes life simpler for the more minimal applications.
-	EnableShader(mShaders.ColourOnly2D);
-	SetTransformIdentity();
+QuadBatchTransform* GLES::QuadBatchGetTransform(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex)
+{
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	assert( pFromIndex <= pToIndex );
+	assert( pToIndex <= QuadBatch->GetNumQuads() );
 
-	return GLES::mKeepGoing;
+	QuadBatch->mDirtyTransforms.Set(pFromIndex,pToIndex);
+	return QuadBatch->mTransforms.data() + pFromIndex;
 }
 
-void GLES::EndFrame()
+void GLES::QuadBatchSetTransforms(uint32_t pQuadBatch,size_t pFromIndex,size_t pCount,const float* pX,const float* pY,const float* pRotation,const float* pSize)
 {
-	glFlush();// This makes sure the display is fully up to date before we allow them to interact with any kind of UI. This is the specified use of this function.
-	mPlatform->SwapBuffers();
-	ProcessSystemEvents();
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	if( pFromIndex + pCount > QuadBatch->GetNumQuads() )
+	{
+		THROW_MEANINGFUL_EXCEPTION("QuadBatchSetTransforms quad range passes the end of the batch, batch has " + std::to_string(QuadBatch->GetNumQuads()) + " quads");
+	}
+	assert( pX && pY && pRotation && pSize );
+
+	FillQuadBatchTransforms(QuadBatch->mTransforms.data() + pFromIndex,pX,pY,pRotation,pSize,pCount);
+	QuadBatch->mDirtyTransforms.Set(pFromIndex,pFromIndex + pCount);
 }
 
-void GLES::Clear(uint8_t pRed,uint8_t pGreen,uint8_t pBlue)
+void GLES::QuadBatchSetDirty(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex)
 {
-	glClearColor((float)pRed / 255.0f,(float)pGreen / 255.0f,(float)pBlue / 255.0f,1.0f);
-	glClear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
-	CHECK_OGL_ERRORS();
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	QuadBatch->mDirtyTransforms.Set(pFromIndex,pToIndex);
+	if( QuadBatch->GetHasColours() )
+	{
+		QuadBatch->mDirtyColours.Set(pFromIndex,pToIndex);
+	}
 }
 
-void GLES::Clear(uint32_t pTexture)
+std::vector<QuadBatchColour>& GLES::QuadBatchGetColour(uint32_t pQuadBatch)
 {
-	glClear(GL_DEPTH_BUFFER_BIT);
-	CHECK_OGL_ERRORS();
-	FillRectangle(0,0,GetWidth(),GetHeight(),pTexture);
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	QuadBatchGetColour(pQuadBatch,0,QuadBatch->GetNumQuads());
+	return QuadBatch->mColours;
 }
 
-void GLES::Begin2D()
+QuadBatchColour* GLES::QuadBatchGetColour(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex)
 {
-	// Setup 2D frustum
-	memset(mMatrices.projection,0,sizeof(mMatrices.projection));
-	mMatrices.projection[3][3] = 1;
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	assert( pFromIndex <= pToIndex );
+	assert( pToIndex <= QuadBatch->GetNumQuads() );
 
-	if( mCreateFlags&ROTATE_FRAME_BUFFER_90 )
-	{
-		mMatrices.projection[0][1] = -2.0f / (float)mPhysical.Height;
-		mMatrices.projection[1][0] = -2.0f / (float)mPhysical.Width;
-				
-		mMatrices.projection[3][0] = 1;
-		mMatrices.projection[3][1] = 1;
-	}
-	else if( mCreateFlags&ROTATE_FRAME_BUFFER_180 )
+	if( QuadBatch->GetHasColours() == false )
 	{
-		mMatrices.projection[0][0] = -2.0f / (float)mPhysical.Width;
-		mMatrices.projection[1][1] = 2.0f / (float)mPhysical.Height;
-				
-		mMatrices.projection[3][0] = 1;
-		mMatrices.projection[3][1] = -1;
+		// Making room for the colours reallocates the buffer, recorded draws may still need what is in it.
+		if( QuadBatch->mDrawnFrame == mDiagnostics.frameNumber )
+		{
+			FlushDeferredDraws();
+		}
+		QuadBatch->EnableColours();
 	}
-	else if( mCreateFlags&ROTATE_FRAME_BUFFER_270 )
+
+	QuadBatch->mDirtyColours.Set(pFromIndex,pToIndex);
+	return QuadBatch->mColours.data() + pFromIndex;
+}
+
+uint32_t GLES::QuadBatchAddFrame(uint32_t pQuadBatch,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+{
+	QuadBatch* batch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	return (uint32_t)batch->AddFrame(pTexFromX + batch->mFrameOffsetX,pTexFromY + batch->mFrameOffsetY,pTexToX + batch->mFrameOffsetX,pTexToY + batch->mFrameOffsetY);
+}
+
+void GLES::QuadBatchSetFrames(uint32_t pQuadBatch,size_t pFromIndex,const uint16_t* pFrames,size_t pCount)
+{
+	auto QuadBatch = GetValid(mQuadBatch.Batchs,pQuadBatch,"Quad batch");
+	if( pFromIndex + pCount > QuadBatch->GetNumQuads() )
 	{
-		mMatrices.projection[0][1] = 2.0f / (float)mPhysical.Height;
-		mMatrices.projection[1][0] = 2.0f / (float)mPhysical.Width;
-				
-		mMatrices.projection[3][0] = -1;
-		mMatrices.projection[3][1] = -1;
+		THROW_MEANINGFUL_EXCEPTION("QuadBatchSetFrames quad range passes the end of the batch, batch has " + std::to_string(QuadBatch->GetNumQuads()) + " quads");
 	}
-	else
+
+	const size_t numFrames = QuadBatch->mFrames.size();
+	Quad2D* uv = QuadBatch->mUVs.data() + pFromIndex;
+	for( size_t n = 0 ; n < pCount ; n++ )
 	{
-		mMatrices.projection[0][0] = 2.0f / (float)mPhysical.Width;
-		mMatrices.projection[1][1] = -2.0f / (float)mPhysical.Height;
-		mMatrices.projection[3][0] = -1;
-		mMatrices.projection[3][1] = 1;
+		if( pFrames[n] >= numFrames )
+		{
+			THROW_MEANINGFUL_EXCEPTION("QuadBatchSetFrames frame index " + std::to_string(pFrames[n]) + " is out of range, batch has " + std::to_string(numFrames) + " frames");
+		}
+		uv[n] = QuadBatch->mFrames[pFrames[n]];
 	}
+	QuadBatch->mDirtyUVs.Set(pFromIndex,pFromIndex + pCount);
+}
 
-	// No Depth buffer in 2D
-	glDisable(GL_DEPTH_TEST);
-	glDepthFunc(GL_ALWAYS);
-	glDepthMask(false);
+//*******************************************
+// Primitive rendering functions for user defined shapes
+void GLES::RenderTriangles(const VerticesXYZC& pVertices)
+{
+	TRACE_SCOPE("RenderTriangles");
+	DrawCommand draw(mShaders.ColourOnly3D,GL_TRIANGLES,pVertices.size());
+
+	const uint8_t* verts = (const uint8_t*)pVertices.data();
+	const uint8_t* c = verts + (sizeof(float)*3);
 
+	draw.SetStream(StreamIndex::VERTEX,3,GL_FLOAT,GL_FALSE,sizeof(VertXYZC),verts);
+	draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(VertXYZC),c);
+	draw.interleaved = true;
+
+	SubmitDraw(draw);
 }
 
-void GLES::Begin3D(float pFov, float pNear, float pFar)
+void GLES::RenderTriangles(const VerticesXYZUV& pVertices,uint32_t pTexture)
 {
-	const float cotangent = 1.0f / tanf(DegreeToRadian(pFov));
-	const float q = pFar / (pFar - pNear);
-	const float aspect = GetDisplayAspectRatio();
+	TRACE_SCOPE("RenderTriangles");
+	if(pTexture == 0)
+	{
+		pTexture = mDiagnostics.texture;
+	}
 
-	memset(mMatrices.projection,0,sizeof(mMatrices.projection));
+	DrawCommand draw(mShaders.TextureOnly3D,GL_TRIANGLES,pVertices.size());
+	draw.texture = pTexture;
 
-	mMatrices.projection[0][0] = cotangent;
+	const uint8_t* verts = (const uint8_t*)pVertices.data();
+	const uint8_t* c = verts + (sizeof(float)*3);
 
-	mMatrices.projection[1][1] = aspect * cotangent;
+	draw.SetStream(StreamIndex::VERTEX,3,GL_FLOAT,GL_FALSE,sizeof(VertXYZUV),verts);
+	draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,sizeof(VertXYZUV),c);
+	draw.interleaved = true;
 
-	mMatrices.projection[2][2] = q;
-	mMatrices.projection[2][3] = 1.0f;
+	SubmitDraw(draw);
+}
 
-	mMatrices.projection[3][2] = -q * pNear;
+//*******************************************
+// Texture functions
+uint32_t GLES::CreateTexture(int pWidth,int pHeight,const uint8_t* pPixels,TextureFormat pFormat,bool pFiltered,bool pGenerateMipmaps)
+{
+	TRACE_SCOPE("CreateTexture");
+	int srcBytesPerPixel = TextureFormatToBytesPerPixel(pFormat);
+	if( pFormat == TextureFormat::FORMAT_16BIT_AUTO )
+	{
+		if( pPixels == nullptr )
+		{
+			THROW_MEANINGFUL_EXCEPTION("CreateTexture passed FORMAT_16BIT_AUTO without pixels, the format is picked by looking at them");
+		}
+		pFormat = Choose16BitFormat(pPixels,(size_t)pWidth * pHeight);
+		srcBytesPerPixel = 4;
+	}
 
-	if( mCreateFlags&ROTATE_FRAME_BUFFER_90 )
+	const GLint format = TextureFormatToGLFormat(pFormat);
+	if( format == GL_INVALID_ENUM )
 	{
-		mMatrices.projection[0][1] = -mMatrices.projection[0][0];
-		mMatrices.projection[0][0] = 0.0f;
+		THROW_MEANINGFUL_EXCEPTION("CreateTexture passed an unknown texture format, I can not continue.");
+	}
 
-		mMatrices.projection[1][0] = mMatrices.projection[1][1];
-		mMatrices.projection[1][1] = 0.0f;
+	const bool compressed = GetIsCompressedFormat(pFormat);
+	if( compressed )
+	{
+		if( GetTextureFormatSupported(pFormat) == false )
+		{
+			THROW_MEANINGFUL_EXCEPTION("CreateTexture passed " + std::string(TextureFormatToString(pFormat)) + " which this GPU does not support, check with GetTextureFormatSupported first");
+		}
+
+		if( pPixels == nullptr || pGenerateMipmaps )
+		{
+			THROW_MEANINGFUL_EXCEPTION("CreateTexture passed a compressed format without it's data or asked for mipmaps, compressed textures can not be filled or have mipmaps made by GL");
+		}
 	}
-	else if( mCreateFlags&ROTATE_FRAME_BUFFER_180 )
+
+	GLuint newTexture;
+	glGenTextures(1,&newTexture);
+	CHECK_OGL_ERRORS();
+	if( newTexture == 0 )
 	{
-		mMatrices.projection[0][0] = -mMatrices.projection[0][0];
-		mMatrices.projection[1][1] = -mMatrices.projection[1][1];
+		THROW_MEANINGFUL_EXCEPTION("Failed to create texture, glGenTextures returned zero");
 	}
-	else if( mCreateFlags&ROTATE_FRAME_BUFFER_270 )
+
+	const size_t bytes = GetTextureBytes(pFormat,pWidth,pHeight,pGenerateMipmaps && pPixels != nullptr);
+	EnforceTextureBudget(bytes);
+
+	const uint32_t handle = mTextures.Add(std::make_unique<GLTexture>(newTexture,pFormat,pWidth,pHeight,srcBytesPerPixel));
+	GLTexture* tex = mTextures.Get(handle);
+	tex->mBytes = bytes;
+	tex->mMipmaps = pGenerateMipmaps && pPixels != nullptr;
+	tex->mLastUsedFrame = mDiagnostics.frameNumber;
+	mTextureMemory.Used += bytes;
+
+	mStateCache->BindTexture(0,newTexture);
+	CHECK_OGL_ERRORS();
+
+	if( compressed )
 	{
-		mMatrices.projection[0][1] = mMatrices.projection[0][0];
-		mMatrices.projection[0][0] = 0.0f;
+		// Where only ETC2 is supported ETC1 is uploaded as ETC2, it's a super set of ETC1.
+		const GLenum internalFormat = (pFormat == TextureFormat::FORMAT_ETC1 && mCompressedFormats.ETC1 == false) ? GL_COMPRESSED_RGB8_ETC2 : format;
+		glCompressedTexImage2D(
+			GL_TEXTURE_2D,
+			0,
+			internalFormat,
+			pWidth,
+			pHeight,
+			0,
+			GetCompressedImageSize(pFormat,pWidth,pHeight),
+			pPixels);
+	}
+	else
+	{
+		glTexImage2D(
+			GL_TEXTURE_2D,
+			0,
+			format,
+			pWidth,
+			pHeight,
+			0,
+			format,
+			TextureFormatToGLType(pFormat),
+			ConvertPixelsForUpload(pFormat,srcBytesPerPixel,pWidth,pHeight,pPixels));
+	}
 
-		mMatrices.projection[1][0] = -mMatrices.projection[1][1];
-		mMatrices.projection[1][1] = 0.0f;
+	if( pPixels != nullptr )
+	{
+		mStateCache->mBytesUploaded += GetTextureBytes(pFormat,pWidth,pHeight,false);
 	}
+	CHECK_OGL_ERRORS();
 
-	// Depth buffer please
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
-	glDepthMask(GL_TRUE);
+	// Unlike GLES 1.1 this is called after texture creation, in GLES 1.1 you say that you want glTexImage2D to make the mips.
+	// Don't call if we don't yet have pixels. Will be called when you fill the texture.
+	if( pPixels != nullptr )
+	{
+		if( pGenerateMipmaps )
+		{
+			glGenerateMipmap(GL_TEXTURE_2D);
+			CHECK_OGL_ERRORS();
+			if( pFiltered )
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			}
+			else
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			}
+		}
+		else
+		{
+			if( pFiltered )
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			}
+			else
+			{
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			}
+		}
+	}
 
-}
+	// If it's alpha only we need to set the texture swizzle for RGB to one.
+	// Leaving in for when I add GLES 3.0 support. But for now, grump, need two textures.
+	// GL_TEXTURE_SWIZZLE_R not supported in GLES 2.0
+	/*
+	if( format == GL_ALPHA )
+	{
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_R,GL_ONE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_G,GL_ONE);
+		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_B,GL_ONE);
+	}
+	*/
 
-void GLES::SetTransform(float pTransform[4][4])
-{
-	assert(mShaders.CurrentShader);
-	memcpy(mMatrices.transform,pTransform,sizeof(float) * 4 * 4);
-	mShaders.CurrentShader->SetTransform(pTransform);
+	CHECK_OGL_ERRORS();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	CHECK_OGL_ERRORS();// Left bound, the state cache knows and it may well be drawn with next.
+
+	VERBOSE_MESSAGE("Texture " << handle << " created with GL name " << newTexture << ", " << pWidth << "x" << pHeight << " Format = " << TextureFormatToString(pFormat) << " Mipmaps = " << (pGenerateMipmaps?"true":"false") << " Filtered = " << (pFiltered?"true":"false"));
+
+
+	return handle;
 }
 
-void GLES::SetTransform(float x,float y,float z)
+uint32_t GLES::CreateTextureFromKTX(const uint8_t* pData,size_t pSize,bool pFiltered)
 {
-	float transOnly[4][4] =
-	{
-		{1,0,0,0},
-		{0,1,0,0},
-		{0,0,1,0},
-		{x,y,z,1}
+	TRACE_SCOPE("CreateTextureFromKTX");
+	// The KTX 1.1 header, all values are in the endianness of the writer. The tool writes little endian, like all the hardware we run on.
+	struct KTXHeader
+	{
+		uint8_t identifier[12];
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
 	};
-	SetTransform(transOnly);
-}
+	static const uint8_t KTXIdentifier[12] = {0xAB,'K','T','X',' ','1','1',0xBB,'\r','\n',0x1A,'\n'};
 
-void GLES::SetTransformIdentity()
-{
-	static float identity[4][4] = {{1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1}};
-	SetTransform(identity);
-}
+	KTXHeader header;
+	if( pData == nullptr || pSize < sizeof(header) )
+	{
+		THROW_MEANINGFUL_EXCEPTION("CreateTextureFromKTX passed too little data to be a KTX file");
+	}
+	memcpy(&header,pData,sizeof(header));
 
-void GLES::SetTransform2D(float pX,float pY,float pRotation,float pScale)
-{
-	float trans[4][4] =
+	if( memcmp(header.identifier,KTXIdentifier,sizeof(KTXIdentifier)) != 0 || header.endianness != 0x04030201 )
 	{
-		{cos(pRotation)*pScale,sin(pRotation)*pScale,0,0},
-		{-sin(pRotation)*pScale,cos(pRotation)*pScale,0,0},
-		{0,0,pScale,0},
-		{pX,pY,0,1}
-	};
-	SetTransform(trans);
-}
+		THROW_MEANINGFUL_EXCEPTION("CreateTextureFromKTX passed data that is not a KTX 1.1 file or is big endian");
+	}
 
-void GLES::OnApplicationExitRequest()
-{
-	VERBOSE_MESSAGE("Exit request from user, quitting application");
-	mKeepGoing = false;
-	if( mSystemEventHandler != nullptr )
+	if( header.pixelDepth > 1 || header.numberOfArrayElements > 0 || header.numberOfFaces != 1 || header.pixelWidth == 0 || header.pixelHeight == 0 )
 	{
-		SystemEventData data(SystemEventType::EXIT_REQUEST);
-		mSystemEventHandler(data);
+		THROW_MEANINGFUL_EXCEPTION("CreateTextureFromKTX passed a KTX file that is not a 2D texture, arrays, cube maps and 3D textures are not supported");
 	}
-}
 
-//*******************************************
-// Primitive draw commands.
-void GLES::DrawLine(int pFromX,int pFromY,int pToX,int pToY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
-{
-	const int16_t quad[4] = {(int16_t)pFromX,(int16_t)pFromY,(int16_t)pToX,(int16_t)pToY};
+	TextureFormat format;
+	switch( header.glInternalFormat )
+	{
+	case GL_ETC1_RGB8_OES:
+		format = TextureFormat::FORMAT_ETC1;
+		break;
 
-	EnableShader(mShaders.ColourOnly2D);
-	mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
+	case GL_COMPRESSED_RGB8_ETC2:
+		format = TextureFormat::FORMAT_ETC2_RGB;
+		break;
 
-	VertexPtr(2,GL_SHORT,quad);
-	glDrawArrays(GL_LINES,0,2);
-	CHECK_OGL_ERRORS();
-}
+	case GL_COMPRESSED_RGBA8_ETC2_EAC:
+		format = TextureFormat::FORMAT_ETC2_RGBA;
+		break;
 
-void GLES::DrawLine(int pFromX,int pFromY,int pToX,int pToY,int pWidth,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
-{
-	if( pWidth < 2 )
-	{
-		DrawLine(pFromX,pFromY,pToX,pToY,pRed,pGreen,pBlue);
+	default:
+		THROW_MEANINGFUL_EXCEPTION("CreateTextureFromKTX passed a KTX file with an internal format of " + std::to_string(header.glInternalFormat) + ", only the ETC formats are supported");
 	}
-	else
-	{
-		pWidth /= 2;
-		VertShortXY p[6];
 
-		if( pFromY < pToY )
+	// Skip the key value data and walk the mip levels, each is it's size then it's data padded to four bytes.
+	const uint32_t numLevels = std::max(header.numberOfMipmapLevels,1u);
+	size_t offset = sizeof(header) + header.bytesOfKeyValueData;
+	std::vector<std::pair<const uint8_t*,size_t>> levels;
+	for( uint32_t level = 0 ; level < numLevels ; level++ )
+	{
+		const int width = std::max(header.pixelWidth >> level,1u);
+		const int height = std::max(header.pixelHeight >> level,1u);
+		uint32_t imageSize = 0;
+		if( offset + sizeof(imageSize) <= pSize )
 		{
-			std::swap(pFromY,pToY);
-			std::swap(pFromX,pToX);
+			memcpy(&imageSize,pData + offset,sizeof(imageSize));
+			offset += sizeof(imageSize);
 		}
 
-		if( pFromX < pToX )
+		if( imageSize != GetCompressedImageSize(format,width,height) || offset + imageSize > pSize )
 		{
-			p[0].x = pToX - pWidth;
-			p[0].y = pToY - pWidth;
-
-			p[1].x = pToX + pWidth;
-			p[1].y = pToY - pWidth;
-
-			p[2].x = pToX + pWidth;
-			p[2].y = pToY + pWidth;
-
-			p[3].x = pFromX + pWidth;
-			p[3].y = pFromY + pWidth;
-
-			p[4].x = pFromX - pWidth;
-			p[4].y = pFromY + pWidth;
-
-			p[5].x = pFromX - pWidth;
-			p[5].y = pFromY - pWidth;
+			THROW_MEANINGFUL_EXCEPTION("CreateTextureFromKTX passed a KTX file that is truncated or has the wrong size for mip level " + std::to_string(level));
 		}
-		else
-		{
-			p[0].x = pFromX + pWidth;
-			p[0].y = pFromY - pWidth;
-
-			p[1].x = pFromX + pWidth;
-			p[1].y = pFromY + pWidth;
-
-			p[2].x = pFromX - pWidth;
-			p[2].y = pFromY + pWidth;
-
-			p[3].x = pToX - pWidth;
-			p[3].y = pToY + pWidth;
 
-			p[4].x = pToX - pWidth;
-			p[4].y = pToY - pWidth;
+		levels.emplace_back(pData + offset,imageSize);
+		offset += (imageSize + 3) & ~3;
+	}
 
-			p[5].x = pToX + pWidth;
-			p[5].y = pToY - pWidth;			
+	const uint32_t texture = CreateTexture(header.pixelWidth,header.pixelHeight,levels[0].first,format,pFiltered);
+	if( levels.size() > 1 )
+	{
+		// CreateTexture left it bound.
+		const GLenum internalFormat = (format == TextureFormat::FORMAT_ETC1 && mCompressedFormats.ETC1 == false) ? GL_COMPRESSED_RGB8_ETC2 : TextureFormatToGLFormat(format);
+		for( size_t level = 1 ; level < levels.size() ; level++ )
+		{
+			const int width = std::max(header.pixelWidth >> level,1u);
+			const int height = std::max(header.pixelHeight >> level,1u);
+			glCompressedTexImage2D(GL_TEXTURE_2D,level,internalFormat,width,height,0,levels[level].second,levels[level].first);
+			mStateCache->mBytesUploaded += levels[level].second;
+			CHECK_OGL_ERRORS();
 		}
-
-		EnableShader(mShaders.ColourOnly2D);
-		mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
-
-		VertexPtr(2,GL_SHORT,p);
-		glDrawArrays(GL_TRIANGLE_FAN,0,6);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, pFiltered ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST);
 		CHECK_OGL_ERRORS();
-	}
-}
 
-void GLES::DrawLineList(const VerticesShortXY& pPoints,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
-{
-	EnableShader(mShaders.ColourOnly2D);
-	mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
+		GLTexture* tex = mTextures.Get(texture);
+		mTextureMemory.Used -= tex->mBytes;
+		tex->mBytes = GetTextureBytes(format,header.pixelWidth,header.pixelHeight,true);
+		tex->mMipmaps = true;
+		mTextureMemory.Used += tex->mBytes;
+	}
 
-	VertexPtr(2,GL_SHORT,pPoints.data());
-	glDrawArrays(GL_LINE_STRIP,0,pPoints.size());
-	CHECK_OGL_ERRORS();
+	VERBOSE_MESSAGE("KTX texture " << texture << " has " << levels.size() << " mip levels");
+	return texture;
 }
 
-void GLES::DrawLineList(const VerticesShortXY& pPoints,int pWidth,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+void GLES::FillTexture(uint32_t pTexture,int pX,int pY,int pWidth,int pHeight,const uint8_t* pPixels,TextureFormat pFormat,bool pGenerateMips)
 {
-	if( pWidth < 2 )
-	{
-		DrawLineList(pPoints,pRed,pGreen,pBlue,pAlpha);
-	}
-	else
-	{
-		for( size_t n = 0 ; n < pPoints.size() - 1 ; n++ )
+	TRACE_SCOPE("FillTexture");
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
+	{// Write to where the image is in it's page.
+		pTexture = sub->mTexture;
+		pX += sub->mX;
+		pY += sub->mY;
+	}
+
+	GLTexture* tex = GetValid(mTextures,pTexture,"FillTexture texture");
+
+	FlushDeferredDraws();// Recorded draws must see the texture as it was when they were made.
+	UseTexture(pTexture);// Only part may be filled, so an evicted texture has to have the rest back first.
+	mStateCache->BindTexture(0,tex->mGLName);
+
+	int srcBytesPerPixel = TextureFormatToBytesPerPixel(pFormat);
+	if( pFormat == TextureFormat::FORMAT_16BIT_AUTO )
+	{// The pixels are RGBA, converted to what ever was picked when the texture was made.
+		pFormat = tex->mFormat;
+		srcBytesPerPixel = 4;
+		if( GetIs16BitFormat(pFormat) == false )
 		{
-			DrawLine(pPoints[n].x,pPoints[n].y,pPoints[n+1].x,pPoints[n+1].y,pWidth,pRed,pGreen,pBlue,pAlpha);
+			THROW_MEANINGFUL_EXCEPTION("FillTexture passed FORMAT_16BIT_AUTO for a texture that is not 16 bit");
 		}
 	}
-}	
 
-void GLES::Circle(int pCenterX,int pCenterY,int pRadius,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,size_t pNumPoints,bool pFilled)
-{
-	if( pNumPoints < 1 )
+	const GLint format = TextureFormatToGLFormat(pFormat);
+	if( format == GL_INVALID_ENUM )
 	{
-        pNumPoints = (int)(3 + (std::sqrt(pRadius)*3));
+		THROW_MEANINGFUL_EXCEPTION("FillTexture passed an unknown texture format, I can not continue.");
 	}
-	if( pNumPoints > 128 ){pNumPoints = 128;}	// Make sure we don't go silly with number of verts and loose all the FPS.
-
-	Vert2Df* verts = mWorkBuffers->vertices2Df.Restart(pNumPoints);
 
-	float rad = 0.0;
-	const float step = GetRadian() / (float)(pNumPoints-2);// +2 is because of first triangle.
-	const float r = (float)pRadius;
-	const float x = (float)pCenterX;
-	const float y = (float)pCenterY;
-	for( size_t n = 0 ; n < pNumPoints ; n++, rad += step )
+	if( GetIsCompressedFormat(pFormat) )
 	{
-		verts[n].x = x - (r*std::sin(rad));
-		verts[n].y = y + (r*std::cos(rad));
+		THROW_MEANINGFUL_EXCEPTION("FillTexture passed a compressed format, compressed textures can only be set when they are created.");
 	}
 
-	EnableShader(mShaders.ColourOnly2D);
-	mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
-
-	VertexPtr(2,GL_FLOAT,verts);
-	glDrawArrays(pFilled?GL_TRIANGLE_FAN:GL_LINE_LOOP,0,pNumPoints);
-	CHECK_OGL_ERRORS();
-}
-
-void GLES::Rectangle(int pFromX,int pFromY,int pToX,int pToY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,bool pFilled,uint32_t pTexture)
-{
-	const int16_t quad[8] = {(int16_t)pFromX,(int16_t)pFromY,(int16_t)pToX,(int16_t)pFromY,(int16_t)pToX,(int16_t)pToY,(int16_t)pFromX,(int16_t)pToY};
-	const int16_t uv[8] = {0,0,1,0,1,1,0,1};
-
-	SelectAndEnableShader(pTexture,pRed,pGreen,pBlue,pAlpha);
+	glTexSubImage2D(GL_TEXTURE_2D,
+		0,
+		pX,pY,
+		pWidth,pHeight,
+		format,TextureFormatToGLType(pFormat),
+		ConvertPixelsForUpload(pFormat,srcBytesPerPixel,pWidth,pHeight,pPixels));
+	mStateCache->mBytesUploaded += GetTextureBytes(pFormat,pWidth,pHeight,false);
 
-	if( mShaders.CurrentShader->GetUsesTexture() )
+	if( pGenerateMips )
 	{
-		glVertexAttribPointer(
-					(GLuint)StreamIndex::TEXCOORD,
-					2,
-					GL_SHORT,
-					GL_FALSE,
-					0,uv);
-		CHECK_OGL_ERRORS();
-	}
+		glGenerateMipmap(GL_TEXTURE_2D);
 
-	VertexPtr(2,GL_SHORT,quad);
-	glDrawArrays(pFilled?GL_TRIANGLE_FAN:GL_LINE_LOOP,0,4);
-	CHECK_OGL_ERRORS();
+		if( tex->mMipmaps == false )
+		{
+			mTextureMemory.Used -= tex->mBytes;
+			tex->mBytes = GetTextureBytes(tex->mFormat,tex->mWidth,tex->mHeight,true);
+			tex->mMipmaps = true;
+			mTextureMemory.Used += tex->mBytes;
+		}
+	}
 }
 
-void GLES::RoundedRectangle(int pFromX,int pFromY,int pToX,int pToY,int pRadius,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha,bool pFilled)
-{
-    size_t numPoints = (int)(7 + (std::sqrt(pRadius)*3));
-
-	// Need a multiple of 4 points.
-	numPoints = (numPoints+3)&~3;
-	if( numPoints > 128 ){numPoints = 128;}	// Make sure we don't go silly with number of verts and loose all the FPS.
-	Vert2Df* verts = mWorkBuffers->vertices2Df.Restart(numPoints);
-
-	float rad = GetRadian();
-	const float step = GetRadian() / (float)(numPoints-1);
-	const float r = (float)pRadius;
-	Vert2Df* p = verts;
-
-	pToX -= pRadius;
-	pToY -= pRadius;
-	pFromX += pRadius;
-	pFromY += pRadius;
 
-	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+/**
+ * @brief Delete the texture, will throw an exception is texture not found.
+ * All textures are deleted when the GLES context is torn down so you only need to use this if you need to reclaim some memory.
+ */
+void GLES::DeleteTexture(uint32_t pTexture)
+{
+	if( pTexture == mDiagnostics.texture )
 	{
-		p->x = pFromX + (r*std::sin(rad));
-		p->y = pToY + (r*std::cos(rad));
-		p++;
-		rad -= step;
+		THROW_MEANINGFUL_EXCEPTION("An attempt was made to delete the debug texture, do not do this!");
 	}
 
-	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+	if( pTexture == mPixelFont.texture )
 	{
-		p->x = pFromX + (r*std::sin(rad));
-		p->y = pFromY + (r*std::cos(rad));
-		p++;
-		rad -= step;
+		THROW_MEANINGFUL_EXCEPTION("An attempt was made to delete the pixel font texture, do not do this!");
 	}
+	
 
-	for( size_t n = 0 ; n < numPoints/4 ; n++ )
-	{
-		p->x = pToX + (r*std::sin(rad));
-		p->y = pFromY + (r*std::cos(rad));
-		p++;
-		rad -= step;
+	if( mSubTextures.Erase(pTexture) )
+	{// Only the handle goes, the space in the page is not used again until the atlas is deleted.
+		return;
 	}
 
-	for( size_t n = 0 ; n < numPoints/4 ; n++ )
+	const GLTexture* tex = mTextures.Get(pTexture);
+	if( tex )
 	{
-		p->x = pToX + (r*std::sin(rad));
-		p->y = pToY + (r*std::cos(rad));
-		p++;
-		rad -= step;
-	}
-
-	EnableShader(mShaders.ColourOnly2D);
-	mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
+		if( pTexture == mRenderTarget.Texture )
+		{
+			THROW_MEANINGFUL_EXCEPTION("An attempt was made to delete the render target being drawn to, call RenderTargetEnd first");
+		}
 
-	VertexPtr(2,GL_FLOAT,verts);
-	glDrawArrays(pFilled?GL_TRIANGLE_FAN:GL_LINE_LOOP,0,numPoints);
-	CHECK_OGL_ERRORS();
+		FlushDeferredDraws();
+		if( tex->mEvicted == false )
+		{
+			mTextureMemory.Used -= tex->mBytes;
+		}
+		if( tex->mFrameBuffer )
+		{
+			glDeleteFramebuffers(1,&tex->mFrameBuffer);
+			glDeleteRenderbuffers(1,&tex->mDepthBuffer);
+		}
+		glDeleteTextures(1,&tex->mGLName);
+		mStateCache->OnTextureDeleted(tex->mGLName);
+		mTextures.Erase(pTexture);
+	}
 }
 
-void GLES::Blit(uint32_t pTexture,int pX,int pY,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+int GLES::GetTextureWidth(uint32_t pTexture)const
 {
-	const auto& tex = mTextures.find(pTexture);
-	if( tex == mTextures.end() )
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
 	{
-		FillRectangle(pX,pY,pX+128,pY+128,pRed,pGreen,pBlue,pAlpha,mDiagnostics.texture);
+		return sub->mWidth;
 	}
-	else
-	{
 
-		FillRectangle(pX,pY,pX+tex->second->mWidth-1,pY+tex->second->mHeight-1,pRed,pGreen,pBlue,pAlpha,pTexture);
+	if( pTexture&STREAMING_TEXTURE_HANDLE_BIT )
+	{
+		return GetValid(mStreamingTextures,pTexture,"Streaming texture")->mWidth;
 	}
+	return GetValid(mTextures,pTexture,"Texture")->mWidth;
 }
 
-// End of primitive draw commands.
-//*******************************************
-// Sprite functions
-uint32_t GLES::SpriteCreate(uint32_t pTexture,float pWidth,float pHeight,float pCX,float pCY,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+int GLES::GetTextureHeight(uint32_t pTexture)const
 {
-	// Will throw an exception if texture not found, done early on so we don't waste sprint indices.
-	const int texWidth = GetTextureWidth(pTexture);
-	const int texHeight = GetTextureHeight(pTexture);
-
-	const uint32_t newSprite = mNextSpriteIndex++;
-	if( newSprite == 0 )
+	const SubTexture* sub = GetSubTexture(pTexture);
+	if( sub )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Failed to create sprite, sprite handles have wrapped around. You have some serious bugs and memory leaks!");
+		return sub->mHeight;
 	}
 
-	if( mSprites.find(newSprite) != mSprites.end() )
+	if( pTexture&STREAMING_TEXTURE_HANDLE_BIT )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Bug found in rendering code, sprite index is an index that we already know about.");
+		return GetValid(mStreamingTextures,pTexture,"Streaming texture")->mHeight;
 	}
-
-	mSprites[newSprite] = std::make_unique<Sprite>();
-	Sprite* s = mSprites[newSprite].get();
-
-	s->mTexture = pTexture;
-	s->mWidth = pWidth;
-	s->mHeight = pHeight;
-	s->mCX = pCX;
-	s->mCY = pCY;
-
-	s->BuildVerts();
-	s->BuildUVs(texWidth,texHeight,pTexFromX,pTexFromY,pTexToX,pTexToY);
-
-	return newSprite;
-}
-
-uint32_t GLES::SpriteCreate(uint32_t pTexture,float pWidth,float pHeight,float pCX,float pCY)
-{
-	const float texWidth = GetTextureWidth(pTexture);
-	const float texHeight = GetTextureHeight(pTexture);
-	return SpriteCreate(pTexture,pWidth,pHeight,pCX,pCY,0,0,texWidth,texHeight);
+	return GetValid(mTextures,pTexture,"Texture")->mHeight;
 }
 
-uint32_t GLES::SpriteCreate(uint32_t pTexture)
+void GLES::SetTextureBudget(size_t pBytes,uint32_t pMinFramesUnused)
 {
-	const float texWidth = GetTextureWidth(pTexture);
-	const float texHeight = GetTextureHeight(pTexture);
-	return SpriteCreate(pTexture,texWidth,texHeight,texWidth / 2.0f,texHeight / 2.0f,0,0,texWidth,texHeight);	
+	mTextureMemory.Budget = pBytes;
+	mTextureMemory.MinFramesUnused = std::max(pMinFramesUnused,1U);// Never the frame it's in, the draws may not have been done yet.
+	EnforceTextureBudget(0);
 }
 
-void GLES::SpriteDelete(uint32_t pSprite)
+void GLES::SetTextureReloader(uint32_t pTexture,TextureReloader pReloader)
 {
-	if( mSprites.find(pSprite) != mSprites.end() )
+	if( GetSubTexture(pTexture) || (pTexture&STREAMING_TEXTURE_HANDLE_BIT) )
+	{
+		THROW_MEANINGFUL_EXCEPTION("SetTextureReloader passed an atlas or streaming texture, only textures from CreateTexture can be evicted");
+	}
+
+	GLTexture* tex = GetValid(mTextures,pTexture,"SetTextureReloader texture");
+	if( tex->mFrameBuffer )
 	{
-		mSprites.erase(pSprite);
+		THROW_MEANINGFUL_EXCEPTION("SetTextureReloader passed a render target, what is drawn to them can not be reloaded");
 	}
+	if( tex->mMipmaps && GetIsCompressedFormat(tex->mFormat) )
+	{
+		THROW_MEANINGFUL_EXCEPTION("SetTextureReloader passed a compressed texture with mip levels, they can not be reloaded from one image");
+	}
+	tex->mReloader = pReloader;
 }
 
-void GLES::SpriteDraw(uint32_t pSprite)
+void GLES::UseTexture(uint32_t pTexture)
 {
-	assert(mShaders.SpriteShader2D);
-
-	auto& sprite = mSprites.at(pSprite);
-
-	EnableShader(mShaders.SpriteShader2D);
+	GLTexture* tex = mTextures.Get(pTexture);
+	if( tex == nullptr )
+	{
+		return;
+	}
 
-	assert(mShaders.CurrentShader);
-	mShaders.CurrentShader->SetTexture(sprite->mTexture);
-	mShaders.CurrentShader->SetGlobalColour(1.0f,1.0f,1.0f,1.0f);
+	tex->mLastUsedFrame = mDiagnostics.frameNumber;
+	if( tex->mEvicted == false )
+	{
+		return;
+	}
 
-	VertexPtr(2,GL_FLOAT,sprite->mVert.data());
+	std::vector<uint8_t> pixels;
+	if( tex->mReloader(pTexture,pixels) == false )
+	{
+		VERBOSE_MESSAGE("Reloader for evicted texture " << pTexture << " failed, it will be tried again");
+		return;
+	}
 
-	// Because UV's are normalized.
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				4,sprite->mUV.data());
+	const bool compressed = GetIsCompressedFormat(tex->mFormat);
+	const size_t expected = compressed ? GetCompressedImageSize(tex->mFormat,tex->mWidth,tex->mHeight) : (size_t)tex->mWidth * tex->mHeight * tex->mSourceBytesPerPixel;
+	if( pixels.size() < expected )
+	{
+		THROW_MEANINGFUL_EXCEPTION("Reloader for texture " + std::to_string(pTexture) + " gave " + std::to_string(pixels.size()) + " bytes, " + std::to_string(expected) + " are needed");
+	}
 
+	EnforceTextureBudget(tex->mBytes);
 
-	glDrawArrays(GL_TRIANGLE_FAN,0,4);
+	mStateCache->BindTexture(0,tex->mGLName);
+	const GLint format = TextureFormatToGLFormat(tex->mFormat);
+	if( compressed )
+	{
+		const GLenum internalFormat = (tex->mFormat == TextureFormat::FORMAT_ETC1 && mCompressedFormats.ETC1 == false) ? GL_COMPRESSED_RGB8_ETC2 : format;
+		glCompressedTexImage2D(GL_TEXTURE_2D,0,internalFormat,tex->mWidth,tex->mHeight,0,expected,pixels.data());
+		mStateCache->mBytesUploaded += expected;
+	}
+	else
+	{
+		glTexImage2D(GL_TEXTURE_2D,0,format,tex->mWidth,tex->mHeight,0,format,TextureFormatToGLType(tex->mFormat),
+			ConvertPixelsForUpload(tex->mFormat,tex->mSourceBytesPerPixel,tex->mWidth,tex->mHeight,pixels.data()));
+		mStateCache->mBytesUploaded += GetTextureBytes(tex->mFormat,tex->mWidth,tex->mHeight,false);
+		if( tex->mMipmaps )
+		{
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
+	}
 	CHECK_OGL_ERRORS();
-}
 
-void GLES::SpriteSetCenter(uint32_t pSprite,float pCX,float pCY)
-{
-	auto& sprite = mSprites.at(pSprite);
-	sprite->mCX = pCX;
-	sprite->mCY = pCY;
-	sprite->BuildVerts();
+	tex->mEvicted = false;
+	mTextureMemory.Used += tex->mBytes;
+	VERBOSE_MESSAGE("Reloaded texture " << pTexture << ", " << mTextureMemory.Used << " bytes of textures now used");
 }
 
-uint32_t GLES::QuadBatchCreate(uint32_t pTexture,int pCount,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY)
+void GLES::EnforceTextureBudget(size_t pIncoming)
 {
-	// Will throw an exception if texture not found, done early on so we don't waste sprint indices.
-	const int texWidth = GetTextureWidth(pTexture);
-	const int texHeight = GetTextureHeight(pTexture);
-
-	const uint32_t newBatch = mQuadBatch.NextIndex++;
-	if( newBatch == 0 )
+	if( mTextureMemory.Budget == 0 || mTextureMemory.Used + pIncoming <= mTextureMemory.Budget )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Failed to create sprite, sprite handles have wrapped around. You have some serious bugs and memory leaks!");
+		return;
 	}
 
-	if( mQuadBatch.Batchs.find(newBatch) != mQuadBatch.Batchs.end() )
+	// Oldest first, only those not used for a while so we don't evict what will be drawn again in a moment.
+	std::vector<std::pair<uint32_t,GLTexture*>> candidates;
+	for( size_t n = 0 ; n < mTextures.Size() ; n++ )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Bug found in rendering code, sprite index is an index that we already know about.");
+		GLTexture* tex = mTextures.GetObject(n);
+		if( tex->mReloader && tex->mEvicted == false && mDiagnostics.frameNumber - tex->mLastUsedFrame >= mTextureMemory.MinFramesUnused )
+		{
+			candidates.emplace_back(mTextures.GetHandle(n),tex);
+		}
 	}
+	std::sort(candidates.begin(),candidates.end(),[](const std::pair<uint32_t,GLTexture*>& a,const std::pair<uint32_t,GLTexture*>& b)
+	{
+		return a.second->mLastUsedFrame < b.second->mLastUsedFrame;
+	});
 
-	mQuadBatch.Batchs[newBatch] = std::make_unique<QuadBatch>(pCount,pTexture,texWidth,texHeight,pTexFromX,pTexFromY,pTexToX,pTexToY);
-	return newBatch;
-}
+	for( const auto& c : candidates )
+	{
+		if( mTextureMemory.Used + pIncoming <= mTextureMemory.Budget )
+		{
+			break;
+		}
 
-uint32_t GLES::QuadBatchCreate(uint32_t pTexture,int pCount)
-{
-	const float texWidth = GetTextureWidth(pTexture);
-	const float texHeight = GetTextureHeight(pTexture);
-	return QuadBatchCreate(pTexture,pCount,0,0,texWidth,texHeight);
+		// Keep the GL name so the handle stays valid, giving every level a zero size frees the memory.
+		GLTexture* tex = c.second;
+		mStateCache->BindTexture(0,tex->mGLName);
+		const GLint format = TextureFormatToGLFormat(GetIsCompressedFormat(tex->mFormat) ? TextureFormat::FORMAT_RGBA : tex->mFormat);
+		int levels = 1;
+		for( int w = tex->mWidth, h = tex->mHeight ; tex->mMipmaps && (w > 1 || h > 1) ; w = std::max(w / 2,1), h = std::max(h / 2,1) )
+		{
+			levels++;
+		}
+		for( int level = 0 ; level < levels ; level++ )
+		{
+			glTexImage2D(GL_TEXTURE_2D,level,format,0,0,0,format,GL_UNSIGNED_BYTE,nullptr);
+		}
+		CHECK_OGL_ERRORS();
+
+		tex->mEvicted = true;
+		mTextureMemory.Used -= tex->mBytes;
+		VERBOSE_MESSAGE("Evicted texture " << c.first << " unused since frame " << tex->mLastUsedFrame << ", " << mTextureMemory.Used << " bytes of textures now used");
+	}
 }
 
-void GLES::QuadBatchDelete(uint32_t pQuadBatch)
+const void* GLES::ConvertPixelsForUpload(TextureFormat pFormat,int pSrcBytesPerPixel,int pWidth,int pHeight,const uint8_t* pPixels)
 {
-	if( mQuadBatch.Batchs.find(pQuadBatch) != mQuadBatch.Batchs.end() )
+	if( pPixels == nullptr || GetIs16BitFormat(pFormat) == false )
 	{
-		mQuadBatch.Batchs.erase(pQuadBatch);
+		return pPixels;
 	}
+
+	uint16_t* converted = mWorkBuffers->pixels16.Restart((size_t)pWidth * pHeight);
+	ConvertTo16Bit(pFormat,pPixels,pSrcBytesPerPixel,pWidth,pHeight,converted,mTextureDithering);
+	return converted;
 }
 
-void GLES::QuadBatchDraw(uint32_t pQuadBatch)
+bool GLES::GetTextureFormatSupported(TextureFormat pFormat)const
 {
-	assert(mShaders.QuadBatchShader2D);
-
-	auto& QuadBatch = mQuadBatch.Batchs.at(pQuadBatch);
-
-	EnableShader(mShaders.QuadBatchShader2D);
-
-	assert(mShaders.CurrentShader == mShaders.QuadBatchShader2D);
-	mShaders.CurrentShader->SetTexture(QuadBatch->mTexture);
-	mShaders.CurrentShader->SetGlobalColour(1.0f,1.0f,1.0f,1.0f);
+	switch( pFormat )
+	{
+	case TextureFormat::FORMAT_ETC1:
+		return mCompressedFormats.ETC1 || mCompressedFormats.ETC2;
 
-	glBindBuffer(GL_ARRAY_BUFFER,mQuadBatch.VerticesBuffer);
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::VERTEX,
-				2,
-				GL_BYTE,
-				GL_TRUE,
-				0,0);
-	glBindBuffer(GL_ARRAY_BUFFER,0);
+	case TextureFormat::FORMAT_ETC2_RGB:
+	case TextureFormat::FORMAT_ETC2_RGBA:
+		return mCompressedFormats.ETC2;
 
-	// Because UV's are normalized.
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				0,QuadBatch->mUVs.data());
-
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TRANSFORM,
-				4,
-				GL_SHORT,
-				GL_FALSE,
-				0,
-				QuadBatch->mTransforms.data());
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mQuadBatch.IndicesBuffer);
-	glDrawElements(GL_TRIANGLES,QuadBatch->GetNumQuads() * mQuadBatch.IndicesPerQuad,GL_UNSIGNED_SHORT,0);
-	CHECK_OGL_ERRORS();
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	default:
+		break;
+	}
+	return TextureFormatToGLFormat(pFormat) != GL_INVALID_ENUM;
 }
 
-void GLES::QuadBatchDraw(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex)
+// End of Texture commands.
+//*******************************************
+// Texture atlas code
+uint32_t GLES::AtlasCreate(TextureFormat pFormat,int pPageSize,bool pFiltered,int pPadding)
 {
-	if( pToIndex <= pFromIndex )
+	if( TextureFormatToBytesPerPixel(pFormat) == 0 )
 	{
-		return;// Allow this as their code may use this case at the start or end of an effect.
+		THROW_MEANINGFUL_EXCEPTION("AtlasCreate passed a compressed, auto or unknown texture format, images are packed in so the format has to be known and uncompressed.");
 	}
 
-	assert(mShaders.QuadBatchShader2D);
-
-	auto& QuadBatch = mQuadBatch.Batchs.at(pQuadBatch);
+	if( pPageSize < 1 || pPadding < 0 || pPadding * 2 >= pPageSize )
+	{
+		THROW_MEANINGFUL_EXCEPTION("AtlasCreate passed a page size or padding that can not work, page size must be more than twice the padding.");
+	}
 
-	assert( pFromIndex < QuadBatch->GetNumQuads() );
-	assert( pToIndex < QuadBatch->GetNumQuads() );
+	return mAtlases.Add(std::make_unique<TextureAtlas>(pFormat,pPageSize,pFiltered,pPadding));
+}
 
-	EnableShader(mShaders.QuadBatchShader2D);
+uint32_t GLES::AtlasAddImage(uint32_t pAtlas,int pWidth,int pHeight,const uint8_t* pPixels)
+{
+	TextureAtlas* atlas = GetValid(mAtlases,pAtlas,"Atlas");
 
-	assert(mShaders.CurrentShader == mShaders.QuadBatchShader2D);
-	mShaders.CurrentShader->SetTexture(QuadBatch->mTexture);
-	mShaders.CurrentShader->SetGlobalColour(1.0f,1.0f,1.0f,1.0f);
+	if( pPixels == nullptr || pWidth < 1 || pHeight < 1 )
+	{
+		THROW_MEANINGFUL_EXCEPTION("AtlasAddImage passed no image data, an image must have pixels and a size of at least 1x1");
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER,mQuadBatch.VerticesBuffer);
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::VERTEX,
-				2,
-				GL_BYTE,
-				GL_TRUE,
-				0,0);
-	glBindBuffer(GL_ARRAY_BUFFER,0);
+	const int pad = atlas->mPadding;
+	const int paddedWidth = pWidth + (pad * 2);
+	const int paddedHeight = pHeight + (pad * 2);
+	if( paddedWidth > atlas->mPageSize || paddedHeight > atlas->mPageSize )
+	{
+		THROW_MEANINGFUL_EXCEPTION("AtlasAddImage passed an image that, with it's padding, is bigger than a page of the atlas");
+	}
 
+	// Find room, try the newest page first as the older ones are likely full.
+	int x = 0,y = 0;
+	TextureAtlas::Page* page = nullptr;
+	for( auto p = atlas->mPages.rbegin() ; p != atlas->mPages.rend() && page == nullptr ; p++ )
+	{
+		if( p->packer.Insert(paddedWidth,paddedHeight,x,y) )
+		{
+			page = &(*p);
+		}
+	}
 
-	// Because UV's are normalized.
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				0,QuadBatch->mUVs.data());
+	if( page == nullptr )
+	{
+		// The page has to be filled when created, see the note on CreateTexture.
+		const int pageSize = atlas->mPageSize;
+		const std::vector<uint8_t> clear(pageSize * pageSize * TextureFormatToBytesPerPixel(atlas->mFormat),0);
+		const uint32_t texture = CreateTexture(pageSize,pageSize,clear.data(),atlas->mFormat,atlas->mFiltered);
+		atlas->mPages.push_back({texture,SkylinePacker(pageSize,pageSize)});
+		page = &atlas->mPages.back();
+		page->packer.Insert(paddedWidth,paddedHeight,x,y);
+		VERBOSE_MESSAGE("Atlas " << pAtlas << " added page " << atlas->mPages.size() << " texture " << texture);
+	}
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TRANSFORM,
-				4,
-				GL_FLOAT,
-				GL_FALSE,
-				0,
-				QuadBatch->mTransforms.data());
+	// Copy the image in to the middle of the padded rectangle then repeat it's edge pixels out in to the padding.
+	const size_t bpp = TextureFormatToBytesPerPixel(atlas->mFormat);
+	const size_t srcStride = pWidth * bpp;
+	std::vector<uint8_t> padded(paddedWidth * paddedHeight * bpp);
+	for( int py = 0 ; py < paddedHeight ; py++ )
+	{
+		const int sy = std::clamp(py - pad,0,pHeight - 1);
+		const uint8_t* src = pPixels + (sy * srcStride);
+		uint8_t* dst = padded.data() + (py * paddedWidth * bpp);
+		for( int px = 0 ; px < pad ; px++, dst += bpp )
+		{
+			memcpy(dst,src,bpp);
+		}
+		memcpy(dst,src,srcStride);
+		dst += srcStride;
+		for( int px = 0 ; px < pad ; px++, dst += bpp )
+		{
+			memcpy(dst,src + srcStride - bpp,bpp);
+		}
+	}
+	FillTexture(page->texture,x,y,paddedWidth,paddedHeight,padded.data(),atlas->mFormat);
 
-/*	const uint16_t* idx = mQuadIndices.data();
-	idx += pFromIndex * mQuadBatch.IndicesPerQuad;
+	const uint32_t newSubTexture = mSubTextures.Add(std::make_unique<SubTexture>(SubTexture{pAtlas,page->texture,x + pad,y + pad,pWidth,pHeight}));
+	atlas->mSubTextures.push_back(newSubTexture);
+	return newSubTexture;
+}
 
-	const int count = (pToIndex - pFromIndex) * mQuadBatch.IndicesPerQuad;
+void GLES::AtlasDelete(uint32_t pAtlas)
+{
+	TextureAtlas* atlas = mAtlases.Get(pAtlas);
+	if( atlas )
+	{
+		for( auto sub : atlas->mSubTextures )
+		{
+			mSubTextures.Erase(sub);
+		}
 
-	glDrawElements(GL_TRIANGLES,count,GL_UNSIGNED_SHORT,idx);
-	CHECK_OGL_ERRORS();*/
+		for( auto& page : atlas->mPages )
+		{
+			DeleteTexture(page.texture);
+		}
+		mAtlases.Erase(pAtlas);
+	}
 }
 
-std::vector<QuadBatchTransform>& GLES::QuadBatchGetTransform(uint32_t pQuadBatch)
+uint32_t GLES::AtlasGetTexture(uint32_t pSubTexture)const
 {
-	auto& QuadBatch = mQuadBatch.Batchs.at(pQuadBatch);
-	return QuadBatch->mTransforms;
+	return GetValid(mSubTextures,pSubTexture,"Atlas image")->mTexture;
 }
 
+// End of texture atlas code.
 //*******************************************
-// Primitive rendering functions for user defined shapes
-void GLES::RenderTriangles(const VerticesXYZC& pVertices)
+// Streaming texture code
+uint32_t GLES::StreamingTextureCreate(int pWidth,int pHeight,TextureFormat pFormat,int pNumBuffers,bool pFiltered)
 {
-	EnableShader(mShaders.ColourOnly3D);
-
-	assert(mShaders.CurrentShader);
-	mShaders.CurrentShader->SetGlobalColour(1.0f,1.0f,1.0f,1.0f);
+	if( TextureFormatToBytesPerPixel(pFormat) == 0 )
+	{
+		THROW_MEANINGFUL_EXCEPTION("StreamingTextureCreate passed a compressed, auto or unknown texture format, streaming textures have to be a known uncompressed format.");
+	}
 
-	const uint8_t* verts = (const uint8_t*)pVertices.data();
-	const uint8_t* c = verts + (sizeof(float)*3);
+	if( pNumBuffers < 1 )
+	{
+		THROW_MEANINGFUL_EXCEPTION("StreamingTextureCreate passed a buffer count less than one, needs at least one texture to work with.");
+	}
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::VERTEX,
-				3,
-				GL_FLOAT,
-				GL_FALSE,
-				sizeof(VertXYZC),
-				verts);
-	CHECK_OGL_ERRORS();
+	auto streaming = std::make_unique<StreamingTexture>(pFormat,pWidth,pHeight);
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::COLOUR,
-				4,
-				GL_UNSIGNED_BYTE,
-				GL_TRUE,
-				sizeof(VertXYZC),
-				c);
-	CHECK_OGL_ERRORS();
+	// Has to be filled when created, see the note on CreateTexture.
+	const std::vector<uint8_t> clear(pWidth * pHeight * TextureFormatToBytesPerPixel(pFormat),0);
+	for( int n = 0 ; n < pNumBuffers ; n++ )
+	{
+		streaming->mTextures.push_back(CreateTexture(pWidth,pHeight,clear.data(),pFormat,pFiltered));
+	}
+	streaming->mDrawnFrame.resize(pNumBuffers,0);
 
-	glDrawArrays(GL_TRIANGLES,0,pVertices.size());
-	CHECK_OGL_ERRORS();
+	return mStreamingTextures.Add(std::move(streaming));
 }
 
-void GLES::RenderTriangles(const VerticesXYZUV& pVertices,uint32_t pTexture)
+void GLES::StreamingTextureUpdate(uint32_t pTexture,const uint8_t* pPixels)
 {
-	if(pTexture == 0)
+	TRACE_SCOPE("StreamingTextureUpdate");
+	StreamingTexture* streaming = GetValid(mStreamingTextures,pTexture,"Streaming texture");
+	if( pPixels == nullptr )
 	{
-		pTexture = mDiagnostics.texture;
+		THROW_MEANINGFUL_EXCEPTION("StreamingTextureUpdate passed null pixels, the whole image has to be given each update");
 	}
 
-	EnableShader(mShaders.TextureOnly3D);
-
-	assert(mShaders.CurrentShader);
-	mShaders.CurrentShader->SetTexture(pTexture);
-	mShaders.CurrentShader->SetGlobalColour(1.0f,1.0f,1.0f,1.0f);
-
-	const uint8_t* verts = (const uint8_t*)pVertices.data();
-	const uint8_t* c = verts + (sizeof(float)*3);
-
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::VERTEX,
-				3,
-				GL_FLOAT,
-				GL_FALSE,
-				sizeof(VertXYZUV),
-				verts);
-	CHECK_OGL_ERRORS();
+	const size_t next = (streaming->mCurrent + 1) % streaming->mTextures.size();
+	const uint32_t drawn = streaming->mDrawnFrame[next];
+	const bool inFlight = drawn != 0 && mDiagnostics.frameNumber - drawn < FRAMES_IN_FLIGHT;
+	if( inFlight )
+	{
+		// Still have to write to it, draws recorded this frame have to go first so they see the old image.
+		streaming->mStallCount++;
+		FlushDeferredDraws();
+	}
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				sizeof(VertXYZUV),
-				c);
+	// Unlike FillTexture no need to flush the recorded draws, none of them use this texture.
+	mStateCache->BindTexture(0,mTextures.Get(streaming->mTextures[next])->mGLName);
+	const void* pixels = ConvertPixelsForUpload(streaming->mFormat,TextureFormatToBytesPerPixel(streaming->mFormat),streaming->mWidth,streaming->mHeight,pPixels);
+	glTexSubImage2D(GL_TEXTURE_2D,0,0,0,streaming->mWidth,streaming->mHeight,TextureFormatToGLFormat(streaming->mFormat),TextureFormatToGLType(streaming->mFormat),pixels);
+	mStateCache->mBytesUploaded += GetTextureBytes(streaming->mFormat,streaming->mWidth,streaming->mHeight,false);
 	CHECK_OGL_ERRORS();
 
-	glDrawArrays(GL_TRIANGLES,0,pVertices.size());
-	CHECK_OGL_ERRORS();
+	streaming->mCurrent = next;
 }
 
-//*******************************************
-// Texture functions
-uint32_t GLES::CreateTexture(int pWidth,int pHeight,const uint8_t* pPixels,TextureFormat pFormat,bool pFiltered,bool pGenerateMipmaps)
+void GLES::StreamingTextureDelete(uint32_t pTexture)
 {
-	const GLint format = TextureFormatToGLFormat(pFormat);
-	if( format == GL_INVALID_ENUM )
+	StreamingTexture* streaming = mStreamingTextures.Get(pTexture);
+	if( streaming )
 	{
-		THROW_MEANINGFUL_EXCEPTION("CreateTexture passed an unknown texture format, I can not continue.");
+		for( auto t : streaming->mTextures )
+		{
+			DeleteTexture(t);
+		}
+		mStreamingTextures.Erase(pTexture);
 	}
+}
 
-	GLuint newTexture;
-	glGenTextures(1,&newTexture);
-	CHECK_OGL_ERRORS();
-	if( newTexture == 0 )
+uint32_t GLES::StreamingTextureGetStallCount(uint32_t pTexture)const
+{
+	return GetValid(mStreamingTextures,pTexture,"Streaming texture")->mStallCount;
+}
+
+uint32_t GLES::ResolveStreamingTexture(uint32_t pTexture)
+{
+	StreamingTexture* streaming = mStreamingTextures.Get(pTexture);
+	if( streaming == nullptr )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Failed to create texture, glGenTextures returned zero");
+		STALE_HANDLE_IN_DRAW("Draw passed a stale or unknown streaming texture handle",0);// Zero, drawn without a texture.
 	}
+	streaming->mDrawnFrame[streaming->mCurrent] = mDiagnostics.frameNumber;
+	return streaming->mTextures[streaming->mCurrent];
+}
 
-	if( mTextures.find(newTexture) != mTextures.end() )
+// End of streaming texture code.
+//*******************************************
+// Render target code
+uint32_t GLES::RenderTargetCreate(int pWidth,int pHeight,TextureFormat pFormat,bool pDepthBuffer,bool pFiltered)
+{
+	switch( pFormat )
 	{
-		THROW_MEANINGFUL_EXCEPTION("Bug found in GLES code, glGenTextures returned an index that we already know about.");
+	case TextureFormat::FORMAT_RGBA:
+	case TextureFormat::FORMAT_RGB:
+	case TextureFormat::FORMAT_RGB565:
+	case TextureFormat::FORMAT_RGBA4444:
+	case TextureFormat::FORMAT_RGBA5551:
+		break;
+
+	default:
+		THROW_MEANINGFUL_EXCEPTION("RenderTargetCreate passed " + std::string(TextureFormatToString(pFormat)) + " which GLES 2.0 can not draw to");
 	}
 
-	mTextures[newTexture] = std::make_unique<GLTexture>(pFormat,pWidth,pHeight);
+	const uint32_t handle = CreateTexture(pWidth,pHeight,nullptr,pFormat,pFiltered,false);
+	GLTexture* tex = mTextures.Get(handle);
 
-	glBindTexture(GL_TEXTURE_2D,newTexture);
+	// CreateTexture leaves the filtering for when it's filled. Clamped as GLES 2.0 can't repeat a texture that's not a power of two in size.
+	mStateCache->BindTexture(0,tex->mGLName);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,pFiltered ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,pFiltered ? GL_LINEAR : GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
 	CHECK_OGL_ERRORS();
 
-	glTexImage2D(
-		GL_TEXTURE_2D,
-		0,
-		format,
-		pWidth,
-		pHeight,
-		0,
-		format,
-		GL_UNSIGNED_BYTE,
-		pPixels);
-
+	glGenFramebuffers(1,&tex->mFrameBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER,tex->mFrameBuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER,GL_COLOR_ATTACHMENT0,GL_TEXTURE_2D,tex->mGLName,0);
 	CHECK_OGL_ERRORS();
 
-	// Unlike GLES 1.1 this is called after texture creation, in GLES 1.1 you say that you want glTexImage2D to make the mips.
-	// Don't call if we don't yet have pixels. Will be called when you fill the texture.
-	if( pPixels != nullptr )
+	if( pDepthBuffer )
 	{
-		if( pGenerateMipmaps )
+		glGenRenderbuffers(1,&tex->mDepthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER,tex->mDepthBuffer);
+		if( mRenderTarget.PackedDepthStencil )
 		{
-			glGenerateMipmap(GL_TEXTURE_2D);
-			CHECK_OGL_ERRORS();
-			if( pFiltered )
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			}
-			else
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-			}
+			glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH24_STENCIL8_OES,pWidth,pHeight);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,tex->mDepthBuffer);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_STENCIL_ATTACHMENT,GL_RENDERBUFFER,tex->mDepthBuffer);
 		}
 		else
 		{
-			if( pFiltered )
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			}
-			else
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-			}
+			glRenderbufferStorage(GL_RENDERBUFFER,GL_DEPTH_COMPONENT16,pWidth,pHeight);
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,tex->mDepthBuffer);
 		}
-	}
+		glBindRenderbuffer(GL_RENDERBUFFER,0);
+		CHECK_OGL_ERRORS();
 
-	// If it's alpha only we need to set the texture swizzle for RGB to one.
-	// Leaving in for when I add GLES 3.0 support. But for now, grump, need two textures.
-	// GL_TEXTURE_SWIZZLE_R not supported in GLES 2.0
-	/*
-	if( format == GL_ALPHA )
-	{
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_R,GL_ONE);
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_G,GL_ONE);
-		glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_SWIZZLE_B,GL_ONE);
+		const size_t depthBytes = (size_t)pWidth * pHeight * (mRenderTarget.PackedDepthStencil ? 4 : 2);
+		tex->mBytes += depthBytes;
+		mTextureMemory.Used += depthBytes;
 	}
-	*/
 
-	CHECK_OGL_ERRORS();
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	const GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 
-	glBindTexture(GL_TEXTURE_2D,0);//Because we had to change it to setup the texture! Stupid GL!
+	// Put back the one being drawn to, could be a render target.
+	glBindFramebuffer(GL_FRAMEBUFFER,mRenderTarget.Texture ? mTextures.Get(mRenderTarget.Texture)->mFrameBuffer : 0);
 	CHECK_OGL_ERRORS();
 
-	VERBOSE_MESSAGE("Texture " << newTexture << " created, " << pWidth << "x" << pHeight << " Format = " << TextureFormatToString(pFormat) << " Mipmaps = " << (pGenerateMipmaps?"true":"false") << " Filtered = " << (pFiltered?"true":"false"));
-
+	if( status != GL_FRAMEBUFFER_COMPLETE )
+	{
+		DeleteTexture(handle);
+		THROW_MEANINGFUL_EXCEPTION("RenderTargetCreate failed, the frame buffer is not complete, status " + std::to_string(status) + ". The driver may not be able to draw to " + std::string(TextureFormatToString(pFormat)));
+	}
 
-	return newTexture;
+	VERBOSE_MESSAGE("Render target " << handle << " created, " << pWidth << "x" << pHeight << " " << TextureFormatToString(pFormat) << (pDepthBuffer ? (mRenderTarget.PackedDepthStencil ? " with depth and stencil" : " with depth") : ""));
+	return handle;
 }
 
-void GLES::FillTexture(uint32_t pTexture,int pX,int pY,int pWidth,int pHeight,const uint8_t* pPixels,TextureFormat pFormat,bool pGenerateMips)
+void GLES::RenderTargetBegin(uint32_t pTarget)
 {
-	glBindTexture(GL_TEXTURE_2D,pTexture);
+	if( mRenderTarget.Texture )
+	{
+		THROW_MEANINGFUL_EXCEPTION("RenderTargetBegin called while drawing to a render target, call RenderTargetEnd first");
+	}
 
-	const GLint format = TextureFormatToGLFormat(pFormat);
-	if( format == GL_INVALID_ENUM )
+	const GLTexture* tex = GetValid(mTextures,pTarget,"RenderTargetBegin texture");
+	if( tex->mFrameBuffer == 0 )
 	{
-		THROW_MEANINGFUL_EXCEPTION("FillTexture passed an unknown texture format, I can not continue.");
+		THROW_MEANINGFUL_EXCEPTION("RenderTargetBegin passed a texture that is not a render target, make it with RenderTargetCreate");
 	}
 
-	glTexSubImage2D(GL_TEXTURE_2D,
-		0,
-		pX,pY,
-		pWidth,pHeight,
-		format,GL_UNSIGNED_BYTE,
-		pPixels);
+	// What has been recorded so far is for the screen.
+	FlushDeferredDraws();
 
-	if( pGenerateMips )
+	memcpy(mRenderTarget.ScreenProjection.m,mMatrices.projection,sizeof(mMatrices.projection));
+	mRenderTarget.ScreenDepthTest = mDepthTest;
+	mRenderTarget.Texture = pTarget;
+	mRenderTarget.Width = tex->mWidth;
+	mRenderTarget.Height = tex->mHeight;
+
+	glBindFramebuffer(GL_FRAMEBUFFER,tex->mFrameBuffer);
+	glViewport(0,0,tex->mWidth,tex->mHeight);
+	if( mDamage.Enabled )
 	{
-		glGenerateMipmap(GL_TEXTURE_2D);
+		glDisable(GL_SCISSOR_TEST);
 	}
+	glFrontFace(GL_CCW);// The projection is flipped in y compared to the screen's, so the winding is too.
+	// Alpha is accumulated and not blended like the colour, so something solid drawn over a solid background leaves it solid when the target is drawn.
+	glBlendFuncSeparate(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA,GL_ONE,GL_ONE_MINUS_SRC_ALPHA);
+	CHECK_OGL_ERRORS();
 
-	glBindTexture(GL_TEXTURE_2D,0);//Because we had to change it to setup the texture! Stupid GL!
-}
+	Begin2D();
 
+	// Give the current shader the target's projection.
+	TinyShader liveShader = mShaders.CurrentShader;
+	mShaders.CurrentShader.reset();
+	if( liveShader )
+	{
+		EnableShader(liveShader);
+	}
+}
 
-/**
- * @brief Delete the texture, will throw an exception is texture not found.
- * All textures are deleted when the GLES context is torn down so you only need to use this if you need to reclaim some memory.
- */
-void GLES::DeleteTexture(uint32_t pTexture)
+void GLES::RenderTargetEnd()
 {
-	if( pTexture == mDiagnostics.texture )
+	if( mRenderTarget.Texture == 0 )
 	{
-		THROW_MEANINGFUL_EXCEPTION("An attempt was made to delete the debug texture, do not do this!");
+		THROW_MEANINGFUL_EXCEPTION("RenderTargetEnd called without a RenderTargetBegin");
 	}
 
-	if( pTexture == mPixelFont.texture )
+	// Draws recorded since RenderTargetBegin are for the target.
+	FlushDeferredDraws();
+
+	mRenderTarget.Texture = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER,0);
+	glViewport(0,0,(GLsizei)mPhysical.Width,(GLsizei)mPhysical.Height);
+	if( mDamage.Enabled && mDamage.InFrame )
 	{
-		THROW_MEANINGFUL_EXCEPTION("An attempt was made to delete the pixel font texture, do not do this!");
+		ApplyDamageScissor();
 	}
-	
+	glFrontFace(GL_CW);
+	glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+	CHECK_OGL_ERRORS();
 
-	if( mTextures.find(pTexture) != mTextures.end() )
+	memcpy(mMatrices.projection,mRenderTarget.ScreenProjection.m,sizeof(mMatrices.projection));
+	if( mDepthTest != mRenderTarget.ScreenDepthTest )
 	{
-		glDeleteTextures(1,(GLuint*)&pTexture);
-		mTextures.erase(pTexture);
+		mDepthTest = mRenderTarget.ScreenDepthTest;
+		ApplyDepthState(mDepthTest);
 	}
-}
-
-int GLES::GetTextureWidth(uint32_t pTexture)const
-{
-	return mTextures.at(pTexture)->mWidth;
-}
 
-int GLES::GetTextureHeight(uint32_t pTexture)const
-{
-	return mTextures.at(pTexture)->mHeight;
+	// Put the current shader back with the screen's projection.
+	TinyShader liveShader = mShaders.CurrentShader;
+	mShaders.CurrentShader.reset();
+	if( liveShader )
+	{
+		EnableShader(liveShader);
+	}
 }
 
-// End of Texture commands.
+// End of render target code.
 //*******************************************
 // 9 Patch code
 uint32_t GLES::CreateNinePatch(int pWidth,int pHeight,const uint8_t* pPixels,bool pFiltered)
@@ -1917,26 +5559,20 @@ uint32_t GLES::CreateNinePatch(int pWidth,int pHeight,const uint8_t* pPixels,boo
 		THROW_MEANINGFUL_EXCEPTION("CreateNinePatch failed to create it's texture, you out of vram?");
 	}
 
-	if( mNinePatchs.find(newTexture) != mNinePatchs.end() )
-	{
-		THROW_MEANINGFUL_EXCEPTION("Bug found in GLES CreateNinePatch code, CreateTexture returned an index that we already know about.");
-	}
-
 	// Create the nine patch entry and return.
-	mNinePatchs[newTexture] = std::make_unique<NinePatch>(newWidth,newHeight,scaleFrom,scaleTo,fillFrom,fillTo);
-
-	return newTexture;
+	return mNinePatchs.Add(std::make_unique<NinePatch>(newTexture,newWidth,newHeight,scaleFrom,scaleTo,fillFrom,fillTo));
 }
 
 void GLES::DeleteNinePatch(uint32_t pNinePatch)
 {
-	if( mNinePatchs.find(pNinePatch) == mNinePatchs.end() )
+	const NinePatch* ninePatch = mNinePatchs.Get(pNinePatch);
+	if( ninePatch == nullptr )
 	{
 		THROW_MEANINGFUL_EXCEPTION("An attempt to delete a nine patch that is not a nine patch was made");
 	}
 
-	DeleteTexture(pNinePatch);	// The nine patch handle is also the texture handle.
-	mNinePatchs.erase(pNinePatch);
+	DeleteTexture(ninePatch->mTexture);
+	mNinePatchs.Erase(pNinePatch);
 }
 
 
@@ -1946,13 +5582,13 @@ void GLES::DeleteNinePatch(uint32_t pNinePatch)
  */
 const NinePatchDrawInfo& GLES::DrawNinePatch(uint32_t pNinePatch,int pX,int pY,float pXScale,float pYScale)
 {
+	TRACE_SCOPE("DrawNinePatch");
 	// Grab out nine pinch object with the data we need.
-	auto found = mNinePatchs.find(pNinePatch);
-	if( found == mNinePatchs.end() )
+	const NinePatch* ninePinch = mNinePatchs.Get(pNinePatch);
+	if( ninePinch == nullptr )
 	{
-		THROW_MEANINGFUL_EXCEPTION("An attempt to draw a nine patch that is not a nine patch was made");
+		STALE_HANDLE_IN_DRAW("An attempt to draw a nine patch that is not a nine patch was made",mNinePatchDrawInfo);
 	}
-	const auto& ninePinch = found->second.get();
 
 	// We have to draw 9 rects, with the center scaling the texture.
 	const int xMove = pX + ((ninePinch->mScalable.to.x - ninePinch->mScalable.from.x) * pXScale);
@@ -1982,16 +5618,6 @@ const NinePatchDrawInfo& GLES::DrawNinePatch(uint32_t pNinePatch,int pX,int pY,f
 		}
 	}
 
-	SelectAndEnableShader(pNinePatch,255,255,255,255);
-
-	// Because UV's are normalised.
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				4,ninePinch->mUVs);
-	CHECK_OGL_ERRORS();
 
 	static const uint8_t indices[9*6] =
 	{
@@ -2008,9 +5634,15 @@ const NinePatchDrawInfo& GLES::DrawNinePatch(uint32_t pNinePatch,int pX,int pY,f
 		10,11,15,10,15,14		
 	};
 
-	VertexPtr(2,GL_SHORT,mWorkBuffers->vertices2DShort.Data());
-	glDrawElements(GL_TRIANGLES,9*6,GL_UNSIGNED_BYTE,indices);
-	CHECK_OGL_ERRORS();
+	// Expanded into the batch, the uvs are normalised.
+	const VertShortXY* uvs = &ninePinch->mUVs[0][0];
+	const VertShortXY* xy = mWorkBuffers->vertices2DShort.Data();
+	const uint32_t colour = PackColour(255,255,255,255);
+	BatchVert2D* batch = Batch2DAppend(Select2DShader(ninePinch->mTexture),ninePinch->mTexture,9*6);
+	for( uint8_t i : indices )
+	{
+		SetBatchVert(*batch++,xy[i].x,xy[i].y,uvs + i,colour);
+	}
 
 
 	return mNinePatchDrawInfo;
@@ -2021,6 +5653,7 @@ const NinePatchDrawInfo& GLES::DrawNinePatch(uint32_t pNinePatch,int pX,int pY,f
 // Pixel font, low res, mainly for debugging.
 void GLES::FontPrint(int pX,int pY,const char* pText)
 {
+	TRACE_SCOPE("FontPrint");
 	const std::string_view s(pText);
 	mWorkBuffers->vertices2DShort.Restart();
 	mWorkBuffers->uvShort.Restart();
@@ -2040,26 +5673,16 @@ void GLES::FontPrint(int pX,int pY,const char* pText)
 		mWorkBuffers->uvShort.BuildQuad(x+64,y+64,charSize-128,charSize-128);// The +- 64 is because of filtering. Makes font look nice at normal size.
 	}
 
-	// Continue adding uvs to the buffer after the verts.
-	EnableShader(mShaders.TextureAlphaOnly2D);
-	mShaders.CurrentShader->SetTexture(mPixelFont.texture);
-	mShaders.CurrentShader->SetGlobalColour(mPixelFont.R,mPixelFont.G,mPixelFont.B,mPixelFont.A);
-
 	// how many?
 	const int numVerts = mWorkBuffers->vertices2DShort.Used();
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				4,mWorkBuffers->uvShort.Data());
-	CHECK_OGL_ERRORS();
-
-	VertexPtr(2,GL_SHORT,mWorkBuffers->vertices2DShort.Data());
-	CHECK_OGL_ERRORS();
-	glDrawArrays(GL_TRIANGLES,0,numVerts);
-	CHECK_OGL_ERRORS();
+	Batch2DAddTriangles(
+		mShaders.TextureAlphaOnly2D,
+		mPixelFont.texture,
+		mWorkBuffers->vertices2DShort.Data(),
+		mWorkBuffers->uvShort.Data(),
+		numVerts,
+		PackColour(mPixelFont.R,mPixelFont.G,mPixelFont.B,mPixelFont.A));
 }
 
 void GLES::FontPrintf(int pX,int pY,const char* pFmt,...)
@@ -2103,17 +5726,17 @@ int GLES::FontGetPrintfWidth(const char* pFmt,...)
 #ifdef USE_FREETYPEFONTS
 uint32_t GLES::FontLoad(const std::string& pFontName,int pPixelHeight)
 {
+	TRACE_SCOPE("FontLoad");
 	FT_Face loadedFace;
 	if( FT_New_Face(mFreetype,pFontName.c_str(),0,&loadedFace) != 0 )
 	{
 		THROW_MEANINGFUL_EXCEPTION("Failed to load true type font " + pFontName);
 	}
 
-	const uint32_t fontID = mNextFontID++;
-	mFreeTypeFonts[fontID] = std::make_unique<FreeTypeFont>(loadedFace,pPixelHeight);
+	const uint32_t fontID = mFreeTypeFonts.Add(std::make_unique<FreeTypeFont>(loadedFace,pPixelHeight));
 
 	// Now we need to prepare the texture cache.
-	auto& font = mFreeTypeFonts.at(fontID);
+	FreeTypeFont* font = mFreeTypeFonts.Get(fontID);
 	font->BuildTexture(
 		mMaximumAllowedGlyph,
 		[this](int pWidth,int pHeight)
@@ -2138,12 +5761,12 @@ uint32_t GLES::FontLoad(const std::string& pFontName,int pPixelHeight)
 
 void GLES::FontDelete(uint32_t pFont)
 {
-	mFreeTypeFonts.erase(pFont);
+	mFreeTypeFonts.Erase(pFont);
 }
 
 void GLES::FontSetColour(uint32_t pFont,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
 {
-	auto& font = mFreeTypeFonts.at(pFont);
+	FreeTypeFont* font = GetValid(mFreeTypeFonts,pFont,"Font");
 	font->mColour.R = pRed;
 	font->mColour.G = pGreen;
 	font->mColour.B = pBlue;
@@ -2152,7 +5775,12 @@ void GLES::FontSetColour(uint32_t pFont,uint8_t pRed,uint8_t pGreen,uint8_t pBlu
 
 void GLES::FontPrint(uint32_t pFont,int pX,int pY,const std::string_view& pText)
 {
-	auto& font = mFreeTypeFonts.at(pFont);
+	TRACE_SCOPE("FontPrint");
+	FreeTypeFont* font = mFreeTypeFonts.Get(pFont);
+	if( font == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("FontPrint passed a stale or unknown font handle");
+	}
 
 	mWorkBuffers->vertices2DShort.Restart();
 	mWorkBuffers->uvShort.Restart();
@@ -2185,23 +5813,17 @@ void GLES::FontPrint(uint32_t pFont,int pX,int pY,const std::string_view& pText)
 	}
 
 	assert(font->mTexture);
-	EnableShader(mShaders.TextureAlphaOnly2D);
-	mShaders.CurrentShader->SetTexture(font->mTexture);
-	mShaders.CurrentShader->SetGlobalColour(font->mColour.R,font->mColour.G,font->mColour.B,font->mColour.A);
 
 	// how many?
 	const int numVerts = mWorkBuffers->vertices2DShort.Used();
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::TEXCOORD,
-				2,
-				GL_SHORT,
-				GL_TRUE,
-				4,mWorkBuffers->uvShort.Data());
-
-	VertexPtr(2,GL_SHORT,mWorkBuffers->vertices2DShort.Data());
-	glDrawArrays(GL_TRIANGLES,0,numVerts);
-	CHECK_OGL_ERRORS();
+	Batch2DAddTriangles(
+		mShaders.TextureAlphaOnly2D,
+		font->mTexture,
+		mWorkBuffers->vertices2DShort.Data(),
+		mWorkBuffers->uvShort.Data(),
+		numVerts,
+		PackColour(font->mColour.R,font->mColour.G,font->mColour.B,font->mColour.A));
 }
 
 void GLES::FontPrintf(uint32_t pFont,int pX,int pY,const char* pFmt,...)
@@ -2216,7 +5838,7 @@ void GLES::FontPrintf(uint32_t pFont,int pX,int pY,const char* pFmt,...)
 
 int GLES::FontGetPrintWidth(uint32_t pFont,const std::string_view& pText)
 {
-	auto& font = mFreeTypeFonts.at(pFont);
+	FreeTypeFont* font = GetValid(mFreeTypeFonts,pFont,"Font");
 
 	// Get where the uvs will be written too.
 	int x = 0;
@@ -2250,13 +5872,13 @@ int GLES::FontGetPrintfWidth(uint32_t pFont,const char* pFmt,...)
 
 int GLES::FontGetHeight(uint32_t pFont)const
 {
-	auto& font = mFreeTypeFonts.at(pFont);
+	FreeTypeFont* font = GetValid(mFreeTypeFonts,pFont,"Font");
 	return font->mBaselineHeight;
 }
 
 uint32_t GLES::FontGetTexture(uint32_t pFont)const
 {
-	auto& font = mFreeTypeFonts.at(pFont);
+	FreeTypeFont* font = GetValid(mFreeTypeFonts,pFont,"Font");
 	return font->mTexture;
 }
 
@@ -2267,6 +5889,7 @@ uint32_t GLES::FontGetTexture(uint32_t pFont)const
 
 void GLES::ProcessSystemEvents()
 {
+	TRACE_SCOPE("ProcessSystemEvents");
 	if( mPlatform->ProcessEvents(mSystemEventHandler) )
 	{// A system event asked to quit. Like window close button.
 	 // Only set to true based on return of ProcessEvents, if we wrote to it run the risk of missing the ctrl+c message
@@ -2291,29 +5914,105 @@ void GLES::SetRenderingDefaults()
 	Begin2D();
 
 	// Always cull, because why not. :) Make code paths simple.
-	glEnable(GL_CULL_FACE);
+	mStateCache->SetCapability(GL_CULL_FACE,true);
 	glFrontFace(GL_CW);
 	glCullFace(GL_BACK);
 
 	// I have alpha blend on all the time. Makes life easy. No point in complicating the code for speed, going for simple implementation not fastest!
 	glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_BLEND);
+	mStateCache->SetCapability(GL_BLEND,true);
 
-	glEnableVertexAttribArray((int)StreamIndex::VERTEX);//Always on
+	mStateCache->SetAttribArray(StreamIndex::VERTEX,true);//Always on
 
 	CHECK_OGL_ERRORS();
 }
 
+void GLES::InitInstancing()
+{
+	const char* version = (const char*)glGetString(GL_VERSION);
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	if( version == nullptr )
+	{
+		return;
+	}
+
+	// Instancing is core in GLES 3.0 and GL 3.3, before that it may be there as an extension.
+	const bool isGLES = strncmp(version,"OpenGL ES",9) == 0;
+	int major = 0,minor = 0;
+	sscanf(isGLES ? version + 9 : version,"%d.%d",&major,&minor);
+	const bool isCore = isGLES ? major >= 3 : (major > 3 || (major == 3 && minor >= 3));
+
+	auto hasExtension = [extensions](const char* pName)
+	{
+		return extensions != nullptr && strstr(extensions,pName) != nullptr;
+	};
+
+	const std::pair<bool,const char*> options[] =
+	{
+		{isCore,""},
+		{hasExtension("GL_ARB_instanced_arrays"),"ARB"},
+		{hasExtension("GL_EXT_instanced_arrays"),"EXT"},
+		{hasExtension("GL_ANGLE_instanced_arrays"),"ANGLE"}
+	};
+
+	for( const auto& option : options )
+	{
+		if( option.first )
+		{
+			mStateCache->mDrawElementsInstanced = (GLStateCache::DrawElementsInstancedFunc)mPlatform->GetProcAddress((std::string("glDrawElementsInstanced") + option.second).c_str());
+			mStateCache->mVertexAttribDivisor = (GLStateCache::VertexAttribDivisorFunc)mPlatform->GetProcAddress((std::string("glVertexAttribDivisor") + option.second).c_str());
+			if( mStateCache->GetHasInstancing() )
+			{
+				VERBOSE_MESSAGE("Instanced drawing is available, using the " << (option.second[0] ? option.second : "core") << " functions");
+				return;
+			}
+		}
+	}
+
+	mStateCache->mDrawElementsInstanced = nullptr;
+	mStateCache->mVertexAttribDivisor = nullptr;
+	VERBOSE_MESSAGE("Instanced drawing is not available, quad batches will replicate their data per vertex");
+}
+
+void GLES::InitTextureFormats()
+{
+	const char* version = (const char*)glGetString(GL_VERSION);
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	if( version == nullptr )
+	{
+		return;
+	}
+
+	// ETC2 is core in GLES 3.0 and GL 4.3, ETC1 is an extension on most GLES 2.0 drivers.
+	const bool isGLES = strncmp(version,"OpenGL ES",9) == 0;
+	int major = 0,minor = 0;
+	sscanf(isGLES ? version + 9 : version,"%d.%d",&major,&minor);
+
+	auto hasExtension = [extensions](const char* pName)
+	{
+		return extensions != nullptr && strstr(extensions,pName) != nullptr;
+	};
+
+	mCompressedFormats.ETC1 = hasExtension("GL_OES_compressed_ETC1_RGB8_texture");
+	mCompressedFormats.ETC2 = isGLES ? major >= 3 : (major > 4 || (major == 4 && minor >= 3) || hasExtension("GL_ARB_ES3_compatibility"));
+
+	// Render targets want a combined depth and stencil buffer, GLES 2.0 can only attach one of each without this.
+	mRenderTarget.PackedDepthStencil = major >= 3 || hasExtension("GL_OES_packed_depth_stencil") || hasExtension("GL_EXT_packed_depth_stencil") || hasExtension("GL_ARB_framebuffer_object");
+
+	VERBOSE_MESSAGE("Compressed textures, ETC1 " << (mCompressedFormats.ETC1 ? "native" : (mCompressedFormats.ETC2 ? "as ETC2" : "not supported")) << " ETC2 " << (mCompressedFormats.ETC2 ? "supported" : "not supported"));
+}
+
 void GLES::BuildShaders()
 {
 	const char* ColourOnly2D_VS = R"(
 		uniform mat4 u_proj_cam;
 		uniform vec4 u_global_colour;
 		attribute vec4 a_xyz;
+		attribute vec4 a_col;
 		varying vec4 v_col;
 		void main(void)
 		{
-			v_col = u_global_colour;
+			v_col = u_global_colour * a_col;
 			gl_Position = u_proj_cam * a_xyz;
 		}
 	)";
@@ -2326,18 +6025,19 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.ColourOnly2D = std::make_unique<GLShader>("ColourOnly2D",ColourOnly2D_VS,ColourOnly2D_PS);
+	mShaders.ColourOnly2D = std::make_unique<GLShader>(*mStateCache,"ColourOnly2D",ColourOnly2D_VS,ColourOnly2D_PS);
 
 	const char* TextureColour2D_VS = R"(
 		uniform mat4 u_proj_cam;
 		uniform vec4 u_global_colour;
 		attribute vec4 a_xyz;
 		attribute vec2 a_uv0;
+		attribute vec4 a_col;
 		varying vec4 v_col;
 		varying vec2 v_tex0;
 		void main(void)
 		{
-			v_col = u_global_colour;
+			v_col = u_global_colour * a_col;
 			v_tex0 = a_uv0;
 			gl_Position = u_proj_cam * a_xyz;
 		}
@@ -2353,18 +6053,19 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.TextureColour2D = std::make_unique<GLShader>("TextureColour2D",TextureColour2D_VS,TextureColour2D_PS);
+	mShaders.TextureColour2D = std::make_unique<GLShader>(*mStateCache,"TextureColour2D",TextureColour2D_VS,TextureColour2D_PS);
 
 	const char* TextureAlphaOnly2D_VS = R"(
 		uniform mat4 u_proj_cam;
 		uniform vec4 u_global_colour;
 		attribute vec4 a_xyz;
 		attribute vec2 a_uv0;
+		attribute vec4 a_col;
 		varying vec4 v_col;
 		varying vec2 v_tex0;
 		void main(void)
 		{
-			v_col = u_global_colour;
+			v_col = u_global_colour * a_col;
 			v_tex0 = a_uv0;
 			gl_Position = u_proj_cam * a_xyz;
 		}
@@ -2380,7 +6081,7 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.TextureAlphaOnly2D = std::make_unique<GLShader>("TextureAlphaOnly2D",TextureAlphaOnly2D_VS,TextureAlphaOnly2D_PS);
+	mShaders.TextureAlphaOnly2D = std::make_unique<GLShader>(*mStateCache,"TextureAlphaOnly2D",TextureAlphaOnly2D_VS,TextureAlphaOnly2D_PS);
 	
 	const char* SpriteShader2D_VS = R"(
 		uniform mat4 u_proj_cam;
@@ -2408,7 +6109,7 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.SpriteShader2D = std::make_unique<GLShader>("SpriteShader2D",SpriteShader2D_VS,SpriteShader2D_PS);
+	mShaders.SpriteShader2D = std::make_unique<GLShader>(*mStateCache,"SpriteShader2D",SpriteShader2D_VS,SpriteShader2D_PS);
 
 	const char* QuadBatchShader2D_VS = R"(
 		uniform mat4 u_proj_cam;
@@ -2416,6 +6117,7 @@ void GLES::BuildShaders()
 		attribute vec4 a_xyz;
 		attribute vec2 a_uv0;
 		attribute vec4 a_trans;
+		attribute vec4 a_col;
 		varying vec4 v_col;
 		varying vec2 v_tex0;
 		void main(void)
@@ -2445,7 +6147,7 @@ void GLES::BuildShaders()
 			trans[3][2] = 0.0;
 			trans[3][3] = 1.0;
 
-			v_col = u_global_colour;
+			v_col = u_global_colour * a_col;
 			v_tex0 = a_uv0;
 			gl_Position = u_proj_cam * (trans * a_xyz);
 		}
@@ -2461,7 +6163,16 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.QuadBatchShader2D = std::make_unique<GLShader>("QuadBatchShader2D",QuadBatchShader2D_VS,QuadBatchShader2D_PS);
+	mShaders.QuadBatchShader2D = std::make_unique<GLShader>(*mStateCache,"QuadBatchShader2D",QuadBatchShader2D_VS,QuadBatchShader2D_PS);
+
+	if( mStateCache->GetHasInstancing() )
+	{
+		// Same as above but the uvs are per quad, top left and bottom right, and the corner is picked with the vertex position.
+		std::string instancedVS = QuadBatchShader2D_VS;
+		instancedVS.replace(instancedVS.find("attribute vec2 a_uv0;"),strlen("attribute vec2 a_uv0;"),"attribute vec4 a_uv0;");
+		instancedVS.replace(instancedVS.find("v_tex0 = a_uv0;"),strlen("v_tex0 = a_uv0;"),"v_tex0 = mix(a_uv0.xy,a_uv0.zw,step(0.0,a_xyz.xy));");
+		mShaders.QuadBatchInstancedShader2D = std::make_unique<GLShader>(*mStateCache,"QuadBatchInstancedShader2D",instancedVS.c_str(),QuadBatchShader2D_PS);
+	}
 
 
 	const char* ColourOnly3D_VS = R"(
@@ -2486,7 +6197,7 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.ColourOnly3D = std::make_unique<GLShader>("ColourOnly3D",ColourOnly3D_VS,ColourOnly3D_PS);	
+	mShaders.ColourOnly3D = std::make_unique<GLShader>(*mStateCache,"ColourOnly3D",ColourOnly3D_VS,ColourOnly3D_PS);	
 
 	const char* TextureOnly3D_VS = R"(
 		uniform mat4 u_proj_cam;
@@ -2514,11 +6225,25 @@ void GLES::BuildShaders()
 		}
 	)";
 
-	mShaders.TextureOnly3D = std::make_unique<GLShader>("TextureOnly3D",TextureOnly3D_VS,TextureOnly3D_PS);	
+	mShaders.TextureOnly3D = std::make_unique<GLShader>(*mStateCache,"TextureOnly3D",TextureOnly3D_VS,TextureOnly3D_PS);	
+
+}
 
+const SubTexture* GLES::GetSubTexture(uint32_t pTexture)const
+{
+	if( (pTexture&SUB_TEXTURE_HANDLE_BIT) == 0 )
+	{// Quick out, most of the time it's a normal texture.
+		return nullptr;
+	}
+	const SubTexture* sub = mSubTextures.Get(pTexture);
+	if( sub == nullptr )
+	{
+		STALE_HANDLE_IN_DRAW("Stale or unknown atlas image handle " + std::to_string(pTexture),nullptr);
+	}
+	return sub;
 }
 
-void GLES::SelectAndEnableShader(uint32_t pTexture,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha)
+TinyShader GLES::Select2DShader(uint32_t pTexture)const
 {
 	assert(mShaders.TextureAlphaOnly2D);
 	assert(mShaders.TextureColour2D);
@@ -2527,7 +6252,27 @@ void GLES::SelectAndEnableShader(uint32_t pTexture,uint8_t pRed,uint8_t pGreen,u
 	TinyShader aShader = mShaders.ColourOnly2D;
 	if( pTexture > 0 )
 	{
-		if( mTextures.at(pTexture)->mFormat == TextureFormat::FORMAT_ALPHA )
+		TextureFormat format = TextureFormat::FORMAT_RGBA;
+		if( pTexture&STREAMING_TEXTURE_HANDLE_BIT )
+		{
+			const StreamingTexture* streaming = mStreamingTextures.Get(pTexture);
+			if( streaming == nullptr )
+			{
+				STALE_HANDLE_IN_DRAW("Stale or unknown streaming texture handle " + std::to_string(pTexture),mShaders.TextureColour2D);
+			}
+			format = streaming->mFormat;
+		}
+		else
+		{
+			const GLTexture* tex = mTextures.Get(pTexture);
+			if( tex == nullptr )
+			{
+				STALE_HANDLE_IN_DRAW("Stale or unknown texture handle " + std::to_string(pTexture),mShaders.TextureColour2D);
+			}
+			format = tex->mFormat;
+		}
+
+		if( format == TextureFormat::FORMAT_ALPHA )
 		{
 			aShader = mShaders.TextureAlphaOnly2D;
 		}
@@ -2537,12 +6282,7 @@ void GLES::SelectAndEnableShader(uint32_t pTexture,uint8_t pRed,uint8_t pGreen,u
 		}
 	}
 
-	EnableShader(aShader);
-	mShaders.CurrentShader->SetGlobalColour(pRed,pGreen,pBlue,pAlpha);
-	if( pTexture > 0 )
-	{
-		mShaders.CurrentShader->SetTexture(pTexture);
-	}
+	return aShader;
 }
 
 void GLES::EnableShader(TinyShader pShader)
@@ -2607,104 +6347,466 @@ void GLES::BuildPixelFontTexture()
 			const uint32_t shift = (7-nibble)*4;
 			const uint32_t mask = (15<<shift);
 
-			uint8_t a = (uint8_t)((dword&mask)>>shift);
-			pixels[n++] = a<<4|a;
+			uint8_t a = (uint8_t)((dword&mask)>>shift);
+			pixels[n++] = a<<4|a;
+		}
+	}
+
+	mPixelFont.texture = CreateTexture(256,256,pixels,tinygles::TextureFormat::FORMAT_ALPHA,true);
+}
+
+void GLES::InitFreeTypeFont()
+{
+#ifdef USE_FREETYPEFONTS	
+	if( FT_Init_FreeType(&mFreetype) == 0 )
+	{
+		VERBOSE_MESSAGE("Freetype font library created");
+	}
+	else
+	{
+		THROW_MEANINGFUL_EXCEPTION("Failed to init free type font library");
+	}
+#endif
+}
+
+void GLES::AllocateQuadBuffers()
+{
+	VERBOSE_MESSAGE("Creating quad buffers");
+	// Fill quad index buffer.
+	const size_t numIndices = mQuadBatch.IndicesPerQuad * mQuadBatch.MaxQuads;
+	const size_t sizeofQuadIndexBuffer = sizeof(uint16_t) * numIndices;
+	uint16_t* idx = (uint16_t*)mWorkBuffers->scratchRam.Restart(sizeofQuadIndexBuffer);
+#ifdef DEBUG_BUILD
+	const uint16_t* idx_end = idx + numIndices;
+#endif
+	uint16_t baseIndex = 0;
+	for( size_t n = 0 ; n < mQuadBatch.MaxQuads ; n++, baseIndex += 4, idx += mQuadBatch.IndicesPerQuad )
+	{
+		assert( idx + mQuadBatch.IndicesPerQuad <= idx_end );
+
+		idx[0] = 0 + baseIndex;
+		idx[1] = 1 + baseIndex;
+		idx[2] = 2 + baseIndex;
+		idx[3] = 0 + baseIndex;
+		idx[4] = 2 + baseIndex;
+		idx[5] = 3 + baseIndex;
+	}
+
+	glGenBuffers(1,&mQuadBatch.IndicesBuffer);
+	mStateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER,mQuadBatch.IndicesBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER,sizeofQuadIndexBuffer,mWorkBuffers->scratchRam.Data(),GL_STATIC_DRAW);
+	mStateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
+	CHECK_OGL_ERRORS();
+
+	// Now build the verts for the quads, here we can use signed bytes.
+	const size_t numberOfVectors = mQuadBatch.VerticesPerQuad * mQuadBatch.MaxQuads;
+	const size_t sizeofQuadVertBuffer = sizeof(Vec2Db) * numberOfVectors;
+	Vec2Db* v = (Vec2Db*)mWorkBuffers->scratchRam.Restart(sizeofQuadVertBuffer);
+#ifdef DEBUG_BUILD
+	const Vec2Db* v_end = v + numberOfVectors;
+#endif	
+	for( size_t n = 0 ; n < mQuadBatch.MaxQuads ; n++, v += mQuadBatch.VerticesPerQuad )
+	{
+		assert( v + mQuadBatch.VerticesPerQuad <= v_end );
+
+		v[0].x = -63;
+		v[0].y = -63;
+
+		v[1].x =  63;
+		v[1].y = -63;
+
+		v[2].x =  63;
+		v[2].y =  63;
+
+		v[3].x = -63;
+		v[3].y =  63;
+	}
+
+	glGenBuffers(1,&mQuadBatch.VerticesBuffer);
+	mStateCache->BindBuffer(GL_ARRAY_BUFFER,mQuadBatch.VerticesBuffer);
+	glBufferData(GL_ARRAY_BUFFER,sizeofQuadVertBuffer,mWorkBuffers->scratchRam.Data(),GL_STATIC_DRAW);
+	mStateCache->BindBuffer(GL_ARRAY_BUFFER,0);
+
+	CHECK_OGL_ERRORS();
+}
+
+void GLES::VertexPtr(DrawCommand& rCommand,int pNum_coord, uint32_t pType,const void* pPointer)
+{
+	if(pNum_coord < 2 || pNum_coord > 3)
+	{
+		THROW_MEANINGFUL_EXCEPTION("VertexPtr passed invalid value for pNum_coord, must be 2 or 3 got " + std::to_string(pNum_coord));
+	}
+
+	rCommand.SetStream(StreamIndex::VERTEX,pNum_coord,pType,pType == GL_BYTE,0,pPointer);
+}
+
+BatchVert2D* GLES::Batch2DAppend(const TinyShader& pShader,uint32_t pTexture,size_t pCount)
+{
+	auto& batch = *mBatch2D;
+	if( pTexture&STREAMING_TEXTURE_HANDLE_BIT )
+	{
+		pTexture = ResolveStreamingTexture(pTexture);
+	}
+
+	if( pCount > Batch2D::MaxVertices )
+	{
+		THROW_MEANINGFUL_EXCEPTION("Batch2DAppend asked for " + std::to_string(pCount) + " vertices, the most it can take in one go is " + std::to_string(Batch2D::MaxVertices));
+	}
+
+	if( batch.mShader != pShader || batch.mTexture != pTexture || batch.mUsed + pCount > Batch2D::MaxVertices )
+	{
+		FlushBatch2D();
+		batch.mShader = pShader;
+		batch.mTexture = pTexture;
+	}
+
+	BatchVert2D* verts = batch.mVertices + batch.mUsed;
+	batch.mUsed += pCount;
+	return verts;
+}
+
+void GLES::Batch2DAddTriangles(const TinyShader& pShader,uint32_t pTexture,const VertShortXY* pVerts,const VertShortXY* pUVs,size_t pCount,uint32_t pColour)
+{
+	while( pCount > 0 )
+	{
+		const size_t count = std::min(pCount,Batch2D::MaxVertices);
+		BatchVert2D* verts = Batch2DAppend(pShader,pTexture,count);
+		for( size_t n = 0 ; n < count ; n++ )
+		{
+			SetBatchVert(verts[n],pVerts[n].x,pVerts[n].y,pUVs + n,pColour);
+		}
+		pVerts += count;
+		pUVs += count;
+		pCount -= count;
+	}
+}
+
+void GLES::FlushBatch2D()
+{
+	auto& batch = *mBatch2D;
+	if( batch.mUsed == 0 )
+	{
+		return;
+	}
+	TRACE_SCOPE("FlushBatch2D");// After the check so the many calls with nothing to draw don't fill the trace.
+
+	const BatchVert2D* verts = batch.mVertices;
+	DrawCommand draw(batch.mShader,GL_TRIANGLES,batch.mUsed);
+	draw.texture = batch.mTexture;
+	draw.SetStream(StreamIndex::VERTEX,2,GL_FLOAT,GL_FALSE,sizeof(BatchVert2D),&verts->x);
+	if( batch.mShader->GetUsesTexture() )
+	{
+		draw.SetStream(StreamIndex::TEXCOORD,2,GL_SHORT,GL_TRUE,sizeof(BatchVert2D),&verts->u);
+	}
+	draw.SetStream(StreamIndex::COLOUR,4,GL_UNSIGNED_BYTE,GL_TRUE,sizeof(BatchVert2D),&verts->rgba);
+	draw.interleaved = true;
+
+	// The vertices stay where they are until the next append so the draw can still use them.
+	batch.mUsed = 0;
+	SubmitDraw(draw);
+}
+
+void GLES::SubmitDraw(const DrawCommand& pCommand)
+{
+	if( mDisplayListRecording )
+	{// The streaming texture is resolved when the list is replayed, so it draws with the texture last updated then.
+		FlushBatch2D();
+		mDisplayListRecording->Record(pCommand,mMatrices.projection,mMatrices.transform,mDepthTest);
+		return;
+	}
+
+	if( pCommand.texture&STREAMING_TEXTURE_HANDLE_BIT )
+	{// Draw with the texture last updated. Not common so taking a copy of the command is fine.
+		DrawCommand resolved = pCommand;
+		resolved.texture = ResolveStreamingTexture(pCommand.texture);
+		SubmitDraw(resolved);
+		return;
+	}
+
+	// Anything in the 2D batch was drawn before this so has to go first.
+	FlushBatch2D();
+
+	if( mDeferred->mEnabled )
+	{
+		if( mDeferred->GetIsProjectionsFull(mMatrices.projection) )
+		{// Out of room in the sort key, draw what we have so the passes stay in order.
+			FlushDeferredDraws();
+		}
+		mDeferred->Record(pCommand,pCommand.shader->mSortID,mMatrices.projection,mMatrices.transform,mDepthTest);
+	}
+	else
+	{
+		ExecuteDraw(pCommand);
+	}
+}
+
+void GLES::ExecuteDraw(const DrawCommand& pCommand)
+{
+	TRACE_SCOPE("ExecuteDraw");
+	assert(pCommand.shader);
+
+	const GLTexture* texture = nullptr;
+	if( pCommand.texture > 0 )
+	{
+		texture = mTextures.Get(pCommand.texture);
+		if( texture == nullptr )
+		{
+			STALE_HANDLE_IN_DRAW("Draw passed a stale or unknown texture handle " + std::to_string(pCommand.texture));
+		}
+	}
+
+	EnableShader(pCommand.shader);
+	mStats->mCurrent.drawCalls++;
+	mStats->mCurrent.vertices += pCommand.count * (pCommand.instanceCount > 0 ? pCommand.instanceCount : 1);
+
+	// A shader that takes a colour stream can be given none, as with quad batches that do not use per quad colour.
+	// The stream is then switched off and all vertices get white.
+	if( pCommand.shader->mEnableStreamColour && pCommand.streams[(size_t)StreamIndex::COLOUR].size == 0 )
+	{
+		mStateCache->SetAttribArray(StreamIndex::COLOUR,false);
+		glVertexAttrib4f((GLuint)StreamIndex::COLOUR,1.0f,1.0f,1.0f,1.0f);
+	}
+	else
+	{
+		mStateCache->SetAttribArray(StreamIndex::COLOUR,pCommand.shader->mEnableStreamColour);
+	}
+
+	if( texture )
+	{
+		if( mTextureMemory.Budget > 0 )
+		{
+			UseTexture(pCommand.texture);
+		}
+		mShaders.CurrentShader->SetTexture(texture->mGLName);
+	}
+	mShaders.CurrentShader->SetGlobalColour(pCommand.colour[0],pCommand.colour[1],pCommand.colour[2],pCommand.colour[3]);
+
+	// Streams in client memory are copied into the streaming buffer and drawn from there.
+	// If the caller says they are interleaved, the block of memory they share is only copied once.
+	uintptr_t clientStart = UINTPTR_MAX;
+	uintptr_t clientEnd = 0;
+	size_t clientBytes = 0;
+	for( const auto& stream : pCommand.streams )
+	{
+		if( stream.size > 0 && stream.buffer == 0 )
+		{
+			clientBytes += pCommand.GetStreamBytes(stream) + 4;// +4 for the alignment of each write.
+		}
+	}
+
+	const bool interleaved = pCommand.interleaved && clientBytes > 0;
+	uintptr_t blockOffset = 0;
+	if( interleaved )
+	{
+		pCommand.GetClientBlock(clientStart,clientEnd);
+		blockOffset = mStreaming->vertices.Write((const void*)clientStart,clientEnd - clientStart);
+	}
+	else if( clientBytes > 0 )
+	{
+		mStreaming->vertices.Reserve(clientBytes);
+	}
+
+	for( size_t n = 0 ; n < pCommand.streams.size() ; n++ )
+	{
+		const DrawStream& stream = pCommand.streams[n];
+		if( stream.size > 0 )
+		{
+			const void* data = stream.data;
+			GLuint buffer = stream.buffer;
+			if( buffer == 0 )
+			{
+				if( interleaved )
+				{
+					data = (const void*)(blockOffset + ((uintptr_t)stream.data - clientStart));
+				}
+				else
+				{
+					data = (const void*)mStreaming->vertices.Write(stream.data,pCommand.GetStreamBytes(stream));
+				}
+				buffer = mStreaming->vertices.GetBuffer();
+			}
+
+			mStateCache->BindBuffer(GL_ARRAY_BUFFER,buffer);
+			glVertexAttribPointer((GLuint)n,stream.size,stream.type,stream.normalised,stream.stride,data);
+			if( mStateCache->GetHasInstancing() )
+			{
+				mStateCache->SetAttribDivisor((StreamIndex)n,stream.divisor);
+			}
+			CHECK_OGL_ERRORS();
 		}
 	}
 
-	mPixelFont.texture = CreateTexture(256,256,pixels,tinygles::TextureFormat::FORMAT_ALPHA,true);
-}
+	assert( pCommand.instanceCount == 0 || (pCommand.GetIsIndexed() && mStateCache->GetHasInstancing()) );
 
-void GLES::InitFreeTypeFont()
-{
-#ifdef USE_FREETYPEFONTS	
-	if( FT_Init_FreeType(&mFreetype) == 0 )
+	if( pCommand.GetIsIndexed() )
 	{
-		VERBOSE_MESSAGE("Freetype font library created");
+		const void* indices = pCommand.indices;
+		GLuint buffer = pCommand.indexBuffer;
+		if( buffer == 0 )
+		{
+			indices = (const void*)mStreaming->indices.Write(pCommand.indices,GetGLTypeSize(pCommand.indexType) * pCommand.count);
+			buffer = mStreaming->indices.GetBuffer();
+		}
+
+		mStateCache->BindBuffer(GL_ELEMENT_ARRAY_BUFFER,buffer);
+		if( pCommand.instanceCount > 0 )
+		{
+			mStateCache->mDrawElementsInstanced(pCommand.mode,pCommand.count,pCommand.indexType,indices,pCommand.instanceCount);
+		}
+		else
+		{
+			glDrawElements(pCommand.mode,pCommand.count,pCommand.indexType,indices);
+		}
+		CHECK_OGL_ERRORS();
 	}
 	else
 	{
-		THROW_MEANINGFUL_EXCEPTION("Failed to init free type font library");
+		glDrawArrays(pCommand.mode,0,pCommand.count);
+		CHECK_OGL_ERRORS();
 	}
-#endif
 }
 
-void GLES::AllocateQuadBuffers()
+void GLES::FlushDeferredDraws()
 {
-	VERBOSE_MESSAGE("Creating quad buffers");
-	// Fill quad index buffer.
-	const size_t numIndices = mQuadBatch.IndicesPerQuad * mQuadBatch.MaxQuads;
-	const size_t sizeofQuadIndexBuffer = sizeof(uint16_t) * numIndices;
-	uint16_t* idx = (uint16_t*)mWorkBuffers->scratchRam.Restart(sizeofQuadIndexBuffer);
-#ifdef DEBUG_BUILD
-	const uint16_t* idx_end = idx + numIndices;
-#endif
-	uint16_t baseIndex = 0;
-	for( size_t n = 0 ; n < mQuadBatch.MaxQuads ; n++, baseIndex += 4, idx += mQuadBatch.IndicesPerQuad )
+	TRACE_SCOPE("FlushDeferredDraws");
+	FlushBatch2D();
+
+	auto& deferred = *mDeferred;
+	if( deferred.mDraws.size() == 0 )
 	{
-		assert( idx + mQuadBatch.IndicesPerQuad <= idx_end );
+		return;
+	}
 
-		idx[0] = 0 + baseIndex;
-		idx[1] = 1 + baseIndex;
-		idx[2] = 2 + baseIndex;
-		idx[3] = 0 + baseIndex;
-		idx[4] = 2 + baseIndex;
-		idx[5] = 3 + baseIndex;
+	// Sort an index and not the commands, they are quite big. Stable so draws with the same key stay in the order they were made.
+	deferred.mOrder.resize(deferred.mDraws.size());
+	for( uint32_t n = 0 ; n < (uint32_t)deferred.mOrder.size() ; n++ )
+	{
+		deferred.mOrder[n] = n;
 	}
+	std::stable_sort(deferred.mOrder.begin(),deferred.mOrder.end(),[&deferred](uint32_t a,uint32_t b)
+	{
+		return deferred.mDraws[a].key < deferred.mDraws[b].key;
+	});
 
-	glGenBuffers(1,&mQuadBatch.IndicesBuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,mQuadBatch.IndicesBuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER,sizeofQuadIndexBuffer,mWorkBuffers->scratchRam.Data(),GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER,0);
-	CHECK_OGL_ERRORS();
+	// The draws are replayed with the state they were recorded with, so keep what the application has set and put it back after.
+	SavedDrawState saved(*this);
 
-	// Now build the verts for the quads, here we can use signed bytes.
-	const size_t numberOfVectors = mQuadBatch.VerticesPerQuad * mQuadBatch.MaxQuads;
-	const size_t sizeofQuadVertBuffer = sizeof(Vec2Db) * numberOfVectors;
-	Vec2Db* v = (Vec2Db*)mWorkBuffers->scratchRam.Restart(sizeofQuadVertBuffer);
-#ifdef DEBUG_BUILD
-	const Vec2Db* v_end = v + numberOfVectors;
-#endif	
-	for( size_t n = 0 ; n < mQuadBatch.MaxQuads ; n++, v += mQuadBatch.VerticesPerQuad )
+	uint32_t currentProjection = UINT32_MAX;
+	uint32_t currentTransform = UINT32_MAX;
+	const uint8_t* data = deferred.mData.data();
+	for( uint32_t index : deferred.mOrder )
 	{
-		assert( v + mQuadBatch.VerticesPerQuad <= v_end );
+		const DeferredDraws::Recorded& r = deferred.mDraws[index];
 
-		v[0].x = -63;
-		v[0].y = -63;
+		if( r.depthTest != mDepthTest )
+		{
+			mDepthTest = r.depthTest;
+			ApplyDepthState(mDepthTest);
+		}
 
-		v[1].x =  63;
-		v[1].y = -63;
+		if( r.projection != currentProjection )
+		{
+			currentProjection = r.projection;
+			memcpy(mMatrices.projection,deferred.mProjections[r.projection].m,sizeof(mMatrices.projection));
+			mShaders.CurrentShader.reset();// Forces the next shader enabled to upload the new projection.
+		}
 
-		v[2].x =  63;
-		v[2].y =  63;
+		if( r.transform != currentTransform )
+		{
+			currentTransform = r.transform;
+			memcpy(mMatrices.transform,deferred.mTransforms[r.transform].m,sizeof(mMatrices.transform));
+			if( mShaders.CurrentShader )
+			{
+				mShaders.CurrentShader->SetTransform(mMatrices.transform);
+			}
+		}
 
-		v[3].x = -63;
-		v[3].y =  63;
-	}
+		// Turn the offsets we stored back into pointers.
+		DrawCommand draw = r.command;
+		for( auto& stream : draw.streams )
+		{
+			if( stream.size > 0 && stream.buffer == 0 )
+			{
+				stream.data = data + (uintptr_t)stream.data;
+			}
+		}
 
-	glGenBuffers(1,&mQuadBatch.VerticesBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER,mQuadBatch.VerticesBuffer);
-	glBufferData(GL_ARRAY_BUFFER,sizeofQuadVertBuffer,mWorkBuffers->scratchRam.Data(),GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER,0);
+		if( draw.indices != nullptr && draw.indexBuffer == 0 )
+		{
+			draw.indices = data + (uintptr_t)draw.indices;
+		}
 
-	CHECK_OGL_ERRORS();
+		ExecuteDraw(draw);
+	}
+
+	deferred.Clear();
 }
 
-void GLES::VertexPtr(int pNum_coord, uint32_t pType,const void* pPointer)
+void GLES::ReplayDisplayList(const DisplayList& pList,const float pTransform[4][4])
 {
-	if(pNum_coord < 2 || pNum_coord > 3)
+	if( mDisplayListRecording )
+	{// It would record draws that use the other list's buffers, which could be deleted before this one.
+		THROW_MEANINGFUL_EXCEPTION("A display list can not be drawn while recording one");
+	}
+
+	// Anything in the 2D batch was drawn before the list so has to go first.
+	FlushBatch2D();
+
+	// Same as FlushDeferredDraws, keep the application's state and put it back after.
+	SavedDrawState saved(*this);
+
+	Matrix extraTransform;
+	if( pTransform )
 	{
-		THROW_MEANINGFUL_EXCEPTION("VertexPtr passed invalid value for pNum_coord, must be 2 or 3 got " + std::to_string(pNum_coord));
+		memcpy(extraTransform.m,pTransform,sizeof(extraTransform.m));
 	}
 
-	glVertexAttribPointer(
-				(GLuint)StreamIndex::VERTEX,
-				pNum_coord,
-				pType,
-				pType == GL_BYTE,
-				0,pPointer);
-	CHECK_OGL_ERRORS();
+	uint32_t currentProjection = UINT32_MAX;
+	uint32_t currentTransform = UINT32_MAX;
+	for( const auto& r : pList.mDraws )
+	{
+		if( r.depthTest != mDepthTest )
+		{
+			mDepthTest = r.depthTest;// Deferred rendering records mDepthTest so it has to be set as well.
+			ApplyDepthState(mDepthTest);
+		}
+
+		if( r.projection != currentProjection )
+		{
+			currentProjection = r.projection;
+			memcpy(mMatrices.projection,pList.mProjections[r.projection].m,sizeof(mMatrices.projection));
+			mShaders.CurrentShader.reset();// Forces the next shader enabled to upload the new projection.
+		}
+
+		if( r.transform != currentTransform )
+		{
+			currentTransform = r.transform;
+			if( pTransform )
+			{
+				Matrix combined;
+				combined.Mul(pList.mTransforms[r.transform],extraTransform);
+				memcpy(mMatrices.transform,combined.m,sizeof(mMatrices.transform));
+			}
+			else
+			{
+				memcpy(mMatrices.transform,pList.mTransforms[r.transform].m,sizeof(mMatrices.transform));
+			}
 
+			if( mShaders.CurrentShader )
+			{
+				mShaders.CurrentShader->SetTransform(mMatrices.transform);
+			}
+		}
+
+		SubmitDraw(r.command);
+	}
+}
+
+void GLES::ApplyDepthState(bool pDepthTest)
+{
+	mStateCache->SetCapability(GL_DEPTH_TEST,pDepthTest);
+	mStateCache->DepthFunc(pDepthTest?GL_LESS:GL_ALWAYS);
+	mStateCache->DepthMask(pDepthTest);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -2733,11 +6835,14 @@ void GLES::CtrlHandler(int SigNum)
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 // GLES Shader definition
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
-GLShader::GLShader(const std::string& pName,const char* pVertex, const char* pFragment) :
+static uint32_t gNextShaderSortID = 0;
+GLShader::GLShader(GLStateCache& rStateCache,const std::string& pName,const char* pVertex, const char* pFragment) :
 	mName(pName),
+	mSortID(gNextShaderSortID++),
 	mEnableStreamUV(strstr(pVertex," a_uv0;")),
 	mEnableStreamTrans(strstr(pVertex," a_trans;")),
-	mEnableStreamColour(strstr(pVertex," a_col;"))
+	mEnableStreamColour(strstr(pVertex," a_col;")),
+	mStateCache(rStateCache)
 {
 	VERBOSE_SHADER_MESSAGE("Creating " << mName << " mEnableStreamUV " << mEnableStreamUV << " mEnableStreamTrans" << mEnableStreamTrans << " mEnableStreamColour" << mEnableStreamColour);
 
@@ -2799,7 +6904,7 @@ GLShader::GLShader(const std::string& pName,const char* pVertex, const char* pFr
 	mUniforms.tex0 = GetUniformLocation("u_tex0");
 
 
-	glUseProgram(0);
+	mStateCache.UseProgram(0);
 #ifdef VERBOSE_SHADER_BUILD
 	gCurrentShaderName = "";
 #endif
@@ -2850,47 +6955,25 @@ void GLShader::Enable(const float projInvcam[4][4])
 #endif
 
 	assert(mShader);
-    glUseProgram(mShader);
-    CHECK_OGL_ERRORS();
-
-    glUniformMatrix4fv(mUniforms.proj_cam, 1, false,(const float*)projInvcam);
-    CHECK_OGL_ERRORS();
-
-	if( mEnableStreamUV )
-	{
-		glEnableVertexAttribArray((int)StreamIndex::TEXCOORD);
-	}
-	else
-	{
-		glDisableVertexAttribArray((int)StreamIndex::TEXCOORD);
-	}
-
-	if( mEnableStreamTrans )
-	{
-		glEnableVertexAttribArray((int)StreamIndex::TRANSFORM);
-	}
-	else
-	{
-		glDisableVertexAttribArray((int)StreamIndex::TRANSFORM);
-	}
+	mStateCache.UseProgram(mShader);
+	CHECK_OGL_ERRORS();
 
-	if( mEnableStreamColour )
-	{
-		glEnableVertexAttribArray((int)StreamIndex::COLOUR);
-	}
-	else
+	if( mStateCache.UpdateUniform(mUniformValues.proj_cam,(const float*)projInvcam,16) )
 	{
-		glDisableVertexAttribArray((int)StreamIndex::COLOUR);
+		glUniformMatrix4fv(mUniforms.proj_cam, 1, false,(const float*)projInvcam);
+		CHECK_OGL_ERRORS();
 	}
-	
 
+	mStateCache.SetAttribArray(StreamIndex::TEXCOORD,mEnableStreamUV);
+	mStateCache.SetAttribArray(StreamIndex::TRANSFORM,mEnableStreamTrans);
+	mStateCache.SetAttribArray(StreamIndex::COLOUR,mEnableStreamColour);
 
-    CHECK_OGL_ERRORS();
+	CHECK_OGL_ERRORS();
 }
 
 void GLShader::SetTransform(float pTransform[4][4])
 {
-	if( mUniforms.trans >= 0 )
+	if( mUniforms.trans >= 0 && mStateCache.UpdateUniform(mUniformValues.trans,(const float*)pTransform,16) )
 	{
 		glUniformMatrix4fv(mUniforms.trans, 1, false,(const GLfloat*)pTransform);
 		CHECK_OGL_ERRORS();
@@ -2910,15 +6993,21 @@ void GLShader::SetGlobalColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t
 
 void GLShader::SetGlobalColour(float pRed,float pGreen,float pBlue,float pAlpha)
 {
-	glUniform4f(mUniforms.global_colour,pRed,pGreen,pBlue,pAlpha);
+	const float colour[4] = {pRed,pGreen,pBlue,pAlpha};
+	if( mStateCache.UpdateUniform(mUniformValues.global_colour,colour,4) )
+	{
+		glUniform4f(mUniforms.global_colour,pRed,pGreen,pBlue,pAlpha);
+	}
 }
 
 void GLShader::SetTexture(GLint pTexture)
 {
 	assert(pTexture);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D,pTexture);
-	glUniform1i(mUniforms.tex0,0);
+	mStateCache.BindTexture(0,pTexture);
+	if( mStateCache.Update(mUniformValues.tex0,0) )
+	{
+		glUniform1i(mUniforms.tex0,0);
+	}
 	CHECK_OGL_ERRORS();
 }
 
@@ -2929,7 +7018,7 @@ int GLShader::LoadShader(int type, const char* shaderCode)
 	int shaderFrag = glCreateShader(type);
 
 	// If we're GLES system we need to add "precision highp float"
-#ifdef PLATFORM_DRM_EGL
+#if defined(PLATFORM_DRM_EGL) || defined(PLATFORM_HEADLESS_EGL)
 	const std::string glesShaderCode= std::string("precision highp float; ") + shaderCode;
 	shaderCode = glesShaderCode.c_str();
 #endif
@@ -3216,6 +7305,7 @@ void FreeTypeFont::BuildTexture(
 			std::function<uint32_t(int pWidth,int pHeight)> pCreateTexture,
 			std::function<void(uint32_t pTexture,int pX,int pY,int pWidth,int pHeight,const uint8_t* pPixels)> pFillTexture)
 {
+	TRACE_SCOPE("FreeTypeFont::BuildTexture");
 
 	int maxX = 0,maxY = 0;
 	mBaselineHeight = 0;
@@ -3420,6 +7510,16 @@ PlatformInterface::PlatformInterface()
 
 PlatformInterface::~PlatformInterface()
 {
+	// The buffers can't go while the display could still be flipping to one.
+	if( mNativeWindow )
+	{
+		WaitForPageFlip(true);
+		if( mScanoutBufferObject )
+		{
+			gbm_surface_release_buffer(mNativeWindow,mScanoutBufferObject);
+		}
+	}
+
 	VERBOSE_MESSAGE("Destroying context");
 	eglDestroyContext(mDisplay, mContext);
     eglDestroySurface(mDisplay, mSurface);
@@ -3582,9 +7682,15 @@ void PlatformInterface::InitialiseDisplay()
 
 	//We have our display and have chosen the config so now we are ready to create the rendering context.
 	VERBOSE_MESSAGE("Creating context");
-	EGLint ai32ContextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+	// Ask for GLES 3.0 first, our shaders work with it and it gives us instancing. Then fall back to 2.0.
+	EGLint ai32ContextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
 	mContext = eglCreateContext(mDisplay,mConfig,EGL_NO_CONTEXT,ai32ContextAttribs);
 	if( !mContext )
+	{
+		ai32ContextAttribs[1] = 2;
+		mContext = eglCreateContext(mDisplay,mConfig,EGL_NO_CONTEXT,ai32ContextAttribs);
+	}
+	if( !mContext )
 	{
 		THROW_MEANINGFUL_EXCEPTION("Failed to get a rendering context");
 	}
@@ -3595,6 +7701,24 @@ void PlatformInterface::InitialiseDisplay()
 
 	eglMakeCurrent(mDisplay, mSurface, mSurface, mContext );
 	CHECK_OGL_ERRORS();
+
+	// Used by damage tracking to only draw what has changed.
+	const char* extensions = eglQueryString(mDisplay,EGL_EXTENSIONS);
+	auto hasExtension = [extensions](const char* pName)
+	{
+		return extensions != nullptr && strstr(extensions,pName) != nullptr;
+	};
+
+	mHasBufferAge = hasExtension("EGL_EXT_buffer_age");
+	if( hasExtension("EGL_KHR_swap_buffers_with_damage") )
+	{
+		mSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	}
+	else if( hasExtension("EGL_EXT_swap_buffers_with_damage") )
+	{
+		mSwapBuffersWithDamage = (PFNEGLSWAPBUFFERSWITHDAMAGEPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	}
+	VERBOSE_MESSAGE("Buffer age " << (mHasBufferAge?"supported":"not supported") << ", swap with damage " << (mSwapBuffersWithDamage?"supported":"not supported"));
 }
 
 void PlatformInterface::FindEGLConfiguration()
@@ -3705,13 +7829,38 @@ void PlatformInterface::UpdateCurrentBuffer()
 static void page_flip_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *data)
 {
 	/* suppress 'unused parameter' warnings */
-	(void)fd, (void)frame, (void)sec, (void)usec;
-	*((bool*)data) = 0;	// Set flip flag to false
+	(void)fd;
+	PlatformInterface* platform = (PlatformInterface*)data;
+	platform->mFlipPending = false;
+	platform->mLastVSync.microseconds = ((uint64_t)sec * 1000000) + usec;
+	platform->mLastVSync.frame = frame;
+}
+
+int PlatformInterface::GetBufferAge()
+{
+	EGLint age = 0;
+	if( mHasBufferAge == false || eglQuerySurface(mDisplay,mSurface,EGL_BUFFER_AGE_EXT,&age) == EGL_FALSE )
+	{
+		return 0;
+	}
+	return age;
 }
 
-void PlatformInterface::SwapBuffers()
+void PlatformInterface::SwapBuffers(const int* pDamageRect)
 {
-	eglSwapBuffers(mDisplay,mSurface);
+	TRACE_SCOPE("SwapBuffers");
+	if( pDamageRect && mSwapBuffersWithDamage )
+	{
+		EGLint rect[4] = {pDamageRect[0],pDamageRect[1],pDamageRect[2],pDamageRect[3]};
+		mSwapBuffersWithDamage(mDisplay,mSurface,rect,1);
+	}
+	else
+	{
+		eglSwapBuffers(mDisplay,mSurface);
+	}
+
+	// Only one flip can be queued, if the last frame's is still waiting for the vertical blank wait for it.
+	WaitForPageFlip(true);
 
 	UpdateCurrentBuffer();
 
@@ -3730,14 +7879,26 @@ void PlatformInterface::SwapBuffers()
 	}
 
 	// Using DRM_MODE_PAGE_FLIP_EVENT as some devices don't support DRM_MODE_PAGE_FLIP_ASYNC.
-	bool waiting_for_flip = 1;
-	int ret = drmModePageFlip(mDRMFile, mModeEncoder->crtc_id, mCurrentFrontBufferID,DRM_MODE_PAGE_FLIP_EVENT,&waiting_for_flip);
+	int ret = drmModePageFlip(mDRMFile, mModeEncoder->crtc_id, mCurrentFrontBufferID,DRM_MODE_PAGE_FLIP_EVENT,this);
 	if (ret)
 	{
 		THROW_MEANINGFUL_EXCEPTION("drmModePageFlip failed to queue page flip " + std::string(strerror(errno)) );
 	}
+	mFlipPending = true;
+	mFlipBufferObject = mCurrentFrontBufferObject;
+
+	// When async the next frame is drawn while this one waits for the vertical blank. The buffer on screen and the
+	// one waiting are locked, gbm gives EGL the third.
+	if( mAsyncPageFlip == false )
+	{
+		WaitForPageFlip(true);
+	}
+}
 
-	while (waiting_for_flip)
+void PlatformInterface::WaitForPageFlip(bool pBlock)
+{
+	TRACE_SCOPE("WaitForPageFlip");
+	while( mFlipPending )
 	{
 		drmEventContext evctx =
 		{
@@ -3747,21 +7908,50 @@ void PlatformInterface::SwapBuffers()
 
 		fd_set fds;
 		FD_ZERO(&fds);
-		FD_SET(0, &fds);
 		FD_SET(mDRMFile, &fds);
 
 		// For some reason this fails when we do ctrl + c dispite hooking into the interrupt.
-		ret = select(mDRMFile + 1, &fds, NULL, NULL, NULL);
+		struct timeval dontWait = {0,0};
+		const int ret = select(mDRMFile + 1, &fds, NULL, NULL, pBlock ? NULL : &dontWait);
 		if( ret < 0 )
 		{
 			// I wanted this to be an exception but could not, see comment on the select. So just cout::error for now...	
-			std::cerr << "PlatformInterface::SwapBuffer select on DRM file failed to queue page flip " << std::string(strerror(errno)) << "\n";
+			std::cerr << "PlatformInterface::WaitForPageFlip select on DRM file failed " << std::string(strerror(errno)) << "\n";
+		}
+
+		if( ret <= 0 && pBlock == false )
+		{// Not happened yet.
+			return;
 		}
 
-		drmHandleEvent(mDRMFile, &evctx);
+		if( ret > 0 )
+		{
+			drmHandleEvent(mDRMFile, &evctx);
+		}
+	}
+
+	// The flip is done, the buffer that was on screen can be drawn to again.
+	if( mFlipBufferObject )
+	{
+		if( mScanoutBufferObject )
+		{
+			gbm_surface_release_buffer(mNativeWindow,mScanoutBufferObject);
+		}
+		mScanoutBufferObject = mFlipBufferObject;
+		mFlipBufferObject = nullptr;
 	}
+}
 
-	gbm_surface_release_buffer(mNativeWindow,mCurrentFrontBufferObject);
+bool PlatformInterface::GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount)
+{
+	WaitForPageFlip(false);// Picks up the flip if it's happened since the last swap.
+	if( mLastVSync.frame == 0 )
+	{
+		return false;
+	}
+	rMicroseconds = mLastVSync.microseconds;
+	rVBlankCount = mLastVSync.frame;
+	return true;
 }
 
 #endif //#ifdef PLATFORM_DRM_EGL
@@ -3974,8 +8164,10 @@ bool PlatformInterface::ProcessEvents(tinygles::GLES::SystemEventHandler pEventH
 	return false;
 }
 
-void PlatformInterface::SwapBuffers()
+void PlatformInterface::SwapBuffers(const int* pDamageRect)
 {
+	TRACE_SCOPE("SwapBuffers");
+	(void)pDamageRect;
 	assert( mWindowReady );
 	if( mXDisplay == nullptr )
 	{
@@ -3984,8 +8176,117 @@ void PlatformInterface::SwapBuffers()
 	glXSwapBuffers(mXDisplay,mWindow);
 }
 
+int PlatformInterface::GetBufferAge()
+{
+	const char* extensions = glXQueryExtensionsString(mXDisplay,DefaultScreen(mXDisplay));
+	if( extensions == nullptr || strstr(extensions,"GLX_EXT_buffer_age") == nullptr )
+	{
+		return 0;
+	}
+
+	unsigned int age = 0;
+	glXQueryDrawable(mXDisplay,mWindow,GLX_BACK_BUFFER_AGE_EXT,&age);
+	return (int)age;
+}
+
 #endif //#ifdef PLATFORM_X11_GL
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+// PLATFORM_HEADLESS_EGL Implementation.
+///////////////////////////////////////////////////////////////////////////////////////////////////////////
+#ifdef PLATFORM_HEADLESS_EGL
+PlatformInterface::~PlatformInterface()
+{
+	VERBOSE_MESSAGE("Cleaning up GL");
+	eglMakeCurrent(mDisplay,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+	eglDestroyContext(mDisplay,mContext);
+	eglDestroySurface(mDisplay,mSurface);
+	eglTerminate(mDisplay);
+}
+
+void PlatformInterface::InitialiseDisplay()
+{
+	VERBOSE_MESSAGE("Calling headless InitialiseDisplay");
+
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY,EGL_EXTENSIONS);
+	if( extensions && strstr(extensions,"EGL_MESA_platform_surfaceless") )
+	{
+		auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if( getPlatformDisplay )
+		{
+			mDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,nullptr);
+		}
+	}
+
+	if( !mDisplay )
+	{
+		mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	if( !mDisplay )
+	{
+		THROW_MEANINGFUL_EXCEPTION("Couldn\'t open an EGL display");
+	}
+
+	EGLint majorVersion,minorVersion;
+	if( !eglInitialize(mDisplay, &majorVersion, &minorVersion) )
+	{
+		THROW_MEANINGFUL_EXCEPTION("eglInitialize() failed");
+	}
+	VERBOSE_MESSAGE("EGL version " << majorVersion << "." << minorVersion);
+	eglBindAPI(EGL_OPENGL_ES_API);
+
+	const EGLint attrib_list[] =
+	{
+		EGL_SURFACE_TYPE,		EGL_PBUFFER_BIT,
+		EGL_RED_SIZE,			8,
+		EGL_GREEN_SIZE,			8,
+		EGL_BLUE_SIZE,			8,
+		EGL_ALPHA_SIZE,			8,
+		EGL_DEPTH_SIZE,			16,
+		EGL_RENDERABLE_TYPE,	EGL_OPENGL_ES2_BIT,
+		EGL_NONE,				EGL_NONE
+	};
+
+	EGLint numConfigs = 0;
+	if( !eglChooseConfig(mDisplay,attrib_list,&mConfig,1,&numConfigs) || numConfigs < 1 )
+	{
+		THROW_MEANINGFUL_EXCEPTION("No matching EGL pbuffer configs found");
+	}
+
+	// Ask for GLES 3.0 first, our shaders work with it and it gives us instancing. Then fall back to 2.0.
+	EGLint ai32ContextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+	mContext = eglCreateContext(mDisplay,mConfig,EGL_NO_CONTEXT,ai32ContextAttribs);
+	if( !mContext )
+	{
+		ai32ContextAttribs[1] = 2;
+		mContext = eglCreateContext(mDisplay,mConfig,EGL_NO_CONTEXT,ai32ContextAttribs);
+	}
+	if( !mContext )
+	{
+		THROW_MEANINGFUL_EXCEPTION("Failed to get a rendering context");
+	}
+
+	const EGLint surfaceAttribs[] = { EGL_WIDTH, GetWidth(), EGL_HEIGHT, GetHeight(), EGL_NONE };
+	mSurface = eglCreatePbufferSurface(mDisplay,mConfig,surfaceAttribs);
+	if( !mSurface )
+	{
+		THROW_MEANINGFUL_EXCEPTION("Failed to create a " + std::to_string(GetWidth()) + "x" + std::to_string(GetHeight()) + " pbuffer");
+	}
+
+	eglMakeCurrent(mDisplay, mSurface, mSurface, mContext );
+	VERBOSE_MESSAGE("Rendering headless to a " << GetWidth() << "x" << GetHeight() << " pbuffer with " << (const char*)glGetString(GL_RENDERER));
+}
+
+void PlatformInterface::SwapBuffers(const int* pDamageRect)
+{
+	TRACE_SCOPE("SwapBuffers");
+	(void)pDamageRect;
+	eglSwapBuffers(mDisplay,mSurface);// Does nothing to a pbuffer but keeps EGL's idea of the frame right.
+}
+
+#endif //#ifdef PLATFORM_HEADLESS_EGL
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 // Pixel Font bits, packed image. Used to create a texture
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
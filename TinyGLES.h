@@ -28,6 +28,7 @@
 #include <vector>
 #include <map>
 #include <array>
+#include <algorithm>
 #include <string_view>
 #include <stdexcept>
 #include <cstring>
@@ -52,6 +53,20 @@
 	#endif
 #endif
 
+/**
+ * @brief PLATFORM_HEADLESS_EGL renders without a display or GPU, to an EGL pbuffer. For build servers, CI and rendering thumbnails, runs on Mesa's llvmpipe.
+ * Set the size with HEADLESS_WIDTH and HEADLESS_HEIGHT in your build settings. Use GLES::SetFrameReadbackHandler to get at what was drawn.
+ */
+#ifdef PLATFORM_HEADLESS_EGL
+	#ifndef HEADLESS_WIDTH
+		#define HEADLESS_WIDTH 1024
+	#endif
+
+	#ifndef HEADLESS_HEIGHT
+		#define HEADLESS_HEIGHT 600
+	#endif
+#endif
+
 /**
  * @brief The define USE_FREETYPEFONTS allows users of this lib to disable freetype support to reduce code size and dependencies.
  * Make sure you have freetype dev installed. sudo apt install libfreetype6-dev
@@ -181,7 +196,14 @@ enum struct TextureFormat
 {
 	FORMAT_RGBA,
 	FORMAT_RGB,
-	FORMAT_ALPHA
+	FORMAT_ALPHA,
+	FORMAT_ETC1,		//!< Compressed RGB, 4 bits per pixel. Can be drawn where only ETC2 is supported as ETC2 can read it.
+	FORMAT_ETC2_RGB,	//!< Compressed RGB, 4 bits per pixel. GLES 3.0 and up.
+	FORMAT_ETC2_RGBA,	//!< Compressed RGBA, 8 bits per pixel. GLES 3.0 and up.
+	FORMAT_RGB565,		//!< 16 bit, made from RGB pixels when uploaded. Half the memory of FORMAT_RGB.
+	FORMAT_RGBA4444,	//!< 16 bit, made from RGBA pixels when uploaded.
+	FORMAT_RGBA5551,	//!< 16 bit, made from RGBA pixels when uploaded. For images where alpha is only on or off.
+	FORMAT_16BIT_AUTO	//!< Only for CreateTexture and FillTexture. Given RGBA pixels, picks 565 if they are all solid, 5551 if alpha is on or off, else 4444.
 };
 
 struct QuadBatchTransform
@@ -212,15 +234,90 @@ struct QuadBatchTransform
 	}trans[4];
 };
 
+/**
+ * @brief The optional per quad colour of a quad batch, multiplied with the texture. Alpha fades the quad out.
+ */
+struct QuadBatchColour
+{
+	// Four again, one per vertex, for the same reasons as the transform.
+	inline void SetColour(uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha = 255)
+	{
+		for( int n = 0 ; n < 4 ; n++ )
+		{
+			col[n].r = pRed;
+			col[n].g = pGreen;
+			col[n].b = pBlue;
+			col[n].a = pAlpha;
+		}
+	}
+
+	struct
+	{
+		uint8_t r = 255;
+		uint8_t g = 255;
+		uint8_t b = 255;
+		uint8_t a = 255;
+	}col[4];
+};
+
+/**
+ * @brief What it took to draw a frame, counted from BeginFrame to EndFrame. See GLES::GetFrameStats.
+ */
+struct FrameStats
+{
+	float frameMilliseconds = 0.0f;	//!< Time since the last frame's EndFrame, so includes waiting for the display.
+	float cpuMilliseconds = 0.0f;	//!< Time from BeginFrame to EndFrame, before the swap. How long the application and TinyGLES took to draw it.
+	uint32_t drawCalls = 0;
+	uint32_t vertices = 0;			//!< Vertices drawn, for indexed draws the number of indices. Instanced draws count each instance.
+	uint32_t shaderChanges = 0;		//!< Times a different shader program was made current.
+	uint32_t textureChanges = 0;	//!< Times a different texture was bound.
+	uint32_t bytesUploaded = 0;		//!< Vertex, index and texture data sent to GL.
+};
+
+/**
+ * @brief The minimum, average, maximum and 99th percentile of each of the frame stats over the last few seconds of frames.
+ */
+struct FrameStatsSummary
+{
+	struct Range
+	{
+		float min = 0.0f;
+		float average = 0.0f;
+		float max = 0.0f;
+		float p99 = 0.0f;
+	};
+
+	uint32_t frames = 0;	//!< How many frames it's made from.
+	Range frameMilliseconds;
+	Range cpuMilliseconds;
+	Range drawCalls;
+	Range vertices;
+	Range shaderChanges;
+	Range textureChanges;
+	Range bytesUploaded;
+};
+
 // Forward decleration of internal types.
 typedef std::shared_ptr<struct GLShader> TinyShader;
 struct FreeTypeFont;
 struct GLTexture;			//!< Because we can't query the values used to create a gl texture we have to store them. horrid API GLES 2.0
 struct NinePatch;			//!< Internal data used to draw the nine patch objects.
+struct TextureAtlas;		//!< Pages that images are packed into, and the packers that track the free space.
+struct SubTexture;			//!< An image in a texture atlas.
+struct StreamingTexture;	//!< A ring of textures that are written to in turn.
 struct WorkBuffers;			//!< Internal work buffers for building temporay render data.
 struct PlatformInterface;	//!< Abstraction of the rendering platform we use to get the work done.
 struct Sprite;				//!< The sprite object. Defined in the source code, only need a forward definition here.
 struct QuadBatch;			//!< The sprite batch object. Defined in the source code, only need a forward definition here.
+struct DrawCommand;			//!< Everything needed to issue one draw call. Defined in the source code.
+struct DeferredDraws;		//!< The per frame list of recorded draw commands used in deferred rendering.
+struct DisplayList;			//!< Draw commands recorded once with their geometry in buffer objects, replayed with one call.
+struct FrameStatsHistory;	//!< The frame stats of the last few seconds and the counts for the frame being drawn.
+struct Batch2D;				//!< Collects consecutive 2D primitives into one draw call.
+struct SpriteBatch;			//!< The sprites drawn between SpriteBatchBegin and SpriteBatchEnd, collected by texture.
+struct GLStateCache;		//!< Shadow of the GL state so we only call GL when something changes.
+struct StreamingBuffers;	//!< Ring of GL buffers that transient vertex and index data is written into.
+struct BatchVert2D;			//!< The vertex format used by Batch2D.
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -279,6 +376,126 @@ struct VertShortXY
 };
 typedef std::vector<VertShortXY> VerticesShortXY;
 
+/**
+ * @brief Holds the objects behind the handles the API gives out, looking one up is an index and a compare, no tree walk.
+ * A handle is the slot index plus one in the low 20 bits with the slot's generation in the 10 above, the generation goes up each time the slot is freed.
+ * So a handle kept after it's object was deleted is spotted, until the slot has been reused 1024 times.
+ * The objects are kept in a dense array so walking them all is quick, by pointer so their address does not change when others are added or removed.
+ * The top two bits are left for the kind of handle, set to pTypeBits, so handles from maps with different type bits never match.
+ */
+template<typename OBJECT_TYPE> class SlotMap
+{
+public:
+	static constexpr uint32_t INDEX_BITS = 20;
+	static constexpr uint32_t INDEX_MASK = (1 << INDEX_BITS) - 1;
+	static constexpr uint32_t GENERATION_MASK = 0x3ff;
+	static constexpr uint32_t TYPE_MASK = 0xc0000000;
+
+	SlotMap(uint32_t pTypeBits = 0):mTypeBits(pTypeBits&TYPE_MASK){}
+
+	/**
+	 * @brief Takes ownership of the object and returns it's handle, never zero.
+	 */
+	uint32_t Add(std::unique_ptr<OBJECT_TYPE> pObject)
+	{
+		uint32_t slot;
+		if( mFreeSlots.size() > 0 )
+		{
+			slot = mFreeSlots.back();
+			mFreeSlots.pop_back();
+		}
+		else
+		{
+			if( mSlots.size() >= INDEX_MASK )
+			{
+				throw std::runtime_error("SlotMap is full, over a million objects have been created and not deleted");
+			}
+			slot = (uint32_t)mSlots.size();
+			mSlots.push_back({mTypeBits,0});
+		}
+
+		// A free slot holds the handle it will give out next without the index, so no handle can match it.
+		const uint32_t handle = mSlots[slot].handle | (slot + 1);
+		mSlots[slot].handle = handle;
+		mSlots[slot].dense = (uint32_t)mObjects.size();
+		mObjects.push_back(std::move(pObject));
+		mHandles.push_back(handle);
+		return handle;
+	}
+
+	/**
+	 * @brief Returns the object or nullptr if the handle is stale, zero or from another map.
+	 */
+	OBJECT_TYPE* Get(uint32_t pHandle)const
+	{
+		const uint32_t slot = (pHandle&INDEX_MASK) - 1;// Zero wraps around and fails the size check.
+		if( slot < mSlots.size() && mSlots[slot].handle == pHandle )
+		{
+			return mObjects[mSlots[slot].dense].get();
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Deletes the object, returns false if the handle was not valid.
+	 * The last object is moved into the gap so the array stays dense.
+	 */
+	bool Erase(uint32_t pHandle)
+	{
+		if( Get(pHandle) == nullptr )
+		{
+			return false;
+		}
+
+		const uint32_t slot = (pHandle&INDEX_MASK) - 1;
+		const uint32_t dense = mSlots[slot].dense;
+		const uint32_t generation = ((pHandle >> INDEX_BITS) + 1)&GENERATION_MASK;
+		mSlots[slot].handle = mTypeBits | (generation << INDEX_BITS);
+		mFreeSlots.push_back(slot);
+
+		// Take it out first, it's destructor may call back into the code that owns this map.
+		std::unique_ptr<OBJECT_TYPE> gone = std::move(mObjects[dense]);
+		const size_t last = mObjects.size() - 1;
+		if( dense != last )
+		{
+			mObjects[dense] = std::move(mObjects[last]);
+			mHandles[dense] = mHandles[last];
+			mSlots[(mHandles[dense]&INDEX_MASK) - 1].dense = dense;
+		}
+		mObjects.pop_back();
+		mHandles.pop_back();
+		return true;
+	}
+
+	/**
+	 * @brief Deletes all the objects, handles given out before are all stale after this.
+	 */
+	void Clear()
+	{
+		while( mHandles.size() > 0 )
+		{
+			Erase(mHandles.back());
+		}
+	}
+
+	size_t Size()const{return mObjects.size();}
+	uint32_t GetHandle(size_t pIndex)const{return mHandles[pIndex];}				//!< For walking all the objects, pIndex is 0 to Size() - 1.
+	OBJECT_TYPE* GetObject(size_t pIndex)const{return mObjects[pIndex].get();}	//!< For walking all the objects, pIndex is 0 to Size() - 1.
+
+private:
+	struct Slot
+	{
+		uint32_t handle;	//!< The handle that is valid for this slot, when free the index is zero.
+		uint32_t dense;		//!< Where it's object is in mObjects.
+	};
+
+	const uint32_t mTypeBits;
+	std::vector<Slot> mSlots;
+	std::vector<uint32_t> mFreeSlots;
+	std::vector<std::unique_ptr<OBJECT_TYPE>> mObjects;
+	std::vector<uint32_t> mHandles;	//!< The handle of each object in mObjects.
+};
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////
 /**
@@ -293,6 +510,18 @@ public:
 
 	typedef std::function<void(const SystemEventData& pEvent)> SystemEventHandler;
 
+	/**
+	 * @brief Called when an evicted texture is drawn with. Fill rPixels with what was passed to CreateTexture, RGBA for FORMAT_16BIT_AUTO.
+	 * Return false if the image can not be loaded, the texture is drawn empty and it will be asked for again the next time.
+	 */
+	typedef std::function<bool(uint32_t pTexture,std::vector<uint8_t>& rPixels)> TextureReloader;
+
+	/**
+	 * @brief Given the finished frame in EndFrame, before it is shown. pRGBA is pWidth * pHeight * 4 bytes, the top row first, only valid for the call.
+	 * The size is that of the physical display, so not rotated.
+	 */
+	typedef std::function<void(int pWidth,int pHeight,const uint8_t* pRGBA)> FrameReadbackHandler;
+
 	/**
 	 * @brief Creates and opens a GLES object. Throws an exception if it fails.
 	 * 
@@ -360,6 +589,117 @@ public:
 
 	void SetTransform2D(float pX,float pY,float pRotation,float pScale);
 
+	/**
+	 * @brief Turns on or off deferred rendering. Off by default.
+	 * When on draw calls are not sent to GL straight away, they are recorded and then sorted by layer, shader, texture and render state before being submitted in EndFrame.
+	 * On systems where changing shader or texture is expensive this can be a big speed up when the application interleaves text, rectangles and icons.
+	 * Draws with the same sort key keep the order they were made in. If draws overlap and their order matters put them on different layers.
+	 */
+	void SetDeferredRendering(bool pEnable);
+	bool GetDeferredRendering()const;
+
+	/**
+	 * @brief Sets the layer that following draw calls are recorded on when deferred rendering is on. Lower layers are drawn first.
+	 * Has no effect when deferred rendering is off. Reset to zero in BeginFrame.
+	 */
+	void SetDrawLayer(int16_t pLayer);
+
+	/**
+	 * @brief Starts recording a display list. For static geometry, backgrounds, maps, text that does not change, that would otherwise be built and sent to GL every frame.
+	 * Draws made until DisplayListEnd are not drawn, they are recorded with the shader, texture, colour, projection, transform and depth state they were made with.
+	 * Only draw calls are recorded, Clear and the other calls that change GL state straight away are not.
+	 * Draws from a quad batch read the batch's buffer when replayed, so see it's quads as they are then. The batch must not be deleted before the display list.
+	 */
+	void DisplayListBegin();
+
+	/**
+	 * @brief Ends the recording, copies it's vertices and indices into buffer objects and returns the display list's handle.
+	 */
+	uint32_t DisplayListEnd();
+
+	/**
+	 * @brief Replays the draws recorded in the display list with the state they were recorded with.
+	 * Textures are looked up when drawn, so a texture filled after recording draws with it's new pixels. A deleted texture is a stale handle.
+	 * Works with deferred rendering, the draws are recorded for the frame like any other.
+	 */
+	void DisplayListDraw(uint32_t pDisplayList);
+
+	/**
+	 * @brief Replays the display list with pTransform applied after the transform each draw was recorded with. So a list can be moved, rotated or scaled as a whole.
+	 */
+	void DisplayListDraw(uint32_t pDisplayList,const float pTransform[4][4]);
+
+	/**
+	 * @brief Deletes the display list and it's buffer objects. Display lists are never updated, to change one delete it and record it again.
+	 */
+	void DisplayListDelete(uint32_t pDisplayList);
+
+	/**
+	 * @brief Turns on or off damage tracking. Off by default. For UIs where little changes from frame to frame.
+	 * The application still draws the whole frame, but only the area passed to AddDamage is drawn to. Everything else is scissored away and left as it was.
+	 * The driver's buffer age (EGL_EXT_buffer_age) tells us which earlier frames' damage the back buffer missed, that is drawn too.
+	 * If the driver can't tell us, the whole screen is drawn. Damage is also passed to eglSwapBuffersWithDamageKHR where the driver has it.
+	 * The first frames after turning it on are drawn in full.
+	 */
+	void SetDamageTracking(bool pEnable);
+
+	/**
+	 * @brief Marks an area of the screen as changed, in the coordinates of the 2D drawing functions.
+	 * Call before BeginFrame for the frame that changes it, or in the frame before anything in the area is drawn.
+	 * Damage is kept as one rectangle, the bounding box of all the areas added.
+	 */
+	void AddDamage(int pX,int pY,int pWidth,int pHeight);
+
+	/**
+	 * @brief Off by default. On the DRM platform EndFrame waits for the page flip, so the frame is on screen before it returns.
+	 * With this on the flip is queued and EndFrame returns straight away, the next frame is drawn into a third buffer while the last one waits for the vertical blank.
+	 * Only one flip can be queued, so if the next frame is ready before the flip is done EndFrame waits for it then. Adds up to a frame of latency. Does nothing on X11.
+	 */
+	void SetAsyncPageFlip(bool pEnable);
+
+	/**
+	 * @brief Gets when the last frame went on screen, the time of the vertical blank from the page flip event in microseconds (CLOCK_MONOTONIC) and the vertical blank count.
+	 * For frame pacing and measuring latency. Returns false if the platform can't tell us, X11, or no frame has been shown yet.
+	 */
+	bool GetLastVSync(uint64_t& rMicroseconds,uint32_t& rVBlankCount);
+
+	/**
+	 * @brief Gets how many GL state changes (binds, uniforms, attribute arrays, enables) were sent to GL and how many were skipped because GL already had the value.
+	 * Counts since the application started or ResetStateChangeCounts was called.
+	 */
+	void GetStateChangeCounts(uint32_t& rIssued,uint32_t& rSkipped)const;
+	void ResetStateChangeCounts();
+
+	/**
+	 * @brief The stats of the last frame, set in EndFrame. For finding why frames are dropped on a deployed unit without adding timers.
+	 */
+	const FrameStats& GetFrameStats()const;
+
+	/**
+	 * @brief The minimum, average, maximum and 99th percentile of the stats of the last 120 frames.
+	 */
+	FrameStatsSummary GetFrameStatsSummary()const;
+
+	/**
+	 * @brief Draws the last frame's stats and a graph of the frame times in the top left corner, on top of everything. Off by default.
+	 * Uses the pixel font. What it draws is not counted in the stats.
+	 */
+	void SetStatsOverlay(bool pEnable);
+
+	/**
+	 * @brief Writes the timing scopes recorded in a TRACE_BUILD to a Chrome trace event JSON file, for chrome://tracing or ui.perfetto.dev.
+	 * The define TRACE_BUILD adds timing scopes to the hot paths, frame begin and end, the swap and page flip wait, system events, texture and font creation and the draw calls.
+	 * Without the define the scopes are not compiled in so cost nothing.
+	 * Each thread keeps its last 16384 scopes. Call between frames, scopes being recorded while the file is written may come out wrong.
+	 * Returns false if the file could not be written or TRACE_BUILD is not defined.
+	 */
+	bool TraceSave(const std::string& pFileName)const;
+
+	/**
+	 * @brief Forgets the scopes recorded so far, so the next TraceSave only has what happened after this call.
+	 */
+	void TraceClear();
+
 	/**
 	 * @brief Sets the flag for the main loop to false and fires the SYSTEM_EVENT_EXIT_REQUEST
 	 * You would typically call this from a UI button to quit the app.
@@ -378,6 +718,12 @@ public:
 	 */
 	void SetSystemEventHandler(SystemEventHandler pEventHandler){mSystemEventHandler = pEventHandler;}
 
+	/**
+	 * @brief Sets a handler that is given each frame's pixels in EndFrame, read back with glReadPixels. Pass nullptr to stop, which is the default.
+	 * Made for PLATFORM_HEADLESS_EGL where there is no display, works on all platforms. Reading back stalls the GPU so is slow.
+	 */
+	void SetFrameReadbackHandler(FrameReadbackHandler pHandler){mFrameReadbackHandler = pHandler;}
+
 //*******************************************
 // Primitive draw commands.
 	/**
@@ -464,9 +810,22 @@ public:
 
 	/**
 	 * @brief Draws the sprite using the current transform to position, scale and rotate it. Witch is the whole point.
+	 * With a 2D transform the sprite is transformed on the CPU and added to the 2D batch, so consecutive sprites with the same texture are one draw call.
 	 */
 	void SpriteDraw(uint32_t pSprite);
 
+	/**
+	 * @brief Sprites drawn from now until SpriteBatchEnd are collected by texture and drawn at SpriteBatchEnd, one draw call per texture.
+	 * Sprites with different textures may be drawn in a different order to the one they were drawn in, and after anything else drawn in between.
+	 * Use this when that does not matter, like a screen full of game objects, it is a lot faster.
+	 */
+	void SpriteBatchBegin();
+
+	/**
+	 * @brief Draws the sprites collected since SpriteBatchBegin. Called for you by EndFrame if you forget.
+	 */
+	void SpriteBatchEnd();
+
 	/**
 	 * @brief Sets the center position of an existing sprite
 	 */
@@ -480,7 +839,7 @@ public:
 	 * @brief creates a list of the quads that will allow many to be drawn in one function draw for much faster speed.
 	 * The transform, rotation and scale is uploaded in a separate data stream. Poor mans instancing as it's not available in the lower end systems we support.
 	 * Texture has to be the same for all, no way of making that different per sprite. Size is set on a per quad basis in the transform data stream.
-	 * Always rotate around their center.
+	 * Always rotate around their center. There is no limit on the number of quads, large batches are drawn in more than one draw call.
 	 */
 	uint32_t QuadBatchCreate(uint32_t pTexture,int pCount,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY);
 
@@ -500,15 +859,58 @@ public:
 	void QuadBatchDraw(uint32_t pQuadBatch);
 
 	/**
-	 * @brief Draws the quads within the range specified, expects that their transforms will have been set.
+	 * @brief Draws quads pFromIndex to pToIndex - 1, expects that their transforms will have been set.
+	 * Handy for level of detail, only drawing what is on screen, or to draw a batch in parts at different depths.
 	 */
 	void QuadBatchDraw(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex);
 
 	/**
 	 * @brief Call this to setup the transform data for all the quads.
+	 * The transforms live on the GPU and only the ones that change are sent. Calling this marks them all as changed.
+	 * If you only change a few use the ranged version below.
 	 */
 	std::vector<QuadBatchTransform>& QuadBatchGetTransform(uint32_t pQuadBatch);
 
+	/**
+	 * @brief Returns the transforms for quads pFromIndex to pToIndex - 1 and marks just them as changed, so only they are sent to the GPU on the next draw.
+	 */
+	QuadBatchTransform* QuadBatchGetTransform(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex);
+
+	/**
+	 * @brief Sets the transforms of pCount quads starting at pFromIndex from separate arrays of positions, rotations and sizes, one entry per quad.
+	 * Much faster than calling QuadBatchTransform::SetTransform for each quad as whole groups of quads are converted and written at once.
+	 * Rotation is in radians. Values are converted to 16 bit, out of range values are clamped. Only the quads set are sent to the GPU on the next draw.
+	 */
+	void QuadBatchSetTransforms(uint32_t pQuadBatch,size_t pFromIndex,size_t pCount,const float* pX,const float* pY,const float* pRotation,const float* pSize);
+
+	/**
+	 * @brief Marks quads pFromIndex to pToIndex - 1 as changed. For when you keep hold of the transforms or colours returned by the getters and write to them later.
+	 */
+	void QuadBatchSetDirty(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex);
+
+	/**
+	 * @brief Call this to setup the colour of all the quads. Until the first time this, or the ranged version, is called all quads are white.
+	 * Like the transforms calling this marks them all as changed.
+	 */
+	std::vector<QuadBatchColour>& QuadBatchGetColour(uint32_t pQuadBatch);
+
+	/**
+	 * @brief Returns the colours for quads pFromIndex to pToIndex - 1 and marks just them as changed.
+	 */
+	QuadBatchColour* QuadBatchGetColour(uint32_t pQuadBatch,size_t pFromIndex,size_t pToIndex);
+
+	/**
+	 * @brief Adds a rectangle of the batch's texture that quads can be set to show, for atlases and animation. Returns the index of the frame.
+	 * Frame zero is the rectangle the batch was created with and is what all quads start with.
+	 */
+	uint32_t QuadBatchAddFrame(uint32_t pQuadBatch,int pTexFromX,int pTexFromY,int pTexToX,int pTexToY);
+
+	/**
+	 * @brief Sets the frame shown by pCount quads starting at pFromIndex, pFrames holds one frame index per quad.
+	 * Only the quads set are sent to the GPU on the next draw.
+	 */
+	void QuadBatchSetFrames(uint32_t pQuadBatch,size_t pFromIndex,const uint16_t* pFrames,size_t pCount);
+
 
 //*******************************************
 // Primitive rendering functions for user defined shapes
@@ -521,6 +923,8 @@ public:
 	 * @brief Create a Texture object with the size passed in and a given name. 
 	 * pPixels is either RGB format 24bit or RGBA 32bit format is pHasAlpha is true.
 	 * pPixels can be null if you're going to use FillTexture later to set the image data.
+	 * For the compressed formats pPixels is the compressed blocks, must not be null, and mipmaps can not be generated.
+	 * For the 16 bit formats pPixels is RGB for 565 and RGBA for the others, they are converted when uploaded.
 	 * But there is a GL gotcha with passing null, if you don't write to ALL the pixels the texture will not work. So if you're texture is always black you may not have filled it all.
 	 */
 	uint32_t CreateTexture(int pWidth,int pHeight,const uint8_t* pPixels,TextureFormat pFormat,bool pFiltered = false,bool pGenerateMipmaps = false);
@@ -538,16 +942,50 @@ public:
 	void DeleteTexture(uint32_t pTexture);
 
 	/**
-	 * @brief Gets the width of the texture. Not recommended that this is called 1000's of times in a frame as it has to search a std::map for the object.
+	 * @brief Gets the width of the texture. The handle is checked and looked up in O(1), fine to call often.
 	 */
 	int GetTextureWidth(uint32_t pTexture)const;
 
 
 	/**
-	 * @brief Gets the height of the texture. Not recommended that this is called 1000's of times in a frame as it has to search a std::map for the object.
+	 * @brief Gets the height of the texture. The handle is checked and looked up in O(1), fine to call often.
 	 */
 	int GetTextureHeight(uint32_t pTexture)const;
 
+	/**
+	 * @brief Creates a texture from a KTX file that has been loaded into memory, as made by the PNGToKTX tool.
+	 * Only the ETC formats are supported, mip levels in the file are used. Will throw if the data is not valid or the format is not supported.
+	 */
+	uint32_t CreateTextureFromKTX(const uint8_t* pData,size_t pSize,bool pFiltered = false);
+
+	/**
+	 * @brief Sets how many bytes of GPU memory textures can use, zero, the default, for no limit.
+	 * When over budget textures with a reloader that have not been drawn with for pMinFramesUnused frames are evicted, least recently used first.
+	 * Checked at the end of each frame and when a texture is created. Textures without a reloader are never evicted but do count.
+	 */
+	void SetTextureBudget(size_t pBytes,uint32_t pMinFramesUnused = 2);
+
+	/**
+	 * @brief Lets the texture be evicted when over budget, the reloader is called to get the image back the next time it is drawn with.
+	 * Textures from CreateTextureFromKTX with more than one mip level can not be reloaded.
+	 */
+	void SetTextureReloader(uint32_t pTexture,TextureReloader pReloader);
+
+	/**
+	 * @brief The bytes of GPU memory used by the textures that are resident, including mip levels.
+	 */
+	size_t GetTextureMemoryUsed()const{return mTextureMemory.Used;}
+
+	/**
+	 * @brief Sets if the 16 bit formats are made with a 4x4 ordered dither, hides the banding in gradients. On by default.
+	 */
+	void SetTextureDithering(bool pDither){mTextureDithering = pDither;}
+
+	/**
+	 * @brief Returns true if textures of the format can be created, the compressed formats depend on the GPU.
+	 */
+	bool GetTextureFormatSupported(TextureFormat pFormat)const;
+
 	/**
 	 * @brief Get the diagnostics texture for use to help with finding issues.
 	 */
@@ -558,6 +996,78 @@ public:
 	 */
 	uint32_t GetPixelFontTexture()const{return mPixelFont.texture;}
 
+//*******************************************
+// Texture atlas, many small images packed into a few large textures so they can all be drawn in one draw call.
+
+	/**
+	 * @brief Creates an empty atlas. Pages, textures of pPageSize x pPageSize, are created as images are added.
+	 * pPadding is the number of pixels around each image that repeat it's edge so filtering does not bleed in the neighbours.
+	 */
+	uint32_t AtlasCreate(TextureFormat pFormat,int pPageSize = 1024,bool pFiltered = false,int pPadding = 1);
+
+	/**
+	 * @brief Packs the image into the atlas, the pixels must be in the format the atlas was created with.
+	 * The handle returned can be passed to FillRectangle, Blit, SpriteCreate, QuadBatchCreate, FillTexture and GetTextureWidth / Height as if it was a texture.
+	 * Pixel coordinates passed with it are relative to the image, not the page. Will throw if the image is bigger than a page.
+	 */
+	uint32_t AtlasAddImage(uint32_t pAtlas,int pWidth,int pHeight,const uint8_t* pPixels);
+
+	/**
+	 * @brief Deletes the atlas, it's pages and the handles of the images in it.
+	 */
+	void AtlasDelete(uint32_t pAtlas);
+
+	/**
+	 * @brief Returns the page, a normal texture, the image is in. Handy if you want to draw it with your own UV's.
+	 */
+	uint32_t AtlasGetTexture(uint32_t pSubTexture)const;
+
+//*******************************************
+// Streaming textures, for images that are replaced every frame like video or a camera feed.
+
+	/**
+	 * @brief Creates a texture that has pNumBuffers textures behind it, each update writes to one the GPU is not drawing with.
+	 * Updating a normal texture the GPU is still using can stall it or make the driver take a copy. Can be used with any draw function that takes a texture.
+	 */
+	uint32_t StreamingTextureCreate(int pWidth,int pHeight,TextureFormat pFormat,int pNumBuffers = 3,bool pFiltered = false);
+
+	/**
+	 * @brief Replaces the whole image, draws from now on will use it. pPixels must be in the format the texture was created with.
+	 */
+	void StreamingTextureUpdate(uint32_t pTexture,const uint8_t* pPixels);
+
+	/**
+	 * @brief Deletes the streaming texture and the textures behind it.
+	 */
+	void StreamingTextureDelete(uint32_t pTexture);
+
+	/**
+	 * @brief The number of updates that had to write to a texture the GPU could still be using. If it keeps going up create it with more buffers.
+	 */
+	uint32_t StreamingTextureGetStallCount(uint32_t pTexture)const;
+
+//*******************************************
+// Render targets, textures that can be drawn to. For caching something expensive to draw, a map layer or a complex gauge, and blitting it each frame until it changes.
+
+	/**
+	 * @brief Creates a texture that can be drawn to with RenderTargetBegin and drawn with like any other texture. It's contents are undefined until drawn to.
+	 * pFormat can be FORMAT_RGBA, FORMAT_RGB, FORMAT_RGB565, FORMAT_RGBA4444 or FORMAT_RGBA5551. Delete it with DeleteTexture.
+	 * @param pDepthBuffer Adds a depth buffer, for 3D. Where the driver has packed depth stencil it has a stencil buffer too.
+	 */
+	uint32_t RenderTargetCreate(int pWidth,int pHeight,TextureFormat pFormat = TextureFormat::FORMAT_RGBA,bool pDepthBuffer = false,bool pFiltered = false);
+
+	/**
+	 * @brief Draws from now on go to the render target until RenderTargetEnd. Sets up 2D rendering for the size of the target, Begin2D and Begin3D also use it's size.
+	 * The image is drawn the right way up, FillRectangle(0,0,width,height,target) shows it on the screen as it was drawn.
+	 * The damage scissor is not used while drawing to a target. Don't draw with the target's own texture while drawing to it.
+	 */
+	void RenderTargetBegin(uint32_t pTarget);
+
+	/**
+	 * @brief Goes back to drawing to the screen with the projection and depth state there was before RenderTargetBegin.
+	 */
+	void RenderTargetEnd();
+
 //*******************************************
 // 9 Patch rendering for buttons. Unity calls them 9-slicing. I'm using the Android specification as that is where most of the UI resources are.
 
@@ -638,16 +1148,50 @@ private:
 	 */
 	void SetRenderingDefaults();
 
+	/**
+	 * @brief Looks for the GL functions for instanced drawing, not part of GLES 2.0 but most drivers have them.
+	 */
+	void InitInstancing();
+
+	/**
+	 * @brief Finds out which compressed texture formats the GPU can use.
+	 */
+	void InitTextureFormats();
+
 	/**
 	 * @brief Build the shaders that we need for basic rendering. If you need more copy the code and go multiply :)
 	 */
 	void BuildShaders();
 
 	/**
-	 * @brief Based on the input data it will select and enable the correct shader to use. If the shader is already enabled then will just updated it's variables.
-	 * 
+	 * @brief Based on the texture passed it will select the correct 2D shader to use.
+	 */
+	TinyShader Select2DShader(uint32_t pTexture)const;
+
+	/**
+	 * @brief If the texture handle is an image in an atlas returns where it is, else nullptr.
+	 */
+	const SubTexture* GetSubTexture(uint32_t pTexture)const;
+
+	/**
+	 * @brief Returns the texture draws with the streaming texture should use and notes it was drawn with this frame.
 	 */
-	void SelectAndEnableShader(uint32_t pTexture,uint8_t pRed,uint8_t pGreen,uint8_t pBlue,uint8_t pAlpha);
+	uint32_t ResolveStreamingTexture(uint32_t pTexture);
+
+	/**
+	 * @brief For the 16 bit formats converts the pixels into a work buffer and returns it, for the others returns the pixels as they are.
+	 */
+	const void* ConvertPixelsForUpload(TextureFormat pFormat,int pSrcBytesPerPixel,int pWidth,int pHeight,const uint8_t* pPixels);
+
+	/**
+	 * @brief Notes the texture is being drawn with, if it was evicted reloads it.
+	 */
+	void UseTexture(uint32_t pTexture);
+
+	/**
+	 * @brief Evicts textures, least recently used first, until pIncoming more bytes will fit in the budget or there are none left that can go.
+	 */
+	void EnforceTextureBudget(size_t pIncoming);
 
 	/**
 	 * @brief If the shader is already active, only it's vars are updated. Else it it is enabled. Depending on platform you want to minimise the changing of the shader used.
@@ -659,7 +1203,101 @@ private:
 	void InitFreeTypeFont();
 	void AllocateQuadBuffers();
 
-	void VertexPtr(int pNum_coord, uint32_t pType,const void* pPointer);
+	void VertexPtr(DrawCommand& rCommand,int pNum_coord, uint32_t pType,const void* pPointer);
+
+	/**
+	 * @brief Returns space for pCount vertices in the 2D batch's triangle list. If the shader or texture are not the same as what is in the batch, or it is full, the batch is drawn first.
+	 * Lines are written as thin quads, so fills and outlines go in the same draw.
+	 */
+	BatchVert2D* Batch2DAppend(const TinyShader& pShader,uint32_t pTexture,size_t pCount);
+
+	/**
+	 * @brief Adds a triangle list to the 2D batch, split up if there are more vertices than the batch can take.
+	 */
+	void Batch2DAddTriangles(const TinyShader& pShader,uint32_t pTexture,const VertShortXY* pVerts,const VertShortXY* pUVs,size_t pCount,uint32_t pColour);
+
+	/**
+	 * @brief Submits what is in the 2D batch as one draw call.
+	 */
+	void FlushBatch2D();
+
+	/**
+	 * @brief All draw calls end up here. Either sends the draw to GL or, when deferred rendering is on, records it for EndFrame.
+	 * Between DisplayListBegin and DisplayListEnd it's recorded into the display list instead.
+	 */
+	void SubmitDraw(const DrawCommand& pCommand);
+
+	/**
+	 * @brief Sends the draw command to GL using the current shader, projection and transform state.
+	 */
+	void ExecuteDraw(const DrawCommand& pCommand);
+
+	/**
+	 * @brief Sorts and sends all the recorded draw commands to GL. Called in EndFrame and before anything that would change what the recorded commands draw.
+	 */
+	void FlushDeferredDraws();
+
+	/**
+	 * @brief Submits the display list's draws with the state they were recorded with. If pTransform is not null it's applied after each draw's transform.
+	 */
+	void ReplayDisplayList(const DisplayList& pList,const float pTransform[4][4]);
+
+	/**
+	 * @brief Sets the GL depth test state for 2D (off) or 3D (on) rendering.
+	 */
+	void ApplyDepthState(bool pDepthTest);
+
+	/**
+	 * @brief Keeps the projection, transform, depth test and current shader and puts them back when it goes out of scope. Defined in the source code.
+	 */
+	struct SavedDrawState;
+
+	/**
+	 * @brief Draws the stats overlay with 2D rendering, puts back the projection, transform, depth and pixel font state it changes.
+	 */
+	void DrawStatsOverlay();
+
+	/**
+	 * @brief Reads the frame buffer and passes it to the frame readback handler, the rows flipped so the top is first.
+	 */
+	void ReadbackFrame();
+
+	/**
+	 * @brief An area of the screen in the 2D drawing coordinates. x1 and y1 are one past the edge.
+	 */
+	struct DamageRect
+	{
+		int x0 = 0,y0 = 0,x1 = 0,y1 = 0;
+
+		bool GetIsEmpty()const{return x1 <= x0 || y1 <= y0;}
+		void Add(const DamageRect& pOther)
+		{
+			if( pOther.GetIsEmpty() )
+			{
+				return;
+			}
+
+			if( GetIsEmpty() )
+			{
+				*this = pOther;
+				return;
+			}
+			x0 = std::min(x0,pOther.x0);
+			y0 = std::min(y0,pOther.y0);
+			x1 = std::max(x1,pOther.x1);
+			y1 = std::max(y1,pOther.y1);
+		}
+	};
+
+	/**
+	 * @brief Converts the rectangle to GL window coordinates, bottom left origin and the frame buffer rotation applied. Fills x,y,width,height.
+	 */
+	void DamageToPhysical(const DamageRect& pRect,int rPhysical[4])const;
+
+	/**
+	 * @brief Sets the scissor to the area being drawn this frame.
+	 */
+	void ApplyDamageScissor();
 
 	uint32_t mCreateFlags;
 	bool mKeepGoing = true;								//!< Set to false by the application requesting to exit or the user doing ctrl + c.
@@ -673,20 +1311,40 @@ private:
 
 	std::unique_ptr<PlatformInterface> mPlatform;				//!< This is all the data needed to drive the rendering platform that this code sits on and used to render with.
 	std::unique_ptr<WorkBuffers> mWorkBuffers;					//!< Handy set of internal work buffers used when rendering so we don't blow the stack or thrash the heap. Easy speed up.
+	std::unique_ptr<GLStateCache> mStateCache;					//!< Shadow of the GL state, stops us making calls that don't change anything.
+	std::unique_ptr<StreamingBuffers> mStreaming;				//!< Where geometry built each frame is written to so it is not drawn from client memory.
+	std::unique_ptr<DeferredDraws> mDeferred;					//!< When deferred rendering is on, the draw calls recorded this frame.
+	std::unique_ptr<FrameStatsHistory> mStats;					//!< Frame stats of the last few seconds, shown by the overlay.
+	std::unique_ptr<DisplayList> mDisplayListRecording;			//!< Not null between DisplayListBegin and DisplayListEnd, where draws go instead of to GL.
+	SlotMap<DisplayList> mDisplayLists;
+	std::unique_ptr<Batch2D> mBatch2D;							//!< The 2D primitives waiting to be drawn as one draw call.
+	std::unique_ptr<SpriteBatch> mSpriteBatch;					//!< Sprites waiting for SpriteBatchEnd.
 	SystemEventHandler mSystemEventHandler = nullptr;			//!< Where all events that we are interested in are routed.
-	std::map<uint32_t,std::unique_ptr<GLTexture>> mTextures; 	//!< Our textures. I reuse the GL texture index (handle) for my own. A handy value and works well.
-	std::map<uint32_t,std::unique_ptr<NinePatch>> mNinePatchs;	//!< Our nine patch data, image data is also into the textures map. I reuse the GL texture index (handle) for my own. A handy value and works well.
+	FrameReadbackHandler mFrameReadbackHandler = nullptr;		//!< When set is given each frame's pixels in EndFrame.
+	std::vector<uint8_t> mFrameReadbackPixels;					//!< Kept so the pixels are not allocated every frame.
+	SlotMap<GLTexture> mTextures;								//!< Our textures. They hold the GL texture name, the handle is not the GL name.
+	SlotMap<NinePatch> mNinePatchs;								//!< Our nine patch data, each has a texture in the textures map with it's image.
 	NinePatchDrawInfo mNinePatchDrawInfo;						//!< Temporary buffer used to pass back rending information to the caller of the DrawNinePatch so they can draw in the safe area.
 
-	std::map<uint32_t,std::unique_ptr<Sprite>> mSprites;		//!< Our sprites. Allows for easier rending with more functionality without functions that have a thousand paramiters.
-	uint32_t mNextSpriteIndex = 1;								//!< The next sprite index to use when a sprite is allocated.
+	SlotMap<TextureAtlas> mAtlases;								//!< Our texture atlases, their pages are in the textures map.
+	SlotMap<SubTexture> mSubTextures;							//!< The images in the atlases. Their handles have the top bit set so they never clash with a texture handle.
+
+	SlotMap<StreamingTexture> mStreamingTextures;				//!< Our streaming textures, their ring of textures are in the textures map. Their handles have a bit set so they can't clash with the others.
+	struct
+	{
+		size_t Budget = 0;				//!< Zero for no limit.
+		size_t Used = 0;				//!< Bytes used by the resident textures.
+		uint32_t MinFramesUnused = 2;	//!< A texture drawn with more recently than this is never evicted.
+	}mTextureMemory;
+	bool mTextureDithering = true;								//!< Dither when converting to the 16 bit formats.
+
+	SlotMap<Sprite> mSprites;									//!< Our sprites. Allows for easier rending with more functionality without functions that have a thousand paramiters.
 
 	struct
 	{
-		std::map<uint32_t,std::unique_ptr<QuadBatch>> Batchs;	//!< Our sprite batches. Allows for easier rending with more functionality without functions that have a thousand paramiters.
-		uint32_t NextIndex = 1;									//!< The next sprite batch index to use when a sprite batch is allocated.
+		SlotMap<QuadBatch> Batchs;								//!< Our sprite batches. Allows for easier rending with more functionality without functions that have a thousand paramiters.
 
-		const size_t MaxQuads = 8000;
+		const size_t MaxQuads = 16384;	//!< The most quads one draw call can use with a 16 bit index buffer. Batches can be bigger, they are drawn in chunks of this size.
 		const size_t IndicesPerQuad = 6;
 		const size_t VerticesPerQuad = 4;
 
@@ -702,6 +1360,12 @@ private:
 		uint32_t texture = 0; //!< A handy texture used in debugging. 16x16 check board.
 		uint32_t frameNumber = 0; //!< What frame we're on. incremented in BeginFrame() So first frame will be 1
 	}mDiagnostics;
+
+	struct
+	{
+		bool ETC1 = false;	//!< The OES ETC1 extension is there, if not but ETC2 is ETC1 textures are uploaded as ETC2.
+		bool ETC2 = false;
+	}mCompressedFormats;
 	
 
 	static const std::array<uint32_t,8192> mFont16x16Data;	//!< used to rebuild font texture.
@@ -719,6 +1383,7 @@ private:
 		TinyShader TextureAlphaOnly2D;
 		TinyShader SpriteShader2D;
 		TinyShader QuadBatchShader2D;
+		TinyShader QuadBatchInstancedShader2D;	//!< Only built when the driver has instancing.
 
 		TinyShader ColourOnly3D;
 		TinyShader TextureOnly3D;
@@ -732,10 +1397,30 @@ private:
 		float transform[4][4];
 	}mMatrices;
 
+	struct
+	{
+		bool Enabled = false;
+		bool InFrame = false;					//!< Between BeginFrame and EndFrame, damage added now also grows the scissor.
+		DamageRect Frame;						//!< The damage of the frame being drawn, or of the next one when between frames.
+		DamageRect Redraw;						//!< What's drawn this frame, Frame plus the damage of the frames the back buffer missed.
+		std::array<DamageRect,4> History;		//!< Damage of the frames before this one, [0] is the last frame. Back buffers older than this are drawn in full.
+	}mDamage;
+
+	bool mDepthTest = false;	//!< Set by Begin2D and Begin3D, recorded with deferred draws so they are replayed with the correct depth state.
+
+	struct
+	{
+		uint32_t Texture = 0;		//!< The render target being drawn to, zero when drawing to the screen.
+		int Width = 0;
+		int Height = 0;
+		Matrix ScreenProjection;	//!< What the screen had when RenderTargetBegin was called, put back by RenderTargetEnd.
+		bool ScreenDepthTest = false;
+		bool PackedDepthStencil = false;	//!< The driver has GL_DEPTH24_STENCIL8, else render targets get a 16 bit depth buffer and no stencil.
+	}mRenderTarget;
+
 #ifdef USE_FREETYPEFONTS
-	uint32_t mNextFontID = 1;
 	int mMaximumAllowedGlyph = 128;
-	std::map<uint32_t,std::unique_ptr<FreeTypeFont>> mFreeTypeFonts;
+	SlotMap<FreeTypeFont> mFreeTypeFonts;
 
 	FT_Library mFreetype = nullptr;	
 #endif
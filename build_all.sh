@@ -3,8 +3,11 @@
 PROJECTS=(
     "./examples/2D/"
     "./examples/3D/"
+    "./examples/Benchmark/"
     "./examples/FreeTypeFont/"
+    "./examples/MicroBenchmarks/"
     "./examples/NinePatch/"
+    "./examples/PNGToKTX/"
     "./examples/PixelFont/"
     "./examples/Sprites/"
     "./examples/Texture/"
@@ -19,3 +22,14 @@ for t in ${PROJECTS[@]}; do
     cd -
 done
 
+# These also build for the headless platform so they can run on machines with no display.
+HEADLESS_PROJECTS=(
+    "./examples/Benchmark/"
+    "./examples/GoldenImages/"
+)
+
+for t in ${HEADLESS_PROJECTS[@]}; do
+    cd "$t"
+    appbuild -c headless -r
+    cd -
+done
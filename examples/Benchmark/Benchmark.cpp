@@ -0,0 +1,451 @@
+#include "TinyGLES.h"
+#include "../SupportCode/TinyPNG.h"
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/**
+ * @brief Runs fixed scenes through the public GLES API and reports how fast they drew as JSON.
+ * Everything random comes from a generator with a fixed seed so every run draws the same frames, the results can be compared between commits.
+ * Build the headless configuration to run it on a machine with no display or GPU.
+ * Usage: Benchmark [-f frames] [-s scene name] [-o output.json]
+ */
+
+static uint32_t LoadTexture(tinygles::GLES &GL,const char* pFilename,bool pFiltered = false)
+{
+    uint32_t textureHandle = 0;
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(pFilename) )
+    {
+        std::vector<uint8_t> RGBA;
+        png.GetRGBA(RGBA);
+        textureHandle = GL.CreateTexture(png.GetWidth(),png.GetHeight(),RGBA.data(),tinygles::TextureFormat::FORMAT_RGBA,pFiltered);
+    }
+    assert(textureHandle);
+
+    return textureHandle;
+}
+
+static uint32_t LoadNinePatch(tinygles::GLES &GL,const char* pFilename)
+{
+    uint32_t textureHandle = 0;
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(pFilename) )
+    {
+        std::vector<uint8_t> RGBA;
+        png.GetRGBA(RGBA);
+        textureHandle = GL.CreateNinePatch(png.GetWidth(),png.GetHeight(),RGBA.data(),true);
+    }
+    assert(textureHandle);
+
+    return textureHandle;
+}
+
+/**
+ * @brief A heightfield of coloured triangles, pSize by pSize quads, for the RenderTriangles scene.
+ */
+static void MakeTerrain(tinygles::VerticesXYZC& rMesh,int pSize,std::mt19937& rRandom)
+{
+    std::vector<float> height((pSize + 1) * (pSize + 1));
+    for( auto& h : height )
+    {
+        h = (float)(rRandom()%1000) * 0.0002f;
+    }
+
+    auto vert = [&](int x,int z)
+    {
+        const float h = height[(z * (pSize + 1)) + x];
+        const uint32_t shade = 0x40 + (uint32_t)(h * 900.0f);
+        return tinygles::VertXYZC{((float)x / pSize) - 0.5f,h,((float)z / pSize) - 0.5f,0xff000000 | (shade << 8) | (shade / 2)};
+    };
+
+    rMesh.clear();
+    for( int z = 0 ; z < pSize ; z++ )
+    {
+        for( int x = 0 ; x < pSize ; x++ )
+        {
+            rMesh.push_back(vert(x,z));
+            rMesh.push_back(vert(x + 1,z));
+            rMesh.push_back(vert(x,z + 1));
+            rMesh.push_back(vert(x + 1,z));
+            rMesh.push_back(vert(x + 1,z + 1));
+            rMesh.push_back(vert(x,z + 1));
+        }
+    }
+}
+
+/**
+ * @brief One benchmark. Setup is called before it's run, not timed, and makes everything Draw needs so Draw only measures drawing.
+ */
+struct Scene
+{
+    const char* name;
+    std::function<void()> setup;
+    std::function<void(int pFrame)> draw;
+    std::function<void()> cleanup;
+};
+
+/**
+ * @brief What a scene measured, averaged over the frames.
+ */
+struct Result
+{
+    const char* name;
+    int frames = 0;
+    double framesPerSecond = 0;
+    double cpuMilliseconds = 0;
+    double frameMillisecondsP99 = 0;
+    double drawCalls = 0;
+    double vertices = 0;
+    double bytesUploaded = 0;
+};
+
+static Result RunScene(tinygles::GLES &GL,Scene& pScene,int pFrames)
+{
+    const int warmUpFrames = 10;// The first frames upload textures and build glyphs, that is not what we are measuring.
+
+    pScene.setup();
+    for( int n = 0 ; n < warmUpFrames && GL.BeginFrame() ; n++ )
+    {
+        GL.Clear(0,0,0);
+        pScene.draw(n);
+        GL.EndFrame();
+    }
+
+    Result result;
+    result.name = pScene.name;
+    std::vector<float> frameTimes;
+    const auto start = std::chrono::steady_clock::now();
+    for( int n = 0 ; n < pFrames && GL.BeginFrame() ; n++ )
+    {
+        GL.Clear(0,0,0);
+        pScene.draw(warmUpFrames + n);
+        GL.EndFrame();
+
+        const tinygles::FrameStats& stats = GL.GetFrameStats();
+        result.frames++;
+        result.cpuMilliseconds += stats.cpuMilliseconds;
+        result.drawCalls += stats.drawCalls;
+        result.vertices += stats.vertices;
+        result.bytesUploaded += stats.bytesUploaded;
+        frameTimes.push_back(stats.frameMilliseconds);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    pScene.cleanup();
+
+    if( result.frames > 0 )
+    {
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        result.framesPerSecond = result.frames / seconds;
+        result.cpuMilliseconds /= result.frames;
+        result.drawCalls /= result.frames;
+        result.vertices /= result.frames;
+        result.bytesUploaded /= result.frames;
+
+        std::sort(frameTimes.begin(),frameTimes.end());
+        result.frameMillisecondsP99 = frameTimes[std::min(frameTimes.size() - 1,(frameTimes.size() * 99) / 100)];
+    }
+    return result;
+}
+
+static const char* GetPlatformName()
+{
+#if defined(PLATFORM_HEADLESS_EGL)
+    return "headless";
+#elif defined(PLATFORM_DRM_EGL)
+    return "drm";
+#elif defined(PLATFORM_X11_GL)
+    return "x11";
+#else
+    return "unknown";
+#endif
+}
+
+static void WriteJSON(std::ostream& pOut,const tinygles::GLES &GL,const std::vector<Result>& pResults)
+{
+    pOut << "{\n";
+    pOut << "  \"platform\": \"" << GetPlatformName() << "\",\n";
+#ifdef DEBUG_BUILD
+    pOut << "  \"build\": \"debug\",\n";
+#else
+    pOut << "  \"build\": \"release\",\n";
+#endif
+    pOut << "  \"width\": " << GL.GetWidth() << ",\n";
+    pOut << "  \"height\": " << GL.GetHeight() << ",\n";
+    pOut << "  \"scenes\": [\n";
+    for( size_t n = 0 ; n < pResults.size() ; n++ )
+    {
+        const Result& r = pResults[n];
+        pOut << "    {";
+        pOut << "\"name\": \"" << r.name << "\", ";
+        pOut << "\"frames\": " << r.frames << ", ";
+        pOut << "\"framesPerSecond\": " << r.framesPerSecond << ", ";
+        pOut << "\"cpuMillisecondsPerFrame\": " << r.cpuMilliseconds << ", ";
+        pOut << "\"frameMillisecondsP99\": " << r.frameMillisecondsP99 << ", ";
+        pOut << "\"drawCallsPerFrame\": " << r.drawCalls << ", ";
+        pOut << "\"verticesPerFrame\": " << r.vertices << ", ";
+        pOut << "\"bytesUploadedPerFrame\": " << r.bytesUploaded;
+        pOut << "}" << (n + 1 < pResults.size() ? "," : "") << "\n";
+    }
+    pOut << "  ]\n";
+    pOut << "}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    int frames = 300;
+    const char* onlyScene = nullptr;
+    const char* outputFile = nullptr;
+    for( int n = 1 ; n < argc ; n++ )
+    {
+        if( strcmp(argv[n],"-f") == 0 && n + 1 < argc )
+        {
+            frames = atoi(argv[++n]);
+        }
+        else if( strcmp(argv[n],"-s") == 0 && n + 1 < argc )
+        {
+            onlyScene = argv[++n];
+        }
+        else if( strcmp(argv[n],"-o") == 0 && n + 1 < argc )
+        {
+            outputFile = argv[++n];
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [-f frames] [-s scene name] [-o output.json]\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+#ifdef DEBUG_BUILD
+    std::cerr << "Debug build, use the release or headless build for meaningful timings\n";
+#endif
+
+    tinygles::GLES GL;
+    const int width = GL.GetWidth();
+    const int height = GL.GetHeight();
+
+    // Everything is made from this so all runs draw the same. Reseeded for each scene so a scene draws the same when run on it's own.
+    std::mt19937 random;
+
+    uint32_t ball = 0;
+    uint32_t sprite = 0;
+    uint32_t quadBatch = 0;
+    uint32_t ninePatch = 0;
+    uint32_t streamed = 0;
+#ifdef USE_FREETYPEFONTS
+    uint32_t font = 0;
+#endif
+    struct Item
+    {
+        int x,y,w,h;
+        uint8_t r,g,b;
+    };
+    std::vector<Item> items;
+    std::vector<float> x,y,rotation,size;
+    std::vector<std::vector<uint8_t>> streamedFrames;
+    tinygles::VerticesXYZC terrain;
+
+    auto makeItems = [&](size_t pCount,int pMaxSize)
+    {
+        random.seed(1234);
+        items.resize(pCount);
+        for( auto& i : items )
+        {
+            i.w = 4 + (random()%pMaxSize);
+            i.h = 4 + (random()%pMaxSize);
+            i.x = random()%(width - i.w);
+            i.y = random()%(height - i.h);
+            i.r = random()%256;
+            i.g = random()%256;
+            i.b = random()%256;
+        }
+    };
+
+    auto makeTransforms = [&](size_t pCount)
+    {
+        random.seed(1234);
+        x.resize(pCount);y.resize(pCount);rotation.resize(pCount);size.resize(pCount);
+        for( size_t n = 0 ; n < pCount ; n++ )
+        {
+            x[n] = (float)(random()%width);
+            y[n] = (float)(random()%height);
+            rotation[n] = (float)(random()%628) * 0.01f;
+            size[n] = (float)(16 + (random()%32));
+        }
+    };
+
+    const std::string longText = "The quick brown fox jumps over the lazy dog 0123456789 THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG!";
+
+    std::vector<Scene> scenes =
+    {
+        {
+            "FillRectangle 10000",
+            [&](){makeItems(10000,64);},
+            [&](int)
+            {
+                for( const auto& i : items )
+                {
+                    GL.FillRectangle(i.x,i.y,i.x + i.w,i.y + i.h,i.r,i.g,i.b);
+                }
+            },
+            [&](){items.clear();}
+        },
+        {
+            "SpriteDraw 2000",
+            [&](){ball = LoadTexture(GL,"../data/foot-ball.png",true);sprite = GL.SpriteCreate(ball,32,32,16,16);makeTransforms(2000);},
+            [&](int pFrame)
+            {
+                for( size_t n = 0 ; n < x.size() ; n++ )
+                {
+                    GL.SetTransform2D(x[n],y[n],rotation[n] + (pFrame * 0.02f),size[n] / 32.0f);
+                    GL.SpriteDraw(sprite);
+                }
+                GL.SetTransformIdentity();
+            },
+            [&](){GL.SpriteDelete(sprite);GL.DeleteTexture(ball);}
+        },
+        {
+            "QuadBatchDraw 2000",
+            [&](){ball = LoadTexture(GL,"../data/foot-ball.png",true);quadBatch = GL.QuadBatchCreate(ball,2000);makeTransforms(2000);},
+            [&](int)
+            {
+                for( auto& r : rotation )
+                {
+                    r += 0.02f;
+                }
+                GL.QuadBatchSetTransforms(quadBatch,0,x.size(),x.data(),y.data(),rotation.data(),size.data());
+                GL.QuadBatchDraw(quadBatch);
+            },
+            [&](){GL.QuadBatchDelete(quadBatch);GL.DeleteTexture(ball);}
+        },
+        {
+            "FontPrint pixel font",
+            [&](){},
+            [&](int pFrame)
+            {
+                for( int line = 0 ; line < height / 16 ; line++ )
+                {
+                    GL.FontPrint(pFrame%16,line * 16,longText.c_str());
+                }
+            },
+            [&](){}
+        },
+#ifdef USE_FREETYPEFONTS
+        {
+            "FontPrint FreeType",
+            [&](){font = GL.FontLoad("../data/LiberationSerif-Bold.ttf",20);},
+            [&](int pFrame)
+            {
+                for( int line = 1 ; line < height / 22 ; line++ )
+                {
+                    GL.FontPrint(font,pFrame%16,line * 22,longText);
+                }
+            },
+            [&](){GL.FontDelete(font);}
+        },
+#endif
+        {
+            "DrawNinePatch 500",
+            [&](){ninePatch = LoadNinePatch(GL,"../data/GreenButton.png");makeItems(500,4);},
+            [&](int)
+            {
+                for( const auto& i : items )
+                {
+                    GL.DrawNinePatch(ninePatch,i.x / 2,i.y / 2,1.0f + (i.w * 0.1f),1.0f + (i.h * 0.05f));
+                }
+            },
+            [&](){GL.DeleteNinePatch(ninePatch);}
+        },
+        {
+            "Circle and RoundedRectangle 4000",
+            [&](){makeItems(1000,48);},
+            [&](int)
+            {
+                for( const auto& i : items )
+                {
+                    GL.FillCircle(i.x + (i.w / 2),i.y + (i.h / 2),i.w / 2,i.r,i.g,i.b);
+                    GL.DrawCircle(i.x + (i.w / 2),i.y + (i.h / 2),i.w / 2,255,255,255);
+                    GL.FillRoundedRectangle(i.x,i.y,i.x + i.w,i.y + i.h,4,i.b,i.g,i.r);
+                    GL.DrawRoundedRectangle(i.x,i.y,i.x + i.w,i.y + i.h,4,255,255,255);
+                }
+            },
+            [&](){items.clear();}
+        },
+        {
+            "RenderTriangles terrain",
+            [&](){random.seed(1234);MakeTerrain(terrain,48,random);},
+            [&](int pFrame)
+            {
+                GL.Begin3D(45.0f,0.1f,100.0f);
+                tinygles::Matrix r,t;
+                for( int n = 0 ; n < 8 ; n++ )
+                {
+                    r.SetRotationX(30.0f);
+                    t.SetRotationY((pFrame * 0.5f) + (n * 45.0f));
+                    r.Mul(t);
+                    r.Translate((n%4) - 1.5f,(n/4) - 0.5f,4);
+                    GL.SetTransform(r.m);
+                    GL.RenderTriangles(terrain);
+                }
+                GL.Begin2D();
+                GL.SetTransformIdentity();
+            },
+            [&](){terrain.clear();}
+        },
+        {
+            "FillTexture 256x256 streaming",
+            [&]()
+            {
+                random.seed(1234);
+                streamedFrames.resize(8);
+                for( auto& f : streamedFrames )
+                {
+                    f.resize(256 * 256 * 4);
+                    for( auto& p : f )
+                    {
+                        p = random()%256;
+                    }
+                }
+                streamed = GL.CreateTexture(256,256,nullptr,tinygles::TextureFormat::FORMAT_RGBA);
+            },
+            [&](int pFrame)
+            {
+                GL.FillTexture(streamed,0,0,256,256,streamedFrames[pFrame%streamedFrames.size()].data(),tinygles::TextureFormat::FORMAT_RGBA);
+                GL.FillRectangle(0,0,width,height,streamed);
+            },
+            [&](){GL.DeleteTexture(streamed);streamedFrames.clear();}
+        },
+    };
+
+    std::vector<Result> results;
+    for( auto& scene : scenes )
+    {
+        if( onlyScene && strcmp(onlyScene,scene.name) != 0 )
+        {
+            continue;
+        }
+        std::cerr << "Running " << scene.name << "\n";
+        results.push_back(RunScene(GL,scene,frames));
+    }
+
+    if( outputFile )
+    {
+        std::ofstream file(outputFile);
+        WriteJSON(file,GL,results);
+    }
+    else
+    {
+        WriteJSON(std::cout,GL,results);
+    }
+
+    return EXIT_SUCCESS;
+}
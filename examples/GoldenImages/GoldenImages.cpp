@@ -0,0 +1,720 @@
+#include "TinyGLES.h"
+#include "../SupportCode/TinyPNG.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <functional>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <fstream>
+#include <zlib.h>
+
+/**
+ * @brief Draws a fixed frame for each scene, reads it back and compares it to a stored golden PNG.
+ * A pixel differs when any channel is more than the tolerance away from the golden, a scene fails when too many pixels differ.
+ * For a failed scene what was drawn and a diff image, differing pixels in red, are written to the output folder.
+ * Build the headless configuration to run it with a software GL, the goldens were made with Mesa's llvmpipe at 640x480.
+ * Each scene is also drawn with deferred rendering and from a display list, they must match the same golden as drawing it immediately.
+ * Usage: GoldenImages [-u] [-t channel tolerance] [-p percent of pixels allowed to differ] [-s scene name] [-g golden folder] [-o output folder]
+ */
+
+static uint32_t LoadTexture(tinygles::GLES &GL,const char* pFilename,bool pFiltered = false)
+{
+    uint32_t textureHandle = 0;
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(pFilename) )
+    {
+        if( png.GetHasAlpha() )
+        {
+            std::vector<uint8_t> RGBA;
+            png.GetRGBA(RGBA);
+            textureHandle = GL.CreateTexture(png.GetWidth(),png.GetHeight(),RGBA.data(),tinygles::TextureFormat::FORMAT_RGBA,pFiltered);
+        }
+        else
+        {
+            std::vector<uint8_t> RGB;
+            png.GetRGB(RGB);
+            textureHandle = GL.CreateTexture(png.GetWidth(),png.GetHeight(),RGB.data(),tinygles::TextureFormat::FORMAT_RGB,pFiltered);
+        }
+    }
+    assert(textureHandle);
+
+    return textureHandle;
+}
+
+static uint32_t LoadNinePatch(tinygles::GLES &GL,const char* pFilename)
+{
+    uint32_t textureHandle = 0;
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(pFilename) )
+    {
+        std::vector<uint8_t> RGBA;
+        png.GetRGBA(RGBA);
+        textureHandle = GL.CreateNinePatch(png.GetWidth(),png.GetHeight(),RGBA.data(),true);
+    }
+    assert(textureHandle);
+
+    return textureHandle;
+}
+
+/**
+ * @brief A unit box, each face is two triangles, used for the coloured and textured 3D draws.
+ */
+static void MakeBoxes(tinygles::VerticesXYZC& rColoured,tinygles::VerticesXYZUV& rTextured)
+{
+    const float corners[8][3] =
+    {
+        {-0.5f, 0.5f,-0.5f},{ 0.5f, 0.5f,-0.5f},{ 0.5f,-0.5f,-0.5f},{-0.5f,-0.5f,-0.5f},
+        {-0.5f, 0.5f, 0.5f},{ 0.5f, 0.5f, 0.5f},{ 0.5f,-0.5f, 0.5f},{-0.5f,-0.5f, 0.5f}
+    };
+    const int faces[6][4] = {{0,1,2,3},{5,4,7,6},{1,5,6,2},{4,0,3,7},{0,4,5,1},{3,2,6,7}};
+    const uint32_t colours[6] = {0xffff0000,0xff00ff00,0xff0000ff,0xffff00ff,0xffffff00,0xff00ffff};
+    const int quadToTriangles[6] = {0,1,3,1,2,3};
+    const float quadUVs[4][2] = {{0,0},{1,0},{1,1},{0,1}};
+
+    rColoured.clear();
+    rTextured.clear();
+    for( int f = 0 ; f < 6 ; f++ )
+    {
+        for( int i : quadToTriangles )
+        {
+            const float* c = corners[faces[f][i]];
+            rColoured.push_back({c[0],c[1],c[2],colours[f]});
+
+            tinygles::VertXYZUV v;
+            v.x = c[0];
+            v.y = c[1];
+            v.z = c[2];
+            v.SetUV(quadUVs[i][0],quadUVs[i][1]);
+            rTextured.push_back(v);
+        }
+    }
+}
+
+/**
+ * @brief Makes a test pattern where every channel is 0 or 255, so it's the same in the 16 bit formats as in 8 bit.
+ * pChannels is 3 for RGB or 4 for RGBA. With pSeeThrough some of the pixels have an alpha of zero.
+ */
+static std::vector<uint8_t> MakePattern(int pSize,int pChannels,bool pSeeThrough)
+{
+    std::vector<uint8_t> pixels;
+    for( int y = 0 ; y < pSize ; y++ )
+    {
+        for( int x = 0 ; x < pSize ; x++ )
+        {
+            const int colour = ((x >> 3) ^ (y >> 2)) & 7;
+            pixels.push_back((colour&1) ? 255 : 0);
+            pixels.push_back((colour&2) ? 255 : 0);
+            pixels.push_back((colour&4) ? 255 : 0);
+            if( pChannels == 4 )
+            {
+                pixels.push_back(pSeeThrough && ((x >> 2) + (y >> 2)) % 3 == 0 ? 0 : 255);
+            }
+        }
+    }
+    return pixels;
+}
+
+static const int PatternSize = 64;
+
+/**
+ * @brief Draws the two patterns at their size and scaled up, the see through one over rectangles so it's alpha shows.
+ * Every texture scene draws this with textures made a different way, they all match the Textures golden.
+ * Only scaled by whole numbers, then no texel edge lands on a pixel centre where which texel is picked would be down to rounding.
+ */
+static void DrawPatterns(tinygles::GLES &GL,uint32_t pOpaque,uint32_t pSeeThrough)
+{
+    GL.FillRectangle(20,20,276,212,pOpaque);
+    GL.FillRectangle(320,20,384,84,pOpaque);
+    GL.FillRectangle(400,20,528,148,pOpaque);
+
+    GL.FillRectangle(20,240,620,460,0,128,255);
+    GL.FillRectangle(320,300,620,460,255,128,0);
+    GL.FillRectangle(40,260,104,324,pSeeThrough);
+    GL.FillRectangle(120,260,376,452,pSeeThrough);
+    GL.FillRectangle(400,280,592,408,pSeeThrough);
+}
+
+/**
+ * @brief One frame to check. Setup and cleanup are outside the frame that is compared.
+ * A scene with a golden set is checked against that scene's golden, for drawing the same thing a different way.
+ */
+struct Scene
+{
+    const char* name;
+    std::function<void()> setup;
+    std::function<void()> draw;
+    std::function<void()> cleanup;
+    const char* golden = nullptr;
+    bool canRecord = true;          //!< False if the draw does more than draw calls, so can't be recorded into a display list.
+
+    const char* GetGolden()const{return golden ? golden : name;}
+};
+
+/**
+ * @brief The ways each scene is drawn.
+ */
+enum class DrawMode
+{
+    IMMEDIATE,
+    DEFERRED,       //!< Recorded and sorted, drawn in EndFrame.
+    DISPLAY_LIST    //!< Recorded into a display list before the frame, replayed in it.
+};
+
+static const char* DrawModeToString(DrawMode pMode)
+{
+    switch( pMode )
+    {
+    case DrawMode::IMMEDIATE:
+        return "Immediate";
+
+    case DrawMode::DEFERRED:
+        return "Deferred";
+
+    case DrawMode::DISPLAY_LIST:
+        return "DisplayList";
+    }
+    return "Unknown";
+}
+
+/**
+ * @brief Draws the scene and returns what ended up in the frame buffer, top row first with alpha set to opaque.
+ * Alpha is forced as the headless surface may or may not have an alpha channel, that would make the goldens depend on the EGL config picked.
+ */
+static void RenderScene(tinygles::GLES &GL,Scene& pScene,DrawMode pMode,int& rWidth,int& rHeight,std::vector<uint8_t>& rRGBA)
+{
+    rWidth = rHeight = 0;
+    rRGBA.clear();
+    GL.SetFrameReadbackHandler([&](int pWidth,int pHeight,const uint8_t* pRGBA)
+    {
+        rWidth = pWidth;
+        rHeight = pHeight;
+        rRGBA.assign(pRGBA,pRGBA + (pWidth * pHeight * 4));
+        for( size_t n = 3 ; n < rRGBA.size() ; n += 4 )
+        {
+            rRGBA[n] = 255;
+        }
+    });
+
+    pScene.setup();
+
+    uint32_t displayList = 0;
+    if( pMode == DrawMode::DISPLAY_LIST )
+    {// Recorded with the same state the frame starts with.
+        GL.Begin2D();
+        GL.SetTransformIdentity();
+        GL.DisplayListBegin();
+        pScene.draw();
+        displayList = GL.DisplayListEnd();
+    }
+
+    GL.SetDeferredRendering(pMode == DrawMode::DEFERRED);
+    if( GL.BeginFrame() )
+    {
+        GL.Clear(40,40,60);
+        GL.Begin2D();
+        GL.SetTransformIdentity();
+        if( displayList )
+        {
+            GL.DisplayListDraw(displayList);
+        }
+        else
+        {
+            pScene.draw();
+        }
+        GL.EndFrame();
+    }
+    GL.SetDeferredRendering(false);
+
+    if( displayList )
+    {
+        GL.DisplayListDelete(displayList);
+    }
+    pScene.cleanup();
+
+    GL.SetFrameReadbackHandler(nullptr);
+}
+
+/**
+ * @brief Counts the pixels where any channel is more than pTolerance away and fills rDiff with an image of them.
+ * Differing pixels are red, the rest are the golden image darkened to grey so you can see where they are.
+ */
+static size_t CompareImages(const std::vector<uint8_t>& pActual,const std::vector<uint8_t>& pGolden,int pTolerance,std::vector<uint8_t>& rDiff)
+{
+    assert( pActual.size() == pGolden.size() );
+    rDiff.resize(pActual.size());
+
+    size_t numDiffering = 0;
+    for( size_t n = 0 ; n < pActual.size() ; n += 4 )
+    {
+        bool differs = false;
+        for( size_t c = 0 ; c < 3 ; c++ )
+        {
+            differs |= abs((int)pActual[n + c] - (int)pGolden[n + c]) > pTolerance;
+        }
+
+        if( differs )
+        {
+            numDiffering++;
+            rDiff[n + 0] = 255;
+            rDiff[n + 1] = 0;
+            rDiff[n + 2] = 0;
+        }
+        else
+        {
+            const uint8_t grey = (uint8_t)((pGolden[n + 0] + pGolden[n + 1] + pGolden[n + 2]) / 6);
+            rDiff[n + 0] = grey;
+            rDiff[n + 1] = grey;
+            rDiff[n + 2] = grey;
+        }
+        rDiff[n + 3] = 255;
+    }
+    return numDiffering;
+}
+
+/**
+ * @brief Adds a PNG chunk, length, name, data then the CRC of the name and data. All big endian.
+ */
+static void WritePNGChunk(std::ofstream& pFile,const char* pChunkName,const std::vector<uint8_t>& pData)
+{
+    const uint32_t length = htobe32((uint32_t)pData.size());
+    pFile.write((const char*)&length,4);
+    pFile.write(pChunkName,4);
+    pFile.write((const char*)pData.data(),pData.size());
+
+    uLong crc = crc32(0,(const Bytef*)pChunkName,4);
+    crc = crc32(crc,pData.data(),pData.size());
+    const uint32_t crcBE = htobe32((uint32_t)crc);
+    pFile.write((const char*)&crcBE,4);
+}
+
+/**
+ * @brief Writes an 8 bit RGBA image to a PNG file. Rows are not filtered, the data is compressed with zlib.
+ * Lives here and not in TinyPNG as the files in SupportCode are copied over from the TinyPNG repo.
+ */
+static bool SavePNG(const std::string& pFilename,uint32_t pWidth,uint32_t pHeight,const std::vector<uint8_t>& pRGBA)
+{
+    const size_t rowSize = pWidth * 4;
+    if( pRGBA.size() < rowSize * pHeight )
+    {
+        std::cerr << "Failed to save PNG " << pFilename << ", given " << pRGBA.size() << " bytes for a " << pWidth << "x" << pHeight << " image\n";
+        return false;
+    }
+
+    // Each row starts with it's filter type, zero for none.
+    std::vector<uint8_t> rows((rowSize + 1) * pHeight);
+    for( uint32_t y = 0 ; y < pHeight ; y++ )
+    {
+        rows[y * (rowSize + 1)] = 0;
+        std::copy(pRGBA.begin() + (y * rowSize),pRGBA.begin() + ((y + 1) * rowSize),rows.begin() + (y * (rowSize + 1)) + 1);
+    }
+
+    uLongf compressedSize = compressBound(rows.size());
+    std::vector<uint8_t> compressed(compressedSize);
+    if( compress(compressed.data(),&compressedSize,rows.data(),rows.size()) != Z_OK )
+    {
+        std::cerr << "Failed to save PNG " << pFilename << ", zlib could not compress it\n";
+        return false;
+    }
+    compressed.resize(compressedSize);
+
+    std::vector<uint8_t> header(13);
+    const uint32_t widthBE = htobe32(pWidth);
+    const uint32_t heightBE = htobe32(pHeight);
+    std::copy((const uint8_t*)&widthBE,(const uint8_t*)&widthBE + 4,header.begin());
+    std::copy((const uint8_t*)&heightBE,(const uint8_t*)&heightBE + 4,header.begin() + 4);
+    header[8] = 8;// Bit depth
+    header[9] = tinypng::Loader::CT_TRUE_COLOUR_WITH_ALPHA;
+    header[10] = 0;// Compression method
+    header[11] = 0;// Filter method
+    header[12] = 0;// Interlace method
+
+    std::ofstream file(pFilename,std::ofstream::binary);
+    if( !file )
+    {
+        std::cerr << "Failed to save PNG, could not open " << pFilename << '\n';
+        return false;
+    }
+
+    const uint8_t signature[8] = {0x89,0x50,0x4E,0x47,0x0D,0x0A,0x1A,0x0A};
+    file.write((const char*)signature,8);
+    WritePNGChunk(file,"IHDR",header);
+    WritePNGChunk(file,"IDAT",compressed);
+    WritePNGChunk(file,"IEND",{});
+
+    return file.good();
+}
+
+/**
+ * @brief Compares the frame to the golden and prints if it passed. For a fail what was drawn and the diff are written to the output folder, named after pLabel.
+ */
+static bool CheckAgainstGolden(const std::string& pLabel,const std::string& pGoldenFile,const std::string& pOutputFolder,int pTolerance,float pAllowedPercent,int pWidth,int pHeight,const std::vector<uint8_t>& pActual)
+{
+    std::vector<uint8_t> golden;
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(pGoldenFile) )
+    {
+        png.GetRGBA(golden);
+    }
+
+    std::string failure;
+    if( golden.size() == 0 )
+    {
+        failure = "could not load " + pGoldenFile;
+    }
+    else if( (int)png.GetWidth() != pWidth || (int)png.GetHeight() != pHeight )
+    {
+        failure = "size is " + std::to_string(pWidth) + "x" + std::to_string(pHeight) + " golden is " + std::to_string(png.GetWidth()) + "x" + std::to_string(png.GetHeight());
+    }
+    else
+    {
+        std::vector<uint8_t> diff;
+        const size_t numDiffering = CompareImages(pActual,golden,pTolerance,diff);
+        const float percent = (numDiffering * 100.0f) / (pWidth * pHeight);
+        if( percent > pAllowedPercent )
+        {
+            failure = std::to_string(numDiffering) + " pixels differ (" + std::to_string(percent) + "%)";
+            SavePNG(pOutputFolder + pLabel + ".diff.png",pWidth,pHeight,diff);
+        }
+    }
+
+    if( failure.size() > 0 )
+    {
+        std::cout << "FAIL " << pLabel << " " << failure << "\n";
+        SavePNG(pOutputFolder + pLabel + ".actual.png",pWidth,pHeight,pActual);
+        return false;
+    }
+
+    std::cout << "PASS " << pLabel << "\n";
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool updateGoldens = false;
+    int tolerance = 8;
+    float allowedPercent = 0.1f;
+    const char* onlyScene = nullptr;
+    std::string goldenFolder = "./golden/";
+    std::string outputFolder = "./failures/";
+    for( int n = 1 ; n < argc ; n++ )
+    {
+        if( strcmp(argv[n],"-u") == 0 )
+        {
+            updateGoldens = true;
+        }
+        else if( strcmp(argv[n],"-t") == 0 && n + 1 < argc )
+        {
+            tolerance = atoi(argv[++n]);
+        }
+        else if( strcmp(argv[n],"-p") == 0 && n + 1 < argc )
+        {
+            allowedPercent = (float)atof(argv[++n]);
+        }
+        else if( strcmp(argv[n],"-s") == 0 && n + 1 < argc )
+        {
+            onlyScene = argv[++n];
+        }
+        else if( strcmp(argv[n],"-g") == 0 && n + 1 < argc )
+        {
+            goldenFolder = std::string(argv[++n]) + "/";
+        }
+        else if( strcmp(argv[n],"-o") == 0 && n + 1 < argc )
+        {
+            outputFolder = std::string(argv[++n]) + "/";
+        }
+        else
+        {
+            std::cerr << "Usage: " << argv[0] << " [-u] [-t channel tolerance] [-p percent of pixels allowed to differ] [-s scene name] [-g golden folder] [-o output folder]\n";
+            std::cerr << "    -u Writes what is drawn as the new goldens, check them by eye before committing them.\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    tinygles::GLES GL;
+
+    uint32_t ball = 0;
+    uint32_t bird = 0;
+    uint32_t tile = 0;
+    uint32_t sprite = 0;
+    uint32_t quadBatch = 0;
+    uint32_t ninePatch = 0;
+#ifdef USE_FREETYPEFONTS
+    uint32_t font = 0;
+#endif
+    uint32_t opaquePattern = 0;
+    uint32_t seeThroughPattern = 0;
+    uint32_t atlas = 0;
+    uint32_t renderTarget = 0;
+    const std::vector<uint8_t> patternRGB = MakePattern(PatternSize,3,false);
+    const std::vector<uint8_t> patternRGBA = MakePattern(PatternSize,4,false);
+    const std::vector<uint8_t> patternSeeThrough = MakePattern(PatternSize,4,true);
+    tinygles::VerticesXYZC colouredBox;
+    tinygles::VerticesXYZUV texturedBox;
+
+    std::vector<Scene> scenes =
+    {
+        {
+            "2D",
+            [&](){},
+            [&]()
+            {
+                GL.FillRectangle(20,20,200,140,255,128,0);
+                GL.DrawRectangle(220,20,400,140,0,255,128);
+                GL.FillRectangle(100,80,300,200,0,128,255,128);
+                GL.FillCircle(520,90,70,200,40,40);
+                GL.DrawCircle(520,90,50,255,255,255);
+                GL.FillRoundedRectangle(20,240,200,380,20,120,200,60);
+                GL.DrawRoundedRectangle(220,240,400,380,30,255,255,0);
+                for( int n = 0 ; n < 16 ; n++ )
+                {
+                    GL.DrawLine(420,240 + (n * 14),620,460 - (n * 14),(uint8_t)(n * 16),255,(uint8_t)(255 - (n * 16)));
+                }
+                GL.DrawLine(20,420,400,460,6,255,255,255);
+
+                tinygles::VerticesShortXY points;
+                for( int n = 0 ; n <= 20 ; n++ )
+                {
+                    points.emplace_back(20 + (n * 19),(n&1) ? 400 : 440);
+                }
+                GL.DrawLineList(points,255,0,255);
+
+                // Too few points to make a circle, these draw nothing.
+                GL.FillCircle(100,100,20,255,0,0,255,1);
+                GL.FillCircle(100,100,20,255,0,0,255,2);
+                GL.DrawCircle(100,100,20,255,0,0,255,1);
+                GL.DrawCircle(100,100,20,255,0,0,255,2);
+            },
+            [&](){}
+        },
+        {
+            "NinePatch",
+            [&](){ninePatch = LoadNinePatch(GL,"../data/GreenButton.png");},
+            [&]()
+            {
+                GL.DrawNinePatch(ninePatch,20,20,1.0f,1.0f);
+                GL.DrawNinePatch(ninePatch,20,140,3.0f,1.0f);
+                GL.DrawNinePatch(ninePatch,300,20,1.5f,3.0f);
+                GL.DrawNinePatch(ninePatch,20,280,5.0f,1.5f);
+            },
+            [&](){GL.DeleteNinePatch(ninePatch);}
+        },
+        {
+            "PixelFont",
+            [&](){},
+            [&]()
+            {
+                GL.FontPrint(10,10,"The quick brown fox jumps over the lazy dog 0123456789");
+                GL.FontSetColour(255,200,0);
+                GL.FontSetScale(2);
+                GL.FontPrint(10,40,"THE QUICK BROWN FOX");
+                GL.FontSetColour(0,200,255);
+                GL.FontSetScale(4);
+                GL.FontPrint(10,100,"Golden!");
+                GL.FontSetScale(1);
+                GL.FontSetColour(255,255,255);
+            },
+            [&](){}
+        },
+#ifdef USE_FREETYPEFONTS
+        {
+            "FreeTypeFont",
+            [&](){font = GL.FontLoad("../data/LiberationSerif-Bold.ttf",40);},
+            [&]()
+            {
+                GL.FontPrint(font,10,50,"The quick brown fox");
+                GL.FontSetColour(font,255,128,0);
+                GL.FontPrint(font,10,120,"jumps over the lazy dog");
+                GL.FontSetColour(font,100,255,100,128);
+                GL.FontPrint(font,10,190,"0123456789 !?&%");
+            },
+            [&](){GL.FontDelete(font);}
+        },
+#endif
+        {
+            "Sprites",
+            [&]()
+            {
+                ball = LoadTexture(GL,"../data/foot-ball.png",true);
+                bird = LoadTexture(GL,"../data/Bird_by_Magnus.png",true);
+                sprite = GL.SpriteCreate(ball,64,64,32,32);
+                quadBatch = GL.QuadBatchCreate(ball,32);
+                std::vector<tinygles::QuadBatchTransform>& transforms = GL.QuadBatchGetTransform(quadBatch);
+                for( size_t n = 0 ; n < transforms.size() ; n++ )
+                {
+                    transforms[n].SetTransform(40 + ((n%8) * 40),300 + ((n/8) * 40),n * 0.2f,32);
+                }
+            },
+            [&]()
+            {
+                GL.FillRectangle(360,20,616,148,bird);
+                for( int n = 0 ; n < 5 ; n++ )
+                {
+                    GL.SetTransform2D(60 + (n * 60),60 + (n * 30),n * 0.4f,0.5f + (n * 0.25f));
+                    GL.SpriteDraw(sprite);
+                }
+                GL.SetTransformIdentity();
+                GL.QuadBatchDraw(quadBatch);
+            },
+            [&](){GL.QuadBatchDelete(quadBatch);GL.SpriteDelete(sprite);GL.DeleteTexture(bird);GL.DeleteTexture(ball);}
+        },
+        {
+            "3D",
+            [&](){tile = LoadTexture(GL,"../data/tile_1.png");MakeBoxes(colouredBox,texturedBox);},
+            [&]()
+            {
+                GL.Begin3D(45.0f,0.1f,100.0f);
+                tinygles::Matrix r,t;
+                for( int n = 0 ; n < 4 ; n++ )
+                {
+                    r.SetRotationX(20.0f + (n * 25.0f));
+                    t.SetRotationY(30.0f + (n * 40.0f));
+                    r.Mul(t);
+                    r.Translate((n * 1.6f) - 2.4f,0.9f,7);
+                    GL.SetTransform(r.m);
+                    GL.RenderTriangles(colouredBox);
+
+                    r.Translate((n * 1.6f) - 2.4f,-0.9f,7);
+                    GL.SetTransform(r.m);
+                    GL.RenderTriangles(texturedBox,tile);
+                }
+                GL.Begin2D();
+                GL.SetTransformIdentity();
+            },
+            [&](){GL.DeleteTexture(tile);}
+        },
+        {
+            "Textures",
+            [&]()
+            {
+                opaquePattern = GL.CreateTexture(PatternSize,PatternSize,patternRGB.data(),tinygles::TextureFormat::FORMAT_RGB,false);
+                seeThroughPattern = GL.CreateTexture(PatternSize,PatternSize,patternSeeThrough.data(),tinygles::TextureFormat::FORMAT_RGBA,false);
+            },
+            [&](){DrawPatterns(GL,opaquePattern,seeThroughPattern);},
+            [&](){GL.DeleteTexture(opaquePattern);GL.DeleteTexture(seeThroughPattern);}
+        },
+        {
+            "Textures16Bit4444",
+            [&]()
+            {
+                opaquePattern = GL.CreateTexture(PatternSize,PatternSize,patternRGB.data(),tinygles::TextureFormat::FORMAT_RGB565,false);
+                seeThroughPattern = GL.CreateTexture(PatternSize,PatternSize,patternSeeThrough.data(),tinygles::TextureFormat::FORMAT_RGBA4444,false);
+            },
+            [&](){DrawPatterns(GL,opaquePattern,seeThroughPattern);},
+            [&](){GL.DeleteTexture(opaquePattern);GL.DeleteTexture(seeThroughPattern);},
+            "Textures"
+        },
+        {
+            "Textures16Bit5551",
+            [&]()
+            {
+                opaquePattern = GL.CreateTexture(PatternSize,PatternSize,patternRGB.data(),tinygles::TextureFormat::FORMAT_RGB565,false);
+                seeThroughPattern = GL.CreateTexture(PatternSize,PatternSize,patternSeeThrough.data(),tinygles::TextureFormat::FORMAT_RGBA5551,false);
+            },
+            [&](){DrawPatterns(GL,opaquePattern,seeThroughPattern);},
+            [&](){GL.DeleteTexture(opaquePattern);GL.DeleteTexture(seeThroughPattern);},
+            "Textures"
+        },
+        {
+            "Atlas",
+            [&]()
+            {
+                atlas = GL.AtlasCreate(tinygles::TextureFormat::FORMAT_RGBA,256);
+                opaquePattern = GL.AtlasAddImage(atlas,PatternSize,PatternSize,patternRGBA.data());
+                seeThroughPattern = GL.AtlasAddImage(atlas,PatternSize,PatternSize,patternSeeThrough.data());
+            },
+            [&](){DrawPatterns(GL,opaquePattern,seeThroughPattern);},
+            [&](){GL.AtlasDelete(atlas);},
+            "Textures"
+        },
+        {
+            "StreamingTexture",
+            [&]()
+            {
+                opaquePattern = GL.StreamingTextureCreate(PatternSize,PatternSize,tinygles::TextureFormat::FORMAT_RGB);
+                seeThroughPattern = GL.StreamingTextureCreate(PatternSize,PatternSize,tinygles::TextureFormat::FORMAT_RGBA);
+                GL.StreamingTextureUpdate(opaquePattern,patternRGB.data());
+                GL.StreamingTextureUpdate(seeThroughPattern,patternSeeThrough.data());
+            },
+            [&](){DrawPatterns(GL,opaquePattern,seeThroughPattern);},
+            [&](){GL.StreamingTextureDelete(opaquePattern);GL.StreamingTextureDelete(seeThroughPattern);},
+            "Textures"
+        },
+        {
+            "RenderTarget",
+            [&]()
+            {
+                opaquePattern = GL.CreateTexture(PatternSize,PatternSize,patternRGB.data(),tinygles::TextureFormat::FORMAT_RGB,false);
+                seeThroughPattern = GL.CreateTexture(PatternSize,PatternSize,patternSeeThrough.data(),tinygles::TextureFormat::FORMAT_RGBA,false);
+                renderTarget = GL.RenderTargetCreate(GL.GetWidth(),GL.GetHeight());
+            },
+            [&]()
+            {
+                GL.RenderTargetBegin(renderTarget);
+                GL.Clear(40,40,60);
+                DrawPatterns(GL,opaquePattern,seeThroughPattern);
+                GL.RenderTargetEnd();
+                GL.FillRectangle(0,0,GL.GetWidth(),GL.GetHeight(),renderTarget);
+            },
+            [&](){GL.DeleteTexture(renderTarget);GL.DeleteTexture(opaquePattern);GL.DeleteTexture(seeThroughPattern);},
+            "Textures",
+            false
+        },
+    };
+
+    if( !updateGoldens )
+    {
+        mkdir(outputFolder.c_str(),0777);
+    }
+
+    int numFailed = 0;
+    for( auto& scene : scenes )
+    {
+        if( onlyScene && strcmp(onlyScene,scene.name) != 0 )
+        {
+            continue;
+        }
+
+        for( DrawMode mode : {DrawMode::IMMEDIATE,DrawMode::DEFERRED,DrawMode::DISPLAY_LIST} )
+        {
+            // Goldens are only written from immediate drawing, the other modes and scenes sharing a golden must match it.
+            const bool writeGolden = updateGoldens && mode == DrawMode::IMMEDIATE && scene.golden == nullptr;
+            if( (updateGoldens && !writeGolden) || (mode == DrawMode::DISPLAY_LIST && !scene.canRecord) )
+            {
+                continue;
+            }
+
+            const std::string label = mode == DrawMode::IMMEDIATE ? std::string(scene.name) : std::string(scene.name) + "." + DrawModeToString(mode);
+            const std::string goldenFile = goldenFolder + scene.GetGolden() + ".png";
+            int width,height;
+            std::vector<uint8_t> actual;
+            RenderScene(GL,scene,mode,width,height,actual);
+            if( actual.size() == 0 )
+            {
+                std::cout << "FAIL " << label << " nothing was read back\n";
+                numFailed++;
+            }
+            else if( writeGolden )
+            {
+                if( SavePNG(goldenFile,width,height,actual) )
+                {
+                    std::cout << "Wrote " << goldenFile << "\n";
+                }
+                else
+                {
+                    numFailed++;
+                }
+            }
+            else if( !CheckAgainstGolden(label,goldenFile,outputFolder,tolerance,allowedPercent,width,height,actual) )
+            {
+                numFailed++;
+            }
+        }
+    }
+
+    return numFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+#include "TinyGLES.h"
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <functional>
+#include <stdlib.h>
+
+/**
+ * @brief Runs the function pIterations times and prints the average time taken per call in microseconds.
+ */
+static void Measure(const char* pName,int pIterations,std::function<void()> pFunction)
+{
+    pFunction();// Warm up the caches.
+
+    const auto start = std::chrono::steady_clock::now();
+    for( int n = 0 ; n < pIterations ; n++ )
+    {
+        pFunction();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    const double totalMicroseconds = std::chrono::duration<double,std::micro>(end - start).count();
+    std::cout << pName << " " << (totalMicroseconds / pIterations) << "us\n";
+}
+
+int main()
+{
+    std::cout << "Micro benchmarks for the CPU side of TinyGLES\n";
+#ifdef DEBUG_BUILD
+    std::cout << "Debug build, use the release build for meaningful timings\n";
+#endif
+
+    tinygles::GLES GL;
+
+    std::vector<uint8_t> white(16*16*4,255);
+    const uint32_t texture = GL.CreateTexture(16,16,white.data(),tinygles::TextureFormat::FORMAT_RGBA,false);
+
+    // Quad batch transform fill, 8000 particles being moved every frame.
+    const size_t numParticles = 8000;
+    const int iterations = 1000;
+    const uint32_t particles = GL.QuadBatchCreate(texture,numParticles);
+
+    std::vector<float> x(numParticles),y(numParticles),rotation(numParticles),size(numParticles);
+    for( size_t n = 0 ; n < numParticles ; n++ )
+    {
+        x[n] = (float)(rand()%GL.GetWidth());
+        y[n] = (float)(rand()%GL.GetHeight());
+        rotation[n] = (float)(rand()%628) * 0.01f;
+        size[n] = (float)(8 + (rand()%24));
+    }
+
+    std::cout << "Filling " << numParticles << " quad batch transforms\n";
+
+    Measure("  QuadBatchTransform::SetTransform per quad",iterations,[&]()
+    {
+        tinygles::QuadBatchTransform* trans = GL.QuadBatchGetTransform(particles).data();
+        for( size_t n = 0 ; n < numParticles ; n++ )
+        {
+            trans[n].SetTransform((int16_t)x[n],(int16_t)y[n],rotation[n],(int16_t)size[n]);
+        }
+    });
+
+    Measure("  QuadBatchSetTransforms bulk",iterations,[&]()
+    {
+        GL.QuadBatchSetTransforms(particles,0,numParticles,x.data(),y.data(),rotation.data(),size.data());
+    });
+
+    GL.QuadBatchDelete(particles);
+    GL.DeleteTexture(texture);
+
+    // Handle look ups, what every draw call does. The std::map is how the objects used to be held.
+    struct Object
+    {
+        int value;
+    };
+    const size_t numHandles = 10000;
+    std::map<uint32_t,std::unique_ptr<Object>> map;
+    tinygles::SlotMap<Object> slotMap;
+    std::vector<uint32_t> mapHandles,slotMapHandles;
+    for( size_t n = 0 ; n < numHandles ; n++ )
+    {
+        map[n + 1] = std::make_unique<Object>(Object{(int)n});
+        mapHandles.push_back(n + 1);
+        slotMapHandles.push_back(slotMap.Add(std::make_unique<Object>(Object{(int)n})));
+    }
+
+    // Random order, as handles are used in a real frame.
+    for( size_t n = 0 ; n < numHandles ; n++ )
+    {
+        const size_t other = rand()%numHandles;
+        std::swap(mapHandles[n],mapHandles[other]);
+        std::swap(slotMapHandles[n],slotMapHandles[other]);
+    }
+
+    std::cout << "Looking up " << numHandles << " handles\n";
+    volatile int sum = 0;
+
+    Measure("  std::map",iterations,[&]()
+    {
+        int total = 0;
+        for( auto h : mapHandles )
+        {
+            total += map.at(h)->value;
+        }
+        sum = total;
+    });
+
+    Measure("  SlotMap",iterations,[&]()
+    {
+        int total = 0;
+        for( auto h : slotMapHandles )
+        {
+            total += slotMap.Get(h)->value;
+        }
+        sum = total;
+    });
+
+    std::vector<uint32_t> textures;
+    for( size_t n = 0 ; n < numHandles ; n++ )
+    {
+        textures.push_back(GL.CreateTexture(1,1,white.data(),tinygles::TextureFormat::FORMAT_RGBA,false));
+    }
+
+    Measure("  GetTextureWidth",iterations,[&]()
+    {
+        int total = 0;
+        for( auto t : textures )
+        {
+            total += GL.GetTextureWidth(t);
+        }
+        sum = total;
+    });
+
+    for( auto t : textures )
+    {
+        GL.DeleteTexture(t);
+    }
+
+    // A static UI panel, drawn every frame as primitives or recorded once and replayed from buffer objects.
+    const int numButtons = 200;
+    std::cout << "Drawing a panel of " << numButtons << " buttons with labels\n";
+    auto drawPanel = [&]()
+    {
+        for( int n = 0 ; n < numButtons ; n++ )
+        {
+            const int x = (n % 10) * 60;
+            const int y = (n / 10) * 22;
+            GL.FillRoundedRectangle(x,y,x + 56,y + 20,4,40,80,160);
+            GL.DrawRoundedRectangle(x,y,x + 56,y + 20,4,255,255,255);
+            GL.FontPrint(x + 4,y + 4,"Button");
+        }
+    };
+
+    Measure("  Immediate",iterations,drawPanel);
+
+    GL.DisplayListBegin();
+    drawPanel();
+    const uint32_t panel = GL.DisplayListEnd();
+    Measure("  DisplayListDraw",iterations,[&]()
+    {
+        GL.DisplayListDraw(panel);
+    });
+    GL.DisplayListDelete(panel);
+
+    return EXIT_SUCCESS;
+}
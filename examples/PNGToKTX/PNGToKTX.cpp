@@ -0,0 +1,469 @@
+/**
+ * @brief Converts a PNG to an ETC compressed KTX file that can be loaded with GLES::CreateTextureFromKTX.
+ * PNGs without alpha, or with all of it solid, are written as ETC1 that ETC2 hardware can also read. PNGs with alpha are written as ETC2 RGBA.
+ * The encoder is simple, it tries both block splits and both base colour modes then picks the best table per sub block.
+ * Not the best quality you can get but quick and good enough for backgrounds and sprites.
+ */
+#include "../SupportCode/TinyPNG.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <string>
+#include <limits>
+#include <string.h>
+#include <stdint.h>
+
+// The GL values written in to the KTX header.
+static const uint32_t GL_RGB_FORMAT = 0x1907;
+static const uint32_t GL_RGBA_FORMAT = 0x1908;
+static const uint32_t GL_ETC1_RGB8_OES_FORMAT = 0x8D64;
+static const uint32_t GL_COMPRESSED_RGB8_ETC2_FORMAT = 0x9274;
+static const uint32_t GL_COMPRESSED_RGBA8_ETC2_EAC_FORMAT = 0x9278;
+
+/**
+ * @brief The intensity modifiers of ETC1, the pixel index picks +a, +b, -a or -b from the sub block's table.
+ */
+static const int ETC1Modifiers[8][2] =
+{
+    {2,8},{5,17},{9,29},{13,42},{18,60},{24,80},{33,106},{47,183}
+};
+
+/**
+ * @brief The alpha modifiers of EAC, multiplied by the block's multiplier.
+ */
+static const int EACModifiers[16][8] =
+{
+    {-3,-6,-9,-15,2,5,8,14},
+    {-3,-7,-10,-13,2,6,9,12},
+    {-2,-5,-8,-13,1,4,7,12},
+    {-2,-4,-6,-13,1,3,5,12},
+    {-3,-6,-8,-12,2,5,7,11},
+    {-3,-7,-9,-11,2,6,8,10},
+    {-4,-7,-8,-11,3,6,7,10},
+    {-3,-5,-8,-11,2,4,7,10},
+    {-2,-6,-8,-10,1,5,7,9},
+    {-2,-5,-8,-10,1,4,7,9},
+    {-2,-4,-8,-10,1,3,7,9},
+    {-2,-5,-7,-10,1,4,6,9},
+    {-3,-4,-7,-10,2,3,6,9},
+    {-1,-2,-3,-10,0,1,2,9},
+    {-4,-6,-8,-9,3,5,7,8},
+    {-3,-5,-7,-9,2,4,6,8}
+};
+
+struct Pixel
+{
+    int r,g,b,a;
+};
+
+typedef std::array<Pixel,16> Block;// Indexed x * 4 + y, the order ETC stores the pixel indices in.
+
+static int Clamp255(int pValue)
+{
+    return std::clamp(pValue,0,255);
+}
+
+/**
+ * @brief Finds the best table and pixel indices for one half of a block with the given base colour, returns the error.
+ */
+static int EncodeSubBlock(const Block& pBlock,const int* pPixels,const Pixel& pBase,int& rTable,std::array<int,16>& rIndices)
+{
+    int bestError = std::numeric_limits<int>::max();
+    for( int table = 0 ; table < 8 ; table++ )
+    {
+        const int modifiers[4] = {ETC1Modifiers[table][0],ETC1Modifiers[table][1],-ETC1Modifiers[table][0],-ETC1Modifiers[table][1]};
+        int error = 0;
+        int indices[8];
+        for( int n = 0 ; n < 8 ; n++ )
+        {
+            const Pixel& p = pBlock[pPixels[n]];
+            int bestPixelError = std::numeric_limits<int>::max();
+            for( int m = 0 ; m < 4 ; m++ )
+            {
+                const int dr = Clamp255(pBase.r + modifiers[m]) - p.r;
+                const int dg = Clamp255(pBase.g + modifiers[m]) - p.g;
+                const int db = Clamp255(pBase.b + modifiers[m]) - p.b;
+                const int e = (dr*dr) + (dg*dg) + (db*db);
+                if( e < bestPixelError )
+                {
+                    bestPixelError = e;
+                    indices[n] = m;
+                }
+            }
+            error += bestPixelError;
+        }
+
+        if( error < bestError )
+        {
+            bestError = error;
+            rTable = table;
+            for( int n = 0 ; n < 8 ; n++ )
+            {
+                rIndices[pPixels[n]] = indices[n];
+            }
+        }
+    }
+    return bestError;
+}
+
+/**
+ * @brief Encodes the colour of the block as an ETC1 block, which is also a valid ETC2 RGB block.
+ */
+static uint64_t EncodeETC1Block(const Block& pBlock)
+{
+    uint64_t bestBits = 0;
+    int bestError = std::numeric_limits<int>::max();
+
+    for( int flip = 0 ; flip < 2 ; flip++ )
+    {
+        // Without flip the halves are the left and right 2x4, with it the top and bottom 4x2.
+        int halves[2][8];
+        int count[2] = {0,0};
+        for( int x = 0 ; x < 4 ; x++ )
+        {
+            for( int y = 0 ; y < 4 ; y++ )
+            {
+                const int half = flip ? (y >= 2) : (x >= 2);
+                halves[half][count[half]++] = (x * 4) + y;
+            }
+        }
+
+        Pixel average[2];
+        for( int h = 0 ; h < 2 ; h++ )
+        {
+            int r = 0,g = 0,b = 0;
+            for( int n = 0 ; n < 8 ; n++ )
+            {
+                r += pBlock[halves[h][n]].r;
+                g += pBlock[halves[h][n]].g;
+                b += pBlock[halves[h][n]].b;
+            }
+            average[h] = {(r + 4) / 8,(g + 4) / 8,(b + 4) / 8,255};
+        }
+
+        for( int differential = 0 ; differential < 2 ; differential++ )
+        {
+            // Quantise the base colours, 4 bits each or 5 bits and a 3 bit signed delta.
+            const int levels = differential ? 31 : 15;
+            int q[2][3];
+            for( int h = 0 ; h < 2 ; h++ )
+            {
+                q[h][0] = ((average[h].r * levels) + 127) / 255;
+                q[h][1] = ((average[h].g * levels) + 127) / 255;
+                q[h][2] = ((average[h].b * levels) + 127) / 255;
+            }
+
+            if( differential )
+            {
+                for( int c = 0 ; c < 3 ; c++ )
+                {
+                    q[1][c] = q[0][c] + std::clamp(q[1][c] - q[0][c],-4,3);
+                }
+            }
+
+            Pixel base[2];
+            for( int h = 0 ; h < 2 ; h++ )
+            {
+                int e[3];
+                for( int c = 0 ; c < 3 ; c++ )
+                {
+                    e[c] = differential ? ((q[h][c] << 3) | (q[h][c] >> 2)) : ((q[h][c] << 4) | q[h][c]);
+                }
+                base[h] = {e[0],e[1],e[2],255};
+            }
+
+            int tables[2];
+            std::array<int,16> indices;
+            const int error = EncodeSubBlock(pBlock,halves[0],base[0],tables[0],indices) + EncodeSubBlock(pBlock,halves[1],base[1],tables[1],indices);
+            if( error >= bestError )
+            {
+                continue;
+            }
+            bestError = error;
+
+            uint64_t bits = 0;
+            if( differential )
+            {
+                for( int c = 0 ; c < 3 ; c++ )
+                {
+                    const uint64_t delta = (uint64_t)(q[1][c] - q[0][c]) & 7;
+                    bits |= (uint64_t)q[0][c] << (59 - (c * 8));
+                    bits |= delta << (56 - (c * 8));
+                }
+            }
+            else
+            {
+                for( int c = 0 ; c < 3 ; c++ )
+                {
+                    bits |= (uint64_t)q[0][c] << (60 - (c * 8));
+                    bits |= (uint64_t)q[1][c] << (56 - (c * 8));
+                }
+            }
+
+            bits |= (uint64_t)tables[0] << 37;
+            bits |= (uint64_t)tables[1] << 34;
+            bits |= (uint64_t)differential << 33;
+            bits |= (uint64_t)flip << 32;
+            for( int n = 0 ; n < 16 ; n++ )
+            {
+                bits |= (uint64_t)(indices[n] >> 1) << (16 + n);
+                bits |= (uint64_t)(indices[n] & 1) << n;
+            }
+            bestBits = bits;
+        }
+    }
+    return bestBits;
+}
+
+/**
+ * @brief Encodes the alpha of the block as an EAC block, the first half of an ETC2 RGBA block.
+ */
+static uint64_t EncodeEACBlock(const Block& pBlock)
+{
+    int low = 255,high = 0;
+    for( const auto& p : pBlock )
+    {
+        low = std::min(low,p.a);
+        high = std::max(high,p.a);
+    }
+
+    // All the same, common for sprites, table 13 has a zero modifier.
+    if( low == high )
+    {
+        uint64_t bits = ((uint64_t)low << 56) | (1ull << 52) | (13ull << 48);
+        for( int n = 0 ; n < 16 ; n++ )
+        {
+            bits |= 4ull << (45 - (n * 3));
+        }
+        return bits;
+    }
+
+    uint64_t bestBits = 0;
+    int bestError = std::numeric_limits<int>::max();
+    const int middle = (low + high + 1) / 2;
+    for( int table = 0 ; table < 16 ; table++ )
+    {
+        const int* modifiers = EACModifiers[table];
+        const int range = modifiers[7] - modifiers[3];
+        const int guess = std::clamp(((high - low) + (range / 2)) / range,1,15);
+        for( int multiplier = std::max(guess - 1,1) ; multiplier <= std::min(guess + 1,15) ; multiplier++ )
+        {
+            for( int base = std::max(middle - 2,0) ; base <= std::min(middle + 2,255) ; base++ )
+            {
+                int error = 0;
+                uint64_t indices = 0;
+                for( int n = 0 ; n < 16 ; n++ )
+                {
+                    int bestPixelError = std::numeric_limits<int>::max();
+                    int bestIndex = 0;
+                    for( int m = 0 ; m < 8 ; m++ )
+                    {
+                        const int d = Clamp255(base + (modifiers[m] * multiplier)) - pBlock[n].a;
+                        if( d * d < bestPixelError )
+                        {
+                            bestPixelError = d * d;
+                            bestIndex = m;
+                        }
+                    }
+                    error += bestPixelError;
+                    indices |= (uint64_t)bestIndex << (45 - (n * 3));
+                }
+
+                if( error < bestError )
+                {
+                    bestError = error;
+                    bestBits = ((uint64_t)base << 56) | ((uint64_t)multiplier << 52) | ((uint64_t)table << 48) | indices;
+                }
+            }
+        }
+    }
+    return bestBits;
+}
+
+static void WriteBigEndian(std::vector<uint8_t>& rOut,uint64_t pBits)
+{
+    for( int n = 7 ; n >= 0 ; n-- )
+    {
+        rOut.push_back((uint8_t)(pBits >> (n * 8)));
+    }
+}
+
+/**
+ * @brief Compresses the RGBA image, edge blocks of images that are not a multiple of four repeat the last row and column.
+ */
+static std::vector<uint8_t> Compress(const std::vector<uint8_t>& pRGBA,int pWidth,int pHeight,bool pAlpha)
+{
+    std::vector<uint8_t> out;
+    for( int by = 0 ; by < pHeight ; by += 4 )
+    {
+        for( int bx = 0 ; bx < pWidth ; bx += 4 )
+        {
+            Block block;
+            for( int x = 0 ; x < 4 ; x++ )
+            {
+                for( int y = 0 ; y < 4 ; y++ )
+                {
+                    const int px = std::min(bx + x,pWidth - 1);
+                    const int py = std::min(by + y,pHeight - 1);
+                    const uint8_t* p = pRGBA.data() + (((py * pWidth) + px) * 4);
+                    block[(x * 4) + y] = {p[0],p[1],p[2],p[3]};
+                }
+            }
+
+            if( pAlpha )
+            {
+                WriteBigEndian(out,EncodeEACBlock(block));
+            }
+            WriteBigEndian(out,EncodeETC1Block(block));
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Halves the image with a box filter, for making the mip levels.
+ */
+static std::vector<uint8_t> HalveImage(const std::vector<uint8_t>& pRGBA,int pWidth,int pHeight)
+{
+    const int width = std::max(pWidth / 2,1);
+    const int height = std::max(pHeight / 2,1);
+    std::vector<uint8_t> out(width * height * 4);
+    for( int y = 0 ; y < height ; y++ )
+    {
+        for( int x = 0 ; x < width ; x++ )
+        {
+            const int x0 = std::min(x * 2,pWidth - 1),x1 = std::min((x * 2) + 1,pWidth - 1);
+            const int y0 = std::min(y * 2,pHeight - 1),y1 = std::min((y * 2) + 1,pHeight - 1);
+            for( int c = 0 ; c < 4 ; c++ )
+            {
+                const int sum = pRGBA[(((y0 * pWidth) + x0) * 4) + c] + pRGBA[(((y0 * pWidth) + x1) * 4) + c] +
+                                pRGBA[(((y1 * pWidth) + x0) * 4) + c] + pRGBA[(((y1 * pWidth) + x1) * 4) + c];
+                out[(((y * width) + x) * 4) + c] = (uint8_t)((sum + 2) / 4);
+            }
+        }
+    }
+    return out;
+}
+
+static void Write32(std::ofstream& rFile,uint32_t pValue)
+{
+    rFile.write((const char*)&pValue,sizeof(pValue));
+}
+
+int main(int argc, char *argv[])
+{
+    bool etc2 = false;
+    bool mipmaps = false;
+    std::vector<std::string> files;
+    for( int n = 1 ; n < argc ; n++ )
+    {
+        if( strcmp(argv[n],"-etc2") == 0 )
+        {
+            etc2 = true;
+        }
+        else if( strcmp(argv[n],"-mipmaps") == 0 )
+        {
+            mipmaps = true;
+        }
+        else
+        {
+            files.push_back(argv[n]);
+        }
+    }
+
+    if( files.size() != 2 )
+    {
+        std::cout << "Usage: PNGToKTX [-etc2] [-mipmaps] input.png output.ktx\n";
+        std::cout << "  PNGs with alpha are always written as ETC2 RGBA, without as ETC1 unless -etc2 is given.\n";
+        std::cout << "  -mipmaps writes all the mip levels, GL can not make them for compressed textures.\n";
+        return EXIT_FAILURE;
+    }
+
+    tinypng::Loader png(false);
+    if( png.LoadFromFile(files[0]) == false )
+    {
+        std::cout << "Failed to load " << files[0] << "\n";
+        return EXIT_FAILURE;
+    }
+
+    int width = png.GetWidth();
+    int height = png.GetHeight();
+    std::vector<uint8_t> RGBA;
+    bool alpha = false;
+    if( png.GetHasAlpha() )
+    {
+        png.GetRGBA(RGBA);
+    }
+    else
+    {
+        std::vector<uint8_t> RGB;
+        png.GetRGB(RGB);
+        for( size_t n = 0 ; n < RGB.size() ; n += 3 )
+        {
+            RGBA.insert(RGBA.end(),{RGB[n],RGB[n+1],RGB[n+2],255});
+        }
+    }
+
+    // Lots of PNGs have an alpha channel that is all solid, they can be ETC1 and half the size.
+    for( size_t n = 3 ; n < RGBA.size() && alpha == false ; n += 4 )
+    {
+        alpha = RGBA[n] != 255;
+    }
+
+    const uint32_t internalFormat = alpha ? GL_COMPRESSED_RGBA8_ETC2_EAC_FORMAT : (etc2 ? GL_COMPRESSED_RGB8_ETC2_FORMAT : GL_ETC1_RGB8_OES_FORMAT);
+
+    std::vector<std::vector<uint8_t>> levels;
+    levels.push_back(Compress(RGBA,width,height,alpha));
+    if( mipmaps )
+    {
+        while( width > 1 || height > 1 )
+        {
+            RGBA = HalveImage(RGBA,width,height);
+            width = std::max(width / 2,1);
+            height = std::max(height / 2,1);
+            levels.push_back(Compress(RGBA,width,height,alpha));
+        }
+    }
+
+    std::ofstream file(files[1],std::ios::binary);
+    if( !file )
+    {
+        std::cout << "Failed to open " << files[1] << " for writing\n";
+        return EXIT_FAILURE;
+    }
+
+    // KTX 1.1 header, compressed data has no type or format, only the internal format.
+    static const uint8_t identifier[12] = {0xAB,'K','T','X',' ','1','1',0xBB,'\r','\n',0x1A,'\n'};
+    file.write((const char*)identifier,sizeof(identifier));
+    Write32(file,0x04030201);
+    Write32(file,0);// glType
+    Write32(file,1);// glTypeSize
+    Write32(file,0);// glFormat
+    Write32(file,internalFormat);
+    Write32(file,alpha ? GL_RGBA_FORMAT : GL_RGB_FORMAT);
+    Write32(file,png.GetWidth());
+    Write32(file,png.GetHeight());
+    Write32(file,0);// pixelDepth
+    Write32(file,0);// numberOfArrayElements
+    Write32(file,1);// numberOfFaces
+    Write32(file,(uint32_t)levels.size());
+    Write32(file,0);// bytesOfKeyValueData
+
+    size_t total = 0;
+    for( const auto& level : levels )
+    {
+        // ETC blocks are 8 or 16 bytes so no padding is needed.
+        Write32(file,(uint32_t)level.size());
+        file.write((const char*)level.data(),level.size());
+        total += level.size();
+    }
+
+    const size_t uncompressed = png.GetWidth() * png.GetHeight() * (alpha ? 4 : 3);
+    std::cout << files[0] << " " << png.GetWidth() << "x" << png.GetHeight() << " -> " << files[1] << " " << (alpha ? "ETC2 RGBA" : (etc2 ? "ETC2 RGB" : "ETC1")) << ", "
+              << levels.size() << " levels, " << total << " bytes, top level was " << uncompressed << " bytes uncompressed\n";
+
+    return EXIT_SUCCESS;
+}